@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Mutex against cohort lock under contention from every node
+ *
+ * THREADS threads spread over the NUMA nodes keep taking one lock and
+ * update a few cache lines of shared data while holding it. On a
+ * multi-socket machine the cohort lock keeps the data on one socket
+ * for several handoffs in a row. A single node machine is split in
+ * two so the cohort path is still exercised.
+ */
+
+#define THREADS 8
+#define SHARED_LINES 8
+#define DURATION 1000000 // 1s
+
+GLock *bench_lock = NULL;
+static bool fake_nodes = false;
+static gint stop = 0;
+static gint64 acquisitions = 0;
+static uint64_t shared[SHARED_LINES * 8];
+
+/**
+ * Thread which keeps taking the lock
+ *
+ * @param data The node of the thread when the nodes are faked
+ */
+static void _bench_thread(gpointer data)
+{
+  GLockSession *session = g_lock_session_new();
+  if(fake_nodes) {
+    g_lock_numa_set_thread_node(GPOINTER_TO_INT(data));
+  }
+  while(!g_atomic_int_get(&stop)) {
+    if(g_lock_start(session, bench_lock)) {
+      for(int ix = 0; ix < SHARED_LINES * 8; ix += 8) {
+        shared[ix]++;
+      }
+      g_lock_end(session, bench_lock);
+      __atomic_fetch_add(&acquisitions, 1, __ATOMIC_RELAXED);
+    }
+  }
+  g_lock_session_free(session);
+}
+
+/**
+ * Run the benchmark for a single lock type
+ *
+ * @param name Human readable lock type
+ * @param type The lock type to benchmark
+ */
+static void _bench_type(const char *name, enum g_lock_type type)
+{
+  GThread *threads[THREADS];
+  uint32_t nodes = g_lock_numa_nodes();
+
+  bench_lock = g_lock_create(name, type);
+  g_atomic_int_set(&stop, 0);
+  acquisitions = 0;
+
+  for(int ix = 0; ix < THREADS; ix++) {
+    threads[ix] = g_thread_new("bench", (GThreadFunc)_bench_thread,
+      GINT_TO_POINTER(ix % nodes));
+  }
+  usleep(DURATION);
+  g_atomic_int_set(&stop, 1);
+  for(int ix = 0; ix < THREADS; ix++) {
+    g_thread_join(threads[ix]);
+  }
+  printf("%s\n", name);
+  printf("  acquisitions %" PRId64 " (%.0f/s) wait avg %" PRIu64
+    " us max %" PRIu64 " us\n",
+    acquisitions,
+    acquisitions * 1e6 / DURATION,
+    bench_lock->stats.wait.count?
+      bench_lock->stats.wait.total_us / bench_lock->stats.wait.count: 0,
+    bench_lock->stats.wait.max_us);
+  if(type == G_LOCK_COHORT) {
+    g_lock_show_all();
+  }
+  g_lock_free(bench_lock);
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  if(g_lock_numa_nodes() == 1) {
+    g_lock_numa_set_nodes(2);
+    fake_nodes = true;
+  }
+  printf("%u nodes%s, %d threads\n", g_lock_numa_nodes(),
+    fake_nodes? " (faked)": "", THREADS);
+  _bench_type("mutex", G_LOCK_MUTEX);
+  _bench_type("cohort", G_LOCK_COHORT);
+  g_lock_manager_free();
+  return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Plain acquisitions against flat combining on a hot lock
+ *
+ * Every thread pushes values through a small shared ring and keeps a
+ * running sum, the work done under the lock is a handful of
+ * instructions. With plain g_lock_start/g_lock_end each operation
+ * pays an acquisition and a handoff of the lock and its data between
+ * threads, with g_lock_execute one thread runs the pending operations
+ * of the others in a batch.
+ */
+
+#define OPS_PER_THREAD 20000
+#define RING_SIZE 64
+
+static const uint32_t thread_counts[] = { 1, 4, 16, 64 };
+
+GLock *hot_lock = NULL;
+
+struct ring {
+  uint64_t values[RING_SIZE];
+  uint32_t head;
+  uint64_t sum;
+} ring;
+
+/**
+ * The critical section, with the hot lock held
+ *
+ * @param user_data The value to push
+ * @return The running sum
+ */
+static gpointer _ring_push(gpointer user_data)
+{
+  uint64_t value = GPOINTER_TO_SIZE(user_data);
+  ring.sum += value - ring.values[ring.head];
+  ring.values[ring.head] = value;
+  ring.head = (ring.head + 1) % RING_SIZE;
+  return GSIZE_TO_POINTER(ring.sum);
+}
+
+/**
+ * Thread taking the lock around each operation
+ */
+static void _plain_thread()
+{
+  G_LOCK_SESSION_START();
+  for(gsize ix = 1; ix <= OPS_PER_THREAD; ix++) {
+    if(g_lock_start(session, hot_lock)) {
+      _ring_push(GSIZE_TO_POINTER(ix));
+      g_lock_end(session, hot_lock);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread handing each operation to g_lock_execute
+ */
+static void _combine_thread()
+{
+  G_LOCK_SESSION_START();
+  for(gsize ix = 1; ix <= OPS_PER_THREAD; ix++) {
+    g_lock_execute(session, hot_lock, _ring_push, GSIZE_TO_POINTER(ix));
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Run threads against the hot lock
+ *
+ * @param threads How many threads to run
+ * @param func The thread function
+ * @return Time taken in microseconds
+ */
+static int64_t _bench(uint32_t threads, GThreadFunc func)
+{
+  GThread **list = calloc(threads, sizeof(GThread *));
+  int64_t start = g_get_monotonic_time();
+  for(uint32_t ix = 0; ix < threads; ix++) {
+    list[ix] = g_thread_new("bench", func, NULL);
+  }
+  for(uint32_t ix = 0; ix < threads; ix++) {
+    g_thread_join(list[ix]);
+  }
+  free(list);
+  return g_get_monotonic_time() - start;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  uint32_t threads;
+  uint64_t ops, batches, requests;
+  int64_t plain_us, combine_us;
+
+  hot_lock = g_lock_create_mutex("hot");
+
+  printf("%d operations per thread, %u processors\n", OPS_PER_THREAD,
+    g_get_num_processors());
+  for(uint32_t ix = 0; ix < G_N_ELEMENTS(thread_counts); ix++) {
+    threads = thread_counts[ix];
+    ops = (uint64_t)threads * OPS_PER_THREAD;
+    plain_us = _bench(threads, (GThreadFunc)_plain_thread);
+    batches = hot_lock->combine.batches;
+    requests = hot_lock->combine.requests;
+    combine_us = _bench(threads, (GThreadFunc)_combine_thread);
+    batches = hot_lock->combine.batches - batches;
+    requests = hot_lock->combine.requests - requests;
+    printf("%u threads\n", threads);
+    printf("  start/end %8" PRId64 " ms (%.0f ops/s)\n",
+      plain_us / 1000, ops * 1e6 / plain_us);
+    printf("  execute   %8" PRId64 " ms (%.0f ops/s) %.1f per batch\n",
+      combine_us / 1000, ops * 1e6 / combine_us,
+      batches? (double)requests / batches: 0);
+  }
+
+  g_lock_free_all();
+  g_lock_manager_free();
+  return 0;
+}
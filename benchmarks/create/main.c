@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Cost of per-object locks
+ *
+ * Creates and frees a growing number of locks, both allocated by the
+ * manager and embedded in caller structures, to show the time per
+ * lock stays flat as the number of live locks grows.
+ */
+
+#define MIN_LOCKS 10000
+#define MAX_LOCKS 1000000
+
+struct cache_entry {
+  GLock lock;
+  uint64_t value;
+};
+
+/**
+ * Create and free count locks allocated by the manager
+ *
+ * @param count How many locks to create
+ */
+static void _run_created(uint32_t count)
+{
+  int64_t start, created, freed;
+  GLock **locks = calloc(count, sizeof(GLock *));
+
+  start = g_get_monotonic_time();
+  for(uint32_t ix = 0; ix < count; ix++) {
+    locks[ix] = g_lock_create_mutex("cache-entry");
+  }
+  created = g_get_monotonic_time() - start;
+  // Free in creation order, the worst case for a list search
+  start = g_get_monotonic_time();
+  for(uint32_t ix = 0; ix < count; ix++) {
+    g_lock_free(locks[ix]);
+  }
+  freed = g_get_monotonic_time() - start;
+  free(locks);
+  printf("  created %8u create %6" PRId64 " ns/lock free %6" PRId64
+    " ns/lock\n",
+    count,
+    created * 1000 / count,
+    freed * 1000 / count);
+}
+
+/**
+ * Initialize and clear count locks embedded in entries
+ *
+ * @param count How many locks to initialize
+ */
+static void _run_embedded(uint32_t count)
+{
+  int64_t start, created, freed;
+  struct cache_entry *entries = calloc(count, sizeof(struct cache_entry));
+
+  start = g_get_monotonic_time();
+  for(uint32_t ix = 0; ix < count; ix++) {
+    g_lock_init(&entries[ix].lock, "cache-entry", G_LOCK_MUTEX);
+  }
+  created = g_get_monotonic_time() - start;
+  start = g_get_monotonic_time();
+  for(uint32_t ix = 0; ix < count; ix++) {
+    g_lock_clear(&entries[ix].lock);
+  }
+  freed = g_get_monotonic_time() - start;
+  free(entries);
+  printf("  embedded %7u init %8" PRId64 " ns/lock clear %5" PRId64
+    " ns/lock\n",
+    count,
+    created * 1000 / count,
+    freed * 1000 / count);
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  g_lock_manager_init();
+  printf("Lock creation\n");
+  for(uint32_t count = MIN_LOCKS; count <= MAX_LOCKS; count *= 10) {
+    _run_created(count);
+    _run_embedded(count);
+  }
+  g_lock_manager_free();
+  return 0;
+}
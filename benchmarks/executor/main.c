@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Thread pool blocking on a hot lock against the lock-aware executor
+ *
+ * Tasks come in bursts of BURST, one burst in HOT_EVERY needs the
+ * hot lock and the others need a lock of their own. Every task sleeps
+ * WORK_TIME while holding its lock, like a short I/O. Pool threads
+ * block on the hot lock and leave the other tasks waiting, executor
+ * workers park the hot tasks and keep running the others.
+ */
+
+#define WORKERS 4
+#define TASKS 4000
+#define BURST 16
+#define HOT_EVERY 4
+#define COLD_LOCKS 16
+#define WORK_TIME 100 // 0.1ms
+
+GLock *hot_lock = NULL;
+GLock *cold_locks[COLD_LOCKS];
+
+/**
+ * Lock needed by a task
+ *
+ * @param task Number of the task
+ * @return The lock
+ */
+static GLock *_task_lock(int task)
+{
+  if((task / BURST) % HOT_EVERY == 0) {
+    return hot_lock;
+  }
+  return cold_locks[task % COLD_LOCKS];
+}
+
+/**
+ * Work of a task once its lock is held
+ */
+static void _task_work(GLockSession *session, gpointer user_data)
+{
+  usleep(WORK_TIME);
+}
+
+/**
+ * Pool thread running a task, blocking on its lock
+ *
+ * @param data Number of the task plus one
+ * @param user_data Unused
+ */
+static void _pool_task(gpointer data, gpointer user_data)
+{
+  static GPrivate session_key = G_PRIVATE_INIT(
+    (GDestroyNotify)g_lock_session_free);
+  GLockSession *session = g_private_get(&session_key);
+  GLock *lock = _task_lock(GPOINTER_TO_INT(data) - 1);
+
+  if(!session) {
+    session = g_lock_session_new();
+    g_private_set(&session_key, session);
+  }
+  if(g_lock_start(session, lock)) {
+    _task_work(session, NULL);
+    g_lock_end(session, lock);
+  }
+}
+
+/**
+ * Run the tasks on a GThreadPool
+ *
+ * @return Time taken in microseconds
+ */
+static int64_t _bench_pool()
+{
+  int64_t start = g_get_monotonic_time();
+  GThreadPool *pool = g_thread_pool_new(_pool_task, NULL, WORKERS, TRUE,
+    NULL);
+  for(int ix = 0; ix < TASKS; ix++) {
+    g_thread_pool_push(pool, GINT_TO_POINTER(ix + 1), NULL);
+  }
+  g_thread_pool_free(pool, FALSE, TRUE);
+  return g_get_monotonic_time() - start;
+}
+
+/**
+ * Run the tasks on an executor
+ *
+ * @param stats Where to copy the counters of the executor
+ * @return Time taken in microseconds
+ */
+static int64_t _bench_executor(struct g_lock_executor_stats *stats)
+{
+  struct g_lock_task_lock lock = { NULL, G_LOCK_ACTION_BASIC };
+  int64_t start = g_get_monotonic_time();
+  GLockExecutor *executor = g_lock_executor_new(WORKERS);
+  for(int ix = 0; ix < TASKS; ix++) {
+    lock.lock = _task_lock(ix);
+    g_lock_executor_submit(executor, &lock, 1, _task_work, NULL);
+  }
+  g_lock_executor_wait(executor);
+  g_lock_executor_stats(executor, stats);
+  g_lock_executor_free(executor);
+  return g_get_monotonic_time() - start;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  struct g_lock_executor_stats stats;
+  int64_t pool_us, executor_us;
+  char name[32];
+
+  hot_lock = g_lock_create_mutex("hot");
+  for(int ix = 0; ix < COLD_LOCKS; ix++) {
+    snprintf(name, sizeof(name), "cold%d", ix);
+    cold_locks[ix] = g_lock_create_mutex(name);
+  }
+
+  printf("%d workers, %d tasks, 1 burst of %d in %d on the hot lock\n",
+    WORKERS, TASKS, BURST, HOT_EVERY);
+  pool_us = _bench_pool();
+  printf("thread pool\n");
+  printf("  %" PRId64 " ms (%.0f tasks/s)\n", pool_us / 1000,
+    TASKS * 1e6 / pool_us);
+  executor_us = _bench_executor(&stats);
+  printf("executor\n");
+  printf("  %" PRId64 " ms (%.0f tasks/s) parked %" PRIu64 " stolen %"
+    PRIu64 "\n", executor_us / 1000, TASKS * 1e6 / executor_us,
+    stats.parked, stats.stolen);
+
+  g_lock_free_all();
+  g_lock_manager_free();
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Memory footprint per lock
+ *
+ * Creates COUNT locks of each representation and reports the size of
+ * the structure and the heap it uses on top of that, measured with
+ * glibc's mallinfo2. Compact locks are measured before and after
+ * their statistics are allocated.
+ */
+
+#define COUNT 100000
+
+/**
+ * Bytes currently allocated on the heap
+ *
+ * @return Allocated bytes
+ */
+static size_t _heap_used()
+{
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+/**
+ * Print the footprint of one representation
+ *
+ * @param what The representation measured
+ * @param size The size of the structure
+ * @param before Heap used before the locks were created
+ * @param after Heap used once the locks were created
+ */
+static void _report(const char *what, size_t size, size_t before,
+  size_t after)
+{
+  printf("  %-28s struct %4zu bytes heap %6.1f bytes/lock\n",
+    what,
+    size,
+    (double)(after - before) / COUNT);
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  size_t before;
+  GLock **created = calloc(COUNT, sizeof(GLock *));
+  GLock *embedded = calloc(COUNT, sizeof(GLock));
+  GLockCompact *compact = calloc(COUNT, sizeof(GLockCompact));
+  GLockClass *klass;
+
+  g_lock_manager_init();
+  klass = g_lock_class_new("entry", G_LOCK_CLASS_FORBIDDEN);
+  printf("Lock footprint (%d locks)\n", COUNT);
+
+  // Heap for created locks includes the structure itself
+  before = _heap_used();
+  for(int ix = 0; ix < COUNT; ix++) {
+    created[ix] = g_lock_create_mutex("entry");
+  }
+  _report("g_lock_create", sizeof(GLock), before, _heap_used());
+
+  before = _heap_used();
+  for(int ix = 0; ix < COUNT; ix++) {
+    g_lock_init_instance(&embedded[ix], klass, G_LOCK_MUTEX, 0);
+  }
+  _report("g_lock_init_instance", sizeof(GLock), before, _heap_used());
+
+  before = _heap_used();
+  for(int ix = 0; ix < COUNT; ix++) {
+    g_lock_compact_init(&compact[ix], klass);
+  }
+  _report("g_lock_compact_init", sizeof(GLockCompact), before,
+    _heap_used());
+
+  before = _heap_used();
+  for(int ix = 0; ix < COUNT; ix++) {
+    g_lock_compact_stats(&compact[ix]);
+  }
+  _report("compact with statistics", sizeof(GLockCompact), before,
+    _heap_used());
+
+  for(int ix = 0; ix < COUNT; ix++) {
+    g_lock_compact_clear(&compact[ix]);
+    g_lock_clear(&embedded[ix]);
+    g_lock_free(created[ix]);
+  }
+  free(compact);
+  free(embedded);
+  free(created);
+  g_lock_manager_free();
+  return 0;
+}
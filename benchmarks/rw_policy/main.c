@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Writer latency under sustained read load
+ *
+ * READERS threads keep the lock read-held back to back for DURATION
+ * while a single writer periodically asks for the write side. The
+ * writer latency shows how each policy handles writer starvation.
+ */
+
+#define READERS 8
+#define READ_HOLD 100 // 100us
+#define WRITE_GAP 1000 // 1ms
+#define DURATION 1000000 // 1s
+
+GLock *rw_lock = NULL;
+static gint stop = 0;
+static gint64 reads = 0;
+
+/**
+ * Spin for a given number of microseconds
+ *
+ * @param us How long to spin
+ */
+static void _busy(int64_t us)
+{
+  int64_t end = g_get_monotonic_time() + us;
+  while(g_get_monotonic_time() < end);
+}
+
+/**
+ * Reader thread which keeps the lock read-held
+ */
+static void _read_thread()
+{
+  GLockSession *session = g_lock_session_new();
+  while(!g_atomic_int_get(&stop)) {
+    if(g_lock_start_read(session, rw_lock)) {
+      _busy(READ_HOLD);
+      g_lock_end_read(session, rw_lock);
+      __atomic_fetch_add(&reads, 1, __ATOMIC_RELAXED);
+    }
+  }
+  g_lock_session_free(session);
+}
+
+/**
+ * Writer thread which measures its own acquisition latency
+ */
+static void _write_thread()
+{
+  int64_t start, latency, total = 0, max = 0;
+  uint64_t writes = 0;
+  GLockSession *session = g_lock_session_new();
+  while(!g_atomic_int_get(&stop)) {
+    start = g_get_monotonic_time();
+    if(g_lock_start_write(session, rw_lock)) {
+      latency = g_get_monotonic_time() - start;
+      g_lock_end_write(session, rw_lock);
+      total += latency;
+      if(latency > max) {
+        max = latency;
+      }
+      writes++;
+    }
+    usleep(WRITE_GAP);
+  }
+  g_lock_session_free(session);
+  printf("  writes %" PRIu64 " avg latency %" PRId64 " us max latency %"
+    PRId64 " us\n",
+    writes,
+    writes? total / (int64_t)writes: 0,
+    max);
+}
+
+/**
+ * Run the benchmark for a single policy
+ *
+ * @param name Human readable policy name
+ * @param policy The policy to benchmark
+ */
+static void _bench_policy(const char *name, enum g_lock_rw_policy policy)
+{
+  GThread *readers[READERS];
+  GThread *writer;
+
+  rw_lock = g_lock_create_rw_policy(name, policy);
+  g_atomic_int_set(&stop, 0);
+  reads = 0;
+
+  for(int ix = 0; ix < READERS; ix++) {
+    readers[ix] = g_thread_new("reader", (GThreadFunc)_read_thread, NULL);
+  }
+  writer = g_thread_new("writer", (GThreadFunc)_write_thread, NULL);
+
+  printf("%s\n", name);
+  usleep(DURATION);
+  g_atomic_int_set(&stop, 1);
+  g_thread_join(writer);
+  for(int ix = 0; ix < READERS; ix++) {
+    g_thread_join(readers[ix]);
+  }
+  printf("  reads %" PRId64 " reader wait avg %" PRIu64 " us max %"
+    PRIu64 " us\n",
+    reads,
+    rw_lock->stats.read_wait.count?
+      rw_lock->stats.read_wait.total_us / rw_lock->stats.read_wait.count: 0,
+    rw_lock->stats.read_wait.max_us);
+  g_lock_free(rw_lock);
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  _bench_policy("default", G_LOCK_RW_POLICY_DEFAULT);
+  _bench_policy("reader-preferring", G_LOCK_RW_POLICY_READER);
+  _bench_policy("writer-preferring", G_LOCK_RW_POLICY_WRITER);
+  _bench_policy("phase-fair", G_LOCK_RW_POLICY_PHASE_FAIR);
+  g_lock_manager_free();
+  return 0;
+}
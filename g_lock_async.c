@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Asynchronous lock acquisition
+ *
+ * A request is queued on the lock and every attempt to take it is
+ * made from the GMainContext of the requesting thread using a
+ * non-blocking try. When the lock is held, the request waits for
+ * the next release which schedules a new attempt. Since the lock is
+ * always taken by the thread running the context, the callback owns
+ * it just as if it had been taken with g_lock_start.
+ *
+ * Synchronous callers block on the lock itself and are usually woken
+ * before an attempt gets to run. A request that keeps losing the lock
+ * this way is marked as starving and new synchronous callers then
+ * give way to it for a while.
+ */
+
+#define G_LOCK_ASYNC_MAX_BYPASS 4 /*<< Failed attempts before starving */
+#define G_LOCK_ASYNC_YIELD_US 10000 /*<< Longest a caller gives way */
+
+struct g_lock_async_request {
+  GLockSession *session;
+  GLock *lock;
+  enum g_lock_action action;
+  GCancellable *cancellable;
+  gulong cancel_id;
+  GLockReadyCallback callback;
+  gpointer user_data;
+  GMainContext *context;
+  struct g_lock_caller *caller; /*<< Shows the request as waiting */
+  int64_t queued_at; /*<< Monotonic time the request was queued */
+  bool scheduled; /*<< An attempt is pending (lock->stats_lock) */
+  unsigned int bypassed; /*<< Attempts which found the lock taken */
+  bool starving; /*<< Counted in lock->async_starving (stats_lock) */
+};
+
+static gboolean _async_attempt(gpointer data);
+
+/**
+ * Schedule an attempt to take the lock on the request's context
+ *
+ * @param req The request to schedule
+ */
+static void _async_schedule(struct g_lock_async_request *req)
+{
+  GSource *source = g_idle_source_new();
+  g_source_set_priority(source, G_PRIORITY_DEFAULT);
+  g_source_set_callback(source, _async_attempt, req, NULL);
+  g_source_attach(source, req->context);
+  g_source_unref(source);
+}
+
+/**
+ * Called when the request's cancellable is triggered
+ *
+ * This may run in any thread, so only wake the request up and let
+ * the attempt on its own context notice the cancellation.
+ *
+ * @param cancellable The cancellable that was triggered
+ * @param data The request
+ */
+static void _async_cancelled(GCancellable *cancellable, gpointer data)
+{
+  struct g_lock_async_request *req = data;
+  g_mutex_lock(&req->lock->stats_lock);
+  if(!req->scheduled) {
+    req->scheduled = true;
+    _async_schedule(req);
+  }
+  g_mutex_unlock(&req->lock->stats_lock);
+}
+
+/**
+ * Complete a request and invoke its callback
+ *
+ * @param req The request to complete
+ * @param acquired Whether the lock was taken
+ */
+static void _async_finish(struct g_lock_async_request *req, bool acquired)
+{
+  GLock *lock = req->lock;
+
+  if(req->cancel_id) {
+    g_cancellable_disconnect(req->cancellable, req->cancel_id);
+    req->cancel_id = 0;
+  }
+
+  g_mutex_lock(&lock->stats_lock);
+  lock->async_waiters = g_list_remove(lock->async_waiters, req);
+  if(req->starving) {
+    // Let the synchronous callers which gave way go
+    req->starving = false;
+    g_atomic_int_add(&lock->async_starving, -1);
+    g_cond_broadcast(&lock->async_cond);
+  }
+  g_mutex_unlock(&lock->stats_lock);
+
+  if(acquired) {
+    req->caller->pending = false;
+    req->caller->acquired_at = g_get_monotonic_time();
+    req->caller->wait_us = req->caller->acquired_at - req->queued_at;
+    _g_lock_stats_acquired(lock, req->caller);
+    if(G_UNLIKELY(lock->manager->thread_accounting) && req->caller->contended) {
+      _g_lock_thread_waited(req->caller->wait_us);
+    }
+    if(G_UNLIKELY(lock->manager->metrics_collecting)) {
+      _g_lock_metrics_taken(lock, req->caller);
+    }
+    if(G_UNLIKELY(lock->manager->tracing)) {
+      if(req->caller->contended) {
+        _g_lock_trace_add(lock, G_LOCK_TRACE_WAIT, req->action,
+          req->caller->callsite, req->queued_at);
+      }
+      _g_lock_trace_add(lock, G_LOCK_TRACE_ACQUIRED, req->action,
+        req->caller->callsite, req->caller->acquired_at);
+    }
+    if(G_UNLIKELY(lock->hold_budget_us || lock->wait_budget_us)) {
+      _g_lock_budget_acquired(lock, req->caller);
+    }
+    _g_lock_session_add_lock(req->session, lock);
+    lock_debug(lock->manager, "LOCKED (async): %s", lock->name);
+  } else {
+    _g_lock_stats_drop_waiter(lock, req->caller);
+    lock_debug(lock->manager, "CANCELLED (async): %s", lock->name);
+  }
+  req->caller = NULL;
+
+  req->callback(req->session, lock, acquired, req->user_data);
+
+  if(req->cancellable) {
+    g_object_unref(req->cancellable);
+  }
+  g_main_context_unref(req->context);
+  free(req);
+}
+
+/**
+ * Try to take the lock for a queued request
+ *
+ * Runs on the request's context. If the lock is busy the request
+ * stays queued until the next release, unless a release already
+ * happened while we were trying in which case we try again.
+ *
+ * @param data The request
+ * @return Always G_SOURCE_REMOVE
+ */
+static gboolean _async_attempt(gpointer data)
+{
+  struct g_lock_async_request *req = data;
+  GLock *lock = req->lock;
+  uint64_t release_gen;
+
+  if(req->cancellable && g_cancellable_is_cancelled(req->cancellable)) {
+    _async_finish(req, false);
+    return G_SOURCE_REMOVE;
+  }
+
+  g_mutex_lock(&lock->stats_lock);
+  release_gen = lock->release_gen;
+  g_mutex_unlock(&lock->stats_lock);
+
+  if(_g_lock_try_acquire(lock, req->action)) {
+    _async_finish(req, true);
+    return G_SOURCE_REMOVE;
+  }
+
+  g_mutex_lock(&lock->stats_lock);
+  req->caller->contended = true;
+  if(++req->bypassed > G_LOCK_ASYNC_MAX_BYPASS && !req->starving) {
+    // Hold back new synchronous callers until we got it
+    req->starving = true;
+    g_atomic_int_inc(&lock->async_starving);
+  }
+  if(release_gen != lock->release_gen) {
+    // Released while we were trying, go again
+    _async_schedule(req);
+  } else {
+    req->scheduled = false;
+  }
+  g_mutex_unlock(&lock->stats_lock);
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * Wake up the asynchronous requests queued on a lock
+ *
+ * Called after the lock was released.
+ *
+ * @param lock The lock that was released
+ */
+void _g_lock_async_wake(GLock *lock)
+{
+  GList *tmpl;
+  struct g_lock_async_request *req;
+
+  g_mutex_lock(&lock->stats_lock);
+  lock->release_gen++;
+  for(tmpl = lock->async_waiters; tmpl; tmpl = tmpl->next) {
+    req = tmpl->data;
+    if(!req->scheduled) {
+      req->scheduled = true;
+      _async_schedule(req);
+    }
+  }
+  g_mutex_unlock(&lock->stats_lock);
+}
+
+/**
+ * Give way to a starving asynchronous request
+ *
+ * Called by synchronous callers before they try to take the lock.
+ * Waiting is bounded so that a caller running the context of the
+ * request, or holding what the request's session needs, carries on.
+ *
+ * @param lock The lock about to be taken
+ */
+void _g_lock_async_yield(GLock *lock)
+{
+  int64_t deadline = g_get_monotonic_time() + G_LOCK_ASYNC_YIELD_US;
+
+  g_mutex_lock(&lock->stats_lock);
+  while(g_atomic_int_get(&lock->async_starving)) {
+    if(!g_cond_wait_until(&lock->async_cond, &lock->stats_lock, deadline)) {
+      break;
+    }
+  }
+  g_mutex_unlock(&lock->stats_lock);
+}
+
+/**
+ * Queue a request for a lock without blocking
+ *
+ * The callback is invoked on the thread-default GMainContext of the
+ * calling thread once the lock is held, or with acquired set to false
+ * if the cancellable was triggered first. The session must not take
+ * other locks while the request is pending, and a lock which was
+ * granted is released with the usual g_lock_end calls.
+ *
+ * @param session The lock session
+ * @param lock The lock to take
+ * @param action The action to perform (for read/write locks)
+ * @param cancellable Optional cancellable for the request
+ * @param callback Called once the request completes
+ * @param user_data Passed to the callback
+ * @param callsite Where the lock is being taken
+ * @return true if the request was queued, false if it was refused
+ *         in which case the callback is never invoked.
+ */
+bool _g_lock_start_async(
+  GLockSession *session,
+  GLock *lock,
+  enum g_lock_action action,
+  GCancellable *cancellable,
+  GLockReadyCallback callback,
+  gpointer user_data,
+  const struct g_lock_callsite *callsite
+  )
+{
+  struct g_lock_async_request *req;
+  if(!session) {
+    lock_log("No session provided");
+    return false;
+  }
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  if(!callback) {
+    lock_log("No callback provided");
+    return false;
+  }
+
+  // Check if we're taking a lock out of order
+  if(!_g_lock_session_check_lock(session, lock, action, callsite)) {
+    return false;
+  }
+
+  req = calloc(1, sizeof(struct g_lock_async_request));
+  if(!req) {
+    lock_log("Failed to create async request");
+    return false;
+  }
+  req->caller = _g_lock_caller_new(session, action, callsite);
+  if(!req->caller) {
+    free(req);
+    return false;
+  }
+  req->caller->pending = true;
+  req->session = session;
+  req->lock = lock;
+  req->action = action;
+  req->callback = callback;
+  req->user_data = user_data;
+  req->context = g_main_context_ref_thread_default();
+  // The first attempt is already on its way
+  req->scheduled = true;
+  if(cancellable) {
+    req->cancellable = g_object_ref(cancellable);
+    req->cancel_id = g_cancellable_connect(cancellable,
+      G_CALLBACK(_async_cancelled), req, NULL);
+  }
+
+  // Show the request as waiting on the lock
+  _g_lock_stats_add_waiter(lock, req->caller);
+  req->queued_at = req->caller->wait_started_at;
+
+  g_mutex_lock(&lock->stats_lock);
+  lock->async_waiters = g_list_append(lock->async_waiters, req);
+  g_mutex_unlock(&lock->stats_lock);
+
+  lock_debug(lock->manager, "QUEUED (async): %s", lock->name);
+  _async_schedule(req);
+  return true;
+}
@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <execinfo.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Hold and wait budgets
+ *
+ * A lock can be given the longest hold and wait its users are
+ * expected to need. Going over budget is counted against the call
+ * site taking the lock, along with a stack showing how the call site
+ * was reached.
+ *
+ * A long wait is seen by the waiting thread itself, its stack is
+ * captured right away. A long hold is only seen on release, when the
+ * stack of the acquisition is gone, so the first long hold of a call
+ * site only marks it. The following acquisitions from that call site
+ * capture their stack until one of them goes over budget too. Call
+ * sites which keep to the budget never pay for a backtrace.
+ *
+ * Violations are logged at most once a second per call site, the
+ * ones which were not logged are counted in the next report.
+ */
+
+#define G_LOCK_BUDGET_REPORT_INTERVAL_US G_USEC_PER_SEC
+
+/**
+ * Set the hold and wait budgets of a lock
+ *
+ * Call this before the lock is used.
+ *
+ * @param lock The lock
+ * @param hold_us Longest expected hold in microseconds, 0 for none
+ * @param wait_us Longest expected wait in microseconds, 0 for none
+ * @return true on success otherwise false
+ */
+bool g_lock_set_budget(GLock *lock, int64_t hold_us, int64_t wait_us)
+{
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  if(hold_us < 0 || wait_us < 0) {
+    lock_log("Invalid budget for lock %s", lock->name);
+    return false;
+  }
+  lock->hold_budget_us = hold_us;
+  lock->wait_budget_us = wait_us;
+  return true;
+}
+
+/**
+ * Capture the stack of the calling thread
+ *
+ * @return The allocated stack or NULL on error
+ */
+static struct g_lock_backtrace *_budget_backtrace()
+{
+  struct g_lock_backtrace *stack = malloc(sizeof(struct g_lock_backtrace));
+  if(!stack) {
+    lock_log("Failed to allocate backtrace");
+    return NULL;
+  }
+  stack->depth = backtrace(stack->frames, G_LOCK_BACKTRACE_DEPTH);
+  return stack;
+}
+
+/**
+ * Print a captured stack
+ *
+ * Symbol names need the program to be linked with -rdynamic.
+ *
+ * @param stack The stack to print
+ */
+static void _budget_print_backtrace(struct g_lock_backtrace *stack)
+{
+  char **symbols = backtrace_symbols(stack->frames, stack->depth);
+  for(int ix = 0; ix < stack->depth; ix++) {
+    if(symbols) {
+      printf("  #%d %s\n", ix, symbols[ix]);
+    } else {
+      printf("  #%d %p\n", ix, stack->frames[ix]);
+    }
+  }
+  free(symbols);
+}
+
+/**
+ * Log a budget violation unless the call site reported one recently
+ *
+ * The caller must hold the stats lock of the GLock.
+ *
+ * @param lock The lock over budget
+ * @param site The call site over budget
+ * @param what What went over budget, "held" or "waited"
+ * @param us How long it lasted
+ * @param budget The budget it went over
+ * @param stack Stack of the call site or NULL if none is known yet
+ */
+static void _budget_report(
+  GLock *lock,
+  struct g_lock_callsite_stats *site,
+  const char *what,
+  int64_t us,
+  int64_t budget,
+  struct g_lock_backtrace *stack
+  )
+{
+  int64_t now = g_get_monotonic_time();
+  if(site->reported_at &&
+     now - site->reported_at < G_LOCK_BUDGET_REPORT_INTERVAL_US) {
+    site->suppressed++;
+    return;
+  }
+
+  lock_log("WARNING: Lock %s %s for %" PRId64 " us, over its budget of %"
+    PRId64 " us, at %s (%s:%u), %" PRIu64 " more since the last report",
+    lock->name, what, us, budget,
+    site->callsite->func,
+    site->callsite->file,
+    site->callsite->line,
+    site->suppressed);
+  if(stack) {
+    _budget_print_backtrace(stack);
+  }
+  site->reported_at = now;
+  site->suppressed = 0;
+}
+
+/**
+ * Check the wait of an acquisition and sample its stack if needed
+ *
+ * Called by the thread which just took a lock with a budget.
+ *
+ * @param lock The lock that was taken
+ * @param caller The caller record of the acquisition
+ */
+void _g_lock_budget_acquired(GLock *lock, struct g_lock_caller *caller)
+{
+  struct g_lock_callsite_stats *site;
+  struct g_lock_backtrace *stack = NULL;
+  bool long_wait, wait_stack = false, sample = false;
+
+  long_wait = lock->wait_budget_us && caller->wait_us > lock->wait_budget_us;
+
+  g_mutex_lock(&lock->stats_lock);
+  site = _g_lock_callsite_stats_get(lock, caller->callsite);
+  if(site) {
+    wait_stack = long_wait && !site->wait_stack;
+    sample = lock->hold_budget_us && site->hold_violations &&
+      !site->hold_stack;
+  }
+  g_mutex_unlock(&lock->stats_lock);
+  if(!site) {
+    return;
+  }
+
+  // Not under the stats lock, backtrace() is slow
+  if(wait_stack) {
+    stack = _budget_backtrace();
+  }
+  if(sample && !caller->stack) {
+    caller->stack = _budget_backtrace();
+  }
+
+  if(long_wait) {
+    g_mutex_lock(&lock->stats_lock);
+    site->wait_violations++;
+    if(!site->wait_stack) {
+      site->wait_stack = stack;
+      stack = NULL;
+    }
+    _budget_report(lock, site, "waited", caller->wait_us,
+      lock->wait_budget_us, site->wait_stack);
+    g_mutex_unlock(&lock->stats_lock);
+  }
+  free(stack);
+}
+
+/**
+ * Check the hold of an acquisition being released
+ *
+ * The caller must hold the stats lock of the GLock.
+ *
+ * @param lock The lock being released
+ * @param site The call site which took the lock
+ * @param caller The caller record of the acquisition
+ * @param hold_us How long the lock was held
+ */
+void _g_lock_budget_released(
+  GLock *lock,
+  struct g_lock_callsite_stats *site,
+  struct g_lock_caller *caller,
+  int64_t hold_us
+  )
+{
+  if(hold_us <= lock->hold_budget_us) {
+    return;
+  }
+  site->hold_violations++;
+  if(caller->stack && !site->hold_stack) {
+    site->hold_stack = caller->stack;
+    caller->stack = NULL;
+  }
+  _budget_report(lock, site, "held", hold_us, lock->hold_budget_us,
+    site->hold_stack);
+}
+
+/**
+ * Free the counters of a call site
+ *
+ * @param data The struct g_lock_callsite_stats to free
+ */
+void _g_lock_callsite_stats_free(gpointer data)
+{
+  struct g_lock_callsite_stats *site = data;
+  free(site->hold_stack);
+  free(site->wait_stack);
+  free(site);
+}
+
+/**
+ * Print the budget violations of a lock
+ *
+ * @param data The lock
+ * @param user_data Unused
+ */
+static void _print_budget_violations(gpointer data, gpointer user_data)
+{
+  GLock *lock = data;
+  GHashTableIter iter;
+  struct g_lock_callsite_stats *site;
+
+  if(!lock->hold_budget_us && !lock->wait_budget_us) {
+    return;
+  }
+  g_mutex_lock(&lock->stats_lock);
+  if(lock->stats.callsites) {
+    g_hash_table_iter_init(&iter, lock->stats.callsites);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&site)) {
+      if(!site->hold_violations && !site->wait_violations) {
+        continue;
+      }
+      printf("Lock: %s - %s (%s:%u) - Over hold budget: %" PRIu64
+        " - Over wait budget: %" PRIu64 "\n",
+        lock->name,
+        site->callsite->func,
+        site->callsite->file,
+        site->callsite->line,
+        site->hold_violations,
+        site->wait_violations);
+      if(site->hold_stack) {
+        printf("Long hold taken at\n");
+        _budget_print_backtrace(site->hold_stack);
+      }
+      if(site->wait_stack) {
+        printf("Long wait at\n");
+        _budget_print_backtrace(site->wait_stack);
+      }
+    }
+  }
+  g_mutex_unlock(&lock->stats_lock);
+}
+
+/**
+ * Print the call sites which went over the budget of their lock
+ *
+ * @param manager The manager whose locks are shown
+ */
+void g_lock_show_budget_violations_in(GLockManager *manager)
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return;
+  }
+  printf("=====================================\n");
+  printf("Budget violations\n");
+  printf("-----------------------------\n");
+  _g_lock_manager_foreach(manager, _print_budget_violations, NULL, NULL);
+  printf("=====================================\n");
+}
+
+/**
+ * Print the call sites which went over the budget of their lock
+ */
+void g_lock_show_budget_violations()
+{
+  g_lock_show_budget_violations_in(g_lock_manager_default());
+}
@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sched.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * NUMA-aware cohort locks
+ *
+ * A cohort lock is a global bit lock plus a mutex per NUMA node. A
+ * thread first takes the mutex of its node, then the global lock
+ * unless its node already owns it. On release, when other threads of
+ * the same node are waiting, the global lock is kept by the node and
+ * only the node mutex is released, so ownership and the data it
+ * protects stay on one socket. After G_LOCK_COHORT_MAX_HANDOFFS
+ * handoffs in a row the global lock is released anyway so other
+ * nodes get their turn.
+ *
+ * The node of a thread is the node of the CPU it runs on, read from
+ * sysfs. The topology can be overridden to exercise the lock on a
+ * single node machine.
+ */
+
+#define G_LOCK_COHORT_MAX_HANDOFFS 64
+#define G_LOCK_NUMA_SYSFS "/sys/devices/system/node"
+
+/**
+ * Per node part of a cohort lock
+ */
+struct g_lock_cohort_node {
+  GMutex mutex; /*<< Taken by the threads of the node */
+  gint waiting; /*<< Threads of the node blocked on the mutex */
+  uint32_t handoffs; /*<< Handoffs within the node in a row */
+  bool global; /*<< The node owns the global lock */
+  uint64_t local_handoffs; /*<< Releases which kept the global lock */
+  uint64_t global_releases; /*<< Releases of the global lock */
+} __attribute__((aligned(G_LOCK_CACHE_LINE)));
+
+static struct {
+  gsize loaded;
+  uint32_t nodes; /*<< Number of nodes found in sysfs */
+  uint32_t cpus; /*<< Size of cpu_node */
+  uint32_t *cpu_node; /*<< Node of every CPU */
+  gint override_nodes; /*<< Nodes set by g_lock_numa_set_nodes or 0 */
+  GMutex alloc_lock; /*<< Serializes allocating the nodes of a lock */
+} _numa;
+
+static GPrivate _numa_thread_node;
+
+/**
+ * Parse a sysfs list such as "0-3,8-11"
+ *
+ * @param str The list
+ * @param func Called for every number of the list
+ * @param user_data Passed to func
+ */
+static void _numa_parse_list(
+  const char *str,
+  void (*func)(uint32_t value, gpointer user_data),
+  gpointer user_data
+  )
+{
+  unsigned long first, last;
+  char *endp;
+
+  while(*str >= '0' && *str <= '9') {
+    first = last = strtoul(str, &endp, 10);
+    if(*endp == '-') {
+      last = strtoul(endp + 1, &endp, 10);
+    }
+    for(unsigned long value = first; value <= last; value++) {
+      func(value, user_data);
+    }
+    str = *endp == ',' ? endp + 1 : endp;
+  }
+}
+
+/**
+ * Remember the highest number of a list
+ *
+ * @param value A number of the list
+ * @param user_data The uint32_t count to raise above value
+ */
+static void _numa_count(uint32_t value, gpointer user_data)
+{
+  uint32_t *count = user_data;
+  if(value >= *count) {
+    *count = value + 1;
+  }
+}
+
+/**
+ * Assign a CPU to the node being read
+ *
+ * @param value The CPU
+ * @param user_data The node
+ */
+static void _numa_assign(uint32_t value, gpointer user_data)
+{
+  if(value < _numa.cpus) {
+    _numa.cpu_node[value] = GPOINTER_TO_UINT(user_data);
+  }
+}
+
+/**
+ * Read the CPU list of a node
+ *
+ * @param node The node
+ * @return The list or NULL if the node has none
+ */
+static gchar *_numa_cpulist(uint32_t node)
+{
+  gchar *path, *contents = NULL;
+  path = g_strdup_printf(G_LOCK_NUMA_SYSFS "/node%u/cpulist", node);
+  if(!g_file_get_contents(path, &contents, NULL, NULL)) {
+    contents = NULL;
+  }
+  g_free(path);
+  return contents;
+}
+
+/**
+ * Load the node of every CPU from sysfs
+ *
+ * Without sysfs every CPU is on node 0.
+ */
+static void _numa_load()
+{
+  gchar *online = NULL, *cpulist;
+  uint32_t nodes = 0, cpus = 0;
+
+  if(g_file_get_contents(G_LOCK_NUMA_SYSFS "/online", &online, NULL, NULL)) {
+    _numa_parse_list(online, _numa_count, &nodes);
+  }
+  for(uint32_t node = 0; node < nodes; node++) {
+    cpulist = _numa_cpulist(node);
+    if(cpulist) {
+      _numa_parse_list(cpulist, _numa_count, &cpus);
+      g_free(cpulist);
+    }
+  }
+
+  _numa.nodes = MAX(nodes, 1);
+  _numa.cpu_node = calloc(MAX(cpus, 1), sizeof(uint32_t));
+  if(!_numa.cpu_node) {
+    lock_log("Failed to allocate NUMA topology");
+    _numa.nodes = 1;
+    g_free(online);
+    return;
+  }
+  _numa.cpus = cpus;
+  for(uint32_t node = 0; node < nodes; node++) {
+    cpulist = _numa_cpulist(node);
+    if(cpulist) {
+      _numa_parse_list(cpulist, _numa_assign, GUINT_TO_POINTER(node));
+      g_free(cpulist);
+    }
+  }
+  g_free(online);
+}
+
+/**
+ * Load the topology the first time it is needed
+ */
+static void _numa_init()
+{
+  if(g_once_init_enter(&_numa.loaded)) {
+    _numa_load();
+    g_once_init_leave(&_numa.loaded, 1);
+  }
+}
+
+/**
+ * Pretend the machine has a number of NUMA nodes
+ *
+ * CPUs are spread over the nodes round robin. Cohort locks which were
+ * already used keep the number of nodes they were first used with.
+ *
+ * @param nodes The number of nodes, 0 to use the topology from sysfs
+ * @return true on success otherwise false
+ */
+bool g_lock_numa_set_nodes(uint32_t nodes)
+{
+  if(nodes > G_MAXINT) {
+    lock_log("Invalid number of nodes %u", nodes);
+    return false;
+  }
+  g_atomic_int_set(&_numa.override_nodes, nodes);
+  return true;
+}
+
+/**
+ * Get the number of NUMA nodes cohort locks are split over
+ *
+ * @return The number of nodes
+ */
+uint32_t g_lock_numa_nodes()
+{
+  gint nodes = g_atomic_int_get(&_numa.override_nodes);
+  if(nodes) {
+    return nodes;
+  }
+  _numa_init();
+  return _numa.nodes;
+}
+
+/**
+ * Place the calling thread on a NUMA node
+ *
+ * Cohort locks taken by the thread use that node instead of the node
+ * of the CPU the thread runs on.
+ *
+ * @param node The node, or -1 to follow the CPU again
+ * @return true on success otherwise false
+ */
+bool g_lock_numa_set_thread_node(int node)
+{
+  if(node < -1) {
+    lock_log("Invalid node %d", node);
+    return false;
+  }
+  g_private_set(&_numa_thread_node, GINT_TO_POINTER(node + 1));
+  return true;
+}
+
+/**
+ * Get the NUMA node of the calling thread
+ *
+ * @return The node, not bounded by the node count of any lock
+ */
+static uint32_t _numa_node()
+{
+  gint node = GPOINTER_TO_INT(g_private_get(&_numa_thread_node));
+  gint nodes;
+  int cpu;
+
+  if(node) {
+    return node - 1;
+  }
+  cpu = sched_getcpu();
+  if(cpu < 0) {
+    return 0;
+  }
+  nodes = g_atomic_int_get(&_numa.override_nodes);
+  if(nodes) {
+    return cpu % nodes;
+  }
+  _numa_init();
+  return (uint32_t)cpu < _numa.cpus ? _numa.cpu_node[cpu] : 0;
+}
+
+/**
+ * Get the per node part of a cohort lock, allocating it on first use
+ *
+ * Locks in static tables are zeroed rather than initialized, so the
+ * nodes are only allocated when the lock is first taken.
+ *
+ * @param cohort The cohort lock
+ * @return The nodes or NULL on error
+ */
+static struct g_lock_cohort_node *_cohort_nodes(
+  struct g_lock_cohort_lock *cohort
+  )
+{
+  struct g_lock_cohort_node *nodes = g_atomic_pointer_get(&cohort->nodes);
+  uint32_t count;
+
+  if(G_LIKELY(nodes)) {
+    return nodes;
+  }
+  g_mutex_lock(&_numa.alloc_lock);
+  nodes = cohort->nodes;
+  if(!nodes) {
+    count = g_lock_numa_nodes();
+    if(posix_memalign((void **)&nodes, G_LOCK_CACHE_LINE,
+         count * sizeof(struct g_lock_cohort_node))) {
+      g_mutex_unlock(&_numa.alloc_lock);
+      lock_log("Failed to allocate cohort lock nodes");
+      return NULL;
+    }
+    memset(nodes, 0, count * sizeof(struct g_lock_cohort_node));
+    for(uint32_t ix = 0; ix < count; ix++) {
+      g_mutex_init(&nodes[ix].mutex);
+    }
+    // node_count must be visible before nodes
+    cohort->node_count = count;
+    g_atomic_pointer_set(&cohort->nodes, nodes);
+  }
+  g_mutex_unlock(&_numa.alloc_lock);
+  return nodes;
+}
+
+/**
+ * Get the node of a cohort lock the calling thread belongs to
+ *
+ * @param cohort The cohort lock
+ * @param index Where to store the index of the node
+ * @return The node or NULL on error
+ */
+static struct g_lock_cohort_node *_cohort_node(
+  struct g_lock_cohort_lock *cohort,
+  uint32_t *index
+  )
+{
+  struct g_lock_cohort_node *nodes = _cohort_nodes(cohort);
+  if(!nodes) {
+    return NULL;
+  }
+  *index = _numa_node() % cohort->node_count;
+  return &nodes[*index];
+}
+
+/**
+ * Take a cohort lock
+ *
+ * @param cohort The cohort lock
+ */
+void _g_lock_cohort_lock(struct g_lock_cohort_lock *cohort)
+{
+  uint32_t index;
+  struct g_lock_cohort_node *node = _cohort_node(cohort, &index);
+  if(!node) {
+    abort();
+  }
+  if(!g_mutex_trylock(&node->mutex)) {
+    g_atomic_int_inc(&node->waiting);
+    g_mutex_lock(&node->mutex);
+    g_atomic_int_add(&node->waiting, -1);
+  }
+  if(!node->global) {
+    g_bit_lock(&cohort->global, 0);
+    node->global = true;
+  }
+  cohort->owner = index;
+}
+
+/**
+ * Take a cohort lock without blocking
+ *
+ * @param cohort The cohort lock
+ * @return true if the lock was taken
+ */
+bool _g_lock_cohort_trylock(struct g_lock_cohort_lock *cohort)
+{
+  uint32_t index;
+  struct g_lock_cohort_node *node = _cohort_node(cohort, &index);
+  if(!node || !g_mutex_trylock(&node->mutex)) {
+    return false;
+  }
+  if(!node->global) {
+    if(!g_bit_trylock(&cohort->global, 0)) {
+      g_mutex_unlock(&node->mutex);
+      return false;
+    }
+    node->global = true;
+  }
+  cohort->owner = index;
+  return true;
+}
+
+/**
+ * Release a cohort lock
+ *
+ * The global lock stays with the node of the holder when another
+ * thread of that node is waiting, up to G_LOCK_COHORT_MAX_HANDOFFS
+ * times in a row.
+ *
+ * @param cohort The cohort lock
+ */
+void _g_lock_cohort_unlock(struct g_lock_cohort_lock *cohort)
+{
+  struct g_lock_cohort_node *node = &cohort->nodes[cohort->owner];
+  if(g_atomic_int_get(&node->waiting) > 0 &&
+     node->handoffs < G_LOCK_COHORT_MAX_HANDOFFS) {
+    node->handoffs++;
+    node->local_handoffs++;
+  } else {
+    node->handoffs = 0;
+    node->global = false;
+    node->global_releases++;
+    g_bit_unlock(&cohort->global, 0);
+  }
+  g_mutex_unlock(&node->mutex);
+}
+
+/**
+ * Count the releases of a cohort lock
+ *
+ * The counters are read without the lock and may be slightly off.
+ *
+ * @param cohort The cohort lock
+ * @param local Where to store the releases which stayed on a node
+ * @param global Where to store the releases of the global lock
+ */
+void _g_lock_cohort_handoffs(
+  struct g_lock_cohort_lock *cohort,
+  uint64_t *local,
+  uint64_t *global
+  )
+{
+  struct g_lock_cohort_node *nodes = g_atomic_pointer_get(&cohort->nodes);
+  *local = *global = 0;
+  if(!nodes) {
+    return;
+  }
+  for(uint32_t ix = 0; ix < cohort->node_count; ix++) {
+    *local += nodes[ix].local_handoffs;
+    *global += nodes[ix].global_releases;
+  }
+}
+
+/**
+ * Free the per node part of a cohort lock
+ *
+ * @param cohort The cohort lock
+ */
+void _g_lock_cohort_clear(struct g_lock_cohort_lock *cohort)
+{
+  if(!cohort->nodes) {
+    return;
+  }
+  for(uint32_t ix = 0; ix < cohort->node_count; ix++) {
+    g_mutex_clear(&cohort->nodes[ix].mutex);
+  }
+  free(cohort->nodes);
+  cohort->nodes = NULL;
+  cohort->node_count = 0;
+}
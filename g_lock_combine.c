@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Flat combining
+ *
+ * g_lock_execute publishes its request on the lock, then tries to
+ * take the lock. The thread which gets it runs every published
+ * request in a batch, oldest first, and hands each result back
+ * through the request. The other threads only wait for their request
+ * to be marked done, so a batch costs a single acquisition and the
+ * data the requests touch stays in the cache of one thread.
+ *
+ * Requests are pushed on a lock-free stack and live on the stack of
+ * their thread, the combiner doesn't touch a request once marked
+ * done. A thread whose request is still pending after a few attempts
+ * blocks on the lock, and combines the pending requests once it got
+ * it.
+ */
+
+#define G_LOCK_COMBINE_YIELDS 16
+#define G_LOCK_COMBINE_PASSES 4
+
+/**
+ * A request published on a lock
+ */
+struct g_lock_combine_request {
+  GLockExecuteFunc func;
+  gpointer user_data;
+  gpointer result;
+  gint done; /*<< Set by the combiner once result is set */
+  struct g_lock_combine_request *next; /*<< Older request */
+};
+
+/**
+ * Add to a counter only written by the holder of the lock
+ *
+ * @param counter The counter
+ * @param value What to add
+ */
+static inline void _combine_add(uint64_t *counter, uint64_t value)
+{
+  __atomic_store_n(counter,
+    __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Run the requests published on a lock
+ *
+ * The caller must hold the lock.
+ *
+ * @param lock The lock
+ * @param own The request of the caller
+ */
+static void _combine_run(GLock *lock, struct g_lock_combine_request *own)
+{
+  struct g_lock_combine_request *req, *next, *oldest;
+  uint64_t count = 0, combined = 0;
+
+  for(int pass = 0; pass < G_LOCK_COMBINE_PASSES; pass++) {
+    req = __atomic_exchange_n(&lock->combine_requests, NULL,
+      __ATOMIC_ACQUIRE);
+    if(!req) {
+      break;
+    }
+    for(oldest = NULL; req; req = next) {
+      next = req->next;
+      req->next = oldest;
+      oldest = req;
+    }
+    for(req = oldest; req; req = next) {
+      next = req->next;
+      req->result = req->func(req->user_data);
+      if(req != own) {
+        combined++;
+      }
+      count++;
+      g_atomic_int_set(&req->done, 1);
+    }
+  }
+  if(!count) {
+    return;
+  }
+  _combine_add(&lock->combine.requests, count);
+  _combine_add(&lock->combine.batches, 1);
+  _combine_add(&lock->combine.combined, combined);
+  if(count > __atomic_load_n(&lock->combine.max_batch, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&lock->combine.max_batch, count, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Run a function with a lock held, possibly from another thread
+ *
+ * Concurrent calls on the same lock are run in batches by whichever
+ * thread holds the lock. The lock is checked against the session and
+ * accounted like any other acquisition, read/write locks are taken
+ * for writing.
+ *
+ * @param session The lock session
+ * @param lock The lock to run the function with
+ * @param func The function, must not take other locks
+ * @param user_data Passed to the function
+ * @param callsite Where the function is run from
+ * @return What the function returned or NULL on error
+ */
+gpointer _g_lock_execute(
+  GLockSession *session,
+  GLock *lock,
+  GLockExecuteFunc func,
+  gpointer user_data,
+  const struct g_lock_callsite *callsite
+  )
+{
+  struct g_lock_combine_request req;
+  enum g_lock_action action;
+  uint32_t yields = 0;
+
+  if(!session) {
+    lock_log("No session provided");
+    return NULL;
+  }
+  if(!lock) {
+    lock_log("No lock provided");
+    return NULL;
+  }
+  if(!func) {
+    lock_log("No function provided");
+    return NULL;
+  }
+  action = lock->type == G_LOCK_RW? G_LOCK_ACTION_WRITE: G_LOCK_ACTION_BASIC;
+  if(!_g_lock_session_check_lock(session, lock, action, callsite)) {
+    return NULL;
+  }
+
+  req.func = func;
+  req.user_data = user_data;
+  req.result = NULL;
+  req.done = 0;
+  req.next = __atomic_load_n(&lock->combine_requests, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&lock->combine_requests, &req.next,
+          &req, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  while(!g_atomic_int_get(&req.done)) {
+    if(_g_lock_try_take(session, lock, action, callsite)) {
+      _combine_run(lock, &req);
+      _g_lock_end(session, lock, action, callsite);
+    } else if(yields++ < G_LOCK_COMBINE_YIELDS) {
+      g_thread_yield();
+    } else if(_g_lock_start(session, lock, action, callsite)) {
+      _combine_run(lock, &req);
+      _g_lock_end(session, lock, action, callsite);
+    }
+  }
+  return req.result;
+}
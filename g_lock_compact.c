@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Compact locks
+ *
+ * A compact lock is a bit lock plus one reference. The reference
+ * points at the class of the lock, and is swapped for a tagged
+ * pointer to the lock's statistics the first time they are needed.
+ * The uncontended path touches the lock word, the session, whose
+ * array of held compact locks is reused from one acquisition to the
+ * next, and counts the acquisition in its class with one relaxed
+ * atomic increment. Metrics are only updated while collected.
+ */
+
+#define G_LOCK_COMPACT_STATS_TAG ((uintptr_t)1)
+#define G_LOCK_COMPACT_SESSION_SIZE 4
+
+/**
+ * Whether the reference of a compact lock points at statistics
+ *
+ * @param ref The reference to check
+ * @return true if the reference points at statistics
+ */
+static inline bool _compact_is_stats(gpointer ref)
+{
+  return ((uintptr_t)ref & G_LOCK_COMPACT_STATS_TAG) != 0;
+}
+
+/**
+ * Get the statistics a tagged reference points at
+ *
+ * @param ref The tagged reference
+ * @return The statistics
+ */
+static inline struct g_lock_compact_stats *_compact_untag(gpointer ref)
+{
+  return (struct g_lock_compact_stats *)
+    ((uintptr_t)ref & ~G_LOCK_COMPACT_STATS_TAG);
+}
+
+/**
+ * Get the class of a compact lock
+ *
+ * @param lock The compact lock
+ * @return The class of the lock
+ */
+GLockClass *_g_lock_compact_class(GLockCompact *lock)
+{
+  gpointer ref = g_atomic_pointer_get(&lock->ref);
+  if(_compact_is_stats(ref)) {
+    return _compact_untag(ref)->klass;
+  }
+  return ref;
+}
+
+/**
+ * Initialize a compact lock
+ *
+ * Compact locks are not registered with the manager, they must be
+ * cleared before their class is freed.
+ *
+ * @param lock The lock to initialize
+ * @param klass The class of the lock
+ * @return true on success otherwise false
+ */
+bool g_lock_compact_init(GLockCompact *lock, GLockClass *klass)
+{
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  if(!klass) {
+    lock_log("No class provided");
+    return false;
+  }
+  lock->word = 0;
+  lock->ref = klass;
+  g_atomic_int_inc(&klass->instances);
+  return true;
+}
+
+/**
+ * Clear a compact lock and free its statistics
+ *
+ * @param lock The lock to clear
+ */
+void g_lock_compact_clear(GLockCompact *lock)
+{
+  if(!lock) {
+    lock_log("No lock provided");
+    return;
+  }
+  if(!lock->ref) {
+    return;
+  }
+  g_atomic_int_add(&_g_lock_compact_class(lock)->instances, -1);
+  if(_compact_is_stats(lock->ref)) {
+    free(_compact_untag(lock->ref));
+  }
+  lock->ref = NULL;
+}
+
+/**
+ * Get the statistics of a compact lock, allocating them if needed
+ *
+ * @param lock The compact lock
+ * @return The statistics or NULL if we are out of memory
+ */
+struct g_lock_compact_stats *g_lock_compact_stats(GLockCompact *lock)
+{
+  struct g_lock_compact_stats *stats;
+  gpointer ref;
+  if(!lock) {
+    lock_log("No lock provided");
+    return NULL;
+  }
+  ref = g_atomic_pointer_get(&lock->ref);
+  if(_compact_is_stats(ref)) {
+    return _compact_untag(ref);
+  }
+
+  stats = calloc(1, sizeof(struct g_lock_compact_stats));
+  if(!stats) {
+    lock_log("Failed to create compact lock statistics");
+    return NULL;
+  }
+  stats->klass = ref;
+  if(!g_atomic_pointer_compare_and_exchange(&lock->ref, ref,
+      (gpointer)((uintptr_t)stats | G_LOCK_COMPACT_STATS_TAG))) {
+    // Somebody else got there first
+    free(stats);
+    return _compact_untag(g_atomic_pointer_get(&lock->ref));
+  }
+  return stats;
+}
+
+/**
+ * Check the order of a compact lock and make room for it in the session
+ *
+ * @param session The lock session
+ * @param lock The compact lock
+ * @return true if the lock can be taken
+ */
+static bool _compact_check(GLockSession *session, GLockCompact *lock)
+{
+  GLockCompact **locks;
+  uint32_t size;
+
+  if(!session) {
+    lock_log("No session provided");
+    return false;
+  }
+  if(!lock || !lock->ref) {
+    lock_log("No lock provided");
+    return false;
+  }
+  if(!_g_lock_session_check_compact(session, lock)) {
+    return false;
+  }
+  if(G_LIKELY(session->compact_count < session->compact_size)) {
+    return true;
+  }
+
+  size = session->compact_size? session->compact_size * 2:
+    G_LOCK_COMPACT_SESSION_SIZE;
+  locks = realloc(session->compact_locks, size * sizeof(GLockCompact *));
+  if(!locks) {
+    lock_log("Failed to grow the compact locks of session %p", session);
+    return false;
+  }
+  session->compact_locks = locks;
+  session->compact_size = size;
+  return true;
+}
+
+/**
+ * Count an acquisition of a compact lock and remember it in the session
+ *
+ * @param session The lock session, with room for the lock
+ * @param lock The compact lock just taken
+ */
+static inline void _compact_taken(GLockSession *session, GLockCompact *lock)
+{
+  GLockClass *klass = _g_lock_compact_class(lock);
+  __atomic_fetch_add(&klass->stats.acquisitions, 1, __ATOMIC_RELAXED);
+  session->compact_locks[session->compact_count++] = lock;
+}
+
+/**
+ * Take a compact lock
+ *
+ * @param session The lock session
+ * @param lock The compact lock
+ * @return true if the lock was taken otherwise false
+ */
+bool g_lock_compact_start(GLockSession *session, GLockCompact *lock)
+{
+  struct g_lock_compact_stats *stats;
+  GLockClass *klass;
+  int64_t start, wait_us;
+
+  if(!_compact_check(session, lock)) {
+    return false;
+  }
+
+  if(!g_bit_trylock(&lock->word, 0)) {
+    // Only the contended path pays for statistics
+    stats = g_lock_compact_stats(lock);
+    start = g_get_monotonic_time();
+    g_bit_lock(&lock->word, 0);
+    wait_us = g_get_monotonic_time() - start;
+
+    klass = _g_lock_compact_class(lock);
+    g_mutex_lock(&klass->stats_lock);
+    if(stats) {
+      stats->contended++;
+      _g_lock_time_stats_add(&stats->wait, wait_us);
+    }
+    klass->stats.contended++;
+    _g_lock_time_stats_add(&klass->stats.wait, wait_us);
+    g_mutex_unlock(&klass->stats_lock);
+    // The hold time of compact locks is not known
+    if(G_UNLIKELY(klass->manager->metrics_collecting)) {
+      _g_lock_metrics_add(&klass->metrics, wait_us, -1, true);
+    }
+  } else {
+    klass = _g_lock_compact_class(lock);
+    if(G_UNLIKELY(klass->manager->metrics_collecting)) {
+      _g_lock_metrics_add(&klass->metrics, 0, -1, false);
+    }
+  }
+
+  _compact_taken(session, lock);
+  return true;
+}
+
+/**
+ * Take a compact lock if it is free
+ *
+ * @param session The lock session
+ * @param lock The compact lock
+ * @return true if the lock was taken otherwise false
+ */
+bool g_lock_compact_try_start(GLockSession *session, GLockCompact *lock)
+{
+  GLockClass *klass;
+
+  if(!_compact_check(session, lock)) {
+    return false;
+  }
+  if(!g_bit_trylock(&lock->word, 0)) {
+    return false;
+  }
+  klass = _g_lock_compact_class(lock);
+  if(G_UNLIKELY(klass->manager->metrics_collecting)) {
+    _g_lock_metrics_add(&klass->metrics, 0, -1, false);
+  }
+  _compact_taken(session, lock);
+  return true;
+}
+
+/**
+ * Release a compact lock
+ *
+ * @param session The lock session
+ * @param lock The compact lock
+ */
+void g_lock_compact_end(GLockSession *session, GLockCompact *lock)
+{
+  uint32_t ix;
+  if(!session) {
+    lock_log("No session provided");
+    return;
+  }
+  if(!lock) {
+    lock_log("No lock provided");
+    return;
+  }
+  // Usually the most recent one
+  for(ix = session->compact_count; ix-- > 0;) {
+    if(session->compact_locks[ix] == lock) {
+      break;
+    }
+  }
+  if(ix == UINT32_MAX) {
+    lock_log("ERROR: Compact lock %p is not held by session %p",
+      lock, session);
+    return;
+  }
+  session->compact_count--;
+  memmove(&session->compact_locks[ix], &session->compact_locks[ix + 1],
+    (session->compact_count - ix) * sizeof(GLockCompact *));
+  g_bit_unlock(&lock->word, 0);
+}
@@ -0,0 +1,431 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Wait-for graph deadlock detection
+ *
+ * While detection is enabled, a thread which finds a lock busy
+ * registers what it waits for before blocking. A detection pass
+ * builds the wait-for graph from those registrations and the holder
+ * records already kept in each lock's call list: a waiting thread
+ * points at the threads owning the sessions that hold the lock.
+ * Any cycle in that graph is a deadlock.
+ *
+ * Only the contended path pays for the bookkeeping, uncontended
+ * acquisitions never get here.
+ */
+
+/**
+ * A thread blocked on a lock
+ */
+struct g_lock_wait {
+  GThread *thread; /*<< The blocked thread */
+  GLockSession *session; /*<< The session asking for the lock */
+  GLock *lock; /*<< The lock being waited on */
+  struct g_lock_caller *caller; /*<< Where the lock is being taken */
+  int64_t since; /*<< Monotonic time the wait started */
+};
+
+/**
+ * A holder of a lock as seen by a detection pass
+ */
+struct g_lock_holder {
+  GThread *thread; /*<< Thread owning the holding session */
+  GLockSession *session; /*<< The holding session */
+  const struct g_lock_callsite *callsite; /*<< Where the lock was taken */
+  int target; /*<< Index of the holder's own wait or -1 */
+};
+
+/**
+ * Copy of a wait made by a detection pass
+ */
+struct g_lock_wait_node {
+  struct g_lock_wait wait;
+  const struct g_lock_callsite *callsite; /*<< Where the lock is taken */
+  char *lock_name;
+  uint32_t lock_index;
+  GArray *holders; /*<< struct g_lock_holder */
+  int color; /*<< DFS state, 0 new, 1 on the stack, 2 done */
+};
+
+static struct {
+  GMutex lock; /*<< Protects waits */
+  GList *waits; /*<< struct g_lock_wait of the blocked threads */
+  GMutex thread_lock; /*<< Protects the members below */
+  GCond thread_cond;
+  GThread *thread; /*<< Background detector */
+  uint32_t interval_ms;
+  bool stop;
+} _detector;
+
+/**
+ * Turn wait tracking for deadlock detection on or off for a manager
+ *
+ * The waits of every manager tracking them are checked together, so
+ * a cycle going through locks of several managers is found as well.
+ *
+ * @param manager The manager whose locks are tracked
+ * @param enable Whether contended acquisitions are tracked
+ */
+void g_lock_manager_enable_deadlock_detection_in(
+  GLockManager *manager,
+  bool enable
+  )
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return;
+  }
+  g_atomic_int_set(&manager->deadlock_detection, enable);
+}
+
+/**
+ * Turn wait tracking for deadlock detection on or off
+ *
+ * @param enable Whether contended acquisitions are tracked
+ */
+void g_lock_manager_enable_deadlock_detection(bool enable)
+{
+  g_lock_manager_enable_deadlock_detection_in(
+    g_lock_manager_default(), enable);
+}
+
+/**
+ * Wait for a busy lock while making the wait visible to the detector
+ *
+ * @param lock The lock to take
+ * @param action The action to perform (for read/write locks)
+ * @param caller The caller record of the acquisition
+ */
+void _g_lock_deadlock_wait(
+  GLock *lock,
+  enum g_lock_action action,
+  struct g_lock_caller *caller
+  )
+{
+  struct g_lock_wait wait;
+  GList link;
+
+  // The list node lives on our stack for the duration of the wait
+  wait.thread = g_thread_self();
+  wait.session = caller->session;
+  wait.lock = lock;
+  wait.caller = caller;
+  wait.since = g_get_monotonic_time();
+  link.data = &wait;
+  link.next = NULL;
+  link.prev = NULL;
+
+  g_mutex_lock(&_detector.lock);
+  _detector.waits = g_list_concat(&link, _detector.waits);
+  g_mutex_unlock(&_detector.lock);
+
+  _g_lock_acquire(lock, action);
+
+  g_mutex_lock(&_detector.lock);
+  _detector.waits = g_list_remove_link(_detector.waits, &link);
+  g_mutex_unlock(&_detector.lock);
+}
+
+/**
+ * Collect the holders of the lock a node is waiting on
+ *
+ * Callers waiting on a condition are not holders.
+ *
+ * @param node The wait node to fill in
+ */
+static void _deadlock_collect_holders(struct g_lock_wait_node *node)
+{
+  GList *tmpl;
+  struct g_lock_caller *caller;
+  struct g_lock_holder holder;
+  GLock *lock = node->wait.lock;
+
+  g_mutex_lock(&lock->stats_lock);
+  for(tmpl = lock->stats.holders; tmpl; tmpl = tmpl->next) {
+    caller = tmpl->data;
+    if(caller->cond_waiting) {
+      continue;
+    }
+    holder.session = caller->session;
+    holder.thread = caller->session->owner;
+    holder.callsite = caller->callsite;
+    holder.target = -1;
+    g_array_append_val(node->holders, holder);
+  }
+  g_mutex_unlock(&lock->stats_lock);
+}
+
+/**
+ * Report a cycle found in the wait-for graph
+ *
+ * @param nodes All the wait nodes
+ * @param stack Node indices on the DFS stack
+ * @param edges Holder used to leave each node on the stack
+ * @param start Position in the stack where the cycle starts
+ * @param depth Number of entries on the stack
+ * @param now Monotonic time of the pass
+ */
+static void _deadlock_report(
+  struct g_lock_wait_node *nodes,
+  int *stack,
+  int *edges,
+  int start,
+  int depth,
+  int64_t now
+  )
+{
+  struct g_lock_wait_node *node;
+  struct g_lock_holder *holder;
+
+  lock_log("CRITICAL: [DEADLOCK] Cycle of %d threads detected",
+    depth - start);
+  for(int ix = start; ix < depth; ix++) {
+    node = &nodes[stack[ix]];
+    holder = &g_array_index(node->holders, struct g_lock_holder, edges[ix]);
+    lock_log(
+      "CRITICAL: [DEADLOCK] Session %p in %s (%s:%u) waits %" PRId64 " ms "
+      "for lock index %u (%s) held by session %p from %s (%s:%u)",
+      node->wait.session,
+      node->callsite->func,
+      node->callsite->file,
+      node->callsite->line,
+      (now - node->wait.since) / 1000,
+      node->lock_index,
+      node->lock_name,
+      holder->session,
+      holder->callsite->func,
+      holder->callsite->file,
+      holder->callsite->line);
+  }
+}
+
+/**
+ * Depth first search for cycles starting at a node
+ *
+ * @param nodes All the wait nodes
+ * @param current The node to visit
+ * @param stack Node indices on the DFS stack
+ * @param edges Holder used to leave each node on the stack
+ * @param depth Number of entries on the stack
+ * @param now Monotonic time of the pass
+ * @return Number of cycles found
+ */
+static uint32_t _deadlock_visit(
+  struct g_lock_wait_node *nodes,
+  int current,
+  int *stack,
+  int *edges,
+  int depth,
+  int64_t now
+  )
+{
+  uint32_t found = 0;
+  struct g_lock_wait_node *node = &nodes[current];
+  struct g_lock_holder *holder;
+
+  node->color = 1;
+  stack[depth] = current;
+  for(guint ix = 0; ix < node->holders->len; ix++) {
+    holder = &g_array_index(node->holders, struct g_lock_holder, ix);
+    if(holder->target < 0) {
+      continue;
+    }
+    edges[depth] = ix;
+    if(nodes[holder->target].color == 1) {
+      for(int start = 0; start <= depth; start++) {
+        if(stack[start] == holder->target) {
+          _deadlock_report(nodes, stack, edges, start, depth + 1, now);
+          break;
+        }
+      }
+      found++;
+    } else if(nodes[holder->target].color == 0) {
+      found += _deadlock_visit(
+        nodes, holder->target, stack, edges, depth + 1, now);
+    }
+  }
+  node->color = 2;
+  return found;
+}
+
+/**
+ * Run a detection pass over the current waits
+ *
+ * @param min_wait_us Ignore waits younger than this
+ * @return Number of cycles found
+ */
+static uint32_t _deadlock_check(int64_t min_wait_us)
+{
+  GList *tmpl;
+  struct g_lock_wait *wait;
+  struct g_lock_wait_node *nodes;
+  struct g_lock_holder *holder;
+  int *stack, *edges;
+  int count = 0, ix, jx;
+  uint32_t found = 0;
+  int64_t now = g_get_monotonic_time();
+
+  // Snapshot the waits and the holders of the locks waited on
+  g_mutex_lock(&_detector.lock);
+  nodes = calloc(g_list_length(_detector.waits) + 1,
+    sizeof(struct g_lock_wait_node));
+  for(tmpl = _detector.waits; tmpl; tmpl = tmpl->next) {
+    wait = tmpl->data;
+    if(now - wait->since < min_wait_us) {
+      continue;
+    }
+    nodes[count].wait = *wait;
+    nodes[count].callsite = wait->caller->callsite;
+    nodes[count].lock_name = strdup(wait->lock->name);
+    nodes[count].lock_index = wait->lock->index;
+    nodes[count].holders = g_array_new(FALSE, FALSE,
+      sizeof(struct g_lock_holder));
+    _deadlock_collect_holders(&nodes[count]);
+    count++;
+  }
+  g_mutex_unlock(&_detector.lock);
+
+  // A holder which is itself blocked leads to its wait
+  for(ix = 0; ix < count; ix++) {
+    for(guint hx = 0; hx < nodes[ix].holders->len; hx++) {
+      holder = &g_array_index(nodes[ix].holders, struct g_lock_holder, hx);
+      for(jx = 0; jx < count; jx++) {
+        if(nodes[jx].wait.thread == holder->thread) {
+          holder->target = jx;
+          break;
+        }
+      }
+    }
+  }
+
+  stack = calloc(count + 1, sizeof(int));
+  edges = calloc(count + 1, sizeof(int));
+  for(ix = 0; ix < count; ix++) {
+    if(nodes[ix].color == 0) {
+      found += _deadlock_visit(nodes, ix, stack, edges, 0, now);
+    }
+  }
+  free(stack);
+  free(edges);
+
+  for(ix = 0; ix < count; ix++) {
+    g_array_free(nodes[ix].holders, TRUE);
+    free(nodes[ix].lock_name);
+  }
+  free(nodes);
+  return found;
+}
+
+/**
+ * Look for deadlocks among the threads currently waiting
+ *
+ * Every participant of a deadlock is logged with the call site it
+ * is blocked at and the call site the lock it waits for was taken
+ * at. Only waits which started while detection was enabled are seen.
+ *
+ * @return Number of deadlock cycles found
+ */
+uint32_t g_lock_manager_check_deadlocks()
+{
+  return _deadlock_check(0);
+}
+
+/**
+ * Background detector thread
+ */
+static gpointer _deadlock_thread(gpointer data)
+{
+  int64_t interval_us, end_time;
+  g_mutex_lock(&_detector.thread_lock);
+  while(!_detector.stop) {
+    interval_us = (int64_t)_detector.interval_ms * 1000;
+    end_time = g_get_monotonic_time() + interval_us;
+    while(!_detector.stop &&
+          g_cond_wait_until(&_detector.thread_cond,
+            &_detector.thread_lock, end_time));
+    if(_detector.stop) {
+      break;
+    }
+    g_mutex_unlock(&_detector.thread_lock);
+    // Only consider waits which lasted a full interval
+    _deadlock_check(interval_us);
+    g_mutex_lock(&_detector.thread_lock);
+  }
+  g_mutex_unlock(&_detector.thread_lock);
+  return NULL;
+}
+
+/**
+ * Start a background thread looking for deadlocks among locks of a manager
+ *
+ * This enables wait tracking in the manager. There is one detector
+ * thread for all the managers. Threads which have been waiting for
+ * at least one interval are checked every interval.
+ *
+ * @param manager The manager whose locks are tracked
+ * @param interval_ms How often to look for deadlocks
+ * @return true if the detector is running
+ */
+bool g_lock_manager_start_deadlock_detector_in(
+  GLockManager *manager,
+  uint32_t interval_ms
+  )
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return false;
+  }
+  if(!interval_ms) {
+    lock_log("No interval provided");
+    return false;
+  }
+  g_lock_manager_enable_deadlock_detection_in(manager, true);
+
+  g_mutex_lock(&_detector.thread_lock);
+  _detector.interval_ms = interval_ms;
+  if(!_detector.thread) {
+    _detector.stop = false;
+    _detector.thread = g_thread_new("g-lock-deadlock", _deadlock_thread, NULL);
+  }
+  g_mutex_unlock(&_detector.thread_lock);
+  return true;
+}
+
+/**
+ * Start a background thread looking for deadlocks
+ *
+ * @param interval_ms How often to look for deadlocks
+ * @return true if the detector is running
+ */
+bool g_lock_manager_start_deadlock_detector(uint32_t interval_ms)
+{
+  return g_lock_manager_start_deadlock_detector_in(
+    g_lock_manager_default(), interval_ms);
+}
+
+/**
+ * Stop the background deadlock detector
+ *
+ * Wait tracking stays enabled until explicitly disabled.
+ */
+void g_lock_manager_stop_deadlock_detector()
+{
+  GThread *thread;
+  g_mutex_lock(&_detector.thread_lock);
+  thread = _detector.thread;
+  _detector.thread = NULL;
+  _detector.stop = true;
+  g_cond_signal(&_detector.thread_cond);
+  g_mutex_unlock(&_detector.thread_lock);
+  if(thread) {
+    g_thread_join(thread);
+  }
+}
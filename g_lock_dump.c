@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Async-signal-safe dump
+ *
+ * g_lock_show_all prints through stdio and waits for the stats lock
+ * of every lock, which can deadlock when called from a signal handler
+ * that interrupted a thread holding either. The dump only uses
+ * async-signal-safe calls instead:
+ *
+ * - the registries are walked in an epoch section reserved for
+ *   signal handlers, no lock is taken;
+ * - only counters are read, never the lists of holders and waiters
+ *   which are changed under the stats lock. The numbers holding and
+ *   waiting are loaded atomically, the rest comes from the metrics
+ *   which are only updated while collected, see
+ *   g_lock_metrics_collect_start;
+ * - text is formatted by hand into a static buffer and written with
+ *   write(2).
+ *
+ * Nothing is added to the locking path. Only one dump runs at a time,
+ * a dump started meanwhile fails.
+ */
+
+#define G_LOCK_DUMP_BUFFER_SIZE 4096
+
+static struct {
+  char buffer[G_LOCK_DUMP_BUFFER_SIZE];
+  size_t used;
+  int fd;
+  bool failed; /*<< A write failed, stop writing */
+} _dump;
+
+static gint _dump_busy = 0;
+
+static struct {
+  volatile sig_atomic_t fd; /*<< Where the handler dumps */
+  int signum; /*<< Signal handled or 0 */
+  struct sigaction previous; /*<< Handler to restore */
+} _dump_signal;
+
+/**
+ * Write the buffered text
+ */
+static void _dump_flush()
+{
+  size_t done = 0;
+  ssize_t ret;
+
+  while(done < _dump.used && !_dump.failed) {
+    ret = write(_dump.fd, _dump.buffer + done, _dump.used - done);
+    if(ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if(ret <= 0) {
+      _dump.failed = true;
+      break;
+    }
+    done += ret;
+  }
+  _dump.used = 0;
+}
+
+/**
+ * Append a string
+ *
+ * @param str The string, NULL is shown as (null)
+ */
+static void _dump_str(const char *str)
+{
+  if(!str) {
+    str = "(null)";
+  }
+  for(; *str; str++) {
+    if(_dump.used == G_LOCK_DUMP_BUFFER_SIZE) {
+      _dump_flush();
+    }
+    _dump.buffer[_dump.used++] = *str;
+  }
+}
+
+/**
+ * Append a number in a base
+ *
+ * @param value The number
+ * @param base 10 or 16
+ */
+static void _dump_num(uint64_t value, unsigned base)
+{
+  static const char digits[] = "0123456789abcdef";
+  char text[24];
+  int pos = sizeof(text) - 1;
+
+  text[pos] = '\0';
+  do {
+    text[--pos] = digits[value % base];
+    value /= base;
+  } while(value);
+  _dump_str(text + pos);
+}
+
+/**
+ * Append a lock which was used
+ *
+ * @param data The lock
+ * @param user_data Unused
+ */
+static void _dump_lock(gpointer data, gpointer user_data)
+{
+  GLock *lock = data;
+  struct g_lock_metrics *metrics = &lock->metrics;
+  int holding = __atomic_load_n(&lock->stats.holding, __ATOMIC_RELAXED);
+  int waiting = __atomic_load_n(&lock->stats.waiting, __ATOMIC_RELAXED);
+  uint64_t acquisitions = __atomic_load_n(&metrics->acquisitions,
+    __ATOMIC_RELAXED);
+
+  if(!holding && !waiting && !acquisitions) {
+    return;
+  }
+  _dump_str("Lock: ");
+  _dump_str(lock->name);
+  _dump_str(" - Index: ");
+  _dump_num(lock->index, 10);
+  _dump_str(" - Holding: ");
+  _dump_num(holding > 0? holding: 0, 10);
+  _dump_str(" - Waiting: ");
+  _dump_num(waiting > 0? waiting: 0, 10);
+  if(!g_atomic_int_get(&lock->manager->metrics_collecting)) {
+    _dump_str("\n");
+    return;
+  }
+  _dump_str(" - Acquisitions: ");
+  _dump_num(acquisitions, 10);
+  _dump_str(" - Contended: ");
+  _dump_num(__atomic_load_n(&metrics->contended, __ATOMIC_RELAXED), 10);
+  _dump_str(" - Wait: ");
+  _dump_num(__atomic_load_n(&metrics->wait_sum_us, __ATOMIC_RELAXED), 10);
+  _dump_str("us - Hold: ");
+  _dump_num(__atomic_load_n(&metrics->hold_sum_us, __ATOMIC_RELAXED), 10);
+  _dump_str("us\n");
+}
+
+/**
+ * Write the state of the locks of a manager, async-signal-safe
+ *
+ * Locks which are not held, waited for or counted in the metrics are
+ * left out.
+ *
+ * @param manager The manager whose locks are dumped
+ * @param fd Where to write
+ * @return false if another dump is running or writing failed
+ */
+bool g_lock_dump_in(GLockManager *manager, int fd)
+{
+  bool walked, ret;
+
+  if(!manager || fd < 0) {
+    return false;
+  }
+  if(!g_atomic_int_compare_and_exchange(&_dump_busy, 0, 1)) {
+    return false;
+  }
+  _dump.fd = fd;
+  _dump.used = 0;
+  _dump.failed = false;
+
+  _dump_str("=====================================\n");
+  _dump_str("Lock dump - Process: ");
+  _dump_num(getpid(), 10);
+  if(!g_atomic_int_get(&manager->metrics_collecting)) {
+    _dump_str("\nMetrics not collected, only holders and waiters are counted");
+  }
+  _dump_str("\n-----------------------------\n");
+  walked = _g_lock_manager_foreach_signal(manager, _dump_lock, NULL);
+  if(!walked) {
+    _dump_str("Registries busy\n");
+  }
+  _dump_str("=====================================\n");
+  _dump_flush();
+
+  ret = walked && !_dump.failed;
+  g_atomic_int_set(&_dump_busy, 0);
+  return ret;
+}
+
+/**
+ * Write the state of the locks, async-signal-safe
+ *
+ * @param fd Where to write
+ * @return false if another dump is running or writing failed
+ */
+bool g_lock_dump(int fd)
+{
+  return g_lock_dump_in(g_lock_manager_default(), fd);
+}
+
+/**
+ * Dump the locks when the signal is received
+ *
+ * @param signum The signal
+ */
+static void _dump_handler(int signum)
+{
+  int saved = errno;
+  g_lock_dump(_dump_signal.fd);
+  errno = saved;
+}
+
+/**
+ * Dump the locks of the default manager whenever a signal comes
+ *
+ * @param signum The signal, SIGQUIT or SIGUSR1 for instance
+ * @param fd Where to write, STDERR_FILENO for instance
+ * @return true if the handler was installed
+ */
+bool g_lock_dump_install(int signum, int fd)
+{
+  struct sigaction action;
+
+  if(fd < 0) {
+    lock_log("No file descriptor provided");
+    return false;
+  }
+  if(_dump_signal.signum) {
+    lock_log("Dump already installed for signal %d", _dump_signal.signum);
+    return false;
+  }
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = _dump_handler;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  _dump_signal.fd = fd;
+  if(sigaction(signum, &action, &_dump_signal.previous) != 0) {
+    lock_log("Failed to install dump for signal %d: %s", signum,
+      strerror(errno));
+    return false;
+  }
+  _dump_signal.signum = signum;
+  return true;
+}
+
+/**
+ * Put back the handler which was there before g_lock_dump_install
+ */
+void g_lock_dump_uninstall()
+{
+  if(!_dump_signal.signum) {
+    return;
+  }
+  sigaction(_dump_signal.signum, &_dump_signal.previous, NULL);
+  _dump_signal.signum = 0;
+}
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Epoch based reclamation
+ *
+ * Code walking the registries of the managers runs between
+ * _g_lock_epoch_enter and _g_lock_epoch_exit without taking any lock.
+ * Every thread announces the global epoch it saw when entering.
+ * Objects unlinked from a registry are retired with the epoch of the
+ * moment and only freed once the global epoch moved two steps past
+ * it, which can only happen after every thread inside at the time of
+ * the unlink left.
+ *
+ * The epoch moves on whenever every thread inside announced the
+ * current one, so with nobody walking a registry a retired object is
+ * freed right away.
+ *
+ * Only the registries are covered, on purpose. The caller records of
+ * a lock are created and dropped by every acquisition, and retiring
+ * each one would cost a malloc and _epoch.lock, shared by all locks,
+ * on every release. They are still read under the stats lock of their
+ * lock, so a reader printing a lock and the threads taking it wait for
+ * each other. Readers which must never wait, the dump and the metrics,
+ * only read atomic counters instead.
+ *
+ * Signal handlers can't allocate an announcement, one is reserved for
+ * them and linked from the start.
+ */
+
+#define G_LOCK_EPOCH_MASK (G_MAXUINT >> 1)
+
+/**
+ * Announcement of a thread
+ */
+struct g_lock_epoch_thread {
+  guint state; /*<< Epoch seen when entering shifted left, bit 0 inside */
+  guint depth; /*<< Nesting of critical sections, owner only */
+  gint used; /*<< Owned by a running thread */
+  struct g_lock_epoch_thread *next; /*<< Never unlinked */
+} __attribute__((aligned(G_LOCK_CACHE_LINE)));
+
+/**
+ * An object waiting for the readers which may see it
+ */
+struct g_lock_epoch_retired {
+  gpointer data;
+  GDestroyNotify func; /*<< Frees data */
+  guint epoch; /*<< Global epoch when it was retired */
+};
+
+static struct g_lock_epoch_thread _epoch_signal = { .used = 1 };
+static gint _epoch_signal_busy = 0;
+
+static struct {
+  GMutex lock; /*<< Protects the members below except epoch reads */
+  struct g_lock_epoch_thread *threads;
+  GQueue retired; /*<< struct g_lock_epoch_retired, oldest first */
+  guint epoch;
+} _epoch = { .threads = &_epoch_signal };
+
+/**
+ * Give the announcement of an exiting thread to the next thread
+ *
+ * @param data The announcement
+ */
+static void _epoch_thread_release(gpointer data)
+{
+  struct g_lock_epoch_thread *thread = data;
+  __atomic_store_n(&thread->state, 0, __ATOMIC_RELEASE);
+  g_atomic_int_set(&thread->used, 0);
+}
+
+static GPrivate _epoch_thread = G_PRIVATE_INIT(_epoch_thread_release);
+
+/**
+ * Get the announcement of the calling thread
+ *
+ * @return The announcement
+ */
+static struct g_lock_epoch_thread *_epoch_thread_get()
+{
+  struct g_lock_epoch_thread *thread = g_private_get(&_epoch_thread);
+  if(G_LIKELY(thread)) {
+    return thread;
+  }
+
+  g_mutex_lock(&_epoch.lock);
+  for(thread = _epoch.threads; thread; thread = thread->next) {
+    if(!g_atomic_int_get(&thread->used)) {
+      break;
+    }
+  }
+  if(!thread) {
+    if(posix_memalign((void **)&thread, G_LOCK_CACHE_LINE,
+         sizeof(struct g_lock_epoch_thread))) {
+      g_mutex_unlock(&_epoch.lock);
+      lock_log("Failed to allocate epoch announcement");
+      abort();
+    }
+    memset(thread, 0, sizeof(struct g_lock_epoch_thread));
+    thread->next = _epoch.threads;
+    g_atomic_pointer_set(&_epoch.threads, thread);
+  }
+  thread->depth = 0;
+  g_atomic_int_set(&thread->used, 1);
+  g_mutex_unlock(&_epoch.lock);
+
+  g_private_set(&_epoch_thread, thread);
+  return thread;
+}
+
+/**
+ * Announce the current epoch
+ *
+ * @param thread The announcement to update
+ */
+static void _epoch_announce(struct g_lock_epoch_thread *thread)
+{
+  guint epoch;
+  // Announce the epoch which is current once the announcement is seen
+  do {
+    epoch = __atomic_load_n(&_epoch.epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&thread->state,
+      ((epoch & G_LOCK_EPOCH_MASK) << 1) | 1, __ATOMIC_SEQ_CST);
+  } while(__atomic_load_n(&_epoch.epoch, __ATOMIC_SEQ_CST) != epoch);
+}
+
+/**
+ * Enter a section reading the registries
+ *
+ * Sections can be nested.
+ */
+void _g_lock_epoch_enter()
+{
+  struct g_lock_epoch_thread *thread = _epoch_thread_get();
+  if(thread->depth++) {
+    return;
+  }
+  _epoch_announce(thread);
+}
+
+/**
+ * Leave a section reading the registries
+ */
+void _g_lock_epoch_exit()
+{
+  struct g_lock_epoch_thread *thread = g_private_get(&_epoch_thread);
+  if(!thread || !thread->depth) {
+    lock_log("Not in an epoch section");
+    return;
+  }
+  if(--thread->depth) {
+    return;
+  }
+  __atomic_store_n(&thread->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Enter a section reading the registries from a signal handler
+ *
+ * Async-signal-safe. Only one handler can be inside at a time.
+ *
+ * @return false if another handler is inside
+ */
+bool _g_lock_epoch_enter_signal()
+{
+  if(!g_atomic_int_compare_and_exchange(&_epoch_signal_busy, 0, 1)) {
+    return false;
+  }
+  _epoch_announce(&_epoch_signal);
+  return true;
+}
+
+/**
+ * Leave a section entered with _g_lock_epoch_enter_signal
+ */
+void _g_lock_epoch_exit_signal()
+{
+  __atomic_store_n(&_epoch_signal.state, 0, __ATOMIC_RELEASE);
+  g_atomic_int_set(&_epoch_signal_busy, 0);
+}
+
+/**
+ * Move the global epoch on if every thread inside saw the current one
+ *
+ * The caller must hold _epoch.lock.
+ *
+ * @return true if the epoch moved on
+ */
+static bool _epoch_advance()
+{
+  struct g_lock_epoch_thread *thread;
+  guint epoch = _epoch.epoch;
+  guint state;
+
+  for(thread = _epoch.threads; thread; thread = thread->next) {
+    state = __atomic_load_n(&thread->state, __ATOMIC_SEQ_CST);
+    if((state & 1) && (state >> 1) != (epoch & G_LOCK_EPOCH_MASK)) {
+      return false;
+    }
+  }
+  __atomic_store_n(&_epoch.epoch, epoch + 1, __ATOMIC_SEQ_CST);
+  return true;
+}
+
+/**
+ * Take the retired objects no reader can see anymore
+ *
+ * The caller must hold _epoch.lock.
+ *
+ * @return The objects to free, struct g_lock_epoch_retired
+ */
+static GList *_epoch_collect()
+{
+  struct g_lock_epoch_retired *retired;
+  GList *ready = NULL;
+
+  while((retired = g_queue_peek_head(&_epoch.retired)) &&
+        _epoch.epoch - retired->epoch >= 2) {
+    g_queue_pop_head(&_epoch.retired);
+    ready = g_list_prepend(ready, retired);
+  }
+  return g_list_reverse(ready);
+}
+
+/**
+ * Free retired objects
+ *
+ * @param ready The objects, struct g_lock_epoch_retired
+ */
+static void _epoch_free(GList *ready)
+{
+  struct g_lock_epoch_retired *retired;
+  GList *tmpl;
+
+  for(tmpl = ready; tmpl; tmpl = tmpl->next) {
+    retired = tmpl->data;
+    retired->func(retired->data);
+    free(retired);
+  }
+  g_list_free(ready);
+}
+
+/**
+ * Free an object once no reader can see it anymore
+ *
+ * The object must already be unlinked from the registry.
+ *
+ * @param data The object
+ * @param func Frees the object
+ */
+void _g_lock_epoch_retire(gpointer data, GDestroyNotify func)
+{
+  struct g_lock_epoch_retired *retired;
+  GList *ready;
+
+  retired = malloc(sizeof(struct g_lock_epoch_retired));
+  if(!retired) {
+    lock_log("Failed to retire %p, waiting for the readers", data);
+    _g_lock_epoch_synchronize();
+    func(data);
+    return;
+  }
+  retired->data = data;
+  retired->func = func;
+
+  g_mutex_lock(&_epoch.lock);
+  retired->epoch = _epoch.epoch;
+  g_queue_push_tail(&_epoch.retired, retired);
+  for(int ix = 0; ix < 2 && _epoch_advance(); ix++);
+  ready = _epoch_collect();
+  g_mutex_unlock(&_epoch.lock);
+
+  _epoch_free(ready);
+}
+
+/**
+ * Wait until every reader which may see an unlinked object left
+ *
+ * Objects retired before the call are freed as well. Must not be
+ * called from a reading section.
+ */
+void _g_lock_epoch_synchronize()
+{
+  struct g_lock_epoch_thread *thread = g_private_get(&_epoch_thread);
+  GList *ready;
+  guint target;
+
+  if(thread && thread->depth) {
+    lock_log("CRITICAL: Waiting for readers from a reading section");
+    return;
+  }
+  g_mutex_lock(&_epoch.lock);
+  target = _epoch.epoch + 2;
+  while((gint)(target - _epoch.epoch) > 0) {
+    if(!_epoch_advance()) {
+      g_mutex_unlock(&_epoch.lock);
+      g_thread_yield();
+      g_mutex_lock(&_epoch.lock);
+    }
+  }
+  ready = _epoch_collect();
+  g_mutex_unlock(&_epoch.lock);
+
+  _epoch_free(ready);
+}
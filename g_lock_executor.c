@@ -0,0 +1,517 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Lock-aware task executor
+ *
+ * Every task lists the locks it needs. A worker only runs a task once
+ * it took all of them, in index order and without blocking, through
+ * its own session. When one of the locks is busy, the locks already
+ * taken are released and the task is parked on the busy lock until
+ * the next release of that lock queues it again. Workers never block
+ * on the locks of a task, so they keep running tasks which don't
+ * conflict instead.
+ *
+ * Each worker has a queue of its own. Tasks submitted or woken by a
+ * worker go to the head of its queue and are run next, other tasks
+ * are spread over the workers. A worker with an empty queue takes
+ * the oldest task of another worker.
+ */
+
+/**
+ * A submitted task
+ */
+struct g_lock_task {
+  GLockExecutor *executor;
+  GLockTaskFunc func;
+  gpointer user_data;
+  const struct g_lock_callsite *callsite; /*<< Where it was submitted */
+  uint32_t count; /*<< Number of locks */
+  struct g_lock_task_lock locks[]; /*<< Sorted by lock index */
+};
+
+/**
+ * A worker thread and its queue
+ */
+struct g_lock_worker {
+  GMutex lock; /*<< Protects tasks */
+  GQueue tasks; /*<< The worker takes from the head, others the tail */
+  GLockExecutor *executor;
+  GThread *thread;
+  uint32_t id;
+} __attribute__((aligned(G_LOCK_CACHE_LINE)));
+
+struct g_lock_executor {
+  GMutex lock; /*<< Protects stopping and waiting on the conditions */
+  GCond work_cond; /*<< Signalled when a task is queued */
+  GCond done_cond; /*<< Signalled when no task is pending */
+  struct g_lock_worker *workers;
+  uint32_t worker_count;
+  gint next_worker; /*<< Worker of the next task submitted from outside */
+  gint queued; /*<< Tasks in the queues of the workers */
+  gint idle; /*<< Workers waiting on work_cond */
+  gint pending; /*<< Tasks submitted which did not finish */
+  bool stopping;
+  struct g_lock_executor_stats stats;
+};
+
+static GPrivate _executor_worker; // The worker of the calling thread
+
+/**
+ * Queue a task on a worker
+ *
+ * @param executor The executor of the task
+ * @param task The task to queue
+ */
+static void _executor_push(GLockExecutor *executor, struct g_lock_task *task)
+{
+  struct g_lock_worker *worker = g_private_get(&_executor_worker);
+  bool local = worker && worker->executor == executor;
+
+  if(!local) {
+    worker = &executor->workers[(guint)g_atomic_int_add(
+      &executor->next_worker, 1) % executor->worker_count];
+  }
+  g_mutex_lock(&worker->lock);
+  if(local) {
+    g_queue_push_head(&worker->tasks, task);
+  } else {
+    g_queue_push_tail(&worker->tasks, task);
+  }
+  g_mutex_unlock(&worker->lock);
+
+  // Idle workers count themselves before checking queued
+  g_atomic_int_inc(&executor->queued);
+  if(g_atomic_int_get(&executor->idle)) {
+    g_mutex_lock(&executor->lock);
+    g_cond_signal(&executor->work_cond);
+    g_mutex_unlock(&executor->lock);
+  }
+}
+
+/**
+ * Take the next task of a worker or steal one
+ *
+ * @param worker The worker looking for a task
+ * @return The task or NULL if every queue is empty
+ */
+static struct g_lock_task *_executor_pop(struct g_lock_worker *worker)
+{
+  GLockExecutor *executor = worker->executor;
+  struct g_lock_worker *victim;
+  struct g_lock_task *task;
+
+  if(!g_atomic_int_get(&executor->queued)) {
+    return NULL;
+  }
+  g_mutex_lock(&worker->lock);
+  task = g_queue_pop_head(&worker->tasks);
+  g_mutex_unlock(&worker->lock);
+  for(uint32_t ix = 1; !task && ix < executor->worker_count; ix++) {
+    victim = &executor->workers[(worker->id + ix) % executor->worker_count];
+    g_mutex_lock(&victim->lock);
+    task = g_queue_pop_tail(&victim->tasks);
+    g_mutex_unlock(&victim->lock);
+    if(task) {
+      __atomic_fetch_add(&executor->stats.stolen, 1, __ATOMIC_RELAXED);
+    }
+  }
+  if(task) {
+    g_atomic_int_add(&executor->queued, -1);
+  }
+  return task;
+}
+
+/**
+ * Release the first locks of a task, last taken first
+ *
+ * @param session The session of the worker
+ * @param task The task
+ * @param held Number of locks of the task which are held
+ */
+static void _executor_release(
+  GLockSession *session,
+  struct g_lock_task *task,
+  uint32_t held
+  )
+{
+  while(held--) {
+    _g_lock_end(session, task->locks[held].lock, task->locks[held].action,
+      task->callsite);
+  }
+}
+
+/**
+ * Forget a task which ran or was refused
+ *
+ * @param executor The executor of the task
+ * @param task The task
+ */
+static void _executor_finish(GLockExecutor *executor, struct g_lock_task *task)
+{
+  free(task);
+  if(g_atomic_int_dec_and_test(&executor->pending)) {
+    g_mutex_lock(&executor->lock);
+    g_cond_broadcast(&executor->done_cond);
+    g_mutex_unlock(&executor->lock);
+  }
+}
+
+/**
+ * Park a task on a busy lock until it is released
+ *
+ * The task belongs to the lock once parked and may run on another
+ * worker right away, so it is not touched afterwards.
+ *
+ * @param session The session of the worker, holding none of the locks
+ * @param task The task
+ * @param ix Index of the busy lock in the task
+ */
+static void _executor_park(
+  GLockSession *session,
+  struct g_lock_task *task,
+  uint32_t ix
+  )
+{
+  GLock *lock = task->locks[ix].lock;
+  enum g_lock_action action = task->locks[ix].action;
+  const struct g_lock_callsite *callsite = task->callsite;
+
+  __atomic_fetch_add(&task->executor->stats.parked, 1, __ATOMIC_RELAXED);
+  g_mutex_lock(&lock->stats_lock);
+  lock->task_waiters = g_list_append(lock->task_waiters, task);
+  g_mutex_unlock(&lock->stats_lock);
+
+  // A release before the task was parked did not see it, releasing the
+  // lock once more queues the task again
+  if(_g_lock_try_take(session, lock, action, callsite)) {
+    _g_lock_end(session, lock, action, callsite);
+  }
+}
+
+/**
+ * Take the locks of a task and run it
+ *
+ * @param session The session of the worker
+ * @param task The task
+ */
+static void _executor_run(GLockSession *session, struct g_lock_task *task)
+{
+  GLockExecutor *executor = task->executor;
+  struct g_lock_task_lock *entry;
+
+  for(uint32_t held = 0; held < task->count; held++) {
+    entry = &task->locks[held];
+    if(!_g_lock_session_check_lock(session, entry->lock, entry->action,
+         task->callsite)) {
+      lock_log("Task refused, lock %s can't be taken", entry->lock->name);
+      _executor_release(session, task, held);
+      __atomic_fetch_add(&executor->stats.refused, 1, __ATOMIC_RELAXED);
+      _executor_finish(executor, task);
+      return;
+    }
+    if(!_g_lock_try_take(session, entry->lock, entry->action,
+         task->callsite)) {
+      _executor_release(session, task, held);
+      _executor_park(session, task, held);
+      return;
+    }
+  }
+
+  task->func(session, task->user_data);
+  _executor_release(session, task, task->count);
+  __atomic_fetch_add(&executor->stats.executed, 1, __ATOMIC_RELAXED);
+  _executor_finish(executor, task);
+}
+
+/**
+ * Body of a worker thread
+ *
+ * @param data The worker
+ * @return Always NULL
+ */
+static gpointer _executor_thread(gpointer data)
+{
+  struct g_lock_worker *worker = data;
+  GLockExecutor *executor = worker->executor;
+  struct g_lock_task *task;
+  GLockSession *session = g_lock_session_new();
+
+  if(!session) {
+    lock_log("Failed to create the session of worker %u", worker->id);
+    return NULL;
+  }
+  g_private_set(&_executor_worker, worker);
+  for(;;) {
+    task = _executor_pop(worker);
+    if(task) {
+      _executor_run(session, task);
+      continue;
+    }
+    g_mutex_lock(&executor->lock);
+    g_atomic_int_inc(&executor->idle);
+    while(!g_atomic_int_get(&executor->queued) && !executor->stopping) {
+      g_cond_wait(&executor->work_cond, &executor->lock);
+    }
+    g_atomic_int_add(&executor->idle, -1);
+    if(executor->stopping) {
+      g_mutex_unlock(&executor->lock);
+      break;
+    }
+    g_mutex_unlock(&executor->lock);
+  }
+  g_private_set(&_executor_worker, NULL);
+  g_lock_session_free(session);
+  return NULL;
+}
+
+/**
+ * Wake up the tasks parked on a lock
+ *
+ * Called after the lock was released.
+ *
+ * @param lock The lock that was released
+ */
+void _g_lock_executor_wake(GLock *lock)
+{
+  struct g_lock_task *task;
+  GList *tasks, *tmpl;
+
+  g_mutex_lock(&lock->stats_lock);
+  tasks = lock->task_waiters;
+  lock->task_waiters = NULL;
+  g_mutex_unlock(&lock->stats_lock);
+
+  for(tmpl = tasks; tmpl; tmpl = tmpl->next) {
+    task = tmpl->data;
+    _executor_push(task->executor, task);
+  }
+  g_list_free(tasks);
+}
+
+/**
+ * Create an executor and start its workers
+ *
+ * @param workers Number of worker threads, 0 for one per processor
+ * @return The executor or NULL on error
+ */
+GLockExecutor *g_lock_executor_new(uint32_t workers)
+{
+  GLockExecutor *executor;
+  char name[32];
+
+  if(!workers) {
+    workers = g_get_num_processors();
+  }
+  executor = calloc(1, sizeof(GLockExecutor));
+  if(!executor) {
+    lock_log("Failed to create executor");
+    return NULL;
+  }
+  if(posix_memalign((void **)&executor->workers, G_LOCK_CACHE_LINE,
+       workers * sizeof(struct g_lock_worker))) {
+    free(executor);
+    lock_log("Failed to create executor workers");
+    return NULL;
+  }
+  memset(executor->workers, 0, workers * sizeof(struct g_lock_worker));
+  g_mutex_init(&executor->lock);
+  g_cond_init(&executor->work_cond);
+  g_cond_init(&executor->done_cond);
+  executor->worker_count = workers;
+  for(uint32_t ix = 0; ix < workers; ix++) {
+    g_mutex_init(&executor->workers[ix].lock);
+    g_queue_init(&executor->workers[ix].tasks);
+    executor->workers[ix].executor = executor;
+    executor->workers[ix].id = ix;
+  }
+  for(uint32_t ix = 0; ix < workers; ix++) {
+    snprintf(name, sizeof(name), "g-lock-task-%u", ix);
+    executor->workers[ix].thread = g_thread_new(name, _executor_thread,
+      &executor->workers[ix]);
+  }
+  return executor;
+}
+
+/**
+ * Compare the locks of a task by index
+ *
+ * @param a The first struct g_lock_task_lock
+ * @param b The second struct g_lock_task_lock
+ * @return Negative if a is taken first
+ */
+static int _executor_compare(const void *a, const void *b)
+{
+  const struct g_lock_task_lock *la = a, *lb = b;
+  if(la->lock->index != lb->lock->index) {
+    return la->lock->index < lb->lock->index? -1: 1;
+  }
+  return 0;
+}
+
+/**
+ * Submit a task needing a set of locks
+ *
+ * The locks may be given in any order, they are taken in index order.
+ * The task runs on a worker once all of them are available, which may
+ * be a long time for a lock held elsewhere.
+ *
+ * @param executor The executor
+ * @param locks The locks the task needs
+ * @param count Number of locks
+ * @param func Run with the locks held
+ * @param user_data Passed to func
+ * @param callsite Where the task is submitted, used to take the locks
+ * @return true if the task was queued
+ */
+bool _g_lock_executor_submit(
+  GLockExecutor *executor,
+  const struct g_lock_task_lock *locks,
+  uint32_t count,
+  GLockTaskFunc func,
+  gpointer user_data,
+  const struct g_lock_callsite *callsite
+  )
+{
+  struct g_lock_task *task;
+  if(!executor) {
+    lock_log("No executor provided");
+    return false;
+  }
+  if(!func) {
+    lock_log("No task function provided");
+    return false;
+  }
+  if(count && !locks) {
+    lock_log("No locks provided");
+    return false;
+  }
+  for(uint32_t ix = 0; ix < count; ix++) {
+    if(!locks[ix].lock) {
+      lock_log("No lock provided");
+      return false;
+    }
+    if(!locks[ix].lock->manager) {
+      lock_log("Lock %s is not registered with a manager",
+        locks[ix].lock->name);
+      return false;
+    }
+  }
+
+  task = malloc(sizeof(struct g_lock_task) +
+    count * sizeof(struct g_lock_task_lock));
+  if(!task) {
+    lock_log("Failed to create task");
+    return false;
+  }
+  task->executor = executor;
+  task->func = func;
+  task->user_data = user_data;
+  task->callsite = callsite;
+  task->count = count;
+  if(count) {
+    memcpy(task->locks, locks, count * sizeof(struct g_lock_task_lock));
+    qsort(task->locks, count, sizeof(struct g_lock_task_lock),
+      _executor_compare);
+  }
+  for(uint32_t ix = 1; ix < count; ix++) {
+    if(task->locks[ix].lock == task->locks[ix - 1].lock) {
+      lock_log("Lock %s is listed twice", task->locks[ix].lock->name);
+      free(task);
+      return false;
+    }
+  }
+
+  g_atomic_int_inc(&executor->pending);
+  __atomic_fetch_add(&executor->stats.submitted, 1, __ATOMIC_RELAXED);
+  _executor_push(executor, task);
+  return true;
+}
+
+/**
+ * Wait until every submitted task ran
+ *
+ * Tasks submitted by running tasks are waited for too. Must not be
+ * called from a task of the executor.
+ *
+ * @param executor The executor
+ */
+void g_lock_executor_wait(GLockExecutor *executor)
+{
+  struct g_lock_worker *worker = g_private_get(&_executor_worker);
+  if(!executor) {
+    lock_log("No executor provided");
+    return;
+  }
+  if(worker && worker->executor == executor) {
+    lock_log("A task can't wait for its own executor");
+    return;
+  }
+  g_mutex_lock(&executor->lock);
+  while(g_atomic_int_get(&executor->pending)) {
+    g_cond_wait(&executor->done_cond, &executor->lock);
+  }
+  g_mutex_unlock(&executor->lock);
+}
+
+/**
+ * Copy the counters of an executor
+ *
+ * @param executor The executor
+ * @param stats Where to copy the counters
+ */
+void g_lock_executor_stats(
+  GLockExecutor *executor,
+  struct g_lock_executor_stats *stats
+  )
+{
+  if(!executor || !stats) {
+    lock_log("No executor provided");
+    return;
+  }
+  stats->submitted = __atomic_load_n(&executor->stats.submitted,
+    __ATOMIC_RELAXED);
+  stats->executed = __atomic_load_n(&executor->stats.executed,
+    __ATOMIC_RELAXED);
+  stats->parked = __atomic_load_n(&executor->stats.parked,
+    __ATOMIC_RELAXED);
+  stats->stolen = __atomic_load_n(&executor->stats.stolen,
+    __ATOMIC_RELAXED);
+  stats->refused = __atomic_load_n(&executor->stats.refused,
+    __ATOMIC_RELAXED);
+}
+
+/**
+ * Wait for the submitted tasks, stop the workers and free the executor
+ *
+ * @param executor The executor
+ */
+void g_lock_executor_free(GLockExecutor *executor)
+{
+  if(!executor) {
+    return;
+  }
+  g_lock_executor_wait(executor);
+
+  g_mutex_lock(&executor->lock);
+  executor->stopping = true;
+  g_cond_broadcast(&executor->work_cond);
+  g_mutex_unlock(&executor->lock);
+  for(uint32_t ix = 0; ix < executor->worker_count; ix++) {
+    g_thread_join(executor->workers[ix].thread);
+    g_mutex_clear(&executor->workers[ix].lock);
+  }
+
+  g_cond_clear(&executor->work_cond);
+  g_cond_clear(&executor->done_cond);
+  g_mutex_clear(&executor->lock);
+  free(executor->workers);
+  free(executor);
+}
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include <strings.h>
@@ -12,34 +13,131 @@
 #include <pwd.h>
 
 #include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+#include "g_lock_probes.h"
 
-static GLockManager _manager;
+static GLockManager _default_manager;
 
 /**
  * Initialize the manager structure
+ *
+ * @param manager The manager to initialize
+ */
+static void _manager_init(GLockManager *manager)
+{
+  memset(manager, 0, sizeof(GLockManager));
+  g_mutex_init(&manager->registry_lock);
+  g_mutex_init(&manager->pool_lock);
+  manager->allow_wrong_order = false;
+}
+
+/**
+ * Initialize the default manager structure
  */
 void g_lock_manager_init()
 {
-  memset(&_manager, 0, sizeof(GLockManager));
-  _manager.allow_wrong_order = false;
+  _manager_init(&_default_manager);
 }
 
 /**
- * Cleanup the manager
+ * Cleanup the default manager
  */
 void g_lock_manager_free()
 {
   g_lock_free_all();
+  _g_lock_epoch_synchronize();
+}
+
+/**
+ * Get the default manager
+ *
+ * This is the manager used by all the functions which do not
+ * take a manager.
+ *
+ * @return The default manager
+ */
+GLockManager *g_lock_manager_default()
+{
+  return &_default_manager;
+}
+
+/**
+ * Create an independent manager
+ *
+ * A manager has its own registry of locks, lock index space,
+ * settings and statistics. Lock order is only enforced between
+ * locks of the same manager.
+ *
+ * @return The new manager or NULL if we are out of memory
+ */
+GLockManager *g_lock_manager_new()
+{
+  GLockManager *manager = calloc(1, sizeof(GLockManager));
+  if(!manager) {
+    lock_log("Failed to create manager");
+    return NULL;
+  }
+  _manager_init(manager);
+  return manager;
+}
+
+/**
+ * Free a manager created with g_lock_manager_new and all its locks
+ *
+ * @param manager The manager to free
+ */
+void g_lock_manager_destroy(GLockManager *manager)
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return;
+  }
+  if(manager == &_default_manager) {
+    lock_log("The default manager can't be destroyed");
+    return;
+  }
+  g_lock_free_all_in(manager);
+  _g_lock_epoch_synchronize();
+  // Another thread may still be giving back a lock it reclaimed
+  while(g_atomic_int_get(&manager->retiring)) {
+    g_thread_yield();
+  }
+  g_slist_free_full(manager->slabs, free);
+  g_mutex_clear(&manager->pool_lock);
+  g_mutex_clear(&manager->registry_lock);
+  free(manager);
+}
+
+/**
+ * Set debugging for a lock manager
+ *
+ * @param manager The manager to change
+ * @param debug What to set the debug to
+ */
+void g_lock_manager_set_debug_in(GLockManager *manager, bool debug)
+{
+  manager->debug = debug;
 }
 
 /**
- * Set debugging for the lock manager
+ * Set debugging for the default lock manager
  *
  * @param debug What to set the debug to
  */
 void g_lock_manager_set_debug(bool debug)
 {
-  _manager.debug = debug;
+  g_lock_manager_set_debug_in(&_default_manager, debug);
+}
+
+/**
+ * Change whether a lock of a manager can be taken out of order
+ *
+ * @param manager The manager to change
+ * @param allow Whether to allow it
+ */
+void g_lock_manager_allow_wrong_order_in(GLockManager *manager, bool allow)
+{
+  manager->allow_wrong_order = allow;
 }
 
 /**
@@ -47,22 +145,20 @@ void g_lock_manager_set_debug(bool debug)
  */
 void g_lock_manager_allow_wrong_order(bool allow)
 {
-  _manager.allow_wrong_order = allow;
-
+  g_lock_manager_allow_wrong_order_in(&_default_manager, allow);
 }
 
-#define lock_log(...) _log(false, __FUNCTION__, __LINE__, __VA_ARGS__)
-#define lock_debug(...) _log(true, __FUNCTION__, __LINE__, __VA_ARGS__)
-
 /**
  * Log function
  *
+ * @param manager The manager deciding whether debug messages are shown
  * @param is_debug Whether this is a debug log message
  * @param func The caller function
  * @param line The caller line number
  * @param message The message to log
  */
-static void _log(
+void _g_lock_log(
+  GLockManager *manager,
   bool is_debug,
   const char *func,
   uint32_t line,
@@ -74,7 +170,7 @@ static void _log(
   va_list ap;
   size_t size = 0;
   char *buf = NULL;
-  if(is_debug && !_manager.debug) {
+  if(is_debug && (!manager || !manager->debug)) {
     return;
   }
   va_start(ap, message);
@@ -111,391 +207,2446 @@ static void _log(
 }
 
 /**
- * Lock the reader for the manager
+ * Serialize changes to the registry of a manager
+ *
+ * Readers don't take it, they walk the registry in an epoch section.
+ *
+ * @param manager The manager to lock
  */
-static void _manager_reader_lock()
+static void _manager_lock(GLockManager *manager)
 {
-  g_rw_lock_reader_lock(&_manager.manager_rw_lock);
+  g_mutex_lock(&manager->registry_lock);
 }
 
 /**
- * Unlock the reader for the manager
+ * Allow changes to the registry of a manager again
+ *
+ * @param manager The manager to unlock
  */
-static void _manager_reader_unlock()
+static void _manager_unlock(GLockManager *manager)
 {
-  g_rw_lock_reader_unlock(&_manager.manager_rw_lock);
+  g_mutex_unlock(&manager->registry_lock);
 }
 
 /**
- * Lock the writer for the manager
+ * Append a node to a registry list
+ *
+ * The node is complete before readers can reach it. The caller must
+ * hold the manager lock.
+ *
+ * @param queue The list
+ * @param link The node to append
  */
-static void _manager_writer_lock()
+static void _registry_push_tail(GQueue *queue, GList *link)
 {
-  g_rw_lock_writer_lock(&_manager.manager_rw_lock);
+  link->next = NULL;
+  link->prev = queue->tail;
+  if(queue->tail) {
+    g_atomic_pointer_set(&queue->tail->next, link);
+  } else {
+    g_atomic_pointer_set(&queue->head, link);
+  }
+  queue->tail = link;
+  queue->length++;
 }
 
 /**
- * Unlock the writer for the manager
+ * Remove a node from a registry list
+ *
+ * The next pointer of the node is kept so readers standing on it
+ * carry on, the node must be retired rather than reused right away.
+ * The caller must hold the manager lock.
+ *
+ * @param queue The list
+ * @param link The node to remove
  */
-static void _manager_writer_unlock()
+static void _registry_unlink(GQueue *queue, GList *link)
 {
-  g_rw_lock_writer_unlock(&_manager.manager_rw_lock);
+  if(link->prev) {
+    g_atomic_pointer_set(&link->prev->next, link->next);
+  } else {
+    g_atomic_pointer_set(&queue->head, link->next);
+  }
+  if(link->next) {
+    link->next->prev = link->prev;
+  } else {
+    queue->tail = link->prev;
+  }
+  link->prev = NULL;
+  queue->length--;
 }
 
 /**
- * Create a new lock
+ * Call a function for every node of a registry list
  *
- * @param lock_name The name of the lock
- * @param type The lock type
- * @return The new lock instance or NULL on error.
+ * The caller must be in an epoch section.
+ *
+ * @param queue The list
+ * @param func Called with the data of each node and user_data
+ * @param user_data Passed to func
  */
-GLock *g_lock_create(
-  const char *lock_name,
-  enum g_lock_type type
-  )
+static void _registry_foreach(GQueue *queue, GFunc func, gpointer user_data)
 {
-  if(!lock_name) {
-    lock_log("No lock name provided");
-    return NULL;
-  }
-
-  GLock *lock = calloc(1, sizeof(GLock));
-  lock->name = strdup(lock_name);
-  lock->type = type;
-
-  // Initialize the main lock
-  switch(type) {
-    case G_LOCK_MUTEX:
-      g_mutex_init(&lock->_lock.mutex);
-      break;
-    case G_LOCK_RECURSIVE:
-      g_rec_mutex_init(&lock->_lock.rec_mutex);
-      break;
-    case G_LOCK_RW:
-      g_rw_lock_init(&lock->_lock.rw_mutex);
-      break;
+  GList *elem;
+  for(elem = g_atomic_pointer_get(&queue->head); elem;
+      elem = g_atomic_pointer_get(&elem->next)) {
+    func(elem->data, user_data);
   }
-
-  // Initialize the stats lock
-  g_mutex_init(&lock->stats_lock);
-
-  // Add this lock to the global list of locks
-  _manager_writer_lock();
-  lock->index = _manager.lock_index++;
-  _manager.locks = g_list_append(_manager.locks, lock);
-  _manager_writer_unlock();
-  return lock;
 }
 
 /**
- * Free the caller data
+ * Call a function for every lock of a manager
  *
- * @param data The caller data passed in
+ * The caller must be in an epoch section.
+ *
+ * @param manager The manager owning the locks
+ * @param func Called with each lock and user_data
+ * @param user_data Passed to func
  */
-static void _lock_free_caller(gpointer data)
+static void _manager_foreach_lock(
+  GLockManager *manager,
+  GFunc func,
+  gpointer user_data
+  )
 {
-  struct g_lock_caller *elem = data;
-  if(!elem) {
-    lock_log("No caller to free");
-    return;
-  }
-  if(elem->caller) {
-    free(elem->caller);
+  struct g_lock_table *table;
+  for(table = g_atomic_pointer_get(&manager->tables); table;
+      table = g_atomic_pointer_get(&table->next)) {
+    for(uint32_t ix = 0; ix < table->count; ix++) {
+      func(table->locks[ix], user_data);
+    }
   }
-  // Free the element itself
-  free(elem);
+  _registry_foreach(&manager->locks, func, user_data);
 }
 
 /**
- * Free the memory associated to a lock
+ * Call functions for every lock and class of a manager
+ *
+ * No registry lock is held while the functions run, the locks and
+ * classes they get are not freed before they return. The functions
+ * take the stats lock of a lock to read its callers.
  *
- * @param data The passed in lock pointer
+ * @param manager The manager owning the locks
+ * @param lock_func Called with each lock and user_data
+ * @param class_func Called with each class and user_data, or NULL
+ * @param user_data Passed to the functions
  */
-static void _free_lock_entry(gpointer data)
+void _g_lock_manager_foreach(
+  GLockManager *manager,
+  GFunc lock_func,
+  GFunc class_func,
+  gpointer user_data
+  )
 {
-  GLock *lock = data;
-  if(!lock) {
-    lock_log("No lock provided");
-    return;
-  }
-  if(lock->name) {
-    free(lock->name);
-  }
-  // Clear the lock based on type
-  switch(lock->type) {
-    case G_LOCK_MUTEX:
-      g_mutex_clear(&lock->_lock.mutex);
-      break;
-    case G_LOCK_RECURSIVE:
-      g_rec_mutex_clear(&lock->_lock.rec_mutex);
-      break;
-    case G_LOCK_RW:
-      g_rw_lock_clear(&lock->_lock.rw_mutex);
-      break;
-  };
-  // Clear the stats lock
-  g_mutex_clear(&lock->stats_lock);
-
-  // Free the statistics for the lock
-  if(lock->stats.call_list) {
-    g_list_free_full(lock->stats.call_list, _lock_free_caller);
-    lock->stats.call_list = NULL;
+  _g_lock_epoch_enter();
+  _manager_foreach_lock(manager, lock_func, user_data);
+  if(class_func) {
+    _registry_foreach(&manager->classes, class_func, user_data);
   }
-
-  // Free the memory of the lock itself
-  free(lock);
+  _g_lock_epoch_exit();
 }
 
 /**
- * Cleanup a single lock
+ * Call a function for every lock of a manager from a signal handler
  *
- * This will remove it from the manager, clear
- * it from being a lock and free the associated
- * memory for it.
+ * Async-signal-safe as long as the function is.
  *
- * @param lock The lock to cleanup
+ * @param manager The manager owning the locks
+ * @param func Called with each lock and user_data
+ * @param user_data Passed to func
+ * @return false if another handler is walking the registries
  */
-void g_lock_free(GLock *lock)
+bool _g_lock_manager_foreach_signal(
+  GLockManager *manager,
+  GFunc func,
+  gpointer user_data
+  )
 {
-  if(!lock) {
-    lock_log("No lock provided");
-    return;
+  if(!_g_lock_epoch_enter_signal()) {
+    return false;
   }
-  // Remove it from the list
-  _manager_writer_lock();
-  _manager.locks = g_list_remove(_manager.locks, lock);
-  _manager_writer_unlock();
-
-  // Clear the lock and free the memory
-  _free_lock_entry(lock);
+  _manager_foreach_lock(manager, func, user_data);
+  _g_lock_epoch_exit_signal();
+  return true;
 }
 
 /**
- * Cleanup all the locks known to the manager
+ * Initialize a read/write lock with an explicit policy
+ *
+ * @param rw The policy lock to initialize
  */
-void g_lock_free_all()
+static void _rw_policy_init(struct g_lock_rw_policy_lock *rw)
 {
-  _manager_writer_lock();
-  g_list_free_full(_manager.locks, _free_lock_entry);
-  _manager.locks = NULL;
-  _manager_writer_unlock();
+  memset(rw, 0, sizeof(struct g_lock_rw_policy_lock));
+  g_mutex_init(&rw->mutex);
+  g_cond_init(&rw->readers_cond);
+  g_cond_init(&rw->writers_cond);
+  g_cond_init(&rw->upgraders_cond);
+  g_cond_init(&rw->upgrade_cond);
 }
 
 /**
- * Convert the lock type to be human readable
+ * Clear a read/write lock with an explicit policy
  *
- * @param type The lock type to convert
- * @return The string representation of the lock.
+ * @param rw The policy lock to clear
  */
-static const char *_lock_type_to_str(enum g_lock_type type)
+static void _rw_policy_clear(struct g_lock_rw_policy_lock *rw)
 {
-  switch(type) {
-    case G_LOCK_MUTEX:
-      return "MUTEX";
-    case G_LOCK_RECURSIVE:
-      return "RECURSIVE";
-    case G_LOCK_RW:
-      return "Read/Write";
-  }
-  return NULL;
+  g_cond_clear(&rw->upgrade_cond);
+  g_cond_clear(&rw->upgraders_cond);
+  g_cond_clear(&rw->writers_cond);
+  g_cond_clear(&rw->readers_cond);
+  g_mutex_clear(&rw->mutex);
 }
 
 /**
- * Print the lock statistics for a given lock
+ * Whether a reader has to wait given the policy
  *
- * @param lock The lock to print the statistics for
+ * @param rw The policy lock
+ * @param policy The policy of the lock
+ * @return true if the reader must block
  */
-static void _print_lock_stats(GLock *lock)
+static bool _rw_policy_reader_blocked(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
+  )
 {
-  if(!lock) {
-    printf("No lock provided\n");
-    return;
+  // A pending upgrade must not be starved by new readers
+  if(rw->writer || rw->upgrading) {
+    return true;
   }
-  GList *elem;
-  struct g_lock_caller *caller;
-  printf("=====================================\n");
-  printf("Lock: %s\n", lock->name);
-  printf("Type: %s\n", _lock_type_to_str(lock->type));
+  switch(policy) {
+    case G_LOCK_RW_POLICY_WRITER:
+    case G_LOCK_RW_POLICY_PHASE_FAIR:
+      return rw->writers_waiting > 0;
+    default:
+      break;
+  }
+  return false;
+}
 
-  g_mutex_lock(&lock->stats_lock);
-  printf("Count: %d\n", lock->stats.count);
-  printf("Callers\n");
-  printf("-----------------------------\n");
-  for(elem = lock->stats.call_list; elem; elem = elem->next) {
-    caller = elem->data;
-    printf("Caller: %s - %d - Timestamp: %ld\n",
-      caller->caller,
-      caller->line,
-      caller->timestamp);
+/**
+ * Take the read side of a policy lock
+ *
+ * With the phase-fair policy a blocked reader waits for the end
+ * of the next writer phase, after which every reader that queued
+ * during that phase is admitted before another writer may enter.
+ *
+ * @param rw The policy lock
+ * @param policy The policy of the lock
+ */
+static void _rw_policy_reader_lock(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
+  )
+{
+  uint64_t phase;
+  g_mutex_lock(&rw->mutex);
+  if(_rw_policy_reader_blocked(rw, policy)) {
+    rw->readers_waiting++;
+    if(policy == G_LOCK_RW_POLICY_PHASE_FAIR) {
+      phase = rw->phase;
+      while(rw->phase == phase) {
+        g_cond_wait(&rw->readers_cond, &rw->mutex);
+      }
+      // Admitted by the new phase, but never alongside a writer
+      while(rw->writer || rw->upgrading) {
+        g_cond_wait(&rw->readers_cond, &rw->mutex);
+      }
+      // The last reader of the phase lets the upgradable readers go
+      if(--rw->readers_pass == 0 && rw->upgraders_waiting) {
+        g_cond_signal(&rw->upgraders_cond);
+      }
+    } else {
+      while(_rw_policy_reader_blocked(rw, policy)) {
+        g_cond_wait(&rw->readers_cond, &rw->mutex);
+      }
+    }
+    rw->readers_waiting--;
   }
-  g_mutex_unlock(&lock->stats_lock);
-  printf("=====================================\n");
+  rw->readers++;
+  g_mutex_unlock(&rw->mutex);
 }
 
 /**
- * Show the statistics for all the locks
+ * Release the read side of a policy lock
+ *
+ * @param rw The policy lock
  */
-void g_lock_show_all()
+static void _rw_policy_reader_unlock(struct g_lock_rw_policy_lock *rw)
 {
-  GList *elem;
-  GLock *lock;
-  _manager_reader_lock();
-  for(elem = _manager.locks; elem; elem = elem->next) {
-    lock = elem->data;
-    _print_lock_stats(lock);
+  g_mutex_lock(&rw->mutex);
+  rw->readers--;
+  if(rw->readers == 0 && rw->upgrading) {
+    g_cond_signal(&rw->upgrade_cond);
+  } else if(rw->readers == 0 && rw->writers_waiting) {
+    g_cond_signal(&rw->writers_cond);
   }
-  _manager_reader_unlock();
+  g_mutex_unlock(&rw->mutex);
 }
 
 /**
- * Log the action for the lock
+ * Whether a writer has to wait given the policy
  *
- * @param action What action is being performed
- * @param name The name of the lock
- * @param action_subtype The subtype of action that is being performed.
- *                       This only applies to read/write locks.
+ * @param rw The policy lock
+ * @param policy The policy of the lock
+ * @return true if the writer must block
  */
-static void _lock_log_action(
-  const char *action,
-  const char *name,
-  enum g_lock_action action_subtype
+static bool _rw_policy_writer_blocked(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
   )
 {
-  char subtype[32];
-  subtype[0] = '\0';
-  switch(action_subtype) {
-    case G_LOCK_ACTION_READ:
-      g_strlcpy(subtype, " (RW-READ) ", sizeof(subtype));
-      break;
-    case G_LOCK_ACTION_WRITE:
-      g_strlcpy(subtype, " (RW-WRITE) ", sizeof(subtype));
-      break;
+  if(rw->writer || rw->upgrader || rw->readers > 0) {
+    return true;
+  }
+  switch(policy) {
+    case G_LOCK_RW_POLICY_READER:
+      return rw->readers_waiting > 0;
+    case G_LOCK_RW_POLICY_PHASE_FAIR:
+      return rw->readers_pass > 0;
     default:
-      subtype[0] = '\0';
       break;
   }
-  lock_debug("%s%s: %s", action, subtype, name);
+  return false;
 }
 
 /**
- * Add the lock index to the session
+ * Take the write side of a policy lock
  *
- * @param session Lock session object
- * @param lock The lock being taken
+ * @param rw The policy lock
+ * @param policy The policy of the lock
  */
-static bool g_lock_session_add_lock(
-  GLockSession *session,
-  GLock *lock
+static void _rw_policy_writer_lock(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
   )
 {
-  if(!session) {
-    lock_log("No session provided");
-    return false;
-  }
-  if(!lock) {
-    lock_log("No lock provided");
-    return false;
+  g_mutex_lock(&rw->mutex);
+  rw->writers_waiting++;
+  while(_rw_policy_writer_blocked(rw, policy)) {
+    g_cond_wait(&rw->writers_cond, &rw->mutex);
   }
-  session->lock_list = g_list_append(
-    session->lock_list,
-    GINT_TO_POINTER(lock->index));
-  return true;
+  rw->writers_waiting--;
+  rw->writer = true;
+  g_mutex_unlock(&rw->mutex);
 }
 
 /**
- * If abort_lock_order is enabled then abort
+ * Release the write side of a policy lock
+ *
+ * @param rw The policy lock
+ * @param policy The policy of the lock
  */
-static void _g_lock_abort()
+static void _rw_policy_writer_unlock(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
+  )
 {
-  if(!_manager.allow_wrong_order) {
-    lock_log("CRITICAL: Aborting");
-    abort();
+  g_mutex_lock(&rw->mutex);
+  rw->writer = false;
+  rw->phase++;
+  if(policy == G_LOCK_RW_POLICY_PHASE_FAIR) {
+    // Every reader queued during this phase goes next
+    rw->readers_pass = rw->readers_waiting;
+  }
+  if(rw->readers_waiting) {
+    g_cond_broadcast(&rw->readers_cond);
   }
+  if(rw->writers_waiting) {
+    g_cond_signal(&rw->writers_cond);
+  }
+  if(rw->upgraders_waiting) {
+    g_cond_signal(&rw->upgraders_cond);
+  }
+  g_mutex_unlock(&rw->mutex);
 }
 
 /**
- * Check if a lock is valid within a session
+ * Whether an upgradable reader has to wait given the policy
  *
- * @param session The session to check
- * @param lock The lock that the caller wants to take
- * @param action The action the caller is taking
- * @return If all is ok then return true otherwise false
+ * Upgradable readers share the lock with plain readers but not with
+ * each other, so that an upgrade never has to wait for another one.
+ *
+ * @param rw The policy lock
+ * @param policy The policy of the lock
+ * @return true if the upgradable reader must block
  */
-static bool _g_lock_session_check_lock(
-  GLockSession *session,
-  GLock *lock,
-  enum g_lock_action action
+static bool _rw_policy_upgrader_blocked(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
   )
 {
-  GList *tmpl = NULL;
-  char *lock_name = NULL;
-  uint32_t cur_index;
-  bool test_same = true;
-
-  if(!session || !lock) {
-    return false;
+  if(rw->writer || rw->upgrader) {
+    return true;
   }
-
-  switch(lock->type) {
-    case G_LOCK_RECURSIVE:
-      test_same = false;
+  switch(policy) {
+    case G_LOCK_RW_POLICY_READER:
+      return false;
+    case G_LOCK_RW_POLICY_PHASE_FAIR:
+      // It could upgrade before the readers let in got to enter
+      return rw->writers_waiting > 0 || rw->readers_pass > 0;
     default:
       break;
-  };
+  }
+  return rw->writers_waiting > 0;
+}
 
+/**
+ * Take the upgradable read side of a policy lock
+ *
+ * @param rw The policy lock
+ * @param policy The policy of the lock
+ */
+static void _rw_policy_upgrader_lock(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
+  )
+{
+  g_mutex_lock(&rw->mutex);
+  rw->upgraders_waiting++;
+  while(_rw_policy_upgrader_blocked(rw, policy)) {
+    g_cond_wait(&rw->upgraders_cond, &rw->mutex);
+  }
+  rw->upgraders_waiting--;
+  rw->upgrader = true;
+  g_mutex_unlock(&rw->mutex);
+}
+
+/**
+ * Release the upgradable read side of a policy lock
+ *
+ * @param rw The policy lock
+ */
+static void _rw_policy_upgrader_unlock(struct g_lock_rw_policy_lock *rw)
+{
+  g_mutex_lock(&rw->mutex);
+  rw->upgrader = false;
+  if(rw->upgraders_waiting) {
+    g_cond_signal(&rw->upgraders_cond);
+  }
+  if(rw->readers == 0 && rw->writers_waiting) {
+    g_cond_signal(&rw->writers_cond);
+  }
+  g_mutex_unlock(&rw->mutex);
+}
+
+/**
+ * Turn the upgradable read side of a policy lock into the write side
+ *
+ * New readers are held back and the readers already in are waited
+ * for. Since there is only one upgradable reader this can't deadlock.
+ *
+ * @param rw The policy lock
+ */
+static void _rw_policy_upgrade(struct g_lock_rw_policy_lock *rw)
+{
+  g_mutex_lock(&rw->mutex);
+  rw->upgrading = true;
+  while(rw->readers > 0) {
+    g_cond_wait(&rw->upgrade_cond, &rw->mutex);
+  }
+  rw->upgrading = false;
+  rw->upgrader = false;
+  rw->writer = true;
+  g_mutex_unlock(&rw->mutex);
+}
+
+/**
+ * Turn the write or upgradable read side of a policy lock into a read
+ *
+ * Readers blocked behind the writer are let in along with the caller.
+ *
+ * @param rw The policy lock
+ * @param action The side held, write or upgradable
+ * @param policy The policy of the lock
+ */
+static void _rw_policy_downgrade(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_action action,
+  enum g_lock_rw_policy policy
+  )
+{
+  g_mutex_lock(&rw->mutex);
+  rw->readers++;
+  if(action == G_LOCK_ACTION_WRITE) {
+    rw->writer = false;
+    rw->phase++;
+    if(policy == G_LOCK_RW_POLICY_PHASE_FAIR) {
+      rw->readers_pass = rw->readers_waiting;
+    }
+    if(rw->readers_waiting) {
+      g_cond_broadcast(&rw->readers_cond);
+    }
+  } else {
+    rw->upgrader = false;
+  }
+  if(rw->upgraders_waiting) {
+    g_cond_signal(&rw->upgraders_cond);
+  }
+  g_mutex_unlock(&rw->mutex);
+}
+
+/**
+ * Try to take the read side of a policy lock without blocking
+ *
+ * @param rw The policy lock
+ * @param policy The policy of the lock
+ * @return true if the read side was taken
+ */
+static bool _rw_policy_reader_trylock(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
+  )
+{
+  bool taken = false;
+  g_mutex_lock(&rw->mutex);
+  if(!_rw_policy_reader_blocked(rw, policy)) {
+    rw->readers++;
+    taken = true;
+  }
+  g_mutex_unlock(&rw->mutex);
+  return taken;
+}
+
+/**
+ * Try to take the write side of a policy lock without blocking
+ *
+ * @param rw The policy lock
+ * @param policy The policy of the lock
+ * @return true if the write side was taken
+ */
+static bool _rw_policy_writer_trylock(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
+  )
+{
+  bool taken = false;
+  g_mutex_lock(&rw->mutex);
+  if(!rw->writers_waiting && !_rw_policy_writer_blocked(rw, policy)) {
+    rw->writer = true;
+    taken = true;
+  }
+  g_mutex_unlock(&rw->mutex);
+  return taken;
+}
+
+/**
+ * Try to take the upgradable read side of a policy lock without blocking
+ *
+ * @param rw The policy lock
+ * @param policy The policy of the lock
+ * @return true if the upgradable read side was taken
+ */
+static bool _rw_policy_upgrader_trylock(
+  struct g_lock_rw_policy_lock *rw,
+  enum g_lock_rw_policy policy
+  )
+{
+  bool taken = false;
+  g_mutex_lock(&rw->mutex);
+  if(!rw->upgraders_waiting && !_rw_policy_upgrader_blocked(rw, policy)) {
+    rw->upgrader = true;
+    taken = true;
+  }
+  g_mutex_unlock(&rw->mutex);
+  return taken;
+}
+
+/**
+ * Number of locks carved out of one pool allocation
+ */
+#define G_LOCK_POOL_SLAB_SIZE 256
+
+/**
+ * Pool of lock structures
+ *
+ * Every manager has its own pool, so creating and freeing locks in
+ * one manager never waits for another. Locks are allocated a slab at
+ * a time and freed locks are kept on the free list of their manager,
+ * linked through their registry node. Slabs are only returned to the
+ * system when the manager is destroyed.
+ */
+
+/**
+ * Take a zeroed lock structure from the pool of a manager
+ *
+ * @param manager The manager the lock will be registered with
+ * @return The lock or NULL if we are out of memory
+ */
+static GLock *_pool_alloc(GLockManager *manager)
+{
+  GLock *lock, *slab;
+  g_mutex_lock(&manager->pool_lock);
+  if(!manager->pool) {
+    slab = calloc(G_LOCK_POOL_SLAB_SIZE, sizeof(GLock));
+    if(!slab) {
+      g_mutex_unlock(&manager->pool_lock);
+      lock_log("Failed to allocate lock slab");
+      return NULL;
+    }
+    manager->slabs = g_slist_prepend(manager->slabs, slab);
+    for(int ix = 0; ix < G_LOCK_POOL_SLAB_SIZE; ix++) {
+      slab[ix].link.data = &slab[ix];
+      slab[ix].link.next = manager->pool;
+      manager->pool = &slab[ix].link;
+    }
+  }
+  lock = manager->pool->data;
+  manager->pool = manager->pool->next;
+  g_mutex_unlock(&manager->pool_lock);
+
+  memset(lock, 0, sizeof(GLock));
+  return lock;
+}
+
+/**
+ * Return a lock structure to the pool of a manager
+ *
+ * @param manager The manager whose pool the lock came from
+ * @param lock The lock to return
+ */
+static void _pool_free(GLockManager *manager, GLock *lock)
+{
+  g_mutex_lock(&manager->pool_lock);
+  lock->link.data = lock;
+  lock->link.next = manager->pool;
+  manager->pool = &lock->link;
+  g_mutex_unlock(&manager->pool_lock);
+}
+
+/**
+ * Add a lock to the manager's list of locks
+ *
+ * @param manager The manager to register the lock with
+ * @param lock The lock to register
+ */
+static void _manager_add_lock(GLockManager *manager, GLock *lock)
+{
+  lock->manager = manager;
+  lock->link.data = lock;
+  _manager_lock(manager);
+  // Instances are ordered by their class
+  if(lock->klass) {
+    lock->index = lock->klass->index;
+  } else {
+    lock->index = manager->lock_index++;
+  }
+  _registry_push_tail(&manager->locks, &lock->link);
+  _manager_unlock(manager);
+  G_LOCK_PROBE_CREATE(lock);
+  if(G_UNLIKELY(_g_lock_publishing)) {
+    _g_lock_publish_lock(lock);
+  }
+}
+
+/**
+ * Remove a lock from its manager's list of locks
+ *
+ * @param lock The lock to unregister
+ */
+static void _manager_remove_lock(GLock *lock)
+{
+  GLockManager *manager = lock->manager;
+  _manager_lock(manager);
+  _registry_unlink(&manager->locks, &lock->link);
+  _manager_unlock(manager);
+}
+
+/**
+ * Initialize a lock structure and register it
+ *
+ * @param manager The manager to register the lock with
+ * @param lock The lock to initialize
+ * @param lock_name The name of the lock
+ * @param type The lock type
+ * @param policy The read/write policy (G_LOCK_RW only)
+ * @param storage Who owns the memory of the lock
+ * @param klass The class of the lock or NULL
+ * @param subclass Nesting level within the class
+ */
+static void _g_lock_init(
+  GLockManager *manager,
+  GLock *lock,
+  const char *lock_name,
+  enum g_lock_type type,
+  enum g_lock_rw_policy policy,
+  enum g_lock_storage storage,
+  GLockClass *klass,
+  uint32_t subclass
+  )
+{
+  // Shared by all the managers on purpose: metrics snapshots and trace
+  // records keep pointing at names after their lock and manager are gone
+  lock->name = g_intern_string(lock_name);
+  lock->type = type;
+  lock->storage = storage;
+  lock->klass = klass;
+  lock->subclass = subclass;
+  if(klass) {
+    g_atomic_int_inc(&klass->instances);
+  }
+
+  // Initialize the main lock
+  switch(type) {
+    case G_LOCK_MUTEX:
+      g_mutex_init(&lock->_lock.mutex);
+      break;
+    case G_LOCK_RECURSIVE:
+      g_rec_mutex_init(&lock->_lock.rec_mutex);
+      break;
+    case G_LOCK_RW:
+      lock->rw_policy = policy;
+      if(policy == G_LOCK_RW_POLICY_DEFAULT) {
+        g_rw_lock_init(&lock->_lock.rw_mutex);
+      } else {
+        _rw_policy_init(&lock->_lock.policy_rw);
+      }
+      break;
+    case G_LOCK_COHORT:
+      memset(&lock->_lock.cohort, 0, sizeof(lock->_lock.cohort));
+      break;
+    case G_LOCK_SHARED:
+      // Set by g_lock_create_shared, the memory is not ours
+      break;
+  }
+
+  // Initialize the stats lock
+  g_mutex_init(&lock->stats_lock);
+  g_cond_init(&lock->async_cond);
+
+  _manager_add_lock(manager, lock);
+}
+
+/**
+ * Check a lock type can be used without extra arguments
+ *
+ * @param type The lock type
+ * @return false if the lock needs a dedicated constructor
+ */
+static bool _g_lock_check_type(enum g_lock_type type)
+{
+  if(type == G_LOCK_SHARED) {
+    lock_log("Shared locks are created with g_lock_create_shared");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Allocate and register a new lock
+ *
+ * @param manager The manager to register the lock with
+ * @param lock_name The name of the lock
+ * @param type The lock type
+ * @param policy The read/write policy (G_LOCK_RW only)
+ * @return The new lock instance or NULL on error.
+ */
+static GLock *_g_lock_create(
+  GLockManager *manager,
+  const char *lock_name,
+  enum g_lock_type type,
+  enum g_lock_rw_policy policy
+  )
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return NULL;
+  }
+  if(!lock_name) {
+    lock_log("No lock name provided");
+    return NULL;
+  }
+  if(!_g_lock_check_type(type)) {
+    return NULL;
+  }
+
+  GLock *lock = _pool_alloc(manager);
+  if(!lock) {
+    return NULL;
+  }
+  _g_lock_init(manager, lock, lock_name, type, policy, G_LOCK_STORAGE_POOL,
+    NULL, 0);
+  return lock;
+}
+
+/**
+ * Initialize a lock embedded in a caller owned structure
+ *
+ * No memory is allocated for the lock. It must be cleared with
+ * g_lock_clear before its memory is released.
+ *
+ * @param manager The manager to register the lock with
+ * @param lock The lock to initialize
+ * @param lock_name The name of the lock
+ * @param type The lock type
+ * @return true on success otherwise false
+ */
+bool g_lock_init_in(
+  GLockManager *manager,
+  GLock *lock,
+  const char *lock_name,
+  enum g_lock_type type
+  )
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return false;
+  }
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  if(!lock_name) {
+    lock_log("No lock name provided");
+    return false;
+  }
+  if(!_g_lock_check_type(type)) {
+    return false;
+  }
+  memset(lock, 0, sizeof(GLock));
+  _g_lock_init(manager, lock, lock_name, type, G_LOCK_RW_POLICY_DEFAULT,
+    G_LOCK_STORAGE_EMBEDDED, NULL, 0);
+  return true;
+}
+
+/**
+ * Initialize a lock embedded in a caller owned structure
+ *
+ * @param lock The lock to initialize
+ * @param lock_name The name of the lock
+ * @param type The lock type
+ * @return true on success otherwise false
+ */
+bool g_lock_init(GLock *lock, const char *lock_name, enum g_lock_type type)
+{
+  return g_lock_init_in(&_default_manager, lock, lock_name, type);
+}
+
+/**
+ * Create a new lock in a manager
+ *
+ * @param manager The manager to register the lock with
+ * @param lock_name The name of the lock
+ * @param type The lock type
+ * @return The new lock instance or NULL on error.
+ */
+GLock *g_lock_create_in(
+  GLockManager *manager,
+  const char *lock_name,
+  enum g_lock_type type
+  )
+{
+  return _g_lock_create(manager, lock_name, type, G_LOCK_RW_POLICY_DEFAULT);
+}
+
+/**
+ * Create a new lock
+ *
+ * @param lock_name The name of the lock
+ * @param type The lock type
+ * @return The new lock instance or NULL on error.
+ */
+GLock *g_lock_create(
+  const char *lock_name,
+  enum g_lock_type type
+  )
+{
+  return g_lock_create_in(&_default_manager, lock_name, type);
+}
+
+/**
+ * Create a lock class in a manager
+ *
+ * The class takes the next index of the manager, so its instances
+ * are ordered against other locks as if the class was a lock created
+ * at this point.
+ *
+ * @param manager The manager to register the class with
+ * @param class_name The name of the class and its instances
+ * @param rule How instances of the class can be nested
+ * @return The new class or NULL on error.
+ */
+GLockClass *g_lock_class_new_in(
+  GLockManager *manager,
+  const char *class_name,
+  enum g_lock_class_rule rule
+  )
+{
+  GLockClass *klass;
+  if(!manager) {
+    lock_log("No manager provided");
+    return NULL;
+  }
+  if(!class_name) {
+    lock_log("No class name provided");
+    return NULL;
+  }
+  klass = calloc(1, sizeof(GLockClass));
+  if(!klass) {
+    lock_log("Failed to create lock class");
+    return NULL;
+  }
+  klass->name = g_intern_string(class_name);
+  klass->rule = rule;
+  klass->manager = manager;
+  klass->link.data = klass;
+  g_mutex_init(&klass->stats_lock);
+
+  _manager_lock(manager);
+  klass->index = manager->lock_index++;
+  _registry_push_tail(&manager->classes, &klass->link);
+  _manager_unlock(manager);
+  if(G_UNLIKELY(_g_lock_publishing)) {
+    _g_lock_publish_class(klass);
+  }
+  return klass;
+}
+
+/**
+ * Create a lock class
+ *
+ * @param class_name The name of the class and its instances
+ * @param rule How instances of the class can be nested
+ * @return The new class or NULL on error.
+ */
+GLockClass *g_lock_class_new(
+  const char *class_name,
+  enum g_lock_class_rule rule
+  )
+{
+  return g_lock_class_new_in(&_default_manager, class_name, rule);
+}
+
+/**
+ * Free the memory of a lock class
+ *
+ * @param data The class
+ */
+static void _free_class_entry(gpointer data)
+{
+  GLockClass *klass = data;
+  if(klass->metrics.published) {
+    _g_lock_publish_detach(&klass->metrics);
+  }
+  g_mutex_clear(&klass->stats_lock);
+  free(klass);
+}
+
+/**
+ * Free a lock class once no reader can see it anymore
+ *
+ * @param klass The class, already unlinked from its manager
+ */
+static void _retire_class(GLockClass *klass)
+{
+  if(klass->metrics.published) {
+    _g_lock_publish_detach(&klass->metrics);
+  }
+  _g_lock_epoch_retire(klass, _free_class_entry);
+}
+
+/**
+ * Free a lock class which has no instances left
+ *
+ * @param klass The class to free
+ */
+void g_lock_class_free(GLockClass *klass)
+{
+  if(!klass) {
+    lock_log("No class provided");
+    return;
+  }
+  if(g_atomic_int_get(&klass->instances)) {
+    lock_log("Lock class %s still has %d instances",
+      klass->name, g_atomic_int_get(&klass->instances));
+    return;
+  }
+  _manager_lock(klass->manager);
+  _registry_unlink(&klass->manager->classes, &klass->link);
+  _manager_unlock(klass->manager);
+  _retire_class(klass);
+}
+
+/**
+ * Create a new instance of a lock class
+ *
+ * @param klass The class of the lock
+ * @param type The lock type
+ * @param subclass Nesting level within the class, only used by
+ *                 G_LOCK_CLASS_SUBCLASS
+ * @return The new lock instance or NULL on error.
+ */
+GLock *g_lock_create_instance(
+  GLockClass *klass,
+  enum g_lock_type type,
+  uint32_t subclass
+  )
+{
+  if(!klass) {
+    lock_log("No class provided");
+    return NULL;
+  }
+  if(!_g_lock_check_type(type)) {
+    return NULL;
+  }
+
+  GLock *lock = _pool_alloc(klass->manager);
+  if(!lock) {
+    return NULL;
+  }
+  _g_lock_init(klass->manager, lock, klass->name, type,
+    G_LOCK_RW_POLICY_DEFAULT, G_LOCK_STORAGE_POOL, klass, subclass);
+  return lock;
+}
+
+/**
+ * Initialize an instance of a lock class embedded in a caller owned
+ * structure
+ *
+ * @param lock The lock to initialize
+ * @param klass The class of the lock
+ * @param type The lock type
+ * @param subclass Nesting level within the class, only used by
+ *                 G_LOCK_CLASS_SUBCLASS
+ * @return true on success otherwise false
+ */
+bool g_lock_init_instance(
+  GLock *lock,
+  GLockClass *klass,
+  enum g_lock_type type,
+  uint32_t subclass
+  )
+{
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  if(!klass) {
+    lock_log("No class provided");
+    return false;
+  }
+  if(!_g_lock_check_type(type)) {
+    return false;
+  }
+  memset(lock, 0, sizeof(GLock));
+  _g_lock_init(klass->manager, lock, klass->name, type,
+    G_LOCK_RW_POLICY_DEFAULT, G_LOCK_STORAGE_EMBEDDED, klass, subclass);
+  return true;
+}
+
+/**
+ * Create a new read/write lock with an explicit policy in a manager
+ *
+ * @param manager The manager to register the lock with
+ * @param lock_name The name of the lock
+ * @param policy Which side is preferred when readers and writers compete
+ * @return The new lock instance or NULL on error.
+ */
+GLock *g_lock_create_rw_policy_in(
+  GLockManager *manager,
+  const char *lock_name,
+  enum g_lock_rw_policy policy
+  )
+{
+  return _g_lock_create(manager, lock_name, G_LOCK_RW, policy);
+}
+
+/**
+ * Create a new read/write lock with an explicit policy
+ *
+ * @param lock_name The name of the lock
+ * @param policy Which side is preferred when readers and writers compete
+ * @return The new lock instance or NULL on error.
+ */
+GLock *g_lock_create_rw_policy(
+  const char *lock_name,
+  enum g_lock_rw_policy policy
+  )
+{
+  return g_lock_create_rw_policy_in(&_default_manager, lock_name, policy);
+}
+
+/**
+ * Create the lock of a process for a process-shared lock
+ *
+ * Every process using the shared lock needs a GLock of its own, which
+ * is ordered against the other locks of the process. A process forked
+ * after the GLock was created can use the one it inherited.
+ *
+ * @param manager The manager to register the lock with
+ * @param shared The lock in shared memory, see g_lock_shared_init
+ * @return The new lock instance or NULL on error.
+ */
+GLock *g_lock_create_shared_in(GLockManager *manager, GLockShared *shared)
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return NULL;
+  }
+  if(!_g_lock_shared_valid(shared)) {
+    return NULL;
+  }
+
+  GLock *lock = _pool_alloc(manager);
+  if(!lock) {
+    return NULL;
+  }
+  lock->_lock.shared = shared;
+  _g_lock_init(manager, lock, shared->name, G_LOCK_SHARED,
+    G_LOCK_RW_POLICY_DEFAULT, G_LOCK_STORAGE_POOL, NULL, 0);
+  return lock;
+}
+
+/**
+ * Create the lock of a process for a process-shared lock
+ *
+ * @param shared The lock in shared memory, see g_lock_shared_init
+ * @return The new lock instance or NULL on error.
+ */
+GLock *g_lock_create_shared(GLockShared *shared)
+{
+  return g_lock_create_shared_in(&_default_manager, shared);
+}
+
+/**
+ * Register a static lock table with a manager
+ *
+ * The locks keep the level they were declared with as their index
+ * and locks created afterwards are ordered after all of them. A table
+ * whose levels overlap the locks already registered is refused, so
+ * tables have to be registered before any lock is created and in
+ * increasing order of levels. Nothing is allocated.
+ *
+ * @param manager The manager to register the locks with
+ * @param table The table defined with G_LOCK_TABLE_DEFINE
+ * @return true on success otherwise false
+ */
+bool g_lock_table_register_in(
+  GLockManager *manager,
+  struct g_lock_table *table
+  )
+{
+  GLock *lock;
+  if(!manager) {
+    lock_log("No manager provided");
+    return false;
+  }
+  if(!table) {
+    lock_log("No lock table provided");
+    return false;
+  }
+
+  _manager_lock(manager);
+  if(table->manager) {
+    _manager_unlock(manager);
+    lock_log("Lock table %s is already registered", table->name);
+    return false;
+  }
+  for(uint32_t ix = 0; ix < table->count; ix++) {
+    if(!_g_lock_check_type(table->locks[ix]->type)) {
+      _manager_unlock(manager);
+      return false;
+    }
+  }
+  // Overlapping levels would leave the locks sharing them unordered
+  for(uint32_t ix = 0; ix < table->count; ix++) {
+    lock = table->locks[ix];
+    if(lock->index < manager->lock_index) {
+      _manager_unlock(manager);
+      lock_log(
+        "Lock %s of table %s has level %u which overlaps the "
+        "locks already registered.",
+        lock->name, table->name, lock->index);
+      return false;
+    }
+    for(uint32_t other = 0; other < ix; other++) {
+      if(table->locks[other]->index == lock->index) {
+        _manager_unlock(manager);
+        lock_log("Locks %s and %s of table %s share level %u",
+          table->locks[other]->name, lock->name, table->name, lock->index);
+        return false;
+      }
+    }
+  }
+  for(uint32_t ix = 0; ix < table->count; ix++) {
+    lock = table->locks[ix];
+    lock->manager = manager;
+    if(lock->index >= manager->lock_index) {
+      manager->lock_index = lock->index + 1;
+    }
+  }
+  table->manager = manager;
+  table->next = manager->tables;
+  g_atomic_pointer_set(&manager->tables, table);
+  _manager_unlock(manager);
+  if(G_UNLIKELY(_g_lock_publishing)) {
+    for(uint32_t ix = 0; ix < table->count; ix++) {
+      _g_lock_publish_lock(table->locks[ix]);
+    }
+  }
+  return true;
+}
+
+/**
+ * Register a static lock table with the default manager
+ *
+ * @param table The table defined with G_LOCK_TABLE_DEFINE
+ * @return true on success otherwise false
+ */
+bool g_lock_table_register(struct g_lock_table *table)
+{
+  return g_lock_table_register_in(&_default_manager, table);
+}
+
+/**
+ * Free the caller data
+ *
+ * @param data The caller data passed in
+ */
+void _g_lock_caller_free(gpointer data)
+{
+  struct g_lock_caller *elem = data;
+  if(!elem) {
+    lock_log("No caller to free");
+    return;
+  }
+  free(elem->stack);
+  // Free the element itself
+  free(elem);
+}
+
+/**
+ * Free the statistics of a lock
+ *
+ * @param lock The lock to clear
+ */
+static void _clear_lock_stats(GLock *lock)
+{
+  if(lock->stats.callsites) {
+    g_hash_table_destroy(lock->stats.callsites);
+    lock->stats.callsites = NULL;
+  }
+  if(lock->stats.waiters) {
+    g_list_free_full(lock->stats.waiters, _g_lock_caller_free);
+    lock->stats.waiters = NULL;
+  }
+  if(lock->stats.holders) {
+    g_list_free_full(lock->stats.holders, _g_lock_caller_free);
+    lock->stats.holders = NULL;
+  }
+}
+
+/**
+ * Detach a lock from its class
+ *
+ * @param lock The lock to detach
+ */
+static void _clear_lock_class(GLock *lock)
+{
+  if(lock->klass) {
+    g_atomic_int_add(&lock->klass->instances, -1);
+    lock->klass = NULL;
+  }
+}
+
+/**
+ * Clear the lock and its statistics
+ *
+ * @param lock The lock to clear
+ */
+static void _clear_lock(GLock *lock)
+{
+  if(lock->metrics.published) {
+    _g_lock_publish_detach(&lock->metrics);
+  }
+  _clear_lock_class(lock);
+
+  // Clear the lock based on type
+  switch(lock->type) {
+    case G_LOCK_MUTEX:
+      g_mutex_clear(&lock->_lock.mutex);
+      break;
+    case G_LOCK_RECURSIVE:
+      g_rec_mutex_clear(&lock->_lock.rec_mutex);
+      break;
+    case G_LOCK_RW:
+      if(lock->rw_policy == G_LOCK_RW_POLICY_DEFAULT) {
+        g_rw_lock_clear(&lock->_lock.rw_mutex);
+      } else {
+        _rw_policy_clear(&lock->_lock.policy_rw);
+      }
+      break;
+    case G_LOCK_COHORT:
+      _g_lock_cohort_clear(&lock->_lock.cohort);
+      break;
+    case G_LOCK_SHARED:
+      lock->_lock.shared = NULL;
+      break;
+  };
+  // Clear the stats lock
+  g_cond_clear(&lock->async_cond);
+  g_mutex_clear(&lock->stats_lock);
+
+  // Free the statistics for the lock
+  _clear_lock_stats(lock);
+}
+
+/**
+ * Clear a lock from the pool and give its memory back
+ *
+ * @param data The lock
+ */
+static void _reclaim_lock(gpointer data)
+{
+  GLock *lock = data;
+  GLockManager *manager = lock->manager;
+  _clear_lock(lock);
+  _pool_free(manager, lock);
+  g_atomic_int_add(&manager->retiring, -1);
+}
+
+/**
+ * Free a lock from the pool once no reader can see it anymore
+ *
+ * The lock stops being published and counted in its class right away.
+ *
+ * @param lock The lock, already unlinked from its manager
+ */
+static void _retire_lock(GLock *lock)
+{
+  if(lock->metrics.published) {
+    _g_lock_publish_detach(&lock->metrics);
+  }
+  _clear_lock_class(lock);
+  g_atomic_int_inc(&lock->manager->retiring);
+  _g_lock_epoch_retire(lock, _reclaim_lock);
+}
+
+/**
+ * Cleanup a single lock
+ *
+ * This will remove it from the manager, clear
+ * it from being a lock and free the associated
+ * memory for it.
+ *
+ * @param lock The lock to cleanup
+ */
+void g_lock_free(GLock *lock)
+{
+  if(!lock) {
+    lock_log("No lock provided");
+    return;
+  }
+  if(lock->storage != G_LOCK_STORAGE_POOL) {
+    lock_log("Lock %s was not created with g_lock_create", lock->name);
+    return;
+  }
+  // Remove it from the list
+  _manager_remove_lock(lock);
+  _retire_lock(lock);
+}
+
+/**
+ * Cleanup a lock initialized with g_lock_init
+ *
+ * The memory of the lock is left to the caller.
+ *
+ * @param lock The lock to cleanup
+ */
+void g_lock_clear(GLock *lock)
+{
+  if(!lock) {
+    lock_log("No lock provided");
+    return;
+  }
+  if(lock->storage != G_LOCK_STORAGE_EMBEDDED) {
+    lock_log("Lock %s was not initialized with g_lock_init", lock->name);
+    return;
+  }
+  // Already unregistered if the manager was cleaned up first
+  if(lock->manager) {
+    _manager_remove_lock(lock);
+    lock->manager = NULL;
+  }
+  // The memory goes back to the caller, readers must be done with it
+  _g_lock_epoch_synchronize();
+  _clear_lock(lock);
+}
+
+/**
+ * Cleanup all the locks known to a manager
+ *
+ * @param manager The manager owning the locks
+ */
+void g_lock_free_all_in(GLockManager *manager)
+{
+  GList *link, *retired = NULL, *classes = NULL;
+  GLock *lock;
+  struct g_lock_table *table;
+  _manager_lock(manager);
+  while((link = manager->locks.head)) {
+    _registry_unlink(&manager->locks, link);
+    lock = link->data;
+    if(lock->storage == G_LOCK_STORAGE_EMBEDDED) {
+      // The caller still owns it and clears it with g_lock_clear
+      g_mutex_lock(&lock->stats_lock);
+      _clear_lock_stats(lock);
+      g_mutex_unlock(&lock->stats_lock);
+      _clear_lock_class(lock);
+      lock->manager = NULL;
+      continue;
+    }
+    retired = g_list_prepend(retired, lock);
+  }
+  // Static locks are only unregistered, they stay usable once the
+  // table is registered again. Their next pointer is kept for readers
+  // still walking the tables.
+  while((table = manager->tables)) {
+    g_atomic_pointer_set(&manager->tables, table->next);
+    for(uint32_t ix = 0; ix < table->count; ix++) {
+      g_mutex_lock(&table->locks[ix]->stats_lock);
+      _clear_lock_stats(table->locks[ix]);
+      g_mutex_unlock(&table->locks[ix]->stats_lock);
+    }
+    table->manager = NULL;
+  }
+  while((link = manager->classes.head)) {
+    _registry_unlink(&manager->classes, link);
+    classes = g_list_prepend(classes, link->data);
+  }
+  // Nothing is registered anymore, tables can take their levels again
+  manager->lock_index = 0;
+  _manager_unlock(manager);
+
+  for(link = retired; link; link = link->next) {
+    _retire_lock(link->data);
+  }
+  // Classes go last, once their instances are detached
+  for(link = classes; link; link = link->next) {
+    _retire_class(link->data);
+  }
+  g_list_free(retired);
+  g_list_free(classes);
+}
+
+/**
+ * Cleanup all the locks known to the default manager
+ */
+void g_lock_free_all()
+{
+  g_lock_free_all_in(&_default_manager);
+}
+
+/**
+ * Convert the lock type to be human readable
+ *
+ * @param type The lock type to convert
+ * @return The string representation of the lock.
+ */
+static const char *_lock_type_to_str(enum g_lock_type type)
+{
+  switch(type) {
+    case G_LOCK_MUTEX:
+      return "MUTEX";
+    case G_LOCK_RECURSIVE:
+      return "RECURSIVE";
+    case G_LOCK_RW:
+      return "Read/Write";
+    case G_LOCK_COHORT:
+      return "COHORT";
+    case G_LOCK_SHARED:
+      return "SHARED";
+  }
+  return NULL;
+}
+
+/**
+ * Convert the read/write policy to be human readable
+ *
+ * @param policy The policy to convert
+ * @return The string representation of the policy.
+ */
+static const char *_lock_rw_policy_to_str(enum g_lock_rw_policy policy)
+{
+  switch(policy) {
+    case G_LOCK_RW_POLICY_DEFAULT:
+      return "Default";
+    case G_LOCK_RW_POLICY_READER:
+      return "Reader-preferring";
+    case G_LOCK_RW_POLICY_WRITER:
+      return "Writer-preferring";
+    case G_LOCK_RW_POLICY_PHASE_FAIR:
+      return "Phase-fair";
+  }
+  return NULL;
+}
+
+/**
+ * Print a set of wait time statistics
+ *
+ * @param label What the statistics describe
+ * @param stats The statistics to print
+ */
+static void _print_time_stats(
+  const char *label,
+  struct g_lock_time_stats *stats
+  )
+{
+  if(!stats->count) {
+    return;
+  }
+  printf("%s: count %" PRIu64 " avg %" PRIu64 " us max %" PRIu64 " us\n",
+    label,
+    stats->count,
+    stats->total_us / stats->count,
+    stats->max_us);
+}
+
+/**
+ * Print the lock statistics for a given lock
+ *
+ * @param lock The lock to print the statistics for
+ */
+static void _print_lock_stats(GLock *lock)
+{
+  if(!lock) {
+    printf("No lock provided\n");
+    return;
+  }
+  GList *elem;
+  struct g_lock_caller *caller;
+  struct g_lock_queue_stats queue;
+  uint64_t local, global, requests;
+  int64_t now;
+  time_t wall;
+  printf("=====================================\n");
+  printf("Lock: %s\n", lock->name);
+  printf("Type: %s\n", _lock_type_to_str(lock->type));
+  if(lock->type == G_LOCK_RW) {
+    printf("Policy: %s\n", _lock_rw_policy_to_str(lock->rw_policy));
+  } else if(lock->type == G_LOCK_COHORT) {
+    _g_lock_cohort_handoffs(&lock->_lock.cohort, &local, &global);
+    printf("Nodes: %u - Handoffs within a node: %" PRIu64
+      " - Between nodes: %" PRIu64 "\n",
+      lock->_lock.cohort.node_count, local, global);
+  } else if(lock->type == G_LOCK_SHARED) {
+    _g_lock_shared_print(lock->_lock.shared);
+  }
+
+  g_mutex_lock(&lock->stats_lock);
+  printf("Holding: %d - Waiting: %d\n",
+    lock->stats.holding, lock->stats.waiting);
+  _print_time_stats("Wait", &lock->stats.wait);
+  _print_time_stats("Wait (read)", &lock->stats.read_wait);
+  _print_time_stats("Wait (write)", &lock->stats.write_wait);
+  _print_time_stats("Wait (condition)", &lock->stats.cond_wait);
+  _print_time_stats("Wait (upgrade)", &lock->stats.upgrade_wait);
+  g_mutex_unlock(&lock->stats_lock);
+  if(g_lock_queue_stats(lock, &queue)) {
+    printf("Queue: Average: %.2f - Longest: %d - Convoys: %" PRIu64 "%s\n",
+      queue.avg_waiting, queue.max_waiting, queue.convoys,
+      queue.convoy? " (ongoing)": "");
+  }
+  requests = __atomic_load_n(&lock->combine.requests, __ATOMIC_RELAXED);
+  if(requests) {
+    printf("Executed: %" PRIu64 " - Batches: %" PRIu64
+      " - For other threads: %" PRIu64 " - Largest batch: %" PRIu64 "\n",
+      requests,
+      __atomic_load_n(&lock->combine.batches, __ATOMIC_RELAXED),
+      __atomic_load_n(&lock->combine.combined, __ATOMIC_RELAXED),
+      __atomic_load_n(&lock->combine.max_batch, __ATOMIC_RELAXED));
+  }
+  now = g_get_monotonic_time();
+  wall = time(NULL);
+  g_mutex_lock(&lock->stats_lock);
+  printf("Holders\n");
+  printf("-----------------------------\n");
+  for(elem = lock->stats.holders; elem; elem = elem->next) {
+    caller = elem->data;
+    printf("Caller: %s - %d - Timestamp: %ld - Held for: %" PRId64
+      "us%s\n",
+      caller->callsite->func,
+      caller->callsite->line,
+      (long)(wall - (now - caller->acquired_at) / G_USEC_PER_SEC),
+      now - caller->acquired_at,
+      caller->cond_waiting? " - Waiting on condition": "");
+  }
+  printf("Waiters\n");
+  printf("-----------------------------\n");
+  for(elem = lock->stats.waiters; elem; elem = elem->next) {
+    caller = elem->data;
+    printf("Caller: %s - %d - Timestamp: %ld - Waiting for: %" PRId64
+      "us%s\n",
+      caller->callsite->func,
+      caller->callsite->line,
+      (long)(wall - (now - caller->wait_started_at) / G_USEC_PER_SEC),
+      now - caller->wait_started_at,
+      caller->pending? " - Queued asynchronously": "");
+  }
+  g_mutex_unlock(&lock->stats_lock);
+  printf("=====================================\n");
+}
+
+/**
+ * Print the lock statistics for each lock of a manager
+ *
+ * @param data The lock
+ * @param user_data Unused
+ */
+static void _print_each_lock_stats(gpointer data, gpointer user_data)
+{
+  GLock *lock = data;
+  // Instances are shown through their class
+  if(lock->klass) {
+    return;
+  }
+  _print_lock_stats(lock);
+}
+
+/**
+ * Convert the class rule to be human readable
+ *
+ * @param rule The rule to convert
+ * @return The string representation of the rule.
+ */
+static const char *_lock_class_rule_to_str(enum g_lock_class_rule rule)
+{
+  switch(rule) {
+    case G_LOCK_CLASS_FORBIDDEN:
+      return "Forbidden";
+    case G_LOCK_CLASS_ADDRESS_ORDERED:
+      return "Address ordered";
+    case G_LOCK_CLASS_SUBCLASS:
+      return "Subclass";
+  }
+  return "Unknown";
+}
+
+/**
+ * Print the statistics aggregated over the instances of a class
+ *
+ * @param data The class
+ * @param user_data Unused
+ */
+static void _print_class_stats(gpointer data, gpointer user_data)
+{
+  GLockClass *klass = data;
+  struct g_lock_class_stats *stats = &klass->stats;
+  printf("=====================================\n");
+  printf("Class: %s\n", klass->name);
+  printf("Nesting: %s\n", _lock_class_rule_to_str(klass->rule));
+  printf("Instances: %d\n", g_atomic_int_get(&klass->instances));
+
+  g_mutex_lock(&klass->stats_lock);
+  printf("Acquisitions: %" PRIu64 " Contended: %" PRIu64
+    " Hold: %" PRIu64 " us\n",
+    __atomic_load_n(&stats->acquisitions, __ATOMIC_RELAXED),
+    stats->contended,
+    stats->hold_us);
+  _print_time_stats("Wait", &stats->wait);
+  g_mutex_unlock(&klass->stats_lock);
+  printf("=====================================\n");
+}
+
+/**
+ * Show the statistics for all the locks of a manager
+ *
+ * The registry is walked without a lock, each lock is printed under
+ * its stats lock.
+ *
+ * @param manager The manager owning the locks
+ */
+void g_lock_show_all_in(GLockManager *manager)
+{
+  _g_lock_epoch_enter();
+  _manager_foreach_lock(manager, _print_each_lock_stats, NULL);
+  _registry_foreach(&manager->classes, _print_class_stats, NULL);
+  _g_lock_epoch_exit();
+}
+
+/**
+ * Show the statistics for all the locks
+ */
+void g_lock_show_all()
+{
+  g_lock_show_all_in(&_default_manager);
+}
+
+/**
+ * A call site statistics entry along with its lock
+ */
+struct g_lock_callsite_report {
+  struct g_lock_callsite_stats stats;
+  char *lock_name;
+};
+
+/**
+ * Order call site reports by contention, most contended first
+ */
+static gint _callsite_report_compare(gconstpointer a, gconstpointer b)
+{
+  const struct g_lock_callsite_report *ra =
+    *(struct g_lock_callsite_report **)a;
+  const struct g_lock_callsite_report *rb =
+    *(struct g_lock_callsite_report **)b;
+  if(ra->stats.contended != rb->stats.contended) {
+    return ra->stats.contended < rb->stats.contended? 1: -1;
+  }
+  if(ra->stats.wait_us != rb->stats.wait_us) {
+    return ra->stats.wait_us < rb->stats.wait_us? 1: -1;
+  }
+  return 0;
+}
+
+/**
+ * Free a call site report
+ *
+ * @param data The report to free
+ */
+static void _callsite_report_free(gpointer data)
+{
+  struct g_lock_callsite_report *report = data;
+  free(report->lock_name);
+  free(report);
+}
+
+/**
+ * Copy the call site counters of a lock into reports
+ *
+ * @param data The lock
+ * @param user_data The array of reports to add to
+ */
+static void _collect_callsite_reports(gpointer data, gpointer user_data)
+{
+  GLock *lock = data;
+  GPtrArray *reports = user_data;
+  GHashTableIter iter;
+  gpointer value;
+  struct g_lock_callsite_report *report;
+
+  g_mutex_lock(&lock->stats_lock);
+  if(!lock->stats.callsites) {
+    g_mutex_unlock(&lock->stats_lock);
+    return;
+  }
+  g_hash_table_iter_init(&iter, lock->stats.callsites);
+  while(g_hash_table_iter_next(&iter, NULL, &value)) {
+    report = calloc(1, sizeof(struct g_lock_callsite_report));
+    if(!report) {
+      break;
+    }
+    report->stats = *(struct g_lock_callsite_stats *)value;
+    report->lock_name = strdup(lock->name);
+    g_ptr_array_add(reports, report);
+  }
+  g_mutex_unlock(&lock->stats_lock);
+}
+
+/**
+ * Show the most contended call sites over all locks of a manager
+ *
+ * @param manager The manager owning the locks
+ * @param count How many call sites to show
+ */
+void g_lock_show_top_callsites_in(GLockManager *manager, uint32_t count)
+{
+  struct g_lock_callsite_report *report;
+  struct g_lock_callsite_stats *stats;
+  GPtrArray *reports = g_ptr_array_new_with_free_func(_callsite_report_free);
+
+  // Copy the counters so no stats lock is held while printing
+  _g_lock_epoch_enter();
+  _manager_foreach_lock(manager, _collect_callsite_reports, reports);
+  _g_lock_epoch_exit();
+
+  g_ptr_array_sort(reports, _callsite_report_compare);
+  printf("=====================================\n");
+  printf("Top contended call sites\n");
+  printf("-----------------------------\n");
+  for(guint ix = 0; ix < reports->len && ix < count; ix++) {
+    report = g_ptr_array_index(reports, ix);
+    stats = &report->stats;
+    printf("Lock: %s (%s) - %s - %s:%u\n",
+      report->lock_name,
+      stats->callsite->lock_hint,
+      stats->callsite->func,
+      stats->callsite->file,
+      stats->callsite->line);
+    printf("  Acquisitions: %" PRIu64 " Contended: %" PRIu64
+      " Wait: %" PRIu64 " us Hold: %" PRIu64 " us\n",
+      stats->acquisitions,
+      stats->contended,
+      stats->wait_us,
+      stats->hold_us);
+  }
+  printf("=====================================\n");
+  g_ptr_array_free(reports, TRUE);
+}
+
+/**
+ * Show the most contended call sites over all locks
+ *
+ * @param count How many call sites to show
+ */
+void g_lock_show_top_callsites(uint32_t count)
+{
+  g_lock_show_top_callsites_in(&_default_manager, count);
+}
+
+/**
+ * Log the action for the lock
+ *
+ * @param action What action is being performed
+ * @param lock The lock the action is performed on
+ * @param action_subtype The subtype of action that is being performed.
+ *                       This only applies to read/write locks.
+ */
+static void _lock_log_action(
+  const char *action,
+  GLock *lock,
+  enum g_lock_action action_subtype
+  )
+{
+  char subtype[32];
+  if(!lock->manager->debug) {
+    return;
+  }
+  subtype[0] = '\0';
+  switch(action_subtype) {
+    case G_LOCK_ACTION_READ:
+      g_strlcpy(subtype, " (RW-READ) ", sizeof(subtype));
+      break;
+    case G_LOCK_ACTION_WRITE:
+      g_strlcpy(subtype, " (RW-WRITE) ", sizeof(subtype));
+      break;
+    case G_LOCK_ACTION_UPGRADABLE:
+      g_strlcpy(subtype, " (RW-UPGRADABLE) ", sizeof(subtype));
+      break;
+    default:
+      subtype[0] = '\0';
+      break;
+  }
+  lock_debug(lock->manager, "%s%s: %s", action, subtype, lock->name);
+}
+
+/**
+ * Add the lock to the session
+ *
+ * @param session Lock session object
+ * @param lock The lock being taken
+ */
+bool _g_lock_session_add_lock(
+  GLockSession *session,
+  GLock *lock
+  )
+{
+  if(!session) {
+    lock_log("No session provided");
+    return false;
+  }
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  session->lock_list = g_list_append(session->lock_list, lock);
+  return true;
+}
+
+/**
+ * Whether a lock supports upgradable reads
+ *
+ * GRWLock can't upgrade, so only read/write locks with an explicit
+ * policy can.
+ *
+ * @param lock The lock
+ * @return true if the lock can be taken upgradable
+ */
+static bool _g_lock_upgradable(GLock *lock)
+{
+  return lock->type == G_LOCK_RW &&
+    lock->rw_policy != G_LOCK_RW_POLICY_DEFAULT;
+}
+
+/**
+ * If abort_lock_order is enabled then abort
+ *
+ * @param manager The manager of the lock taken out of order
+ */
+static void _g_lock_abort(GLockManager *manager)
+{
+  if(!manager->allow_wrong_order) {
+    lock_log("CRITICAL: Aborting");
+    abort();
+  }
+}
+
+/**
+ * Check whether an instance can be taken while holding another one
+ * of the same class
+ *
+ * @param klass The class of both instances
+ * @param held The instance already held
+ * @param held_subclass The subclass of the instance already held
+ * @param lock The instance being taken
+ * @param subclass The subclass of the instance being taken
+ * @return true if the class rule allows the nesting
+ */
+static bool _g_lock_class_allows(
+  GLockClass *klass,
+  const void *held,
+  uint32_t held_subclass,
+  const void *lock,
+  uint32_t subclass
+  )
+{
+  switch(klass->rule) {
+    case G_LOCK_CLASS_ADDRESS_ORDERED:
+      return (uintptr_t)held < (uintptr_t)lock;
+    case G_LOCK_CLASS_SUBCLASS:
+      return held_subclass < subclass;
+    case G_LOCK_CLASS_FORBIDDEN:
+    default:
+      break;
+  }
+  return false;
+}
+
+/**
+ * Check if a lock is valid within a session
+ *
+ * @param session The session to check
+ * @param lock The lock that the caller wants to take
+ * @param action The action the caller is taking
+ * @param callsite Where the lock is being taken
+ * @return If all is ok then return true otherwise false
+ */
+bool _g_lock_session_check_lock(
+  GLockSession *session,
+  GLock *lock,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite
+  )
+{
+  GList *tmpl = NULL;
+  GLock *cur;
+  GLockClass *held;
+  GLockCompact *compact;
+  bool test_same = true;
+
+  if(!session || !lock) {
+    return false;
+  }
+  if(!lock->manager) {
+    lock_log("Lock %s is not registered with a manager", lock->name);
+    return false;
+  }
+  if(action == G_LOCK_ACTION_UPGRADABLE && !_g_lock_upgradable(lock)) {
+    lock_log("Lock %s can't be taken upgradable", lock->name);
+    return false;
+  }
+
+  switch(lock->type) {
+    case G_LOCK_RECURSIVE:
+      test_same = false;
+    default:
+      break;
+  };
+
+
+  for(tmpl = session->lock_list; tmpl; tmpl = tmpl->next) {
+    cur = tmpl->data;
+    // Locks of different managers are not ordered
+    if(cur->manager != lock->manager) {
+      continue;
+    }
+    if(test_same) {
+      if(lock == cur) {
+        lock_log(
+          "CRITICAL: [LOCK ORDER] "
+          "Attempting to take lock index %u (%s) which has already "
+          "been taken in this session.",
+          lock->index, lock->name);
+        G_LOCK_PROBE_ORDER_VIOLATION(lock->index, lock->name,
+          cur->index, cur->name, callsite);
+        _g_lock_abort(lock->manager);
+        return false;
+      }
+    }
+    // Check if the lock was taken out of order
+    if(lock->index < cur->index) {
+      lock_log(
+        "CRITICAL: [LOCK_ORDER] "
+        "Attempting to take lock index %u (%s) which is less "
+        "then already taken lock index %u (%s).",
+        lock->index, lock->name,
+        cur->index, cur->name);
+      G_LOCK_PROBE_ORDER_VIOLATION(lock->index, lock->name,
+        cur->index, cur->name, callsite);
+      _g_lock_abort(lock->manager);
+      return false;
+    }
+    // Instances of one class are ordered by the class rule
+    if(lock->klass && lock->klass == cur->klass && lock != cur &&
+       !_g_lock_class_allows(lock->klass, cur, cur->subclass,
+         lock, lock->subclass)) {
+      lock_log(
+        "CRITICAL: [LOCK_ORDER] "
+        "Attempting to take %s instance %p (subclass %u) while holding "
+        "instance %p (subclass %u) which is not allowed by the %s rule.",
+        lock->name, lock, lock->subclass,
+        cur, cur->subclass,
+        _lock_class_rule_to_str(lock->klass->rule));
+      G_LOCK_PROBE_ORDER_VIOLATION(lock->index, lock->name,
+        cur->index, cur->name, callsite);
+      _g_lock_abort(lock->manager);
+      return false;
+    }
+  }
+  for(uint32_t ix = session->compact_count; ix-- > 0;) {
+    compact = session->compact_locks[ix];
+    held = _g_lock_compact_class(compact);
+    if(held->manager != lock->manager) {
+      continue;
+    }
+    if(lock->index < held->index ||
+       (lock->klass == held &&
+        !_g_lock_class_allows(held, compact, 0, lock, lock->subclass))) {
+      lock_log(
+        "CRITICAL: [LOCK_ORDER] "
+        "Attempting to take lock index %u (%s) while holding "
+        "compact lock %p of index %u (%s).",
+        lock->index, lock->name,
+        compact, held->index, held->name);
+      G_LOCK_PROBE_ORDER_VIOLATION(lock->index, lock->name,
+        held->index, held->name, callsite);
+      _g_lock_abort(lock->manager);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Check if a compact lock is valid within a session
+ *
+ * @param session The session to check
+ * @param lock The compact lock that the caller wants to take
+ * @return If all is ok then return true otherwise false
+ */
+bool _g_lock_session_check_compact(GLockSession *session, GLockCompact *lock)
+{
+  GList *tmpl;
+  GLock *cur;
+  GLockClass *held;
+  GLockCompact *compact;
+  GLockClass *klass = _g_lock_compact_class(lock);
 
   for(tmpl = session->lock_list; tmpl; tmpl = tmpl->next) {
-    cur_index = GPOINTER_TO_INT(tmpl->data);
-    if(test_same) {
-      if(lock->index == cur_index) {
-        lock_name = g_lock_name_by_index(cur_index);
-        lock_log(
-          "CRITICAL: [LOCK ORDER] "
-          "Attempting to take lock index %u (%s) which has already "
-          "been taken in this session.",
-          lock->index, lock->name);
-        if(lock_name) {
-          free(lock_name);
-        }
-        _g_lock_abort();
-        return false;
-      }
+    cur = tmpl->data;
+    if(cur->manager != klass->manager) {
+      continue;
     }
-    // Check if the lock was taken out of order
-    if(lock->index < cur_index) {
-      lock_name = g_lock_name_by_index(cur_index);
+    if(klass->index < cur->index ||
+       (cur->klass == klass &&
+        !_g_lock_class_allows(klass, cur, cur->subclass, lock, 0))) {
       lock_log(
         "CRITICAL: [LOCK_ORDER] "
-        "Attempting to take lock index %u (%s) which is less "
-        "then already taken lock index %u (%s).",
-        lock->index, lock->name,
-        cur_index, lock_name);
-      if(lock_name) {
-        free(lock_name);
-      }
-      _g_lock_abort();
+        "Attempting to take compact lock %p of index %u (%s) while "
+        "holding lock index %u (%s).",
+        lock, klass->index, klass->name,
+        cur->index, cur->name);
+      G_LOCK_PROBE_ORDER_VIOLATION(klass->index, klass->name,
+        cur->index, cur->name, G_LOCK_PROBE_NO_CALLSITE);
+      _g_lock_abort(klass->manager);
+      return false;
+    }
+  }
+  for(uint32_t ix = session->compact_count; ix-- > 0;) {
+    compact = session->compact_locks[ix];
+    held = _g_lock_compact_class(compact);
+    if(held->manager != klass->manager) {
+      continue;
+    }
+    if(compact == lock) {
+      lock_log(
+        "CRITICAL: [LOCK ORDER] "
+        "Attempting to take compact lock %p (%s) which has already "
+        "been taken in this session.",
+        lock, klass->name);
+      G_LOCK_PROBE_ORDER_VIOLATION(klass->index, klass->name,
+        klass->index, klass->name, G_LOCK_PROBE_NO_CALLSITE);
+      _g_lock_abort(klass->manager);
+      return false;
+    }
+    if(klass->index < held->index ||
+       (held == klass &&
+        !_g_lock_class_allows(klass, compact, 0, lock, 0))) {
+      lock_log(
+        "CRITICAL: [LOCK_ORDER] "
+        "Attempting to take compact lock %p of index %u (%s) while "
+        "holding compact lock %p of index %u (%s).",
+        lock, klass->index, klass->name,
+        compact, held->index, held->name);
+      G_LOCK_PROBE_ORDER_VIOLATION(klass->index, klass->name,
+        held->index, held->name, G_LOCK_PROBE_NO_CALLSITE);
+      _g_lock_abort(klass->manager);
       return false;
     }
   }
   return true;
 }
 
+/**
+ * Block until the lock is taken for the given action
+ *
+ * @param lock The lock to take
+ * @param action The action to perform (for read/write locks)
+ */
+void _g_lock_acquire(GLock *lock, enum g_lock_action action)
+{
+  switch(lock->type) {
+    case G_LOCK_MUTEX:
+      g_mutex_lock(&lock->_lock.mutex);
+      break;
+    case G_LOCK_RECURSIVE:
+      g_rec_mutex_lock(&lock->_lock.rec_mutex);
+      break;
+    case G_LOCK_RW:
+      if(lock->rw_policy != G_LOCK_RW_POLICY_DEFAULT) {
+        if(action == G_LOCK_ACTION_READ) {
+          _rw_policy_reader_lock(&lock->_lock.policy_rw, lock->rw_policy);
+        } else if(action == G_LOCK_ACTION_UPGRADABLE) {
+          _rw_policy_upgrader_lock(&lock->_lock.policy_rw, lock->rw_policy);
+        } else {
+          _rw_policy_writer_lock(&lock->_lock.policy_rw, lock->rw_policy);
+        }
+      } else if(action == G_LOCK_ACTION_READ) {
+        g_rw_lock_reader_lock(&lock->_lock.rw_mutex);
+      } else {
+        g_rw_lock_writer_lock(&lock->_lock.rw_mutex);
+      }
+      break;
+    case G_LOCK_COHORT:
+      _g_lock_cohort_lock(&lock->_lock.cohort);
+      break;
+    case G_LOCK_SHARED:
+      _g_lock_shared_lock(lock->_lock.shared);
+      break;
+  };
+}
+
+/**
+ * Take the lock for the given action without blocking
+ *
+ * @param lock The lock to take
+ * @param action The action to perform (for read/write locks)
+ * @return true if the lock was taken
+ */
+bool _g_lock_try_acquire(GLock *lock, enum g_lock_action action)
+{
+  switch(lock->type) {
+    case G_LOCK_MUTEX:
+      return g_mutex_trylock(&lock->_lock.mutex);
+    case G_LOCK_RECURSIVE:
+      return g_rec_mutex_trylock(&lock->_lock.rec_mutex);
+    case G_LOCK_RW:
+      if(lock->rw_policy != G_LOCK_RW_POLICY_DEFAULT) {
+        if(action == G_LOCK_ACTION_READ) {
+          return _rw_policy_reader_trylock(
+            &lock->_lock.policy_rw, lock->rw_policy);
+        } else if(action == G_LOCK_ACTION_UPGRADABLE) {
+          return _rw_policy_upgrader_trylock(
+            &lock->_lock.policy_rw, lock->rw_policy);
+        }
+        return _rw_policy_writer_trylock(
+          &lock->_lock.policy_rw, lock->rw_policy);
+      } else if(action == G_LOCK_ACTION_READ) {
+        return g_rw_lock_reader_trylock(&lock->_lock.rw_mutex);
+      }
+      return g_rw_lock_writer_trylock(&lock->_lock.rw_mutex);
+    case G_LOCK_COHORT:
+      return _g_lock_cohort_trylock(&lock->_lock.cohort);
+    case G_LOCK_SHARED:
+      return _g_lock_shared_trylock(lock->_lock.shared);
+  };
+  return false;
+}
+
+/**
+ * Release the lock for the given action
+ *
+ * @param lock The lock to release
+ * @param action The action that was performed (for read/write locks)
+ */
+static void _g_lock_release(GLock *lock, enum g_lock_action action)
+{
+  switch(lock->type) {
+    case G_LOCK_MUTEX:
+      g_mutex_unlock(&lock->_lock.mutex);
+      break;
+    case G_LOCK_RECURSIVE:
+      g_rec_mutex_unlock(&lock->_lock.rec_mutex);
+      break;
+    case G_LOCK_RW:
+      if(lock->rw_policy != G_LOCK_RW_POLICY_DEFAULT) {
+        if(action == G_LOCK_ACTION_READ) {
+          _rw_policy_reader_unlock(&lock->_lock.policy_rw);
+        } else if(action == G_LOCK_ACTION_UPGRADABLE) {
+          _rw_policy_upgrader_unlock(&lock->_lock.policy_rw);
+        } else {
+          _rw_policy_writer_unlock(&lock->_lock.policy_rw, lock->rw_policy);
+        }
+      } else if(action == G_LOCK_ACTION_READ) {
+        g_rw_lock_reader_unlock(&lock->_lock.rw_mutex);
+      } else {
+        g_rw_lock_writer_unlock(&lock->_lock.rw_mutex);
+      }
+      break;
+    case G_LOCK_COHORT:
+      _g_lock_cohort_unlock(&lock->_lock.cohort);
+      break;
+    case G_LOCK_SHARED:
+      _g_lock_shared_unlock(lock->_lock.shared);
+      break;
+  };
+}
+
+/**
+ * Get the wait statistics that match an action
+ *
+ * @param lock The lock owning the statistics
+ * @param action The action that was performed
+ * @return The statistics to update
+ */
+static struct g_lock_time_stats *_g_lock_wait_stats(
+  GLock *lock,
+  enum g_lock_action action
+  )
+{
+  switch(action) {
+    case G_LOCK_ACTION_READ:
+    case G_LOCK_ACTION_UPGRADABLE:
+      return &lock->stats.read_wait;
+    case G_LOCK_ACTION_WRITE:
+      return &lock->stats.write_wait;
+    default:
+      break;
+  }
+  return &lock->stats.wait;
+}
+
+/**
+ * Add a sample to a set of time statistics
+ *
+ * The caller must hold the lock protecting the statistics.
+ *
+ * @param stats The statistics to update
+ * @param us The sample in microseconds
+ */
+void _g_lock_time_stats_add(
+  struct g_lock_time_stats *stats,
+  int64_t us
+  )
+{
+  if(us < 0) {
+    us = 0;
+  }
+  stats->count++;
+  stats->total_us += us;
+  if((uint64_t)us > stats->max_us) {
+    stats->max_us = us;
+  }
+}
+
+/**
+ * Create the caller record for an acquisition
+ *
+ * @param session The session taking the lock
+ * @param action The action to perform (for read/write locks)
+ * @param callsite Where the lock is being taken
+ * @return New caller record or NULL if we are out of memory
+ */
+struct g_lock_caller *_g_lock_caller_new(
+  GLockSession *session,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite
+  )
+{
+  struct g_lock_caller *caller = calloc(1, sizeof(struct g_lock_caller));
+  if(!caller) {
+    lock_log("Failed to create caller");
+    return NULL;
+  }
+  caller->callsite = callsite;
+  caller->session = session;
+  caller->action = action;
+  return caller;
+}
+
+/**
+ * Add a caller record to the waiters of a lock
+ *
+ * The caller starts waiting now.
+ *
+ * @param lock The lock being waited on
+ * @param caller The caller record
+ */
+void _g_lock_stats_add_waiter(GLock *lock, struct g_lock_caller *caller)
+{
+  caller->wait_started_at = g_get_monotonic_time();
+  g_mutex_lock(&lock->stats_lock);
+  _g_lock_queue_change(lock, caller->wait_started_at, 1);
+  lock->stats.waiters = g_list_append(lock->stats.waiters, caller);
+  g_mutex_unlock(&lock->stats_lock);
+}
+
+/**
+ * Add a caller record to the holders of a lock
+ *
+ * @param lock The lock taken
+ * @param caller The caller record
+ */
+void _g_lock_stats_add_holder(GLock *lock, struct g_lock_caller *caller)
+{
+  g_mutex_lock(&lock->stats_lock);
+  lock->stats.holding++;
+  lock->stats.holders = g_list_append(lock->stats.holders, caller);
+  g_mutex_unlock(&lock->stats_lock);
+}
+
+/**
+ * Move a caller record from the waiters to the holders of a lock
+ *
+ * @param lock The lock taken
+ * @param caller The caller record, acquired_at is set
+ */
+void _g_lock_stats_acquired(GLock *lock, struct g_lock_caller *caller)
+{
+  g_mutex_lock(&lock->stats_lock);
+  _g_lock_queue_change(lock, caller->acquired_at, -1);
+  lock->stats.waiters = g_list_remove(lock->stats.waiters, caller);
+  lock->stats.holding++;
+  lock->stats.holders = g_list_append(lock->stats.holders, caller);
+  g_mutex_unlock(&lock->stats_lock);
+}
+
+/**
+ * Drop a waiter record that never got the lock
+ *
+ * The record is freed and no wait statistics are recorded.
+ *
+ * @param lock The lock that was waited on
+ * @param caller The caller record
+ */
+void _g_lock_stats_drop_waiter(GLock *lock, struct g_lock_caller *caller)
+{
+  g_mutex_lock(&lock->stats_lock);
+  _g_lock_queue_change(lock, g_get_monotonic_time(), -1);
+  lock->stats.waiters = g_list_remove(lock->stats.waiters, caller);
+  g_mutex_unlock(&lock->stats_lock);
+  _g_lock_caller_free(caller);
+}
+
 /**
  * Start a new session for the lock
  *
  * @param session The lock session
  * @param lock The lock to create the session for
  * @param action The action to perform (for read/write locks)
- * @param caller_func The caller's function name
- * @param caller_line The caller's line number
+ * @param callsite Where the lock is being taken
  * @return On success true is returned otherwise false.
  */
 bool _g_lock_start(
   GLockSession *session,
   GLock *lock,
   enum g_lock_action action,
-  const char *caller_func,
-  uint32_t caller_line
+  const struct g_lock_callsite *callsite
+  )
+{
+  if(!session) {
+    lock_log("No session provided");
+    return false;
+  }
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  struct g_lock_caller *caller = _g_lock_caller_new(
+    session, action, callsite);
+  if(!caller) {
+    return false;
+  }
+
+  // Check if we're taking a lock out of order
+  if(!_g_lock_session_check_lock(session, lock, action, callsite)) {
+    _g_lock_caller_free(caller);
+    return false;
+  }
+
+  // Update our session information with this lock
+  _g_lock_session_add_lock(session, lock);
+
+  // Perform the lock based on the action
+  _lock_log_action("LOCKING", lock, action);
+  if(G_UNLIKELY(g_atomic_int_get(&lock->async_starving))) {
+    _g_lock_async_yield(lock);
+  }
+  if(!_g_lock_try_acquire(lock, action)) {
+    caller->contended = true;
+    G_LOCK_PROBE_WAIT(lock, action, callsite);
+    _g_lock_stats_add_waiter(lock, caller);
+    if(G_UNLIKELY(lock->manager->tracing)) {
+      _g_lock_trace_add(lock, G_LOCK_TRACE_WAIT, action, callsite,
+        caller->wait_started_at);
+    }
+    if(G_UNLIKELY(lock->manager->deadlock_detection)) {
+      _g_lock_deadlock_wait(lock, action, caller);
+    } else {
+      _g_lock_acquire(lock, action);
+    }
+    caller->acquired_at = g_get_monotonic_time();
+    caller->wait_us = caller->acquired_at - caller->wait_started_at;
+    _g_lock_stats_acquired(lock, caller);
+    if(G_UNLIKELY(lock->manager->thread_accounting)) {
+      _g_lock_thread_waited(caller->wait_us);
+    }
+  } else {
+    caller->acquired_at = g_get_monotonic_time();
+    _g_lock_stats_add_holder(lock, caller);
+  }
+  if(G_UNLIKELY(lock->manager->metrics_collecting)) {
+    _g_lock_metrics_taken(lock, caller);
+  }
+  G_LOCK_PROBE_ACQUIRED(lock, action, callsite, caller->wait_us);
+  if(G_UNLIKELY(lock->hold_budget_us || lock->wait_budget_us)) {
+    _g_lock_budget_acquired(lock, caller);
+  }
+  if(G_UNLIKELY(lock->manager->tracing)) {
+    _g_lock_trace_add(lock, G_LOCK_TRACE_ACQUIRED, action, callsite,
+      caller->acquired_at);
+  }
+  _lock_log_action("LOCKED", lock, action);
+  return true;
+}
+
+/**
+ * Take a lock only if it is available right away
+ *
+ * Nothing is recorded in the session or the lock statistics
+ * when the lock could not be taken.
+ *
+ * @param session The lock session
+ * @param lock The lock to take
+ * @param action The action to perform (for read/write locks)
+ * @param callsite Where the lock is being taken
+ * @return true if the lock was taken otherwise false.
+ */
+bool _g_lock_try_start(
+  GLockSession *session,
+  GLock *lock,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite
   )
 {
   if(!session) {
@@ -506,60 +2657,174 @@ bool _g_lock_start(
     lock_log("No lock provided");
     return false;
   }
-  struct g_lock_caller *caller = calloc(1, sizeof(struct g_lock_caller));
-  if(!caller) {
-    lock_log("Failed to create caller");
-    return false;
+
+  // Check if we're taking a lock out of order
+  if(!_g_lock_session_check_lock(session, lock, action, callsite)) {
+    return false;
+  }
+  return _g_lock_try_take(session, lock, action, callsite);
+}
+
+/**
+ * Take a lock already checked against the session if it is available
+ *
+ * @param session The lock session
+ * @param lock The lock to take
+ * @param action The action to perform (for read/write locks)
+ * @param callsite Where the lock is being taken
+ * @return true if the lock was taken otherwise false.
+ */
+bool _g_lock_try_take(
+  GLockSession *session,
+  GLock *lock,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite
+  )
+{
+  if(!_g_lock_try_acquire(lock, action)) {
+    return false;
+  }
+  struct g_lock_caller *caller = _g_lock_caller_new(
+    session, action, callsite);
+  if(!caller) {
+    _g_lock_release(lock, action);
+    return false;
+  }
+  caller->acquired_at = g_get_monotonic_time();
+  if(G_UNLIKELY(lock->manager->metrics_collecting)) {
+    _g_lock_metrics_taken(lock, caller);
+  }
+  G_LOCK_PROBE_ACQUIRED(lock, action, callsite, 0);
+  if(G_UNLIKELY(lock->manager->tracing)) {
+    _g_lock_trace_add(lock, G_LOCK_TRACE_ACQUIRED, action, callsite,
+      caller->acquired_at);
+  }
+  _g_lock_stats_add_holder(lock, caller);
+  if(G_UNLIKELY(lock->hold_budget_us)) {
+    _g_lock_budget_acquired(lock, caller);
+  }
+  _g_lock_session_add_lock(session, lock);
+  _lock_log_action("LOCKED", lock, action);
+  return true;
+}
+
+/**
+ * Time a lock was held by a caller, not counting condition waits
+ *
+ * @param caller The caller record of the acquisition
+ * @param now Monotonic time of the release
+ * @return The hold time in microseconds
+ */
+static int64_t _g_lock_caller_hold_us(
+  struct g_lock_caller *caller,
+  int64_t now
+  )
+{
+  return now - caller->acquired_at - caller->cond_wait_us;
+}
+
+/**
+ * Find or create the counters of a call site taking a lock
+ *
+ * The caller must hold the stats lock of the GLock.
+ *
+ * @param lock The lock being taken
+ * @param callsite Where the lock is taken
+ * @return The counters or NULL on error
+ */
+struct g_lock_callsite_stats *_g_lock_callsite_stats_get(
+  GLock *lock,
+  const struct g_lock_callsite *callsite
+  )
+{
+  struct g_lock_callsite_stats *site;
+  // Created on first use since static locks start without it
+  if(!lock->stats.callsites) {
+    lock->stats.callsites = g_hash_table_new_full(
+      g_direct_hash, g_direct_equal, NULL, _g_lock_callsite_stats_free);
+  }
+  site = g_hash_table_lookup(lock->stats.callsites, callsite);
+  if(!site) {
+    site = calloc(1, sizeof(struct g_lock_callsite_stats));
+    if(!site) {
+      lock_log("Failed to create call site statistics");
+      return NULL;
+    }
+    site->callsite = callsite;
+    g_hash_table_insert(lock->stats.callsites, (gpointer)callsite, site);
+  }
+  return site;
+}
+
+/**
+ * Account a finished acquisition to its call site
+ *
+ * The caller must hold the stats lock of the GLock.
+ *
+ * @param lock The lock that is being released
+ * @param caller The caller record of the acquisition
+ * @param hold_us How long the lock was held
+ * @return The counters of the call site or NULL on error
+ */
+static struct g_lock_callsite_stats *_g_lock_callsite_stats_add(
+  GLock *lock,
+  struct g_lock_caller *caller,
+  int64_t hold_us
+  )
+{
+  struct g_lock_callsite_stats *site = _g_lock_callsite_stats_get(
+    lock, caller->callsite);
+  if(!site) {
+    return NULL;
+  }
+  site->acquisitions++;
+  if(caller->contended) {
+    site->contended++;
   }
-  caller->caller = strdup(caller_func);
-  caller->line = caller_line;
-  caller->timestamp = time(NULL);
-  caller->session = session;
+  site->wait_us += caller->wait_us > 0? caller->wait_us: 0;
+  site->hold_us += hold_us > 0? hold_us: 0;
+  return site;
+}
 
-  // Check if we're taking a lock out of order
-  if(!_g_lock_session_check_lock(session, lock, action)) {
-    return false;
+/**
+ * Add a completed acquisition to the statistics of the lock's class
+ *
+ * @param klass The class of the lock being released
+ * @param caller The caller record of the acquisition
+ * @param hold_us How long the lock was held
+ */
+static void _g_lock_class_stats_add(
+  GLockClass *klass,
+  struct g_lock_caller *caller,
+  int64_t hold_us
+  )
+{
+  g_mutex_lock(&klass->stats_lock);
+  // Compact instances count theirs without the stats lock
+  __atomic_fetch_add(&klass->stats.acquisitions, 1, __ATOMIC_RELAXED);
+  if(caller->contended) {
+    klass->stats.contended++;
+  }
+  _g_lock_time_stats_add(&klass->stats.wait, caller->wait_us);
+  klass->stats.hold_us += hold_us > 0? hold_us: 0;
+  g_mutex_unlock(&klass->stats_lock);
+  if(G_UNLIKELY(klass->manager->metrics_collecting)) {
+    _g_lock_metrics_add(&klass->metrics, caller->wait_us, hold_us,
+      caller->contended);
   }
-
-  // Update the statistics for the lock
-  g_mutex_lock(&lock->stats_lock);
-  lock->stats.count++;
-  lock->stats.call_list = g_list_append(lock->stats.call_list, caller);
-  g_mutex_unlock(&lock->stats_lock);
-
-  // Update our session information with this lock
-  g_lock_session_add_lock(session, lock);
-
-  // Perform the lock based on the action
-  _lock_log_action("LOCKING", lock->name, action);
-  switch(lock->type) {
-    case G_LOCK_MUTEX:
-      g_mutex_lock(&lock->_lock.mutex);
-      break;
-    case G_LOCK_RECURSIVE:
-      g_rec_mutex_lock(&lock->_lock.rec_mutex);
-      break;
-    case G_LOCK_RW:
-      if(action == G_LOCK_ACTION_READ) {
-        g_rw_lock_reader_lock(&lock->_lock.rw_mutex);
-      } else {
-        g_rw_lock_writer_lock(&lock->_lock.rw_mutex);
-      }
-      break;
-  };
-  _lock_log_action("LOCKED", lock->name, action);
-  return true;
 }
 
 /**
- * Search for a caller to remove from the lock's caller list
+ * Search for a caller to remove from the lock's holders
  *
  * @param session The current caller's session
  * @param lock The lock that is being unlocked
+ * @param now Monotonic time of the release
  */
 static void _g_lock_remove_caller(
   GLockSession *session,
-  GLock *lock
+  GLock *lock,
+  int64_t now
   )
 {
   if(!session) {
@@ -570,21 +2835,49 @@ static void _g_lock_remove_caller(
     lock_log("lock is NULL");
     return;
   }
-  if(lock->stats.call_list == NULL) {
+  if(lock->stats.holders == NULL) {
     return;
   }
 
   GList *tmpl = NULL;
   struct g_lock_caller *callerp = NULL;
-  for(tmpl = lock->stats.call_list; tmpl; tmpl = tmpl->next) {
+  struct g_lock_callsite_stats *site = NULL;
+  int64_t hold_us;
+  for(tmpl = lock->stats.holders; tmpl; tmpl = tmpl->next) {
     callerp = tmpl->data;
     if(callerp->session == session) {
-      lock_debug("Found matching caller. %p == %p",
+      lock_debug(lock->manager, "Found matching caller. %p == %p",
           session,
           callerp->session);
-      _lock_free_caller(tmpl->data);
-      lock->stats.call_list = g_list_delete_link(
-        lock->stats.call_list, tmpl);
+      _g_lock_time_stats_add(
+        _g_lock_wait_stats(lock, callerp->action),
+        callerp->wait_us);
+      hold_us = _g_lock_caller_hold_us(callerp, now);
+      // Only worth a hash lookup when someone reads the call sites
+      if(G_UNLIKELY(lock->manager->metrics_collecting ||
+                    lock->hold_budget_us)) {
+        site = _g_lock_callsite_stats_add(lock, callerp, hold_us);
+      }
+      if(G_UNLIKELY(lock->hold_budget_us) && site) {
+        _g_lock_budget_released(lock, site, callerp, hold_us);
+      }
+      if(G_UNLIKELY(lock->manager->metrics_collecting)) {
+        _g_lock_metrics_add(&lock->metrics, callerp->wait_us, hold_us,
+          callerp->contended);
+      }
+      if(G_UNLIKELY(callerp->metered)) {
+        _g_lock_metrics_holders(lock, -1);
+      }
+      _g_lock_queue_released(lock, now, hold_us);
+      if(G_UNLIKELY(lock->manager->thread_accounting)) {
+        _g_lock_thread_released(callerp, hold_us);
+      }
+      if(lock->klass) {
+        _g_lock_class_stats_add(lock->klass, callerp, hold_us);
+      }
+      _g_lock_caller_free(tmpl->data);
+      lock->stats.holding--;
+      lock->stats.holders = g_list_delete_link(lock->stats.holders, tmpl);
       return;
     }
   }
@@ -597,15 +2890,13 @@ static void _g_lock_remove_caller(
  * @param session The lock session
  * @param lock The lock in question
  * @param action The action to perform (for read/write locks)
- * @param caller_func The caller's function
- * @param caller_line The caller's line number
+ * @param callsite Where the lock is being released
  */
 void _g_lock_end(
   GLockSession *session,
   GLock *lock,
   enum g_lock_action action,
-  const char *caller_func,
-  uint32_t caller_line
+  const struct g_lock_callsite *callsite
   )
 {
   if(!session) {
@@ -617,39 +2908,388 @@ void _g_lock_end(
     return;
   }
 
+  // One clock read serves all the accounting of the release
+  int64_t now = g_get_monotonic_time();
+
   // Update the statistics for the lock
   g_mutex_lock(&lock->stats_lock);
 
-  lock->stats.count--;
-  _g_lock_remove_caller(session, lock);
+  _g_lock_remove_caller(session, lock, now);
 
   g_mutex_unlock(&lock->stats_lock);
 
-  _lock_log_action("UNLOCKING", lock->name, action);
+  _lock_log_action("UNLOCKING", lock, action);
+  G_LOCK_PROBE_RELEASE(lock, action, callsite);
 
-  // Perform the lock based on the action
-  switch(lock->type) {
-    case G_LOCK_MUTEX:
-      g_mutex_unlock(&lock->_lock.mutex);
-      break;
-    case G_LOCK_RECURSIVE:
-      g_rec_mutex_unlock(&lock->_lock.rec_mutex);
-      break;
-    case G_LOCK_RW:
-      if(action == G_LOCK_ACTION_READ) {
-        g_rw_lock_reader_unlock(&lock->_lock.rw_mutex);
-      } else {
-        g_rw_lock_writer_unlock(&lock->_lock.rw_mutex);
-      }
-      break;
-  };
+  // Perform the unlock based on the action
+  _g_lock_release(lock, action);
+  if(G_UNLIKELY(lock->manager->tracing)) {
+    _g_lock_trace_add(lock, G_LOCK_TRACE_RELEASED, action, callsite, now);
+  }
+
+  // Give queued asynchronous requests a chance at the lock
+  if(g_atomic_pointer_get(&lock->async_waiters)) {
+    _g_lock_async_wake(lock);
+  }
+  if(g_atomic_pointer_get(&lock->task_waiters)) {
+    _g_lock_executor_wake(lock);
+  }
 
   // Pop the last lock from the session object
-  session->lock_list = g_list_remove_link(
+  session->lock_list = g_list_delete_link(
     session->lock_list,
     g_list_last(session->lock_list));
 
-  _lock_log_action("UNLOCKED", lock->name, action);
+  _lock_log_action("UNLOCKED", lock, action);
+}
+
+/**
+ * Find the record of the caller holding a lock in a session
+ *
+ * The caller must hold the stats lock of the GLock.
+ *
+ * @param lock The lock to look in
+ * @param session The session holding the lock
+ * @return The caller record or NULL if the session does not hold it
+ */
+static struct g_lock_caller *_g_lock_find_caller(
+  GLock *lock,
+  GLockSession *session
+  )
+{
+  GList *tmpl;
+  struct g_lock_caller *caller;
+  for(tmpl = lock->stats.holders; tmpl; tmpl = tmpl->next) {
+    caller = tmpl->data;
+    if(caller->session == session) {
+      return caller;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Wait on a condition with a mutex lock held by the session
+ *
+ * The caller record stays in place while waiting but is flagged as
+ * waiting on the condition since the mutex is released meanwhile.
+ * Time spent on the condition is recorded apart from lock wait time
+ * and is not counted as hold time. Asynchronous requests queued on
+ * the lock are not woken by the wait releasing the mutex.
+ *
+ * @param session The lock session holding the lock
+ * @param lock The mutex lock protecting the condition
+ * @param cond The condition to wait on
+ * @param end_time Monotonic time to give up at or G_LOCK_WAIT_FOREVER
+ * @param callsite Where the wait happens
+ * @return true if woken up, false on timeout or error
+ */
+bool _g_lock_wait(
+  GLockSession *session,
+  GLock *lock,
+  GCond *cond,
+  int64_t end_time,
+  const struct g_lock_callsite *callsite
+  )
+{
+  struct g_lock_caller *caller;
+  int64_t start, waited;
+  bool signalled = true;
+  if(!session) {
+    lock_log("No session provided");
+    return false;
+  }
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  if(!cond) {
+    lock_log("No condition provided");
+    return false;
+  }
+  if(lock->type != G_LOCK_MUTEX) {
+    lock_log("Lock %s is not a mutex, can't wait on a condition", lock->name);
+    return false;
+  }
+
+  g_mutex_lock(&lock->stats_lock);
+  caller = _g_lock_find_caller(lock, session);
+  if(caller) {
+    caller->cond_waiting = true;
+  }
+  g_mutex_unlock(&lock->stats_lock);
+  if(!caller) {
+    lock_log("Lock %s is not held by session %p", lock->name, session);
+    return false;
+  }
+
+  _lock_log_action("WAITING", lock, G_LOCK_ACTION_BASIC);
+  start = g_get_monotonic_time();
+  if(G_UNLIKELY(lock->manager->tracing)) {
+    // The mutex is let go for the duration of the wait
+    _g_lock_trace_add(lock, G_LOCK_TRACE_RELEASED, G_LOCK_ACTION_BASIC,
+      callsite, start);
+  }
+  if(end_time == G_LOCK_WAIT_FOREVER) {
+    g_cond_wait(cond, &lock->_lock.mutex);
+  } else {
+    signalled = g_cond_wait_until(cond, &lock->_lock.mutex, end_time);
+  }
+  waited = g_get_monotonic_time() - start;
+  if(G_UNLIKELY(lock->manager->tracing)) {
+    _g_lock_trace_add(lock, G_LOCK_TRACE_ACQUIRED, G_LOCK_ACTION_BASIC,
+      callsite, start + waited);
+  }
+
+  g_mutex_lock(&lock->stats_lock);
+  caller->cond_waiting = false;
+  caller->cond_wait_us += waited;
+  _g_lock_time_stats_add(&lock->stats.cond_wait, waited);
+  g_mutex_unlock(&lock->stats_lock);
+  if(G_UNLIKELY(lock->manager->thread_accounting)) {
+    _g_lock_thread_cond_waited(waited);
+  }
+  _lock_log_action(signalled? "WOKEN": "TIMED OUT", lock,
+    G_LOCK_ACTION_BASIC);
+  return signalled;
+}
+
+/**
+ * Find the caller record of a session holding a lock with an action
+ *
+ * @param session The lock session
+ * @param lock The lock held
+ * @param what What the caller is about to do, for the error message
+ * @param first One of the actions expected
+ * @param second The other action expected
+ * @return The caller record or NULL if the lock is not held that way
+ */
+static struct g_lock_caller *_g_lock_find_holder(
+  GLockSession *session,
+  GLock *lock,
+  const char *what,
+  enum g_lock_action first,
+  enum g_lock_action second
+  )
+{
+  struct g_lock_caller *caller;
+  if(!session) {
+    lock_log("No session provided");
+    return NULL;
+  }
+  if(!lock) {
+    lock_log("No lock provided");
+    return NULL;
+  }
+  if(!_g_lock_upgradable(lock)) {
+    lock_log("Lock %s can't %s", lock->name, what);
+    return NULL;
+  }
+  g_mutex_lock(&lock->stats_lock);
+  caller = _g_lock_find_caller(lock, session);
+  if(caller && caller->action != first && caller->action != second) {
+    caller = NULL;
+  }
+  g_mutex_unlock(&lock->stats_lock);
+  if(!caller) {
+    lock_log("Lock %s is not held by session %p in a way it can %s",
+      lock->name, session, what);
+  }
+  return caller;
+}
+
+/**
+ * Turn an upgradable read into a write
+ *
+ * Waits for the readers to leave while keeping new ones out. The
+ * session and holder records stay in place, the lock is then ended
+ * with g_lock_end_write or downgraded back.
+ *
+ * @param session The lock session
+ * @param lock The lock held upgradable
+ * @param callsite Where the lock is upgraded
+ * @return true if the lock is now held for write
+ */
+bool _g_lock_upgrade(
+  GLockSession *session,
+  GLock *lock,
+  const struct g_lock_callsite *callsite
+  )
+{
+  struct g_lock_caller *caller;
+  int64_t start, waited;
+
+  caller = _g_lock_find_holder(session, lock, "upgrade",
+    G_LOCK_ACTION_UPGRADABLE, G_LOCK_ACTION_UPGRADABLE);
+  if(!caller) {
+    return false;
+  }
+
+  _lock_log_action("UPGRADING", lock, G_LOCK_ACTION_UPGRADABLE);
+  start = g_get_monotonic_time();
+  _rw_policy_upgrade(&lock->_lock.policy_rw);
+  waited = g_get_monotonic_time() - start;
+
+  g_mutex_lock(&lock->stats_lock);
+  caller->action = G_LOCK_ACTION_WRITE;
+  _g_lock_time_stats_add(&lock->stats.upgrade_wait, waited);
+  g_mutex_unlock(&lock->stats_lock);
+  if(G_UNLIKELY(lock->manager->thread_accounting)) {
+    _g_lock_thread_waited(waited);
+  }
+  _lock_log_action("UPGRADED", lock, G_LOCK_ACTION_WRITE);
+  return true;
+}
+
+/**
+ * Turn a write or an upgradable read into a plain read
+ *
+ * Never blocks. Readers waiting behind the lock are let in, and the
+ * lock is then ended with g_lock_end_read.
+ *
+ * @param session The lock session
+ * @param lock The lock held for write or upgradable
+ * @param callsite Where the lock is downgraded
+ * @return true if the lock is now held for read
+ */
+bool _g_lock_downgrade(
+  GLockSession *session,
+  GLock *lock,
+  const struct g_lock_callsite *callsite
+  )
+{
+  struct g_lock_caller *caller;
+  enum g_lock_action action;
+
+  caller = _g_lock_find_holder(session, lock, "downgrade",
+    G_LOCK_ACTION_WRITE, G_LOCK_ACTION_UPGRADABLE);
+  if(!caller) {
+    return false;
+  }
+
+  // Only the holding session changes the action of its record
+  action = caller->action;
+  _rw_policy_downgrade(&lock->_lock.policy_rw, action, lock->rw_policy);
+  g_mutex_lock(&lock->stats_lock);
+  caller->action = G_LOCK_ACTION_READ;
+  g_mutex_unlock(&lock->stats_lock);
+
+  // Queued asynchronous readers may get in now
+  if(g_atomic_pointer_get(&lock->async_waiters)) {
+    _g_lock_async_wake(lock);
+  }
+  if(g_atomic_pointer_get(&lock->task_waiters)) {
+    _g_lock_executor_wake(lock);
+  }
+  _lock_log_action("DOWNGRADED", lock, G_LOCK_ACTION_READ);
+  return true;
+}
+
+/**
+ * Check that a session holds the mutex lock of a condition
+ *
+ * @param session The lock session
+ * @param lock The mutex lock protecting the condition
+ * @param cond The condition
+ * @return true if the condition can be used
+ */
+static bool _g_lock_check_cond(
+  GLockSession *session,
+  GLock *lock,
+  GCond *cond
+  )
+{
+  if(!session) {
+    lock_log("No session provided");
+    return false;
+  }
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  if(!cond) {
+    lock_log("No condition provided");
+    return false;
+  }
+  if(lock->type != G_LOCK_MUTEX) {
+    lock_log("Lock %s is not a mutex, can't use a condition", lock->name);
+    return false;
+  }
+  if(!g_list_find(session->lock_list, lock)) {
+    lock_log("Lock %s is not held by session %p", lock->name, session);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Wake up one thread waiting on a condition
+ *
+ * Nothing is signalled if the session doesn't hold the lock.
+ *
+ * @param session The lock session holding the lock
+ * @param lock The mutex lock protecting the condition
+ * @param cond The condition to signal
+ */
+void g_lock_signal(GLockSession *session, GLock *lock, GCond *cond)
+{
+  if(_g_lock_check_cond(session, lock, cond)) {
+    g_cond_signal(cond);
+  }
+}
+
+/**
+ * Wake up all threads waiting on a condition
+ *
+ * Nothing is broadcast if the session doesn't hold the lock.
+ *
+ * @param session The lock session holding the lock
+ * @param lock The mutex lock protecting the condition
+ * @param cond The condition to broadcast
+ */
+void g_lock_broadcast(GLockSession *session, GLock *lock, GCond *cond)
+{
+  if(_g_lock_check_cond(session, lock, cond)) {
+    g_cond_broadcast(cond);
+  }
+}
+
+struct g_lock_name_lookup {
+  uint32_t index; /*<< The index to look for */
+  char *name; /*<< Allocated name of the lock found */
+};
+
+/**
+ * Copy the name of a lock if it has the index looked for
+ *
+ * @param data The lock
+ * @param user_data The lookup
+ */
+static void _match_lock_index(gpointer data, gpointer user_data)
+{
+  GLock *lock = data;
+  struct g_lock_name_lookup *lookup = user_data;
+  if(lock->index == lookup->index && !lookup->name) {
+    lookup->name = strdup(lock->name);
+  }
+}
+
+/**
+ * Get lock name based on lock index in a manager
+ *
+ * The caller must free the result
+ *
+ * @param manager The manager owning the index space
+ * @param index The index to look for
+ * @return Allocated name of the lock if found otherwise NULL
+ */
+char *g_lock_name_by_index_in(GLockManager *manager, uint32_t index)
+{
+  struct g_lock_name_lookup lookup = { index, NULL };
+  _g_lock_epoch_enter();
+  _manager_foreach_lock(manager, _match_lock_index, &lookup);
+  _g_lock_epoch_exit();
+  return lookup.name;
 }
 
 /**
@@ -662,18 +3302,7 @@ void _g_lock_end(
  */
 char *g_lock_name_by_index(uint32_t index)
 {
-  char *name = NULL;
-  GLock *lock;
-  GList *tmpl = NULL;
-  _manager_reader_lock();
-  for(tmpl = _manager.locks; tmpl; tmpl = tmpl->next) {
-    lock = tmpl->data;
-    if(lock->index == index) {
-      name = strdup(lock->name);
-    }
-  }
-  _manager_reader_unlock();
-  return name;
+  return g_lock_name_by_index_in(&_default_manager, index);
 }
 
 /**
@@ -684,6 +3313,9 @@ char *g_lock_name_by_index(uint32_t index)
 GLockSession *g_lock_session_new()
 {
   GLockSession *session = calloc(1, sizeof(GLockSession));
+  if(session) {
+    session->owner = g_thread_self();
+  }
   return session;
 }
 
@@ -699,6 +3331,7 @@ void g_lock_session_free(GLockSession *session)
       g_list_free(session->lock_list);
       session->lock_list = NULL;
     }
+    free(session->compact_locks);
     free(session);
   }
 }
@@ -3,11 +3,30 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include <glib.h>
+#include <gio/gio.h>
 
+/**
+ * Registry of locks with its own index space and settings
+ *
+ * The functions which do not take a manager use a default
+ * instance. Others can be created with g_lock_manager_new.
+ */
 typedef struct {
-  GList *locks;
-  GRWLock manager_rw_lock;
+  GQueue locks; /*<< Registered locks, linked through their own node */
+  struct g_lock_table *tables; /*<< Registered static lock tables */
+  GQueue classes; /*<< Lock classes, linked through their own node */
+  GMutex registry_lock; /*<< Serializes changes, readers use epochs */
+  GMutex pool_lock; /*<< Protects pool and slabs */
+  GList *pool; /*<< Unused lock structures, linked through their node */
+  GSList *slabs; /*<< Allocations the pool was carved from */
+  gint retiring; /*<< Freed locks waiting for readers to go back */
+  gint metrics_collecting; /*<< Nesting of g_lock_metrics_collect_start */
+  gint tracing; /*<< Lock events are recorded */
+  gint thread_accounting; /*<< What threads do with locks is counted */
+  gint deadlock_detection; /*<< Contended waits are tracked */
   uint32_t lock_index;
   bool allow_wrong_order;
   bool debug;
@@ -17,28 +36,321 @@ enum g_lock_type {
   G_LOCK_MUTEX = 0, /*<< The simplest lock - MUTEX */
   G_LOCK_RECURSIVE, /*<< A recursive mutex */
   G_LOCK_RW, /*<< A read/write mutex */
+  G_LOCK_COHORT, /*<< A mutex handed over within a NUMA node first */
+  G_LOCK_SHARED, /*<< A mutex in memory shared between processes */
+};
+
+enum g_lock_rw_policy {
+  G_LOCK_RW_POLICY_DEFAULT = 0, /*<< GRWLock, the policy is decided by GLib */
+  G_LOCK_RW_POLICY_READER, /*<< Readers are admitted while writers wait */
+  G_LOCK_RW_POLICY_WRITER, /*<< New readers queue behind waiting writers */
+  G_LOCK_RW_POLICY_PHASE_FAIR, /*<< Reader and writer phases alternate */
+};
+
+enum g_lock_storage {
+  G_LOCK_STORAGE_POOL = 0, /*<< Allocated by g_lock_create */
+  G_LOCK_STORAGE_STATIC, /*<< Declared in a static lock table */
+  G_LOCK_STORAGE_EMBEDDED, /*<< Owned by the caller, see g_lock_init */
 };
 
 enum g_lock_action {
   G_LOCK_ACTION_BASIC=0,
   G_LOCK_ACTION_READ,
   G_LOCK_ACTION_WRITE,
+  G_LOCK_ACTION_UPGRADABLE, /*<< Read which may become a write */
 };
 
+/**
+ * Lock reduced to two words for very large numbers of per-object locks
+ *
+ * The lock is a bit lock and the name, level and nesting rule come
+ * from its class. The reference points at the class until statistics
+ * are allocated, it then points at them with bit 0 set. Compact locks
+ * are mutexes and can't be used with conditions, asynchronous requests
+ * or the deadlock detector. Their class counts every acquisition but
+ * only times the contended ones.
+ */
+typedef struct {
+  gint word; /*<< Bit 0 is the lock */
+  gpointer ref; /*<< GLockClass or tagged struct g_lock_compact_stats */
+} GLockCompact;
+
 typedef struct {
-  GList *lock_list; /**< Locked indeces in a session */
+  GList *lock_list; /**< Locks taken in a session */
+  GLockCompact **compact_locks; /**< Compact locks taken, oldest first */
+  uint32_t compact_count; /**< Number of compact locks taken */
+  uint32_t compact_size; /**< Room in compact_locks, kept for reuse */
+  GThread *owner; /**< Thread which created the session */
 } GLockSession;
 
-struct g_lock_caller {
-  char *caller; /*<< Caller function */
+/**
+ * Static description of a place in the code taking a lock
+ *
+ * One is emitted per call site by the g_lock_start* macros so the
+ * manager only ever passes a pointer around.
+ */
+struct g_lock_callsite {
+  const char *func; /*<< Caller function */
+  const char *file; /*<< Caller source file */
   uint32_t line; /*<< Caller function line number */
-  time_t timestamp; /** Timestamp session was started */
+  const char *lock_hint; /*<< Lock expression used at the call site */
+};
+
+#define G_LOCK_CALLSITE(lock) \
+  ({ \
+    static const struct g_lock_callsite _g_lock_callsite = { \
+      __FUNCTION__, __FILE__, __LINE__, #lock \
+    }; \
+    &_g_lock_callsite; \
+  })
+
+#define G_LOCK_BACKTRACE_DEPTH 32
+
+/**
+ * Stack captured for a budget violation
+ */
+struct g_lock_backtrace {
+  int depth; /*<< Number of frames */
+  void *frames[G_LOCK_BACKTRACE_DEPTH];
+};
+
+/**
+ * Counters for one call site taking one lock
+ */
+struct g_lock_callsite_stats {
+  const struct g_lock_callsite *callsite;
+  uint64_t acquisitions; /*<< Number of times the lock was taken */
+  uint64_t contended; /*<< Acquisitions which found the lock busy */
+  uint64_t wait_us; /*<< Total time spent waiting */
+  uint64_t hold_us; /*<< Total time the lock was held */
+  uint64_t hold_violations; /*<< Holds longer than the lock's budget */
+  uint64_t wait_violations; /*<< Waits longer than the lock's budget */
+  struct g_lock_backtrace *hold_stack; /*<< Where a long hold was taken */
+  struct g_lock_backtrace *wait_stack; /*<< Where a long wait happened */
+  int64_t reported_at; /*<< Monotonic time of the last violation report */
+  uint64_t suppressed; /*<< Violations not reported since then */
+};
+
+struct g_lock_caller {
+  const struct g_lock_callsite *callsite; /*<< Where the lock was taken */
   GLockSession *session;
+  enum g_lock_action action; /*<< Action the caller performed */
+  int64_t wait_started_at; /*<< Monotonic time the caller started waiting */
+  int64_t wait_us; /*<< Time spent waiting to acquire the lock */
+  int64_t acquired_at; /*<< Monotonic time the lock was taken */
+  bool contended; /*<< Whether the lock was busy when asked for */
+  bool cond_waiting; /*<< Waiting on a condition, the lock is released */
+  int64_t cond_wait_us; /*<< Time spent waiting on conditions */
+  bool pending; /*<< Queued asynchronously, not holding the lock yet */
+  bool metered; /*<< Counted in the holders of the metrics */
+  struct g_lock_backtrace *stack; /*<< Sampled when over budget before */
+};
+
+struct g_lock_time_stats {
+  uint64_t count; /*<< Number of samples */
+  uint64_t total_us; /*<< Sum of all samples in microseconds */
+  uint64_t max_us; /*<< Largest sample in microseconds */
+};
+
+/**
+ * Length of the queue of callers waiting for a lock
+ *
+ * The length is integrated over time to give its average. Time is
+ * also cut in windows of G_LOCK_CONVOY_WINDOW_US, a window is flagged
+ * as a convoy when on average at least G_LOCK_CONVOY_WAITERS callers
+ * were queued while holds lasted G_LOCK_CONVOY_HOLD_US at most.
+ */
+struct g_lock_queue {
+  int max_waiting; /*<< Longest the queue has been */
+  int64_t since; /*<< Monotonic time the first caller came */
+  int64_t changed_at; /*<< Monotonic time the length was last accounted */
+  uint64_t area; /*<< Length multiplied by time since then, in us */
+  int64_t window_start; /*<< Monotonic time the current window started */
+  uint64_t window_area; /*<< Area within the current window */
+  uint64_t window_holds; /*<< Releases within the current window */
+  uint64_t window_hold_us; /*<< Time those were held */
+  uint64_t convoys; /*<< Windows flagged as convoys */
+  bool convoy; /*<< Whether the last complete window was a convoy */
+};
+
+#define G_LOCK_CONVOY_WINDOW_US 100000
+#define G_LOCK_CONVOY_WAITERS 2
+#define G_LOCK_CONVOY_HOLD_US 100
+
+/**
+ * Snapshot of the queue of a lock
+ */
+struct g_lock_queue_stats {
+  int waiting; /*<< Callers waiting for the lock */
+  int holding; /*<< Callers holding the lock */
+  int max_waiting; /*<< Longest the queue has been */
+  double avg_waiting; /*<< Time weighted average length of the queue */
+  uint64_t convoys; /*<< Windows flagged as convoys */
+  bool convoy; /*<< Whether the last complete window was a convoy */
 };
 
 struct g_lock_stats {
-  int count; /*<< Number of callers waiting/using lock */
-  GList *call_list; /**< List of callers. Acts like a queue */
+  int waiting; /*<< Number of callers waiting for the lock */
+  int holding; /*<< Number of callers holding the lock */
+  GList *waiters; /*<< Callers waiting for the lock, oldest first */
+  GList *holders; /*<< Callers holding the lock, oldest first */
+  struct g_lock_queue queue; /*<< Length of the waiters queue */
+  struct g_lock_time_stats wait; /*<< Wait times of basic acquisitions */
+  struct g_lock_time_stats read_wait; /*<< Wait times of readers */
+  struct g_lock_time_stats write_wait; /*<< Wait times of writers */
+  struct g_lock_time_stats cond_wait; /*<< Time spent on conditions */
+  struct g_lock_time_stats upgrade_wait; /*<< Upgrades waiting for readers */
+  GHashTable *callsites; /*<< struct g_lock_callsite_stats by call site */
+};
+
+#define G_LOCK_METRICS_BUCKETS 8
+
+struct g_lock_publish_record;
+
+/**
+ * Counters read by the metrics exporter
+ *
+ * Updated with atomic operations so the exporter can copy them
+ * without taking a lock the locking threads use. Times are put in
+ * buckets of 1us, 10us, 100us, 1ms, 10ms, 100ms, 1s and above.
+ */
+struct g_lock_metrics {
+  uint64_t acquisitions; /*<< Completed acquisitions */
+  uint64_t contended; /*<< Acquisitions which found the lock busy */
+  int64_t holders; /*<< Sessions currently holding the lock */
+  uint64_t wait_sum_us; /*<< Total time spent waiting */
+  uint64_t hold_sum_us; /*<< Total time the lock was held */
+  uint64_t wait_buckets[G_LOCK_METRICS_BUCKETS]; /*<< Wait time counts */
+  uint64_t hold_buckets[G_LOCK_METRICS_BUCKETS]; /*<< Hold time counts */
+  struct g_lock_publish_record *published; /*<< Record in the stats file */
+};
+
+/**
+ * How instances of one lock class can be nested
+ */
+enum g_lock_class_rule {
+  G_LOCK_CLASS_FORBIDDEN = 0, /*<< Only one instance can be held */
+  G_LOCK_CLASS_ADDRESS_ORDERED, /*<< Instances are taken by address */
+  G_LOCK_CLASS_SUBCLASS, /*<< Instances are taken by subclass */
+};
+
+/**
+ * Counters aggregated over all the instances of a lock class
+ */
+struct g_lock_class_stats {
+  uint64_t acquisitions; /*<< Number of times an instance was taken */
+  uint64_t contended; /*<< Acquisitions which found the instance busy */
+  struct g_lock_time_stats wait; /*<< Wait times of all actions */
+  uint64_t hold_us; /*<< Total time instances were held */
+};
+
+/**
+ * Kind of lock shared by many instances
+ *
+ * All instances share the index of the class, so they are ordered
+ * against other locks as a single lock and against each other by
+ * the class rule.
+ */
+typedef struct {
+  const char *name; /*<< Interned, also the name of the instances */
+  uint32_t index; /*<< Level of every instance */
+  enum g_lock_class_rule rule;
+  GLockManager *manager; /*<< Manager the class is registered with */
+  GList link; /*<< Node in the manager's list of classes */
+  gint instances; /*<< Number of live instances */
+  GMutex stats_lock;
+  struct g_lock_class_stats stats;
+  struct g_lock_metrics metrics; /*<< Aggregated over the instances */
+} GLockClass;
+
+/**
+ * Statistics of a compact lock
+ *
+ * Only allocated the first time the lock is contended or inspected.
+ * The counters are updated under the stats lock of the class.
+ */
+struct g_lock_compact_stats {
+  GLockClass *klass; /*<< Class of the lock */
+  uint64_t contended; /*<< Acquisitions which found the lock busy */
+  struct g_lock_time_stats wait; /*<< Wait times of contended acquisitions */
+};
+
+/**
+ * Read/write lock with an explicit admission policy
+ *
+ * Used instead of GRWLock when a policy other than
+ * G_LOCK_RW_POLICY_DEFAULT is requested.
+ */
+struct g_lock_rw_policy_lock {
+  GMutex mutex;
+  GCond readers_cond;
+  GCond writers_cond;
+  GCond upgraders_cond;
+  GCond upgrade_cond; /*<< Signalled when the last reader leaves */
+  uint32_t readers; /*<< Number of active readers */
+  uint32_t readers_waiting; /*<< Number of blocked readers */
+  uint32_t readers_pass; /*<< Readers let in by the last writer (phase-fair) */
+  uint32_t writers_waiting; /*<< Number of blocked writers */
+  uint64_t phase; /*<< Incremented every time a writer releases */
+  bool writer; /*<< Whether a writer holds the lock */
+  bool upgrader; /*<< Whether an upgradable reader holds the lock */
+  bool upgrading; /*<< The upgradable reader waits to become the writer */
+  uint32_t upgraders_waiting; /*<< Number of blocked upgradable readers */
+};
+
+/**
+ * Mutex which prefers handing ownership to waiters on the same node
+ *
+ * A global bit lock plus a mutex per NUMA node, which are only
+ * allocated the first time the lock is taken.
+ */
+struct g_lock_cohort_lock {
+  gint global; /*<< Bit 0 is the lock shared by all nodes */
+  uint32_t owner; /*<< Node of the holder */
+  uint32_t node_count; /*<< Number of nodes */
+  struct g_lock_cohort_node *nodes; /*<< One per node */
+};
+
+#define G_LOCK_SHARED_NAME_MAX 64
+
+/**
+ * Counters of a process-shared lock, updated while holding it
+ */
+struct g_lock_shared_stats {
+  uint64_t acquisitions; /*<< Number of times the lock was taken */
+  uint64_t contended; /*<< Acquisitions which found the lock busy */
+  uint64_t owner_died; /*<< Holders which exited holding the lock */
+  struct g_lock_time_stats wait; /*<< Wait times of all acquisitions */
+  struct g_lock_time_stats hold; /*<< Hold times of all acquisitions */
+};
+
+/**
+ * Mutex and statistics placed in memory shared between processes
+ *
+ * It must not contain pointers since every process may map it at a
+ * different address. The mutex is robust: when a holder exits, the
+ * next process to take the lock recovers it.
+ */
+typedef struct {
+  pthread_mutex_t mutex; /*<< Robust and process-shared */
+  uint32_t magic; /*<< Set once the lock is initialized */
+  char name[G_LOCK_SHARED_NAME_MAX];
+  pid_t holder_pid; /*<< Process holding the lock or 0 */
+  pid_t holder_tid; /*<< Thread holding the lock or 0 */
+  int64_t acquired_at; /*<< Monotonic time, the same in all processes */
+  struct g_lock_shared_stats stats;
+} GLockShared;
+
+/**
+ * Counters of the requests executed on a lock by g_lock_execute
+ *
+ * Written by the holder of the lock, read without it.
+ */
+struct g_lock_combine_stats {
+  uint64_t requests; /*<< Requests executed */
+  uint64_t batches; /*<< Acquisitions which executed requests */
+  uint64_t combined; /*<< Requests executed for another thread */
+  uint64_t max_batch; /*<< Most requests executed in one acquisition */
 };
 
 typedef struct {
@@ -46,14 +358,175 @@ typedef struct {
     GMutex mutex;
     GRecMutex rec_mutex;
     GRWLock rw_mutex;
+    struct g_lock_rw_policy_lock policy_rw;
+    struct g_lock_cohort_lock cohort;
+    GLockShared *shared; /*<< Not owned by the lock */
   } _lock;
-  char *name;
+  const char *name; /*<< Interned, shared by locks with the same name */
   GMutex stats_lock;
   enum g_lock_type type;
+  enum g_lock_rw_policy rw_policy; /*<< Only used by G_LOCK_RW */
   struct g_lock_stats stats;
+  struct g_lock_metrics metrics;
   uint32_t index;
+  GLockManager *manager; /*<< Manager the lock is registered with */
+  GLockClass *klass; /*<< Class of the lock or NULL */
+  uint32_t subclass; /*<< Nesting level within the class */
+  enum g_lock_storage storage; /*<< Who owns the memory of the lock */
+  GList link; /*<< Node in the manager's list of locks */
+  GList *async_waiters; /*<< Queued asynchronous requests (stats_lock) */
+  uint64_t release_gen; /*<< Releases seen by async waiters (stats_lock) */
+  gint async_starving; /*<< Async requests synchronous callers let by */
+  GCond async_cond; /*<< Signalled when one of those completes */
+  GList *task_waiters; /*<< Executor tasks waiting (stats_lock) */
+  gpointer combine_requests; /*<< Published by g_lock_execute, newest first */
+  struct g_lock_combine_stats combine; /*<< Counters of g_lock_execute */
+  int64_t hold_budget_us; /*<< Longest expected hold or 0 */
+  int64_t wait_budget_us; /*<< Longest expected wait or 0 */
 } GLock;
 
+/**
+ * Statically allocated locks declared with G_LOCK_TABLE_DEFINE
+ *
+ * The locks are linked into a manager by g_lock_table_register
+ * which does not allocate.
+ */
+struct g_lock_table {
+  const char *name; /*<< Name of the table */
+  GLock *const *locks; /*<< The locks of the table */
+  uint32_t count; /*<< Number of locks */
+  GLockManager *manager; /*<< Manager the table is registered with */
+  struct g_lock_table *next; /*<< Next table of the manager */
+};
+
+/**
+ * Declare a lock hierarchy
+ *
+ * The hierarchy is an X-macro taking one entry per lock:
+ *
+ *   #define APP_LOCKS(X) \
+ *     X(config_lock, G_LOCK_RW, 10) \
+ *     X(cache_lock, G_LOCK_MUTEX, 20)
+ *
+ * The level of a lock is its fixed index, so a lock can only be taken
+ * while holding locks of lower levels. Use G_LOCK_TABLE_DECLARE in a
+ * header and G_LOCK_TABLE_DEFINE in exactly one source file.
+ */
+#define _G_LOCK_TABLE_DECLARE_LOCK(ident, lock_type, level) \
+  extern GLock *const ident; \
+  enum { G_LOCK_LEVEL_##ident = level };
+#define G_LOCK_TABLE_DECLARE(table, LOCKS) \
+  LOCKS(_G_LOCK_TABLE_DECLARE_LOCK) \
+  extern struct g_lock_table table
+
+#define _G_LOCK_TABLE_DEFINE_LOCK(ident, lock_type, level) \
+  static GLock _g_lock_static_##ident = { \
+    .name = #ident, \
+    .type = lock_type, \
+    .index = level, \
+    .storage = G_LOCK_STORAGE_STATIC, \
+  }; \
+  GLock *const ident = &_g_lock_static_##ident;
+#define _G_LOCK_TABLE_ENTRY(ident, lock_type, level) \
+  &_g_lock_static_##ident,
+#define _G_LOCK_TABLE_LEVEL_CASE(ident, lock_type, level) \
+  case level: break;
+#define G_LOCK_TABLE_DEFINE(table, LOCKS) \
+  LOCKS(_G_LOCK_TABLE_DEFINE_LOCK) \
+  static GLock *const _g_lock_table_##table[] = { \
+    LOCKS(_G_LOCK_TABLE_ENTRY) \
+  }; \
+  /* Two locks sharing a level fail to build with a duplicate case */ \
+  G_GNUC_UNUSED static void _g_lock_table_levels_##table(int level) \
+  { \
+    switch(level) { \
+      LOCKS(_G_LOCK_TABLE_LEVEL_CASE) \
+      default: break; \
+    } \
+  } \
+  struct g_lock_table table = { \
+    #table, _g_lock_table_##table, G_N_ELEMENTS(_g_lock_table_##table), \
+    NULL, NULL \
+  }
+
+/**
+ * Fail the build if inner can't be taken while holding outer
+ */
+#define G_LOCK_ASSERT_ORDER(outer, inner) \
+  _Static_assert((int)G_LOCK_LEVEL_##outer < (int)G_LOCK_LEVEL_##inner, \
+    #inner " can't be taken while holding " #outer)
+
+bool g_lock_table_register(struct g_lock_table *table);
+bool g_lock_table_register_in(
+  GLockManager *manager,
+  struct g_lock_table *table
+  );
+
+bool g_lock_compact_init(GLockCompact *lock, GLockClass *klass);
+void g_lock_compact_clear(GLockCompact *lock);
+bool g_lock_compact_start(GLockSession *session, GLockCompact *lock);
+bool g_lock_compact_try_start(GLockSession *session, GLockCompact *lock);
+void g_lock_compact_end(GLockSession *session, GLockCompact *lock);
+struct g_lock_compact_stats *g_lock_compact_stats(GLockCompact *lock);
+
+/**
+ * Called once an asynchronous lock request completes
+ *
+ * @param session The session the request was made for
+ * @param lock The requested lock
+ * @param acquired true if the lock is now held, false if the
+ *                 request was cancelled
+ * @param user_data The user data given with the request
+ */
+typedef void (*GLockReadyCallback)(
+  GLockSession *session,
+  GLock *lock,
+  bool acquired,
+  gpointer user_data
+  );
+
+/**
+ * A lock needed by an executor task and how it is taken
+ */
+struct g_lock_task_lock {
+  GLock *lock;
+  enum g_lock_action action; /*<< Basic, read, write or upgradable */
+};
+
+/**
+ * Run by an executor worker once every lock of the task is held
+ *
+ * The locks are released when the function returns.
+ *
+ * @param session The session of the worker holding the locks
+ * @param user_data The user data given with the task
+ */
+typedef void (*GLockTaskFunc)(GLockSession *session, gpointer user_data);
+
+typedef struct g_lock_executor GLockExecutor;
+
+/**
+ * Run by g_lock_execute with the lock held
+ *
+ * It may run on another thread than the one which asked for it, in
+ * the session of that thread, so it must not take other locks.
+ *
+ * @param user_data The argument given to g_lock_execute
+ * @return The result returned by g_lock_execute
+ */
+typedef gpointer (*GLockExecuteFunc)(gpointer user_data);
+
+/**
+ * Counters of an executor
+ */
+struct g_lock_executor_stats {
+  uint64_t submitted; /*<< Tasks accepted */
+  uint64_t executed; /*<< Tasks which ran */
+  uint64_t parked; /*<< Times a task found one of its locks busy */
+  uint64_t stolen; /*<< Tasks taken from the queue of another worker */
+  uint64_t refused; /*<< Tasks dropped since a lock could not be taken */
+};
+
 
 GLock *g_lock_create(
   const char *lock_name,
@@ -62,39 +535,361 @@ GLock *g_lock_create(
 #define g_lock_create_mutex(name) g_lock_create(name, G_LOCK_MUTEX)
 #define g_lock_create_recursive(name) g_lock_create(name, G_LOCK_RECURSIVE)
 #define g_lock_create_rw(name) g_lock_create(name, G_LOCK_RW)
+#define g_lock_create_cohort(name) g_lock_create(name, G_LOCK_COHORT)
+GLock *g_lock_create_rw_policy(
+  const char *lock_name,
+  enum g_lock_rw_policy policy
+  );
+GLock *g_lock_create_in(
+  GLockManager *manager,
+  const char *lock_name,
+  enum g_lock_type type
+  );
+bool g_lock_init(GLock *lock, const char *lock_name, enum g_lock_type type);
+bool g_lock_init_in(
+  GLockManager *manager,
+  GLock *lock,
+  const char *lock_name,
+  enum g_lock_type type
+  );
+void g_lock_clear(GLock *lock);
+
+GLockClass *g_lock_class_new(
+  const char *class_name,
+  enum g_lock_class_rule rule
+  );
+GLockClass *g_lock_class_new_in(
+  GLockManager *manager,
+  const char *class_name,
+  enum g_lock_class_rule rule
+  );
+void g_lock_class_free(GLockClass *klass);
+GLock *g_lock_create_instance(
+  GLockClass *klass,
+  enum g_lock_type type,
+  uint32_t subclass
+  );
+bool g_lock_init_instance(
+  GLock *lock,
+  GLockClass *klass,
+  enum g_lock_type type,
+  uint32_t subclass
+  );
+GLock *g_lock_create_rw_policy_in(
+  GLockManager *manager,
+  const char *lock_name,
+  enum g_lock_rw_policy policy
+  );
+
+bool g_lock_shared_init(GLockShared *shared, const char *lock_name);
+void g_lock_shared_clear(GLockShared *shared);
+GLock *g_lock_create_shared(GLockShared *shared);
+GLock *g_lock_create_shared_in(GLockManager *manager, GLockShared *shared);
+void g_lock_shared_show(GLockShared *shared);
 
 #define g_lock_start(session, lock) \
-  _g_lock_start(session, lock, G_LOCK_ACTION_BASIC, __FUNCTION__, __LINE__)
+  _g_lock_start(session, lock, G_LOCK_ACTION_BASIC, G_LOCK_CALLSITE(lock))
 #define g_lock_start_read(session, lock) \
-  _g_lock_start(session, lock, G_LOCK_ACTION_READ, __FUNCTION__, __LINE__)
+  _g_lock_start(session, lock, G_LOCK_ACTION_READ, G_LOCK_CALLSITE(lock))
 #define g_lock_start_write(session, lock) \
-  _g_lock_start(session, lock, G_LOCK_ACTION_WRITE, __FUNCTION__, __LINE__)
+  _g_lock_start(session, lock, G_LOCK_ACTION_WRITE, G_LOCK_CALLSITE(lock))
+#define g_lock_start_upgradable(session, lock) \
+  _g_lock_start(session, lock, G_LOCK_ACTION_UPGRADABLE, \
+    G_LOCK_CALLSITE(lock))
 bool _g_lock_start(
   GLockSession *session,
   GLock *lock,
   enum g_lock_action action,
-  const char *caller_func,
-  uint32_t caller_line
+  const struct g_lock_callsite *callsite
+  );
+
+#define g_lock_try_start(session, lock) \
+  _g_lock_try_start(session, lock, G_LOCK_ACTION_BASIC, G_LOCK_CALLSITE(lock))
+#define g_lock_try_start_read(session, lock) \
+  _g_lock_try_start(session, lock, G_LOCK_ACTION_READ, G_LOCK_CALLSITE(lock))
+#define g_lock_try_start_write(session, lock) \
+  _g_lock_try_start(session, lock, G_LOCK_ACTION_WRITE, G_LOCK_CALLSITE(lock))
+#define g_lock_try_start_upgradable(session, lock) \
+  _g_lock_try_start(session, lock, G_LOCK_ACTION_UPGRADABLE, \
+    G_LOCK_CALLSITE(lock))
+bool _g_lock_try_start(
+  GLockSession *session,
+  GLock *lock,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite
+  );
+
+#define g_lock_start_async(session, lock, action, cancellable, callback, \
+    user_data) \
+  _g_lock_start_async(session, lock, action, cancellable, callback, \
+    user_data, G_LOCK_CALLSITE(lock))
+bool _g_lock_start_async(
+  GLockSession *session,
+  GLock *lock,
+  enum g_lock_action action,
+  GCancellable *cancellable,
+  GLockReadyCallback callback,
+  gpointer user_data,
+  const struct g_lock_callsite *callsite
+  );
+
+GLockExecutor *g_lock_executor_new(uint32_t workers);
+#define g_lock_executor_submit(executor, locks, count, func, user_data) \
+  _g_lock_executor_submit(executor, locks, count, func, user_data, \
+    G_LOCK_CALLSITE(locks))
+bool _g_lock_executor_submit(
+  GLockExecutor *executor,
+  const struct g_lock_task_lock *locks,
+  uint32_t count,
+  GLockTaskFunc func,
+  gpointer user_data,
+  const struct g_lock_callsite *callsite
+  );
+void g_lock_executor_wait(GLockExecutor *executor);
+void g_lock_executor_stats(
+  GLockExecutor *executor,
+  struct g_lock_executor_stats *stats
+  );
+void g_lock_executor_free(GLockExecutor *executor);
+
+#define g_lock_execute(session, lock, func, user_data) \
+  _g_lock_execute(session, lock, func, user_data, G_LOCK_CALLSITE(lock))
+gpointer _g_lock_execute(
+  GLockSession *session,
+  GLock *lock,
+  GLockExecuteFunc func,
+  gpointer user_data,
+  const struct g_lock_callsite *callsite
   );
 
 #define g_lock_end(session, lock) \
-  _g_lock_end(session, lock, G_LOCK_ACTION_BASIC, __FUNCTION__, __LINE__)
+  _g_lock_end(session, lock, G_LOCK_ACTION_BASIC, G_LOCK_CALLSITE(lock))
 #define g_lock_end_read(session, lock) \
-  _g_lock_end(session, lock, G_LOCK_ACTION_READ, __FUNCTION__, __LINE__)
+  _g_lock_end(session, lock, G_LOCK_ACTION_READ, G_LOCK_CALLSITE(lock))
 #define g_lock_end_write(session, lock) \
-  _g_lock_end(session, lock, G_LOCK_ACTION_WRITE, __FUNCTION__, __LINE__)
+  _g_lock_end(session, lock, G_LOCK_ACTION_WRITE, G_LOCK_CALLSITE(lock))
+#define g_lock_end_upgradable(session, lock) \
+  _g_lock_end(session, lock, G_LOCK_ACTION_UPGRADABLE, G_LOCK_CALLSITE(lock))
 void _g_lock_end(
   GLockSession *session,
   GLock *lock,
   enum g_lock_action action,
-  const char *caller_func,
-  uint32_t caller_line
+  const struct g_lock_callsite *callsite
   );
 
+#define g_lock_upgrade(session, lock) \
+  _g_lock_upgrade(session, lock, G_LOCK_CALLSITE(lock))
+#define g_lock_downgrade(session, lock) \
+  _g_lock_downgrade(session, lock, G_LOCK_CALLSITE(lock))
+bool _g_lock_upgrade(
+  GLockSession *session,
+  GLock *lock,
+  const struct g_lock_callsite *callsite
+  );
+bool _g_lock_downgrade(
+  GLockSession *session,
+  GLock *lock,
+  const struct g_lock_callsite *callsite
+  );
+
+#define G_LOCK_WAIT_FOREVER (-1)
+
+#define g_lock_wait(session, lock, cond) \
+  _g_lock_wait(session, lock, cond, G_LOCK_WAIT_FOREVER, \
+    G_LOCK_CALLSITE(lock))
+#define g_lock_wait_until(session, lock, cond, end_time) \
+  _g_lock_wait(session, lock, cond, end_time, G_LOCK_CALLSITE(lock))
+bool _g_lock_wait(
+  GLockSession *session,
+  GLock *lock,
+  GCond *cond,
+  int64_t end_time,
+  const struct g_lock_callsite *callsite
+  );
+void g_lock_signal(GLockSession *session, GLock *lock, GCond *cond);
+void g_lock_broadcast(GLockSession *session, GLock *lock, GCond *cond);
+
+char *g_lock_metrics_render();
+char *g_lock_metrics_render_in(GLockManager *manager);
+void g_lock_metrics_collect_start();
+void g_lock_metrics_collect_start_in(GLockManager *manager);
+void g_lock_metrics_collect_stop();
+void g_lock_metrics_collect_stop_in(GLockManager *manager);
+bool g_lock_metrics_start_unix(const char *path);
+bool g_lock_metrics_start_unix_in(GLockManager *manager, const char *path);
+bool g_lock_metrics_start_tcp(uint16_t port);
+bool g_lock_metrics_start_tcp_in(GLockManager *manager, uint16_t port);
+void g_lock_metrics_stop();
+
+/**
+ * Layout of the live statistics file written by g_lock_publish_start
+ *
+ * The file is a header followed by capacity records. Readers must
+ * check the magic and version and use header_size and record_size to
+ * find the records. A record is written under a sequence lock: seq is
+ * odd while it changes, so a reader copies it between two reads of an
+ * identical even seq.
+ */
+#define G_LOCK_PUBLISH_MAGIC "GLKSTATS"
+#define G_LOCK_PUBLISH_VERSION 1
+#define G_LOCK_PUBLISH_NAME_MAX 48
+
+struct g_lock_publish_header {
+  char magic[8]; /*<< G_LOCK_PUBLISH_MAGIC, written last */
+  uint32_t version; /*<< G_LOCK_PUBLISH_VERSION */
+  uint32_t header_size; /*<< Offset of the first record */
+  uint32_t record_size; /*<< Size of a record */
+  uint32_t capacity; /*<< Number of records in the file */
+  uint32_t used; /*<< Records ever used, the others are all zero */
+  uint32_t dropped; /*<< Locks not published for lack of records */
+  uint32_t buckets; /*<< G_LOCK_METRICS_BUCKETS */
+  uint32_t pid; /*<< Process publishing the file */
+  int64_t started_at; /*<< Real time publishing started, in us */
+  uint64_t bucket_bounds[G_LOCK_METRICS_BUCKETS]; /*<< Upper bounds in us */
+};
+
+enum g_lock_publish_state {
+  G_LOCK_PUBLISH_FREE = 0, /*<< Not in use */
+  G_LOCK_PUBLISH_LOCK, /*<< Counters of a lock */
+  G_LOCK_PUBLISH_CLASS, /*<< Counters aggregated over a lock class */
+};
+
+struct g_lock_publish_record {
+  uint32_t seq; /*<< Odd while the record is written */
+  uint32_t state; /*<< enum g_lock_publish_state */
+  uint32_t index; /*<< Index of the lock or class */
+  uint32_t type; /*<< enum g_lock_type of a lock */
+  char name[G_LOCK_PUBLISH_NAME_MAX]; /*<< Truncated, NUL terminated */
+  uint64_t acquisitions;
+  uint64_t contended;
+  int64_t holders;
+  uint64_t wait_sum_us;
+  uint64_t hold_sum_us;
+  uint64_t wait_buckets[G_LOCK_METRICS_BUCKETS];
+  uint64_t hold_buckets[G_LOCK_METRICS_BUCKETS];
+};
+
+bool g_lock_publish_start(const char *path, uint32_t capacity);
+bool g_lock_publish_start_in(
+  GLockManager *manager,
+  const char *path,
+  uint32_t capacity
+  );
+void g_lock_publish_stop();
+
+bool g_lock_trace_start(uint32_t events_per_thread);
+bool g_lock_trace_start_in(GLockManager *manager, uint32_t events_per_thread);
+void g_lock_trace_stop();
+void g_lock_trace_stop_in(GLockManager *manager);
+char *g_lock_trace_export();
+bool g_lock_trace_export_file(const char *path);
+bool g_lock_trace_save(const char *path);
+
+/**
+ * Binary trace written by g_lock_trace_save for the replay tool
+ *
+ * The header is followed by lock_count locks, callsite_count call
+ * sites and thread_count threads, each thread followed by its
+ * events. Strings follow their record without a terminating NUL.
+ * Values are in host byte order.
+ */
+#define G_LOCK_REPLAY_MAGIC "GLKRPL01"
+#define G_LOCK_REPLAY_NO_CALLSITE 0xffff
+
+struct g_lock_replay_header {
+  char magic[8]; /*<< G_LOCK_REPLAY_MAGIC */
+  uint32_t lock_count;
+  uint32_t callsite_count;
+  uint32_t thread_count;
+  uint32_t reserved;
+};
+
+struct g_lock_replay_lock {
+  uint32_t index; /*<< Index of the lock when recorded */
+  uint8_t type; /*<< enum g_lock_type */
+  uint8_t rw_policy; /*<< enum g_lock_rw_policy */
+  uint16_t name_len; /*<< Followed by the name */
+};
+
+struct g_lock_replay_callsite {
+  uint32_t line;
+  uint16_t func_len; /*<< Followed by the function */
+  uint16_t file_len; /*<< Followed by the file after the function */
+};
+
+struct g_lock_replay_thread {
+  uint32_t event_count; /*<< Followed by the events */
+  char name[16];
+};
+
+enum g_lock_replay_op {
+  G_LOCK_REPLAY_ACQUIRE=0,
+  G_LOCK_REPLAY_RELEASE,
+};
+
+struct g_lock_replay_event {
+  uint32_t lock; /*<< Position of the lock in the trace */
+  uint32_t delta_us; /*<< Time since the previous event of the thread */
+  uint32_t wait_us; /*<< Time the acquisition waited */
+  uint16_t callsite; /*<< Position of the call site or NO_CALLSITE */
+  uint8_t op; /*<< enum g_lock_replay_op */
+  uint8_t action; /*<< enum g_lock_action */
+};
+
+bool g_lock_set_budget(GLock *lock, int64_t hold_us, int64_t wait_us);
+void g_lock_show_budget_violations();
+void g_lock_show_budget_violations_in(GLockManager *manager);
+
+/**
+ * What threads did with locks
+ */
+struct g_lock_thread_counters {
+  uint64_t acquisitions; /*<< Acquisitions released */
+  uint64_t contended; /*<< Those which found the lock busy */
+  uint64_t wait_us; /*<< Time blocked taking or upgrading locks */
+  uint64_t cond_wait_us; /*<< Time waiting on conditions */
+  uint64_t hold_us; /*<< Time locks were held */
+};
+
+/**
+ * What the threads with one name did with locks during an interval
+ */
+struct g_lock_thread_stats {
+  char name[16];
+  uint32_t threads; /*<< Threads with this name seen in the interval */
+  int64_t interval_us; /*<< Time since the last reset */
+  int64_t alive_us; /*<< Sum of the time each thread ran in the interval */
+  struct g_lock_thread_counters counters;
+};
+
+void g_lock_thread_stats_start();
+void g_lock_thread_stats_start_in(GLockManager *manager);
+void g_lock_thread_stats_stop();
+void g_lock_thread_stats_stop_in(GLockManager *manager);
+GArray *g_lock_thread_stats(bool reset);
+void g_lock_show_thread_stats(bool reset);
+
+bool g_lock_queue_stats(GLock *lock, struct g_lock_queue_stats *stats);
+void g_lock_show_convoys();
+void g_lock_show_convoys_in(GLockManager *manager);
+
+bool g_lock_numa_set_nodes(uint32_t nodes);
+uint32_t g_lock_numa_nodes();
+bool g_lock_numa_set_thread_node(int node);
+
 void g_lock_free_all();
+void g_lock_free_all_in(GLockManager *manager);
 void g_lock_free(GLock *lock);
 void g_lock_show_all();
+void g_lock_show_all_in(GLockManager *manager);
+bool g_lock_dump(int fd);
+bool g_lock_dump_in(GLockManager *manager, int fd);
+bool g_lock_dump_install(int signum, int fd);
+void g_lock_dump_uninstall();
+void g_lock_show_top_callsites(uint32_t count);
+void g_lock_show_top_callsites_in(GLockManager *manager, uint32_t count);
 char *g_lock_name_by_index(uint32_t index);
+char *g_lock_name_by_index_in(GLockManager *manager, uint32_t index);
 
 GLockSession *g_lock_session_new();
 void g_lock_session_free(GLockSession *session);
@@ -115,5 +910,24 @@ void g_lock_manager_free();
 void g_lock_manager_set_debug(bool debug);
 void g_lock_manager_allow_wrong_order(bool allow);
 
+GLockManager *g_lock_manager_default();
+GLockManager *g_lock_manager_new();
+void g_lock_manager_destroy(GLockManager *manager);
+void g_lock_manager_set_debug_in(GLockManager *manager, bool debug);
+void g_lock_manager_allow_wrong_order_in(GLockManager *manager, bool allow);
+
+void g_lock_manager_enable_deadlock_detection(bool enable);
+void g_lock_manager_enable_deadlock_detection_in(
+  GLockManager *manager,
+  bool enable
+  );
+uint32_t g_lock_manager_check_deadlocks();
+bool g_lock_manager_start_deadlock_detector(uint32_t interval_ms);
+bool g_lock_manager_start_deadlock_detector_in(
+  GLockManager *manager,
+  uint32_t interval_ms
+  );
+void g_lock_manager_stop_deadlock_detector();
+
 #endif // _G_LOCK_MANAGER_H
 
@@ -0,0 +1,180 @@
+#ifndef _G_LOCK_MANAGER_PRIVATE_H
+#define _G_LOCK_MANAGER_PRIVATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "g_lock_manager.h"
+
+/**
+ * Internal helpers shared between the manager sources.
+ * Nothing in here is part of the public API.
+ */
+
+#define lock_log(...) \
+  _g_lock_log(NULL, false, __FUNCTION__, __LINE__, __VA_ARGS__)
+#define lock_debug(manager, ...) \
+  _g_lock_log(manager, true, __FUNCTION__, __LINE__, __VA_ARGS__)
+
+#define G_LOCK_CACHE_LINE 64
+
+void _g_lock_log(
+  GLockManager *manager,
+  bool is_debug,
+  const char *func,
+  uint32_t line,
+  const char *message,
+  ...
+  );
+
+void _g_lock_acquire(GLock *lock, enum g_lock_action action);
+bool _g_lock_try_acquire(GLock *lock, enum g_lock_action action);
+
+struct g_lock_caller *_g_lock_caller_new(
+  GLockSession *session,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite
+  );
+void _g_lock_caller_free(gpointer data);
+void _g_lock_stats_add_waiter(GLock *lock, struct g_lock_caller *caller);
+void _g_lock_stats_add_holder(GLock *lock, struct g_lock_caller *caller);
+void _g_lock_stats_acquired(GLock *lock, struct g_lock_caller *caller);
+void _g_lock_stats_drop_waiter(GLock *lock, struct g_lock_caller *caller);
+void _g_lock_queue_change(GLock *lock, int64_t now, int delta);
+void _g_lock_queue_released(GLock *lock, int64_t now, int64_t hold_us);
+
+void _g_lock_manager_foreach(
+  GLockManager *manager,
+  GFunc lock_func,
+  GFunc class_func,
+  gpointer user_data
+  );
+bool _g_lock_manager_foreach_signal(
+  GLockManager *manager,
+  GFunc func,
+  gpointer user_data
+  );
+
+bool _g_lock_session_check_lock(
+  GLockSession *session,
+  GLock *lock,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite
+  );
+bool _g_lock_try_take(
+  GLockSession *session,
+  GLock *lock,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite
+  );
+bool _g_lock_session_add_lock(GLockSession *session, GLock *lock);
+bool _g_lock_session_check_compact(GLockSession *session, GLockCompact *lock);
+void _g_lock_time_stats_add(struct g_lock_time_stats *stats, int64_t us);
+struct g_lock_callsite_stats *_g_lock_callsite_stats_get(
+  GLock *lock,
+  const struct g_lock_callsite *callsite
+  );
+
+// g_lock_budget.c
+void _g_lock_budget_acquired(GLock *lock, struct g_lock_caller *caller);
+void _g_lock_budget_released(
+  GLock *lock,
+  struct g_lock_callsite_stats *site,
+  struct g_lock_caller *caller,
+  int64_t hold_us
+  );
+void _g_lock_callsite_stats_free(gpointer data);
+
+// g_lock_async.c
+void _g_lock_async_wake(GLock *lock);
+void _g_lock_async_yield(GLock *lock);
+
+// g_lock_executor.c
+void _g_lock_executor_wake(GLock *lock);
+
+// g_lock_epoch.c
+void _g_lock_epoch_enter();
+void _g_lock_epoch_exit();
+bool _g_lock_epoch_enter_signal();
+void _g_lock_epoch_exit_signal();
+void _g_lock_epoch_retire(gpointer data, GDestroyNotify func);
+void _g_lock_epoch_synchronize();
+
+// g_lock_compact.c
+GLockClass *_g_lock_compact_class(GLockCompact *lock);
+
+// g_lock_cohort.c
+void _g_lock_cohort_lock(struct g_lock_cohort_lock *cohort);
+bool _g_lock_cohort_trylock(struct g_lock_cohort_lock *cohort);
+void _g_lock_cohort_unlock(struct g_lock_cohort_lock *cohort);
+void _g_lock_cohort_handoffs(
+  struct g_lock_cohort_lock *cohort,
+  uint64_t *local,
+  uint64_t *global
+  );
+void _g_lock_cohort_clear(struct g_lock_cohort_lock *cohort);
+
+// g_lock_shared.c
+bool _g_lock_shared_valid(GLockShared *shared);
+void _g_lock_shared_lock(GLockShared *shared);
+bool _g_lock_shared_trylock(GLockShared *shared);
+void _g_lock_shared_unlock(GLockShared *shared);
+void _g_lock_shared_print(GLockShared *shared);
+
+// g_lock_metrics.c
+extern const uint64_t _g_lock_metrics_bounds[G_LOCK_METRICS_BUCKETS - 1];
+void _g_lock_metrics_copy(
+  struct g_lock_metrics *dst,
+  struct g_lock_metrics *src
+  );
+void _g_lock_metrics_add(
+  struct g_lock_metrics *metrics,
+  int64_t wait_us,
+  int64_t hold_us,
+  bool contended
+  );
+void _g_lock_metrics_holders(GLock *lock, int64_t delta);
+void _g_lock_metrics_taken(GLock *lock, struct g_lock_caller *caller);
+
+// g_lock_publish.c
+extern gint _g_lock_publishing;
+void _g_lock_publish_lock(GLock *lock);
+void _g_lock_publish_class(GLockClass *klass);
+void _g_lock_publish_detach(struct g_lock_metrics *metrics);
+void _g_lock_publish_add(
+  struct g_lock_metrics *metrics,
+  uint64_t wait_us,
+  int wait_bucket,
+  int64_t hold_us,
+  int hold_bucket,
+  bool contended
+  );
+void _g_lock_publish_holders(struct g_lock_metrics *metrics, int64_t delta);
+
+// g_lock_trace.c
+enum g_lock_trace_phase {
+  G_LOCK_TRACE_WAIT=0,
+  G_LOCK_TRACE_ACQUIRED,
+  G_LOCK_TRACE_RELEASED,
+};
+
+void _g_lock_trace_add(
+  GLock *lock,
+  enum g_lock_trace_phase phase,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite,
+  int64_t time
+  );
+
+// g_lock_thread.c
+void _g_lock_thread_waited(int64_t wait_us);
+void _g_lock_thread_cond_waited(int64_t wait_us);
+void _g_lock_thread_released(struct g_lock_caller *caller, int64_t hold_us);
+
+// g_lock_deadlock.c
+void _g_lock_deadlock_wait(
+  GLock *lock,
+  enum g_lock_action action,
+  struct g_lock_caller *caller
+  );
+
+#endif // _G_LOCK_MANAGER_PRIVATE_H
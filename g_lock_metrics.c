@@ -0,0 +1,741 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * OpenMetrics exporter
+ *
+ * Every lock and lock class keeps a set of atomic counters next to
+ * its regular statistics. They are only updated while somebody reads
+ * them: the exporter, the live statistics file or a caller of
+ * g_lock_metrics_collect_start. Otherwise the locking path pays for
+ * a single flag check. A scrape copies those counters for all the
+ * locks of a manager into a snapshot and renders the snapshot after
+ * letting go of the manager. Only the manager lock is taken, so
+ * scraping delays lock creation but never the locking threads.
+ *
+ * The exporter thread answers every connection on its socket with
+ * a minimal HTTP response carrying the rendered metrics.
+ */
+
+#define G_LOCK_METRICS_REQUEST_MAX 4096
+#define G_LOCK_METRICS_TIMEOUT_MS 1000
+
+/**
+ * Upper bounds of the histogram buckets in microseconds
+ */
+const uint64_t _g_lock_metrics_bounds[G_LOCK_METRICS_BUCKETS - 1] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000
+};
+
+/**
+ * Bucket bounds as rendered in the le label, in seconds
+ */
+static const char *_bucket_labels[G_LOCK_METRICS_BUCKETS] = {
+  "1e-06", "1e-05", "0.0001", "0.001", "0.01", "0.1", "1.0", "+Inf"
+};
+
+/**
+ * Copy of the counters of one lock or class
+ */
+struct g_lock_metrics_entry {
+  const char *name; /*<< Interned or static, never freed */
+  uint32_t index;
+  bool is_class;
+  struct g_lock_metrics metrics;
+};
+
+static struct {
+  GMutex lock; /*<< Protects the members below */
+  GThread *thread;
+  int listen_fd;
+  int wake_fd[2]; /*<< Written to stop the thread */
+  char *unix_path; /*<< Removed once the exporter stops */
+  GLockManager *manager;
+} _exporter;
+
+/**
+ * Find the bucket of a time sample
+ *
+ * @param us The sample in microseconds
+ * @return The bucket index
+ */
+static int _bucket(uint64_t us)
+{
+  int ix;
+  for(ix = 0; ix < G_LOCK_METRICS_BUCKETS - 1; ix++) {
+    if(us <= _g_lock_metrics_bounds[ix]) {
+      break;
+    }
+  }
+  return ix;
+}
+
+/**
+ * Start updating the metrics of the locks of a manager
+ *
+ * Calls nest, the metrics are updated until every start is matched
+ * by a stop. Acquisitions made before are not counted.
+ *
+ * @param manager The manager whose locks are counted
+ */
+void g_lock_metrics_collect_start_in(GLockManager *manager)
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return;
+  }
+  g_atomic_int_inc(&manager->metrics_collecting);
+}
+
+/**
+ * Start updating the metrics of the locks
+ */
+void g_lock_metrics_collect_start()
+{
+  g_lock_metrics_collect_start_in(g_lock_manager_default());
+}
+
+/**
+ * Stop updating the metrics of the locks of a manager
+ *
+ * The metrics collected so far can still be read.
+ *
+ * @param manager The manager whose locks were counted
+ */
+void g_lock_metrics_collect_stop_in(GLockManager *manager)
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return;
+  }
+  if(g_atomic_int_get(&manager->metrics_collecting) <= 0) {
+    lock_log("Metrics are not being collected");
+    return;
+  }
+  g_atomic_int_add(&manager->metrics_collecting, -1);
+}
+
+/**
+ * Stop updating the metrics of the locks
+ */
+void g_lock_metrics_collect_stop()
+{
+  g_lock_metrics_collect_stop_in(g_lock_manager_default());
+}
+
+/**
+ * Add a completed acquisition to a set of metrics
+ *
+ * @param metrics The metrics to update
+ * @param wait_us Time spent waiting for the lock
+ * @param hold_us Time the lock was held, negative if not known
+ * @param contended Whether the lock was busy when asked for
+ */
+void _g_lock_metrics_add(
+  struct g_lock_metrics *metrics,
+  int64_t wait_us,
+  int64_t hold_us,
+  bool contended
+  )
+{
+  uint64_t wait = wait_us > 0? wait_us: 0;
+  int wait_bucket = _bucket(wait);
+  int hold_bucket = hold_us >= 0? _bucket(hold_us): -1;
+  __atomic_fetch_add(&metrics->acquisitions, 1, __ATOMIC_RELAXED);
+  if(contended) {
+    __atomic_fetch_add(&metrics->contended, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&metrics->wait_sum_us, wait, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&metrics->wait_buckets[wait_bucket], 1,
+    __ATOMIC_RELAXED);
+  if(hold_us >= 0) {
+    __atomic_fetch_add(&metrics->hold_sum_us, hold_us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics->hold_buckets[hold_bucket], 1,
+      __ATOMIC_RELAXED);
+  }
+  if(G_UNLIKELY(g_atomic_pointer_get(&metrics->published))) {
+    _g_lock_publish_add(metrics, wait, wait_bucket, hold_us, hold_bucket,
+      contended);
+  }
+}
+
+/**
+ * Update the number of sessions holding a lock and its class
+ *
+ * @param lock The lock taken or released
+ * @param delta 1 when taken, -1 when released
+ */
+void _g_lock_metrics_holders(GLock *lock, int64_t delta)
+{
+  __atomic_fetch_add(&lock->metrics.holders, delta, __ATOMIC_RELAXED);
+  if(G_UNLIKELY(g_atomic_pointer_get(&lock->metrics.published))) {
+    _g_lock_publish_holders(&lock->metrics, delta);
+  }
+  if(lock->klass) {
+    __atomic_fetch_add(&lock->klass->metrics.holders, delta,
+      __ATOMIC_RELAXED);
+    if(G_UNLIKELY(g_atomic_pointer_get(&lock->klass->metrics.published))) {
+      _g_lock_publish_holders(&lock->klass->metrics, delta);
+    }
+  }
+}
+
+/**
+ * Count a caller which just took a lock in the holders
+ *
+ * Only called while collecting, the release looks at the caller so
+ * holders stay balanced when collection starts or stops meanwhile.
+ *
+ * @param lock The lock taken
+ * @param caller The caller record of the acquisition
+ */
+void _g_lock_metrics_taken(GLock *lock, struct g_lock_caller *caller)
+{
+  caller->metered = true;
+  _g_lock_metrics_holders(lock, 1);
+}
+
+/**
+ * Copy a set of metrics
+ *
+ * @param dst Where to copy to
+ * @param src The metrics being updated by the locking threads
+ */
+void _g_lock_metrics_copy(
+  struct g_lock_metrics *dst,
+  struct g_lock_metrics *src
+  )
+{
+  dst->acquisitions = __atomic_load_n(&src->acquisitions, __ATOMIC_RELAXED);
+  dst->contended = __atomic_load_n(&src->contended, __ATOMIC_RELAXED);
+  dst->holders = __atomic_load_n(&src->holders, __ATOMIC_RELAXED);
+  dst->wait_sum_us = __atomic_load_n(&src->wait_sum_us, __ATOMIC_RELAXED);
+  dst->hold_sum_us = __atomic_load_n(&src->hold_sum_us, __ATOMIC_RELAXED);
+  for(int ix = 0; ix < G_LOCK_METRICS_BUCKETS; ix++) {
+    dst->wait_buckets[ix] = __atomic_load_n(&src->wait_buckets[ix],
+      __ATOMIC_RELAXED);
+    dst->hold_buckets[ix] = __atomic_load_n(&src->hold_buckets[ix],
+      __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Add the metrics of a lock to a snapshot
+ *
+ * Instances of a class are only exported through their class.
+ *
+ * @param data The lock
+ * @param user_data The snapshot
+ */
+static void _snapshot_lock(gpointer data, gpointer user_data)
+{
+  GLock *lock = data;
+  GArray *snapshot = user_data;
+  struct g_lock_metrics_entry entry;
+  if(lock->klass) {
+    return;
+  }
+  entry.name = lock->name;
+  entry.index = lock->index;
+  entry.is_class = false;
+  _g_lock_metrics_copy(&entry.metrics, &lock->metrics);
+  g_array_append_val(snapshot, entry);
+}
+
+/**
+ * Add the metrics of a class to a snapshot
+ *
+ * @param data The class
+ * @param user_data The snapshot
+ */
+static void _snapshot_class(gpointer data, gpointer user_data)
+{
+  GLockClass *klass = data;
+  GArray *snapshot = user_data;
+  struct g_lock_metrics_entry entry;
+  entry.name = klass->name;
+  entry.index = klass->index;
+  entry.is_class = true;
+  _g_lock_metrics_copy(&entry.metrics, &klass->metrics);
+  g_array_append_val(snapshot, entry);
+}
+
+/**
+ * Append the labels identifying an entry
+ *
+ * @param out The text being rendered
+ * @param entry The entry
+ */
+static void _render_labels(GString *out, struct g_lock_metrics_entry *entry)
+{
+  g_string_append(out, entry->is_class? "class=\"": "lock=\"");
+  for(const char *c = entry->name; *c; c++) {
+    switch(*c) {
+      case '\\':
+        g_string_append(out, "\\\\");
+        break;
+      case '"':
+        g_string_append(out, "\\\"");
+        break;
+      case '\n':
+        g_string_append(out, "\\n");
+        break;
+      default:
+        g_string_append_c(out, *c);
+        break;
+    }
+  }
+  g_string_append_printf(out, "\",index=\"%u\"", entry->index);
+}
+
+/**
+ * Render a histogram family
+ *
+ * @param out The text being rendered
+ * @param snapshot The entries to render
+ * @param family The name of the family
+ * @param help The description of the family
+ * @param hold Whether to render hold times instead of wait times
+ */
+static void _render_histogram(
+  GString *out,
+  GArray *snapshot,
+  const char *family,
+  const char *help,
+  bool hold
+  )
+{
+  struct g_lock_metrics_entry *entry;
+  uint64_t *buckets, sum_us, count;
+
+  g_string_append_printf(out, "# TYPE %s histogram\n", family);
+  g_string_append_printf(out, "# UNIT %s seconds\n", family);
+  g_string_append_printf(out, "# HELP %s %s\n", family, help);
+  for(guint ix = 0; ix < snapshot->len; ix++) {
+    entry = &g_array_index(snapshot, struct g_lock_metrics_entry, ix);
+    buckets = hold? entry->metrics.hold_buckets: entry->metrics.wait_buckets;
+    sum_us = hold? entry->metrics.hold_sum_us: entry->metrics.wait_sum_us;
+    // The count comes from the buckets so the histogram adds up
+    count = 0;
+    for(int bx = 0; bx < G_LOCK_METRICS_BUCKETS; bx++) {
+      count += buckets[bx];
+      g_string_append_printf(out, "%s_bucket{", family);
+      _render_labels(out, entry);
+      g_string_append_printf(out, ",le=\"%s\"} %" PRIu64 "\n",
+        _bucket_labels[bx], count);
+    }
+    g_string_append_printf(out, "%s_sum{", family);
+    _render_labels(out, entry);
+    g_string_append_printf(out, "} %" PRIu64 ".%06" PRIu64 "\n",
+      sum_us / 1000000, sum_us % 1000000);
+    g_string_append_printf(out, "%s_count{", family);
+    _render_labels(out, entry);
+    g_string_append_printf(out, "} %" PRIu64 "\n", count);
+  }
+}
+
+/**
+ * Render a counter family
+ *
+ * @param out The text being rendered
+ * @param snapshot The entries to render
+ * @param family The name of the family
+ * @param help The description of the family
+ * @param contended Whether to render contended acquisitions
+ */
+static void _render_counter(
+  GString *out,
+  GArray *snapshot,
+  const char *family,
+  const char *help,
+  bool contended
+  )
+{
+  struct g_lock_metrics_entry *entry;
+  g_string_append_printf(out, "# TYPE %s counter\n", family);
+  g_string_append_printf(out, "# HELP %s %s\n", family, help);
+  for(guint ix = 0; ix < snapshot->len; ix++) {
+    entry = &g_array_index(snapshot, struct g_lock_metrics_entry, ix);
+    g_string_append_printf(out, "%s_total{", family);
+    _render_labels(out, entry);
+    g_string_append_printf(out, "} %" PRIu64 "\n",
+      contended? entry->metrics.contended: entry->metrics.acquisitions);
+  }
+}
+
+/**
+ * Render the metrics of a manager in the OpenMetrics text format
+ *
+ * Instances of a lock class are aggregated into their class.
+ *
+ * @param manager The manager owning the locks
+ * @return The allocated text, to be freed with g_free
+ */
+char *g_lock_metrics_render_in(GLockManager *manager)
+{
+  struct g_lock_metrics_entry *entry;
+  GArray *snapshot;
+  GString *out;
+
+  if(!manager) {
+    lock_log("No manager provided");
+    return NULL;
+  }
+
+  // Copy everything first, then render without holding anything
+  snapshot = g_array_new(FALSE, FALSE, sizeof(struct g_lock_metrics_entry));
+  _g_lock_manager_foreach(manager, _snapshot_lock, _snapshot_class,
+    snapshot);
+
+  out = g_string_new(NULL);
+  _render_counter(out, snapshot, "glock_acquisitions",
+    "Completed lock acquisitions.", false);
+  _render_counter(out, snapshot, "glock_contended",
+    "Acquisitions which found the lock busy.", true);
+  _render_histogram(out, snapshot, "glock_wait_seconds",
+    "Time spent waiting for the lock.", false);
+  _render_histogram(out, snapshot, "glock_hold_seconds",
+    "Time the lock was held.", true);
+  g_string_append(out, "# TYPE glock_holders gauge\n");
+  g_string_append(out, "# HELP glock_holders Sessions holding the lock.\n");
+  for(guint ix = 0; ix < snapshot->len; ix++) {
+    entry = &g_array_index(snapshot, struct g_lock_metrics_entry, ix);
+    g_string_append(out, "glock_holders{");
+    _render_labels(out, entry);
+    g_string_append_printf(out, "} %" PRId64 "\n", entry->metrics.holders);
+  }
+  g_string_append(out, "# EOF\n");
+
+  g_array_free(snapshot, TRUE);
+  return g_string_free(out, FALSE);
+}
+
+/**
+ * Render the metrics of the default manager
+ *
+ * @return The allocated text, to be freed with g_free
+ */
+char *g_lock_metrics_render()
+{
+  return g_lock_metrics_render_in(g_lock_manager_default());
+}
+
+/**
+ * Write a whole buffer to a socket
+ *
+ * @param fd The socket
+ * @param data The data to write
+ * @param len The length of the data
+ * @return true if everything was written
+ */
+static bool _write_all(int fd, const char *data, size_t len)
+{
+  ssize_t written;
+  while(len) {
+    written = send(fd, data, len, MSG_NOSIGNAL);
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    len -= written;
+  }
+  return true;
+}
+
+/**
+ * Answer one scrape
+ *
+ * The request is read up to the end of its headers and ignored, any
+ * path returns the metrics.
+ *
+ * @param fd The client socket
+ */
+static void _serve_client(int fd)
+{
+  char request[G_LOCK_METRICS_REQUEST_MAX + 1];
+  size_t used = 0;
+  ssize_t got;
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  char *body, *header;
+
+  while(used < G_LOCK_METRICS_REQUEST_MAX) {
+    if(poll(&pfd, 1, G_LOCK_METRICS_TIMEOUT_MS) <= 0) {
+      return;
+    }
+    got = recv(fd, request + used, G_LOCK_METRICS_REQUEST_MAX - used, 0);
+    if(got <= 0) {
+      return;
+    }
+    used += got;
+    request[used] = '\0';
+    if(strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+      break;
+    }
+  }
+
+  body = g_lock_metrics_render_in(_exporter.manager);
+  header = g_strdup_printf(
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: application/openmetrics-text; version=1.0.0; "
+    "charset=utf-8\r\n"
+    "Content-Length: %zu\r\n"
+    "Connection: close\r\n"
+    "\r\n",
+    strlen(body));
+  if(_write_all(fd, header, strlen(header))) {
+    _write_all(fd, body, strlen(body));
+  }
+  g_free(header);
+  g_free(body);
+}
+
+/**
+ * Exporter thread accepting scrapes until stopped
+ */
+static gpointer _exporter_thread(gpointer data)
+{
+  int client;
+  struct pollfd pfds[2] = {
+    { _exporter.listen_fd, POLLIN, 0 },
+    { _exporter.wake_fd[0], POLLIN, 0 },
+  };
+  while(true) {
+    if(poll(pfds, 2, -1) < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      lock_log("Metrics exporter failed to poll: %s", strerror(errno));
+      break;
+    }
+    if(pfds[1].revents) {
+      break;
+    }
+    if(!(pfds[0].revents & POLLIN)) {
+      continue;
+    }
+    client = accept(_exporter.listen_fd, NULL, NULL);
+    if(client < 0) {
+      continue;
+    }
+    _serve_client(client);
+    close(client);
+  }
+  return NULL;
+}
+
+/**
+ * Whether the exporter thread is running
+ *
+ * @return true if it is running
+ */
+static bool _exporter_running()
+{
+  bool running;
+  g_mutex_lock(&_exporter.lock);
+  running = _exporter.thread != NULL;
+  g_mutex_unlock(&_exporter.lock);
+  if(running) {
+    lock_log("Metrics exporter is already running");
+  }
+  return running;
+}
+
+/**
+ * Start the exporter thread on a listening socket
+ *
+ * @param manager The manager whose metrics are served
+ * @param fd The listening socket, closed on failure
+ * @param unix_path Path to remove when stopping or NULL
+ * @return true if the exporter is running
+ */
+static bool _exporter_start(
+  GLockManager *manager,
+  int fd,
+  const char *unix_path
+  )
+{
+  if(listen(fd, 8) < 0) {
+    lock_log("Failed to listen for metrics: %s", strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  g_mutex_lock(&_exporter.lock);
+  if(_exporter.thread) {
+    g_mutex_unlock(&_exporter.lock);
+    lock_log("Metrics exporter is already running");
+    close(fd);
+    return false;
+  }
+  if(pipe(_exporter.wake_fd) < 0) {
+    g_mutex_unlock(&_exporter.lock);
+    lock_log("Failed to create metrics wake up pipe: %s", strerror(errno));
+    close(fd);
+    return false;
+  }
+  _exporter.listen_fd = fd;
+  _exporter.manager = manager;
+  _exporter.unix_path = unix_path? strdup(unix_path): NULL;
+  g_lock_metrics_collect_start_in(manager);
+  _exporter.thread = g_thread_new("g-lock-metrics", _exporter_thread, NULL);
+  g_mutex_unlock(&_exporter.lock);
+  return true;
+}
+
+/**
+ * Serve the metrics of a manager on a Unix socket
+ *
+ * An existing file at the path is replaced. Only one exporter runs
+ * at a time.
+ *
+ * @param manager The manager whose metrics are served
+ * @param path Path of the socket
+ * @return true if the exporter is running
+ */
+bool g_lock_metrics_start_unix_in(GLockManager *manager, const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+  if(!manager) {
+    lock_log("No manager provided");
+    return false;
+  }
+  if(!path) {
+    lock_log("No socket path provided");
+    return false;
+  }
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    lock_log("Socket path %s is too long", path);
+    return false;
+  }
+  if(_exporter_running()) {
+    return false;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    lock_log("Failed to create metrics socket: %s", strerror(errno));
+    return false;
+  }
+  unlink(path);
+  if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    lock_log("Failed to bind metrics socket %s: %s", path, strerror(errno));
+    close(fd);
+    return false;
+  }
+  return _exporter_start(manager, fd, path);
+}
+
+/**
+ * Serve the metrics of the default manager on a Unix socket
+ *
+ * @param path Path of the socket
+ * @return true if the exporter is running
+ */
+bool g_lock_metrics_start_unix(const char *path)
+{
+  return g_lock_metrics_start_unix_in(g_lock_manager_default(), path);
+}
+
+/**
+ * Serve the metrics of a manager on a local TCP port
+ *
+ * Only the loopback interface is listened on. Only one exporter runs
+ * at a time.
+ *
+ * @param manager The manager whose metrics are served
+ * @param port The port to listen on
+ * @return true if the exporter is running
+ */
+bool g_lock_metrics_start_tcp_in(GLockManager *manager, uint16_t port)
+{
+  struct sockaddr_in addr;
+  int fd, reuse = 1;
+
+  if(!manager) {
+    lock_log("No manager provided");
+    return false;
+  }
+  if(_exporter_running()) {
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    lock_log("Failed to create metrics socket: %s", strerror(errno));
+    return false;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    lock_log("Failed to bind metrics port %u: %s", port, strerror(errno));
+    close(fd);
+    return false;
+  }
+  return _exporter_start(manager, fd, NULL);
+}
+
+/**
+ * Serve the metrics of the default manager on a local TCP port
+ *
+ * @param port The port to listen on
+ * @return true if the exporter is running
+ */
+bool g_lock_metrics_start_tcp(uint16_t port)
+{
+  return g_lock_metrics_start_tcp_in(g_lock_manager_default(), port);
+}
+
+/**
+ * Stop the metrics exporter
+ */
+void g_lock_metrics_stop()
+{
+  GThread *thread;
+  GLockManager *manager;
+  g_mutex_lock(&_exporter.lock);
+  thread = _exporter.thread;
+  manager = _exporter.manager;
+  _exporter.thread = NULL;
+  g_mutex_unlock(&_exporter.lock);
+  if(!thread) {
+    return;
+  }
+
+  if(write(_exporter.wake_fd[1], "", 1) < 0) {
+    lock_log("Failed to wake up the metrics exporter: %s", strerror(errno));
+  }
+  g_thread_join(thread);
+  g_lock_metrics_collect_stop_in(manager);
+  close(_exporter.wake_fd[0]);
+  close(_exporter.wake_fd[1]);
+  close(_exporter.listen_fd);
+  if(_exporter.unix_path) {
+    unlink(_exporter.unix_path);
+    free(_exporter.unix_path);
+    _exporter.unix_path = NULL;
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef _G_LOCK_PROBES_H
+#define _G_LOCK_PROBES_H
+
+/**
+ * USDT probes for perf, bpftrace and SystemTap
+ *
+ * Only built in when configured with --enable-usdt, otherwise the
+ * macros expand to nothing. A probe nobody is attached to is a
+ * single nop. All probes belong to the glock provider:
+ *
+ *   create(index, name, type)
+ *   wait(index, name, action, func, file, line)
+ *   acquired(index, name, action, func, file, line, wait_us)
+ *   release(index, name, action, func, file, line)
+ *   order_violation(index, name, held_index, held_name, func, file, line)
+ *
+ * func, file and line describe the call site, they are NULL and 0
+ * when the call site is not known.
+ */
+
+// For probes fired where the call site is not known
+#define G_LOCK_PROBE_NO_CALLSITE ((const struct g_lock_callsite *)NULL)
+
+#ifdef G_LOCK_HAVE_USDT
+#include <sys/sdt.h>
+
+#define G_LOCK_PROBE_CREATE(lock) \
+  STAP_PROBE3(glock, create, (lock)->index, (lock)->name, (lock)->type)
+#define G_LOCK_PROBE_WAIT(lock, action, callsite) \
+  STAP_PROBE6(glock, wait, (lock)->index, (lock)->name, action, \
+    (callsite)->func, (callsite)->file, (callsite)->line)
+#define G_LOCK_PROBE_ACQUIRED(lock, action, callsite, wait_us) \
+  STAP_PROBE7(glock, acquired, (lock)->index, (lock)->name, action, \
+    (callsite)->func, (callsite)->file, (callsite)->line, wait_us)
+#define G_LOCK_PROBE_RELEASE(lock, action, callsite) \
+  STAP_PROBE6(glock, release, (lock)->index, (lock)->name, action, \
+    (callsite)->func, (callsite)->file, (callsite)->line)
+#define G_LOCK_PROBE_ORDER_VIOLATION(index, name, held_index, held_name, \
+    callsite) \
+  STAP_PROBE7(glock, order_violation, index, name, held_index, held_name, \
+    (callsite)? (callsite)->func: NULL, \
+    (callsite)? (callsite)->file: NULL, \
+    (callsite)? (callsite)->line: 0)
+
+#else
+
+#define G_LOCK_PROBE_CREATE(lock) do {} while(0)
+#define G_LOCK_PROBE_WAIT(lock, action, callsite) do {} while(0)
+#define G_LOCK_PROBE_ACQUIRED(lock, action, callsite, wait_us) do {} while(0)
+#define G_LOCK_PROBE_RELEASE(lock, action, callsite) do {} while(0)
+#define G_LOCK_PROBE_ORDER_VIOLATION(index, name, held_index, held_name, \
+    callsite) do {} while(0)
+
+#endif // G_LOCK_HAVE_USDT
+
+#endif // _G_LOCK_PROBES_H
@@ -0,0 +1,468 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Live statistics file
+ *
+ * The counters of every lock and class of a manager are mirrored into
+ * records of a memory-mapped file, so another process can map it and
+ * watch them without asking this process anything. The file has a
+ * fixed layout described in g_lock_manager.h.
+ *
+ * The locking threads update the record of a lock at the same time as
+ * its metrics, which are collected while publishing. Each record is a
+ * sequence lock: a writer makes seq odd with a compare and swap,
+ * updates the record and makes seq even again. Writers of different
+ * locks never touch the same cache lines and readers never write, so
+ * watching the file can't slow the process down.
+ *
+ * Records of freed locks are reused. When the file is full, new locks
+ * are counted as dropped and not published.
+ */
+
+#define G_LOCK_PUBLISH_DEFAULT_CAPACITY 1024
+
+gint _g_lock_publishing = 0;
+
+static struct {
+  GMutex lock; /*<< Protects the members below except writers */
+  GLockManager *manager;
+  int fd;
+  void *map;
+  size_t size;
+  struct g_lock_publish_header *header;
+  struct g_lock_publish_record *records;
+  GArray *free_records; /*<< Indexes of records which can be reused */
+  gint writers; /*<< Threads updating a record right now */
+} _publish = { .fd = -1 };
+
+/**
+ * Start writing a record
+ *
+ * The record is looked up again once the thread is counted as a
+ * writer, so g_lock_publish_stop can wait for writers to leave before
+ * unmapping the file.
+ *
+ * @param metrics The metrics the record mirrors
+ * @return The record to write or NULL if it is not published anymore
+ */
+static struct g_lock_publish_record *_publish_begin(
+  struct g_lock_metrics *metrics
+  )
+{
+  struct g_lock_publish_record *record;
+  uint32_t seq;
+
+  g_atomic_int_inc(&_publish.writers);
+  record = g_atomic_pointer_get(&metrics->published);
+  if(!record) {
+    g_atomic_int_add(&_publish.writers, -1);
+    return NULL;
+  }
+  for(;;) {
+    seq = __atomic_load_n(&record->seq, __ATOMIC_RELAXED);
+    if(!(seq & 1) && __atomic_compare_exchange_n(&record->seq, &seq,
+         seq + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return record;
+    }
+  }
+}
+
+/**
+ * Finish writing a record
+ *
+ * @param record The record written
+ */
+static void _publish_end(struct g_lock_publish_record *record)
+{
+  __atomic_fetch_add(&record->seq, 1, __ATOMIC_RELEASE);
+  g_atomic_int_add(&_publish.writers, -1);
+}
+
+/**
+ * Wait for the threads writing a record to finish
+ */
+static void _publish_wait_writers()
+{
+  while(g_atomic_int_get(&_publish.writers)) {
+    g_thread_yield();
+  }
+}
+
+/**
+ * Mirror a completed acquisition into the record of a set of metrics
+ *
+ * @param metrics The metrics which were updated
+ * @param wait_us Time spent waiting for the lock
+ * @param wait_bucket Histogram bucket of the wait
+ * @param hold_us Time the lock was held, negative if not known
+ * @param hold_bucket Histogram bucket of the hold
+ * @param contended Whether the lock was busy when asked for
+ */
+void _g_lock_publish_add(
+  struct g_lock_metrics *metrics,
+  uint64_t wait_us,
+  int wait_bucket,
+  int64_t hold_us,
+  int hold_bucket,
+  bool contended
+  )
+{
+  struct g_lock_publish_record *record = _publish_begin(metrics);
+  if(!record) {
+    return;
+  }
+  record->acquisitions++;
+  if(contended) {
+    record->contended++;
+  }
+  record->wait_sum_us += wait_us;
+  record->wait_buckets[wait_bucket]++;
+  if(hold_us >= 0) {
+    record->hold_sum_us += hold_us;
+    record->hold_buckets[hold_bucket]++;
+  }
+  _publish_end(record);
+}
+
+/**
+ * Mirror a change of holders into the record of a set of metrics
+ *
+ * @param metrics The metrics which were updated
+ * @param delta 1 when taken, -1 when released
+ */
+void _g_lock_publish_holders(struct g_lock_metrics *metrics, int64_t delta)
+{
+  struct g_lock_publish_record *record = _publish_begin(metrics);
+  if(!record) {
+    return;
+  }
+  record->holders += delta;
+  _publish_end(record);
+}
+
+/**
+ * Give a record to a lock or class
+ *
+ * The caller must hold _publish.lock. Counters from before the record
+ * was given are copied into it, updates made while copying may be
+ * missing.
+ *
+ * @param metrics The metrics to publish
+ * @param state What the record describes
+ * @param index Index of the lock or class
+ * @param type Type of the lock
+ * @param name Name of the lock or class
+ */
+static void _publish_attach(
+  struct g_lock_metrics *metrics,
+  enum g_lock_publish_state state,
+  uint32_t index,
+  enum g_lock_type type,
+  const char *name
+  )
+{
+  struct g_lock_publish_record *record;
+  struct g_lock_metrics copy;
+  uint32_t slot;
+
+  if(!_publish.map || metrics->published) {
+    return;
+  }
+  if(_publish.free_records->len) {
+    slot = g_array_index(_publish.free_records, uint32_t,
+      _publish.free_records->len - 1);
+    g_array_set_size(_publish.free_records, _publish.free_records->len - 1);
+  } else if(_publish.header->used < _publish.header->capacity) {
+    slot = _publish.header->used;
+    __atomic_store_n(&_publish.header->used, slot + 1, __ATOMIC_RELEASE);
+  } else {
+    _publish.header->dropped++;
+    return;
+  }
+
+  _g_lock_metrics_copy(&copy, metrics);
+  record = &_publish.records[slot];
+  // Nobody else writes a free record
+  __atomic_store_n(&record->seq, record->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  record->state = state;
+  record->index = index;
+  record->type = type;
+  g_strlcpy(record->name, name, sizeof(record->name));
+  record->acquisitions = copy.acquisitions;
+  record->contended = copy.contended;
+  record->holders = copy.holders;
+  record->wait_sum_us = copy.wait_sum_us;
+  record->hold_sum_us = copy.hold_sum_us;
+  memcpy(record->wait_buckets, copy.wait_buckets,
+    sizeof(record->wait_buckets));
+  memcpy(record->hold_buckets, copy.hold_buckets,
+    sizeof(record->hold_buckets));
+  __atomic_store_n(&record->seq, record->seq + 1, __ATOMIC_RELEASE);
+  g_atomic_pointer_set(&metrics->published, record);
+}
+
+/**
+ * Publish the counters of a new lock
+ *
+ * Instances of a class are published through their class.
+ *
+ * @param lock The lock
+ */
+void _g_lock_publish_lock(GLock *lock)
+{
+  if(lock->klass) {
+    return;
+  }
+  g_mutex_lock(&_publish.lock);
+  if(lock->manager == _publish.manager) {
+    _publish_attach(&lock->metrics, G_LOCK_PUBLISH_LOCK, lock->index,
+      lock->type, lock->name);
+  }
+  g_mutex_unlock(&_publish.lock);
+}
+
+/**
+ * Publish the counters of a new class
+ *
+ * @param klass The class
+ */
+void _g_lock_publish_class(GLockClass *klass)
+{
+  g_mutex_lock(&_publish.lock);
+  if(klass->manager == _publish.manager) {
+    _publish_attach(&klass->metrics, G_LOCK_PUBLISH_CLASS, klass->index,
+      G_LOCK_MUTEX, klass->name);
+  }
+  g_mutex_unlock(&_publish.lock);
+}
+
+/**
+ * Stop publishing the counters of a lock or class being freed
+ *
+ * @param metrics The metrics of the lock or class
+ */
+void _g_lock_publish_detach(struct g_lock_metrics *metrics)
+{
+  struct g_lock_publish_record *record;
+  uint32_t slot;
+
+  g_mutex_lock(&_publish.lock);
+  record = metrics->published;
+  g_atomic_pointer_set(&metrics->published, NULL);
+  if(record && _publish.map) {
+    // The record is reused, let writers holding it finish
+    _publish_wait_writers();
+    __atomic_store_n(&record->seq, record->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memset((char *)record + sizeof(record->seq), 0,
+      sizeof(struct g_lock_publish_record) - sizeof(record->seq));
+    __atomic_store_n(&record->seq, record->seq + 1, __ATOMIC_RELEASE);
+    slot = record - _publish.records;
+    g_array_append_val(_publish.free_records, slot);
+  }
+  g_mutex_unlock(&_publish.lock);
+}
+
+/**
+ * Publish the counters of an existing lock
+ *
+ * @param data The lock
+ * @param user_data Unused
+ */
+static void _publish_each_lock(gpointer data, gpointer user_data)
+{
+  _g_lock_publish_lock(data);
+}
+
+/**
+ * Publish the counters of an existing class
+ *
+ * @param data The class
+ * @param user_data Unused
+ */
+static void _publish_each_class(gpointer data, gpointer user_data)
+{
+  _g_lock_publish_class(data);
+}
+
+/**
+ * Stop publishing the counters of a lock
+ *
+ * @param data The lock
+ * @param user_data Unused
+ */
+static void _unpublish_each_lock(gpointer data, gpointer user_data)
+{
+  GLock *lock = data;
+  g_atomic_pointer_set(&lock->metrics.published, NULL);
+}
+
+/**
+ * Stop publishing the counters of a class
+ *
+ * @param data The class
+ * @param user_data Unused
+ */
+static void _unpublish_each_class(gpointer data, gpointer user_data)
+{
+  GLockClass *klass = data;
+  g_atomic_pointer_set(&klass->metrics.published, NULL);
+}
+
+/**
+ * Publish the counters of the locks of a manager in a file
+ *
+ * The file is created or truncated and stays mapped until
+ * g_lock_publish_stop. Only one file can be published at a time.
+ *
+ * @param manager The manager whose locks are published
+ * @param path Path of the file
+ * @param capacity Number of records in the file, 0 for 1024
+ * @return true if the file is published
+ */
+bool g_lock_publish_start_in(
+  GLockManager *manager,
+  const char *path,
+  uint32_t capacity
+  )
+{
+  struct g_lock_publish_header *header;
+  size_t size;
+  void *map;
+  int fd;
+
+  if(!manager) {
+    lock_log("No manager provided");
+    return false;
+  }
+  if(!path) {
+    lock_log("No path provided");
+    return false;
+  }
+  if(!capacity) {
+    capacity = G_LOCK_PUBLISH_DEFAULT_CAPACITY;
+  }
+
+  g_mutex_lock(&_publish.lock);
+  if(_publish.map) {
+    g_mutex_unlock(&_publish.lock);
+    lock_log("Statistics are already published");
+    return false;
+  }
+  size = sizeof(struct g_lock_publish_header) +
+    (size_t)capacity * sizeof(struct g_lock_publish_record);
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd < 0) {
+    g_mutex_unlock(&_publish.lock);
+    lock_log("Failed to create %s: %s", path, strerror(errno));
+    return false;
+  }
+  if(ftruncate(fd, size) < 0) {
+    close(fd);
+    g_mutex_unlock(&_publish.lock);
+    lock_log("Failed to size %s: %s", path, strerror(errno));
+    return false;
+  }
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(map == MAP_FAILED) {
+    close(fd);
+    g_mutex_unlock(&_publish.lock);
+    lock_log("Failed to map %s: %s", path, strerror(errno));
+    return false;
+  }
+
+  header = map;
+  header->version = G_LOCK_PUBLISH_VERSION;
+  header->header_size = sizeof(struct g_lock_publish_header);
+  header->record_size = sizeof(struct g_lock_publish_record);
+  header->capacity = capacity;
+  header->buckets = G_LOCK_METRICS_BUCKETS;
+  header->pid = getpid();
+  header->started_at = g_get_real_time();
+  for(int ix = 0; ix < G_LOCK_METRICS_BUCKETS - 1; ix++) {
+    header->bucket_bounds[ix] = _g_lock_metrics_bounds[ix];
+  }
+  header->bucket_bounds[G_LOCK_METRICS_BUCKETS - 1] = UINT64_MAX;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(header->magic, G_LOCK_PUBLISH_MAGIC, sizeof(header->magic));
+
+  _publish.fd = fd;
+  _publish.map = map;
+  _publish.size = size;
+  _publish.header = header;
+  _publish.records = (struct g_lock_publish_record *)(header + 1);
+  _publish.free_records = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  _publish.manager = manager;
+  g_lock_metrics_collect_start_in(manager);
+  g_atomic_int_set(&_g_lock_publishing, 1);
+  g_mutex_unlock(&_publish.lock);
+
+  // Locks created from now on publish themselves
+  _g_lock_manager_foreach(manager, _publish_each_lock, _publish_each_class,
+    NULL);
+  return true;
+}
+
+/**
+ * Publish the counters of the locks of the default manager in a file
+ *
+ * @param path Path of the file
+ * @param capacity Number of records in the file, 0 for 1024
+ * @return true if the file is published
+ */
+bool g_lock_publish_start(const char *path, uint32_t capacity)
+{
+  return g_lock_publish_start_in(g_lock_manager_default(), path, capacity);
+}
+
+/**
+ * Stop publishing counters
+ *
+ * The file is left in place with the last values written.
+ */
+void g_lock_publish_stop()
+{
+  GLockManager *manager;
+  void *map;
+  size_t size;
+  int fd;
+
+  g_mutex_lock(&_publish.lock);
+  g_atomic_int_set(&_g_lock_publishing, 0);
+  manager = _publish.manager;
+  map = _publish.map;
+  size = _publish.size;
+  fd = _publish.fd;
+  _publish.manager = NULL;
+  _publish.map = NULL;
+  _publish.header = NULL;
+  _publish.records = NULL;
+  _publish.fd = -1;
+  if(_publish.free_records) {
+    g_array_free(_publish.free_records, TRUE);
+    _publish.free_records = NULL;
+  }
+  g_mutex_unlock(&_publish.lock);
+  if(!map) {
+    return;
+  }
+
+  _g_lock_manager_foreach(manager, _unpublish_each_lock,
+    _unpublish_each_class, NULL);
+  _publish_wait_writers();
+  g_lock_metrics_collect_stop_in(manager);
+  munmap(map, size);
+  close(fd);
+}
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Queue length and convoys
+ *
+ * Every time the number of callers waiting for a lock changes, the
+ * length it had since the previous change is accounted, which gives
+ * its average weighted by time.
+ *
+ * A convoy is a queue which stays long while every holder only keeps
+ * the lock for a short time: the callers spend their time handing
+ * the lock over rather than working under it. Splitting the critical
+ * section does not help there, taking the lock less often does. A
+ * long queue behind long holds calls for shortening the section
+ * instead. Windows are only closed when the queue changes or the
+ * lock is released, an idle lock keeps the verdict of its last busy
+ * window.
+ */
+
+/**
+ * Close the current window if it is over
+ *
+ * The caller must hold the stats lock of the GLock.
+ *
+ * @param lock The lock
+ * @param now The current monotonic time
+ */
+static void _queue_close_window(GLock *lock, int64_t now)
+{
+  struct g_lock_queue *queue = &lock->stats.queue;
+  int64_t elapsed = now - queue->window_start;
+  bool convoy;
+
+  if(elapsed < G_LOCK_CONVOY_WINDOW_US) {
+    return;
+  }
+  convoy = queue->window_holds &&
+    queue->window_area >= (uint64_t)elapsed * G_LOCK_CONVOY_WAITERS &&
+    queue->window_hold_us <= queue->window_holds * G_LOCK_CONVOY_HOLD_US;
+  if(convoy) {
+    if(!queue->convoy) {
+      lock_debug(lock->manager, "CONVOY: %s - %.1f waiting - "
+        "%" PRIu64 "us held on average", lock->name,
+        (double)queue->window_area / elapsed,
+        queue->window_hold_us / queue->window_holds);
+    }
+    queue->convoys++;
+  }
+  queue->convoy = convoy;
+  queue->window_start = now;
+  queue->window_area = 0;
+  queue->window_holds = 0;
+  queue->window_hold_us = 0;
+}
+
+/**
+ * Account the length of the queue up to now
+ *
+ * The caller must hold the stats lock of the GLock.
+ *
+ * @param lock The lock
+ * @param now The current monotonic time
+ */
+static void _queue_account(GLock *lock, int64_t now)
+{
+  struct g_lock_queue *queue = &lock->stats.queue;
+  uint64_t area;
+
+  if(G_UNLIKELY(!queue->since)) {
+    queue->since = now;
+    queue->changed_at = now;
+    queue->window_start = now;
+    return;
+  }
+  if(now > queue->changed_at) {
+    area = (uint64_t)lock->stats.waiting * (now - queue->changed_at);
+    queue->area += area;
+    queue->window_area += area;
+    queue->changed_at = now;
+  }
+  _queue_close_window(lock, now);
+}
+
+/**
+ * Change the number of callers waiting for a lock
+ *
+ * The caller must hold the stats lock of the GLock.
+ *
+ * @param lock The lock
+ * @param now The current monotonic time
+ * @param delta 1 when a caller starts waiting, -1 when it stops
+ */
+void _g_lock_queue_change(GLock *lock, int64_t now, int delta)
+{
+  _queue_account(lock, now);
+  lock->stats.waiting += delta;
+  if(lock->stats.waiting > lock->stats.queue.max_waiting) {
+    lock->stats.queue.max_waiting = lock->stats.waiting;
+  }
+}
+
+/**
+ * Account a release for the convoy detection
+ *
+ * The caller must hold the stats lock of the GLock.
+ *
+ * @param lock The lock being released
+ * @param now Monotonic time of the release
+ * @param hold_us How long it was held
+ */
+void _g_lock_queue_released(GLock *lock, int64_t now, int64_t hold_us)
+{
+  struct g_lock_queue *queue = &lock->stats.queue;
+
+  queue->window_holds++;
+  queue->window_hold_us += hold_us > 0? hold_us: 0;
+  _queue_account(lock, now);
+}
+
+/**
+ * Get the queue of a lock
+ *
+ * @param lock The lock
+ * @param stats Filled in with the state of the queue
+ * @return true on success otherwise false
+ */
+bool g_lock_queue_stats(GLock *lock, struct g_lock_queue_stats *stats)
+{
+  struct g_lock_queue *queue;
+  int64_t now, elapsed;
+
+  if(!lock) {
+    lock_log("No lock provided");
+    return false;
+  }
+  if(!stats) {
+    lock_log("No queue statistics provided");
+    return false;
+  }
+  queue = &lock->stats.queue;
+  now = g_get_monotonic_time();
+
+  g_mutex_lock(&lock->stats_lock);
+  stats->waiting = lock->stats.waiting;
+  stats->holding = lock->stats.holding;
+  stats->max_waiting = queue->max_waiting;
+  elapsed = queue->since? now - queue->since: 0;
+  if(elapsed > 0) {
+    stats->avg_waiting = (queue->area +
+      (double)lock->stats.waiting * (now - queue->changed_at)) / elapsed;
+  } else {
+    stats->avg_waiting = 0;
+  }
+  stats->convoys = queue->convoys;
+  stats->convoy = queue->convoy;
+  g_mutex_unlock(&lock->stats_lock);
+  return true;
+}
+
+/**
+ * Print a lock which went through convoys
+ *
+ * @param data The lock
+ * @param user_data Unused
+ */
+static void _print_convoys(gpointer data, gpointer user_data)
+{
+  GLock *lock = data;
+  struct g_lock_queue_stats stats;
+
+  if(!g_lock_queue_stats(lock, &stats) || !stats.convoys) {
+    return;
+  }
+  printf("Lock: %s - Convoys: %" PRIu64 "%s - Average queue: %.2f"
+    " - Longest queue: %d\n",
+    lock->name,
+    stats.convoys,
+    stats.convoy? " (ongoing)": "",
+    stats.avg_waiting,
+    stats.max_waiting);
+}
+
+/**
+ * Print the locks whose queue formed convoys
+ *
+ * @param manager The manager whose locks are shown
+ */
+void g_lock_show_convoys_in(GLockManager *manager)
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return;
+  }
+  printf("=====================================\n");
+  printf("Convoys\n");
+  printf("-----------------------------\n");
+  _g_lock_manager_foreach(manager, _print_convoys, NULL, NULL);
+  printf("=====================================\n");
+}
+
+/**
+ * Print the locks whose queue formed convoys
+ */
+void g_lock_show_convoys()
+{
+  g_lock_show_convoys_in(g_lock_manager_default());
+}
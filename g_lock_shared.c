@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Process-shared locks
+ *
+ * A GLockShared lives in memory shared by several processes, such as
+ * an anonymous shared mapping created before forking workers. It is
+ * initialized once with g_lock_shared_init, then every process gets a
+ * GLock of its own for it with g_lock_create_shared. The GLock takes
+ * part in the lock order and the statistics of that process like any
+ * other lock, while the counters and the holder in the GLockShared
+ * are common to all processes.
+ *
+ * The mutex is robust. If a process exits holding the lock, the next
+ * acquisition marks it consistent again and counts the dead holder,
+ * the data the lock protects may need to be repaired by the caller.
+ */
+
+#define G_LOCK_SHARED_MAGIC 0x474c5348 // GLSH
+
+/**
+ * Initialize a process-shared lock in shared memory
+ *
+ * Call this once, from one process, before the lock is used.
+ *
+ * @param shared The lock in shared memory
+ * @param lock_name The name of the lock
+ * @return true on success otherwise false
+ */
+bool g_lock_shared_init(GLockShared *shared, const char *lock_name)
+{
+  pthread_mutexattr_t attr;
+  int rc;
+  if(!shared) {
+    lock_log("No shared lock provided");
+    return false;
+  }
+  if(!lock_name) {
+    lock_log("No lock name provided");
+    return false;
+  }
+  memset(shared, 0, sizeof(GLockShared));
+  g_strlcpy(shared->name, lock_name, sizeof(shared->name));
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  rc = pthread_mutex_init(&shared->mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if(rc) {
+    lock_log("Failed to initialize shared lock %s: %s", lock_name,
+      strerror(rc));
+    return false;
+  }
+  shared->magic = G_LOCK_SHARED_MAGIC;
+  return true;
+}
+
+/**
+ * Destroy a process-shared lock
+ *
+ * Call this once no process uses the lock anymore.
+ *
+ * @param shared The lock in shared memory
+ */
+void g_lock_shared_clear(GLockShared *shared)
+{
+  if(!_g_lock_shared_valid(shared)) {
+    return;
+  }
+  pthread_mutex_destroy(&shared->mutex);
+  shared->magic = 0;
+}
+
+/**
+ * Check a process-shared lock was initialized
+ *
+ * @param shared The lock in shared memory
+ * @return true if the lock can be used
+ */
+bool _g_lock_shared_valid(GLockShared *shared)
+{
+  if(!shared) {
+    lock_log("No shared lock provided");
+    return false;
+  }
+  if(shared->magic != G_LOCK_SHARED_MAGIC) {
+    lock_log("Shared lock %p is not initialized", (void *)shared);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Record the new holder of a process-shared lock
+ *
+ * @param shared The lock which was just taken
+ * @param rc What taking the mutex returned
+ * @param wait_start When the acquisition started to wait or 0
+ * @return false if the lock could not be recovered
+ */
+static bool _shared_acquired(GLockShared *shared, int rc, int64_t wait_start)
+{
+  if(rc == EOWNERDEAD) {
+    lock_log("WARNING: Lock %s was held by process %d which exited, "
+      "recovering it", shared->name, (int)shared->holder_pid);
+    pthread_mutex_consistent(&shared->mutex);
+    shared->stats.owner_died++;
+  } else if(rc) {
+    lock_log("Failed to take shared lock %s: %s", shared->name,
+      strerror(rc));
+    return false;
+  }
+  shared->acquired_at = g_get_monotonic_time();
+  shared->holder_pid = getpid();
+  shared->holder_tid = syscall(SYS_gettid);
+  shared->stats.acquisitions++;
+  if(wait_start) {
+    shared->stats.contended++;
+    _g_lock_time_stats_add(&shared->stats.wait,
+      shared->acquired_at - wait_start);
+  } else {
+    _g_lock_time_stats_add(&shared->stats.wait, 0);
+  }
+  return true;
+}
+
+/**
+ * Take a process-shared lock
+ *
+ * @param shared The lock in shared memory
+ */
+void _g_lock_shared_lock(GLockShared *shared)
+{
+  int64_t wait_start = 0;
+  int rc = pthread_mutex_trylock(&shared->mutex);
+  if(rc == EBUSY) {
+    wait_start = g_get_monotonic_time();
+    rc = pthread_mutex_lock(&shared->mutex);
+  }
+  if(!_shared_acquired(shared, rc, wait_start)) {
+    abort();
+  }
+}
+
+/**
+ * Take a process-shared lock without blocking
+ *
+ * @param shared The lock in shared memory
+ * @return true if the lock was taken
+ */
+bool _g_lock_shared_trylock(GLockShared *shared)
+{
+  int rc = pthread_mutex_trylock(&shared->mutex);
+  if(rc == EBUSY) {
+    return false;
+  }
+  return _shared_acquired(shared, rc, 0);
+}
+
+/**
+ * Release a process-shared lock
+ *
+ * @param shared The lock in shared memory
+ */
+void _g_lock_shared_unlock(GLockShared *shared)
+{
+  _g_lock_time_stats_add(&shared->stats.hold,
+    g_get_monotonic_time() - shared->acquired_at);
+  shared->holder_pid = 0;
+  shared->holder_tid = 0;
+  shared->acquired_at = 0;
+  pthread_mutex_unlock(&shared->mutex);
+}
+
+/**
+ * Print a time statistic of a process-shared lock
+ *
+ * @param label What the statistic is
+ * @param stats The statistic
+ */
+static void _shared_print_time(
+  const char *label,
+  struct g_lock_time_stats *stats
+  )
+{
+  printf("%s: count %" PRIu64 " avg %" PRIu64 " us max %" PRIu64 " us\n",
+    label,
+    stats->count,
+    stats->count? stats->total_us / stats->count: 0,
+    stats->max_us);
+}
+
+/**
+ * Print the counters and holder of a process-shared lock
+ *
+ * The lock is not taken, the values are read as they are.
+ *
+ * @param shared The lock in shared memory
+ */
+void _g_lock_shared_print(GLockShared *shared)
+{
+  pid_t pid = shared->holder_pid;
+  printf("Shared acquisitions: %" PRIu64 " - Contended: %" PRIu64
+    " - Holders died: %" PRIu64 "\n",
+    shared->stats.acquisitions,
+    shared->stats.contended,
+    shared->stats.owner_died);
+  _shared_print_time("Shared wait", &shared->stats.wait);
+  _shared_print_time("Shared hold", &shared->stats.hold);
+  if(pid) {
+    printf("Held by process %d thread %d for %" PRId64 " us\n",
+      (int)pid, (int)shared->holder_tid,
+      g_get_monotonic_time() - shared->acquired_at);
+  }
+}
+
+/**
+ * Print the counters and holder of a process-shared lock
+ *
+ * Works from any process mapping the lock, with or without a GLock
+ * for it.
+ *
+ * @param shared The lock in shared memory
+ */
+void g_lock_shared_show(GLockShared *shared)
+{
+  if(!_g_lock_shared_valid(shared)) {
+    return;
+  }
+  printf("=====================================\n");
+  printf("Shared lock: %s\n", shared->name);
+  _g_lock_shared_print(shared);
+  printf("=====================================\n");
+}
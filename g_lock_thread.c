@@ -0,0 +1,348 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/prctl.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Per-thread accounting
+ *
+ * While accounting, every thread adds its waits, holds and
+ * acquisitions to counters of its own, allocated when it first
+ * releases or waits for a lock. Only the thread writes its counters,
+ * with relaxed atomic stores, so the locking path never takes a lock
+ * nor shares a cache line with another thread.
+ *
+ * A read sums the counters of the threads by name. A reset does not
+ * write the counters, it keeps a copy of them which the next reads
+ * subtract. Threads which exited are kept until the next reset.
+ */
+
+/**
+ * Counters of one thread
+ */
+struct g_lock_thread_record {
+  struct g_lock_thread_counters counters; /*<< Written by the thread */
+  struct g_lock_thread_counters base; /*<< Counters at the last reset */
+  char name[16];
+  int64_t started_at; /*<< Monotonic time the thread was first seen */
+  int64_t exited_at; /*<< Monotonic time the thread exited or 0 */
+} __attribute__((aligned(G_LOCK_CACHE_LINE)));
+
+static void _thread_exit(gpointer data);
+
+static struct {
+  GMutex lock; /*<< Protects the members below */
+  GList *records; /*<< struct g_lock_thread_record */
+  int64_t reset_at; /*<< Monotonic time of the last reset */
+} _threads;
+
+static GPrivate _thread_record = G_PRIVATE_INIT(_thread_exit);
+
+
+/**
+ * Called when a thread which accounted for locks exits
+ *
+ * Its counters stay around until the next reset.
+ *
+ * @param data The record of the thread
+ */
+static void _thread_exit(gpointer data)
+{
+  struct g_lock_thread_record *record = data;
+  g_mutex_lock(&_threads.lock);
+  record->exited_at = g_get_monotonic_time();
+  g_mutex_unlock(&_threads.lock);
+}
+
+/**
+ * Get the record of the calling thread
+ *
+ * @param since Monotonic time the activity to account started, the
+ *   thread is seen from then on when its record is created
+ * @return The record or NULL on error
+ */
+static struct g_lock_thread_record *_thread_record_get(int64_t since)
+{
+  struct g_lock_thread_record *record = g_private_get(&_thread_record);
+  if(G_LIKELY(record)) {
+    return record;
+  }
+
+  if(posix_memalign((void **)&record, G_LOCK_CACHE_LINE,
+       sizeof(struct g_lock_thread_record))) {
+    lock_log("Failed to create thread record");
+    return NULL;
+  }
+  memset(record, 0, sizeof(struct g_lock_thread_record));
+  prctl(PR_GET_NAME, record->name, 0, 0, 0);
+  record->started_at = since;
+
+  g_mutex_lock(&_threads.lock);
+  _threads.records = g_list_prepend(_threads.records, record);
+  g_mutex_unlock(&_threads.lock);
+
+  g_private_set(&_thread_record, record);
+  return record;
+}
+
+/**
+ * Add to a counter only the calling thread writes
+ *
+ * @param counter The counter
+ * @param value What to add
+ */
+static inline void _thread_add(uint64_t *counter, int64_t value)
+{
+  if(value <= 0) {
+    return;
+  }
+  __atomic_store_n(counter,
+    __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Account time the calling thread was blocked taking a lock
+ *
+ * @param wait_us How long it waited
+ */
+void _g_lock_thread_waited(int64_t wait_us)
+{
+  struct g_lock_thread_record *record = _thread_record_get(
+    g_get_monotonic_time() - wait_us);
+  if(record) {
+    _thread_add(&record->counters.wait_us, wait_us);
+  }
+}
+
+/**
+ * Account time the calling thread waited on a condition
+ *
+ * @param wait_us How long it waited
+ */
+void _g_lock_thread_cond_waited(int64_t wait_us)
+{
+  struct g_lock_thread_record *record = _thread_record_get(
+    g_get_monotonic_time() - wait_us);
+  if(record) {
+    _thread_add(&record->counters.cond_wait_us, wait_us);
+  }
+}
+
+/**
+ * Account an acquisition released by the calling thread
+ *
+ * @param caller The caller record of the acquisition
+ * @param hold_us How long the lock was held
+ */
+void _g_lock_thread_released(struct g_lock_caller *caller, int64_t hold_us)
+{
+  struct g_lock_thread_record *record = _thread_record_get(
+    caller->acquired_at - caller->wait_us);
+  if(!record) {
+    return;
+  }
+  _thread_add(&record->counters.acquisitions, 1);
+  if(caller->contended) {
+    _thread_add(&record->counters.contended, 1);
+  }
+  _thread_add(&record->counters.hold_us, hold_us);
+}
+
+/**
+ * Read the counters of a thread
+ *
+ * @param counters Filled in with the counters
+ * @param record The record of the thread
+ */
+static void _thread_counters_load(
+  struct g_lock_thread_counters *counters,
+  struct g_lock_thread_record *record
+  )
+{
+  counters->acquisitions = __atomic_load_n(
+    &record->counters.acquisitions, __ATOMIC_RELAXED);
+  counters->contended = __atomic_load_n(
+    &record->counters.contended, __ATOMIC_RELAXED);
+  counters->wait_us = __atomic_load_n(
+    &record->counters.wait_us, __ATOMIC_RELAXED);
+  counters->cond_wait_us = __atomic_load_n(
+    &record->counters.cond_wait_us, __ATOMIC_RELAXED);
+  counters->hold_us = __atomic_load_n(
+    &record->counters.hold_us, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add what a thread did since the last reset to the stats of its name
+ *
+ * @param stats The stats of the name
+ * @param record The record of the thread
+ * @param counters The current counters of the thread
+ * @param now The current monotonic time
+ */
+static void _thread_stats_add(
+  struct g_lock_thread_stats *stats,
+  struct g_lock_thread_record *record,
+  struct g_lock_thread_counters *counters,
+  int64_t now
+  )
+{
+  int64_t start = MAX(record->started_at, _threads.reset_at);
+  int64_t end = record->exited_at? record->exited_at: now;
+
+  stats->threads++;
+  stats->alive_us += end > start? end - start: 0;
+  stats->counters.acquisitions +=
+    counters->acquisitions - record->base.acquisitions;
+  stats->counters.contended += counters->contended - record->base.contended;
+  stats->counters.wait_us += counters->wait_us - record->base.wait_us;
+  stats->counters.cond_wait_us +=
+    counters->cond_wait_us - record->base.cond_wait_us;
+  stats->counters.hold_us += counters->hold_us - record->base.hold_us;
+}
+
+/**
+ * Get what the threads did with locks since the last reset
+ *
+ * Threads are summed by name, so the workers of a pool come out as
+ * one entry.
+ *
+ * @param reset Whether to start a new interval
+ * @return struct g_lock_thread_stats by name, free with g_array_unref
+ */
+GArray *g_lock_thread_stats(bool reset)
+{
+  GArray *array;
+  GHashTable *by_name;
+  GList *tmpl, *next;
+  struct g_lock_thread_record *record;
+  struct g_lock_thread_counters counters;
+  struct g_lock_thread_stats entry, *stats;
+  int64_t now;
+  gpointer value;
+
+  array = g_array_new(FALSE, TRUE, sizeof(struct g_lock_thread_stats));
+  by_name = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+  g_mutex_lock(&_threads.lock);
+  now = g_get_monotonic_time();
+  for(tmpl = _threads.records; tmpl; tmpl = next) {
+    next = tmpl->next;
+    record = tmpl->data;
+    _thread_counters_load(&counters, record);
+    if(!g_hash_table_lookup_extended(by_name, record->name, NULL, &value)) {
+      memset(&entry, 0, sizeof(entry));
+      memcpy(entry.name, record->name, sizeof(entry.name));
+      g_array_append_val(array, entry);
+      value = GUINT_TO_POINTER(array->len - 1);
+      g_hash_table_insert(by_name, strdup(record->name), value);
+    }
+    stats = &g_array_index(array, struct g_lock_thread_stats,
+      GPOINTER_TO_UINT(value));
+    _thread_stats_add(stats, record, &counters, now);
+    stats->interval_us = _threads.reset_at? now - _threads.reset_at: 0;
+
+    if(reset && record->exited_at) {
+      _threads.records = g_list_delete_link(_threads.records, tmpl);
+      free(record);
+    } else if(reset) {
+      record->base = counters;
+    }
+  }
+  if(reset) {
+    _threads.reset_at = now;
+  }
+  g_mutex_unlock(&_threads.lock);
+
+  g_hash_table_destroy(by_name);
+  return array;
+}
+
+/**
+ * Start accounting what threads do with the locks of a manager
+ *
+ * The threads have one set of counters for all the managers
+ * accounting them. Starts a new interval. Counters kept from an
+ * earlier accounting are not cleared.
+ *
+ * @param manager The manager whose locks are accounted
+ */
+void g_lock_thread_stats_start_in(GLockManager *manager)
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return;
+  }
+  g_array_unref(g_lock_thread_stats(true));
+  g_atomic_int_set(&manager->thread_accounting, 1);
+}
+
+/**
+ * Start accounting what threads do with locks
+ */
+void g_lock_thread_stats_start()
+{
+  g_lock_thread_stats_start_in(g_lock_manager_default());
+}
+
+/**
+ * Stop accounting what threads do with the locks of a manager
+ *
+ * The counters can still be read.
+ *
+ * @param manager The manager whose locks were accounted
+ */
+void g_lock_thread_stats_stop_in(GLockManager *manager)
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return;
+  }
+  g_atomic_int_set(&manager->thread_accounting, 0);
+}
+
+/**
+ * Stop accounting what threads do with locks
+ */
+void g_lock_thread_stats_stop()
+{
+  g_lock_thread_stats_stop_in(g_lock_manager_default());
+}
+
+/**
+ * Print what the threads did with locks since the last reset
+ *
+ * @param reset Whether to start a new interval
+ */
+void g_lock_show_thread_stats(bool reset)
+{
+  GArray *array = g_lock_thread_stats(reset);
+  struct g_lock_thread_stats *stats;
+
+  printf("=====================================\n");
+  printf("Threads\n");
+  printf("-----------------------------\n");
+  for(guint ix = 0; ix < array->len; ix++) {
+    stats = &g_array_index(array, struct g_lock_thread_stats, ix);
+    printf("Thread: %s - Threads: %u - Acquisitions: %" PRIu64
+      " - Contended: %" PRIu64 "\n",
+      stats->name,
+      stats->threads,
+      stats->counters.acquisitions,
+      stats->counters.contended);
+    printf("  Waiting: %" PRIu64 "us (%.1f%%) - On conditions: %" PRIu64
+      "us - Holding: %" PRIu64 "us (%.1f%%)\n",
+      stats->counters.wait_us,
+      stats->alive_us? 100.0 * stats->counters.wait_us / stats->alive_us: 0,
+      stats->counters.cond_wait_us,
+      stats->counters.hold_us,
+      stats->alive_us? 100.0 * stats->counters.hold_us / stats->alive_us: 0);
+  }
+  printf("=====================================\n");
+  g_array_unref(array);
+}
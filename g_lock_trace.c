@@ -0,0 +1,834 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+
+#include "g_lock_manager.h"
+#include "g_lock_manager_private.h"
+
+/**
+ * Timeline recording
+ *
+ * While recording, every thread appends its wait, acquired and
+ * released events to a ring of events of its own, allocated once
+ * when the thread records its first event. Only the recording thread
+ * and an export ever take the ring's mutex, so it is never contended
+ * on the locking path. When a ring is full the oldest events are
+ * overwritten, keeping memory bounded whatever the recording window.
+ *
+ * An export pairs the events of each thread into complete slices in
+ * the Chrome Trace Event format which Perfetto and chrome://tracing
+ * open directly. The same events can also be saved as a compact
+ * binary trace for the replay tool, see tools/replay.
+ */
+
+#define G_LOCK_TRACE_DEFAULT_EVENTS 65536
+
+/**
+ * An event recorded by a thread
+ */
+struct g_lock_trace_event {
+  int64_t time; /*<< Monotonic time in microseconds */
+  const void *id; /*<< Address of the lock, never dereferenced */
+  const char *name; /*<< Interned or static, never freed */
+  const struct g_lock_callsite *callsite;
+  uint32_t index;
+  uint8_t phase; /*<< enum g_lock_trace_phase */
+  uint8_t action; /*<< enum g_lock_action */
+  uint8_t type; /*<< enum g_lock_type */
+  uint8_t rw_policy; /*<< enum g_lock_rw_policy */
+};
+
+/**
+ * Events of one thread
+ */
+struct g_lock_trace_buffer {
+  GMutex lock; /*<< Protects the members below */
+  struct g_lock_trace_event *events;
+  uint32_t capacity;
+  uint64_t written; /*<< Events written since the recording started */
+  uint32_t tid; /*<< Thread id in the trace */
+  char thread_name[16];
+  bool exited; /*<< The thread is gone, free on the next start */
+};
+
+/**
+ * A wait or hold which was started but not yet ended by an export
+ */
+struct g_lock_trace_open {
+  struct g_lock_trace_event event;
+  bool hold;
+};
+
+static void _trace_thread_exit(gpointer data);
+
+static struct {
+  GMutex lock; /*<< Protects the members below */
+  GList *buffers; /*<< struct g_lock_trace_buffer */
+  uint32_t capacity; /*<< Events per thread */
+  uint32_t next_tid;
+} _trace;
+
+static GPrivate _trace_buffer = G_PRIVATE_INIT(_trace_thread_exit);
+
+/**
+ * Free the events of a thread
+ *
+ * @param buffer The buffer to free
+ */
+static void _trace_buffer_free(struct g_lock_trace_buffer *buffer)
+{
+  g_mutex_clear(&buffer->lock);
+  free(buffer->events);
+  free(buffer);
+}
+
+/**
+ * Called when a thread which recorded events exits
+ *
+ * Its events stay around for the next export.
+ *
+ * @param data The buffer of the thread
+ */
+static void _trace_thread_exit(gpointer data)
+{
+  struct g_lock_trace_buffer *buffer = data;
+  g_mutex_lock(&_trace.lock);
+  buffer->exited = true;
+  g_mutex_unlock(&_trace.lock);
+}
+
+/**
+ * Create the buffer of the calling thread
+ *
+ * @return The buffer or NULL on error
+ */
+static struct g_lock_trace_buffer *_trace_buffer_new()
+{
+  struct g_lock_trace_buffer *buffer;
+
+  buffer = calloc(1, sizeof(struct g_lock_trace_buffer));
+  if(!buffer) {
+    lock_log("Failed to create trace buffer");
+    return NULL;
+  }
+  g_mutex_init(&buffer->lock);
+  prctl(PR_GET_NAME, buffer->thread_name, 0, 0, 0);
+
+  g_mutex_lock(&_trace.lock);
+  buffer->capacity = _trace.capacity;
+  buffer->events = calloc(buffer->capacity,
+    sizeof(struct g_lock_trace_event));
+  if(!buffer->events) {
+    g_mutex_unlock(&_trace.lock);
+    lock_log("Failed to create trace buffer");
+    _trace_buffer_free(buffer);
+    return NULL;
+  }
+  buffer->tid = ++_trace.next_tid;
+  _trace.buffers = g_list_prepend(_trace.buffers, buffer);
+  g_mutex_unlock(&_trace.lock);
+
+  g_private_set(&_trace_buffer, buffer);
+  return buffer;
+}
+
+/**
+ * Record an event of the calling thread
+ *
+ * Only called while recording.
+ *
+ * @param lock The lock concerned
+ * @param phase What happened
+ * @param action The action of the caller (for read/write locks)
+ * @param callsite Where the lock is being taken or released
+ * @param time Monotonic time of the event
+ */
+void _g_lock_trace_add(
+  GLock *lock,
+  enum g_lock_trace_phase phase,
+  enum g_lock_action action,
+  const struct g_lock_callsite *callsite,
+  int64_t time
+  )
+{
+  struct g_lock_trace_event *event;
+  struct g_lock_trace_buffer *buffer = g_private_get(&_trace_buffer);
+
+  if(!buffer) {
+    buffer = _trace_buffer_new();
+    if(!buffer) {
+      return;
+    }
+  }
+
+  g_mutex_lock(&buffer->lock);
+  event = &buffer->events[buffer->written % buffer->capacity];
+  event->time = time;
+  event->id = lock;
+  event->name = lock->name;
+  event->callsite = callsite;
+  event->index = lock->index;
+  event->phase = phase;
+  event->action = action;
+  event->type = lock->type;
+  event->rw_policy = lock->rw_policy;
+  buffer->written++;
+  g_mutex_unlock(&buffer->lock);
+}
+
+/**
+ * Start recording events of the locks of a manager
+ *
+ * The threads have one ring of events for all the managers, so
+ * events of a previous recording are dropped whichever manager they
+ * came from. Each thread keeps at most the given number of its latest
+ * events, which takes 40 bytes per event.
+ *
+ * @param manager The manager whose locks are recorded
+ * @param events_per_thread Size of the ring of every thread, 0 for
+ *        the default of 65536
+ * @return true if recording
+ */
+bool g_lock_trace_start_in(GLockManager *manager, uint32_t events_per_thread)
+{
+  GList *tmpl, *next;
+  struct g_lock_trace_buffer *buffer;
+  struct g_lock_trace_event *events;
+  bool ret = true;
+
+  if(!manager) {
+    lock_log("No manager provided");
+    return false;
+  }
+  if(!events_per_thread) {
+    events_per_thread = G_LOCK_TRACE_DEFAULT_EVENTS;
+  }
+
+  g_mutex_lock(&_trace.lock);
+  _trace.capacity = events_per_thread;
+  for(tmpl = _trace.buffers; tmpl; tmpl = next) {
+    next = tmpl->next;
+    buffer = tmpl->data;
+    if(buffer->exited) {
+      _trace.buffers = g_list_delete_link(_trace.buffers, tmpl);
+      _trace_buffer_free(buffer);
+      continue;
+    }
+    g_mutex_lock(&buffer->lock);
+    if(buffer->capacity != events_per_thread) {
+      events = calloc(events_per_thread, sizeof(struct g_lock_trace_event));
+      if(events) {
+        free(buffer->events);
+        buffer->events = events;
+        buffer->capacity = events_per_thread;
+      } else {
+        lock_log("Failed to resize trace buffer");
+        ret = false;
+      }
+    }
+    buffer->written = 0;
+    g_mutex_unlock(&buffer->lock);
+  }
+  g_atomic_int_set(&manager->tracing, ret);
+  g_mutex_unlock(&_trace.lock);
+  return ret;
+}
+
+/**
+ * Start recording lock events
+ *
+ * @param events_per_thread Size of the ring of every thread, 0 for
+ *        the default of 65536
+ * @return true if recording
+ */
+bool g_lock_trace_start(uint32_t events_per_thread)
+{
+  return g_lock_trace_start_in(g_lock_manager_default(), events_per_thread);
+}
+
+/**
+ * Stop recording events of the locks of a manager
+ *
+ * The recorded events are kept for an export until the next start.
+ *
+ * @param manager The manager whose locks were recorded
+ */
+void g_lock_trace_stop_in(GLockManager *manager)
+{
+  if(!manager) {
+    lock_log("No manager provided");
+    return;
+  }
+  g_atomic_int_set(&manager->tracing, 0);
+}
+
+/**
+ * Stop recording lock events
+ */
+void g_lock_trace_stop()
+{
+  g_lock_trace_stop_in(g_lock_manager_default());
+}
+
+/**
+ * Append a string as a JSON string literal
+ *
+ * @param out Where to append
+ * @param prefix Put in front of the string, not escaped
+ * @param str The string to append
+ */
+static void _trace_append_string(
+  GString *out,
+  const char *prefix,
+  const char *str
+  )
+{
+  g_string_append_c(out, '"');
+  g_string_append(out, prefix);
+  for(; str && *str; str++) {
+    if(*str == '"' || *str == '\\') {
+      g_string_append_c(out, '\\');
+      g_string_append_c(out, *str);
+    } else if((unsigned char)*str < 0x20) {
+      g_string_append_printf(out, "\\u%04x", (unsigned char)*str);
+    } else {
+      g_string_append_c(out, *str);
+    }
+  }
+  g_string_append_c(out, '"');
+}
+
+/**
+ * Short name of a lock action for the trace
+ *
+ * @param action The action
+ * @return The name
+ */
+static const char *_trace_action_to_str(enum g_lock_action action)
+{
+  switch(action) {
+    case G_LOCK_ACTION_READ:
+      return "read";
+    case G_LOCK_ACTION_WRITE:
+      return "write";
+    case G_LOCK_ACTION_UPGRADABLE:
+      return "upgradable";
+    default:
+      return "basic";
+  }
+}
+
+/**
+ * Append a complete slice to the trace
+ *
+ * @param out Where to append
+ * @param tid Thread id in the trace
+ * @param open The wait or hold the slice is for
+ * @param end Monotonic time the slice ended
+ * @param ended Whether the slice really ended before the export
+ */
+static void _trace_append_slice(
+  GString *out,
+  uint32_t tid,
+  struct g_lock_trace_open *open,
+  int64_t end,
+  bool ended
+  )
+{
+  const struct g_lock_callsite *callsite = open->event.callsite;
+
+  g_string_append(out, ",\n{\"ph\":\"X\",\"cat\":");
+  g_string_append(out, open->hold? "\"hold\"": "\"wait\"");
+  g_string_append(out, ",\"name\":");
+  _trace_append_string(out, open->hold? "": "wait ", open->event.name);
+  g_string_append_printf(out,
+    ",\"pid\":%d,\"tid\":%u,\"ts\":%" PRId64 ",\"dur\":%" PRId64
+    ",\"args\":{\"index\":%u,\"action\":\"%s\"",
+    getpid(), tid, open->event.time, end - open->event.time,
+    open->event.index, _trace_action_to_str(open->event.action));
+  if(callsite) {
+    g_string_append(out, ",\"func\":");
+    _trace_append_string(out, "", callsite->func);
+    g_string_append(out, ",\"file\":");
+    _trace_append_string(out, "", callsite->file);
+    g_string_append_printf(out, ",\"line\":%u", callsite->line);
+  }
+  if(!ended) {
+    g_string_append(out, ",\"open\":true");
+  }
+  g_string_append(out, "}}");
+}
+
+/**
+ * Find the latest open wait or hold of a lock
+ *
+ * @param opened Open waits and holds of the thread
+ * @param index Index of the lock
+ * @param hold Whether to look for a hold or a wait
+ * @return The position in opened or -1 if there is none
+ */
+static int _trace_find_open(GArray *opened, uint32_t index, bool hold)
+{
+  struct g_lock_trace_open *open;
+  for(int ix = (int)opened->len - 1; ix >= 0; ix--) {
+    open = &g_array_index(opened, struct g_lock_trace_open, ix);
+    if(open->hold == hold && open->event.index == index) {
+      return ix;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Copy the events of a thread, oldest first
+ *
+ * The thread can go on recording while the copy is used.
+ *
+ * @param buffer The buffer of the thread
+ * @param count Where to store the number of events
+ * @return The allocated events or NULL on error
+ */
+static struct g_lock_trace_event *_trace_copy_events(
+  struct g_lock_trace_buffer *buffer,
+  uint64_t *count
+  )
+{
+  struct g_lock_trace_event *events;
+  uint64_t first;
+
+  g_mutex_lock(&buffer->lock);
+  *count = MIN(buffer->written, buffer->capacity);
+  first = buffer->written - *count;
+  events = malloc(*count * sizeof(struct g_lock_trace_event) + 1);
+  for(uint64_t ix = 0; events && ix < *count; ix++) {
+    events[ix] = buffer->events[(first + ix) % buffer->capacity];
+  }
+  g_mutex_unlock(&buffer->lock);
+  if(!events) {
+    lock_log("Failed to copy trace events");
+  }
+  return events;
+}
+
+/**
+ * Append the events of a thread to the trace
+ *
+ * @param out Where to append
+ * @param buffer The buffer of the thread
+ * @param now Monotonic time of the export
+ */
+static void _trace_append_thread(
+  GString *out,
+  struct g_lock_trace_buffer *buffer,
+  int64_t now
+  )
+{
+  struct g_lock_trace_event *events, *event;
+  struct g_lock_trace_open open;
+  GArray *opened;
+  uint64_t count;
+  int ox;
+
+  events = _trace_copy_events(buffer, &count);
+  if(!events) {
+    return;
+  }
+
+  g_string_append_printf(out,
+    ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%u,"
+    "\"args\":{\"name\":",
+    getpid(), buffer->tid);
+  _trace_append_string(out, "", buffer->thread_name);
+  g_string_append(out, "}}");
+
+  opened = g_array_new(FALSE, FALSE, sizeof(struct g_lock_trace_open));
+  for(uint64_t ix = 0; ix < count; ix++) {
+    event = &events[ix];
+    open.event = *event;
+    open.hold = event->phase != G_LOCK_TRACE_WAIT;
+    switch(event->phase) {
+      case G_LOCK_TRACE_WAIT:
+        g_array_append_val(opened, open);
+        break;
+      case G_LOCK_TRACE_ACQUIRED:
+        // try_start and uncontended acquisitions have no wait
+        ox = _trace_find_open(opened, event->index, false);
+        if(ox >= 0) {
+          _trace_append_slice(out, buffer->tid,
+            &g_array_index(opened, struct g_lock_trace_open, ox),
+            event->time, true);
+          g_array_remove_index(opened, ox);
+        }
+        g_array_append_val(opened, open);
+        break;
+      case G_LOCK_TRACE_RELEASED:
+        ox = _trace_find_open(opened, event->index, true);
+        if(ox >= 0) {
+          _trace_append_slice(out, buffer->tid,
+            &g_array_index(opened, struct g_lock_trace_open, ox),
+            event->time, true);
+          g_array_remove_index(opened, ox);
+        } else {
+          // Taken before the window kept in the ring, start with it
+          open.event.time = events[0].time;
+          _trace_append_slice(out, buffer->tid, &open, event->time, true);
+        }
+        break;
+    }
+  }
+
+  // Whatever is still open lasts until the export
+  for(guint ox = 0; ox < opened->len; ox++) {
+    _trace_append_slice(out, buffer->tid,
+      &g_array_index(opened, struct g_lock_trace_open, ox), now, false);
+  }
+  g_array_free(opened, TRUE);
+  free(events);
+}
+
+/**
+ * Export the recorded events as a Chrome Trace Event JSON document
+ *
+ * Waits and holds are exported as complete slices on the timeline of
+ * their thread, so a trace shows which thread held a lock while the
+ * others queued. Slices still open at the time of the export end
+ * with the export and are marked open. This can be called while
+ * recording.
+ *
+ * @return The allocated JSON document, free with g_free()
+ */
+char *g_lock_trace_export()
+{
+  GList *tmpl;
+  GString *out = g_string_new(NULL);
+  int64_t now = g_get_monotonic_time();
+
+  g_string_append_printf(out,
+    "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+    "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,"
+    "\"args\":{\"name\":\"g_lock\"}}",
+    getpid());
+
+  g_mutex_lock(&_trace.lock);
+  for(tmpl = _trace.buffers; tmpl; tmpl = tmpl->next) {
+    _trace_append_thread(out, tmpl->data, now);
+  }
+  g_mutex_unlock(&_trace.lock);
+
+  g_string_append(out, "\n]}\n");
+  return g_string_free(out, FALSE);
+}
+
+/**
+ * Export the recorded events to a file
+ *
+ * @param path Where to write the JSON document
+ * @return true if the file was written
+ */
+bool g_lock_trace_export_file(const char *path)
+{
+  char *trace;
+  GError *error = NULL;
+  bool ret = true;
+
+  if(!path) {
+    lock_log("No path provided");
+    return false;
+  }
+  trace = g_lock_trace_export();
+  if(!g_file_set_contents(path, trace, -1, &error)) {
+    lock_log("Failed to write trace to %s: %s", path, error->message);
+    g_error_free(error);
+    ret = false;
+  }
+  g_free(trace);
+  return ret;
+}
+
+/**
+ * Locks, call sites and threads gathered while saving a binary trace
+ */
+struct g_lock_replay_builder {
+  GHashTable *locks; /*<< Lock address to position + 1 */
+  GArray *lock_list; /*<< struct g_lock_trace_event, one per lock */
+  GHashTable *callsites; /*<< Call site to position + 1 */
+  GPtrArray *callsite_list; /*<< const struct g_lock_callsite */
+  GString *threads; /*<< Threads and their events */
+  uint32_t thread_count;
+};
+
+/**
+ * Clamp a duration to what a binary trace event holds
+ *
+ * @param us The duration in microseconds
+ * @return The clamped duration
+ */
+static uint32_t _replay_us(int64_t us)
+{
+  if(us < 0) {
+    return 0;
+  }
+  return us > UINT32_MAX? UINT32_MAX: (uint32_t)us;
+}
+
+/**
+ * Position of the lock of an event in the binary trace
+ *
+ * Locks are told apart by address so the instances of a class,
+ * which share their index, are replayed as separate locks.
+ *
+ * @param builder The trace being saved
+ * @param event An event of the lock
+ * @return The position of the lock
+ */
+static uint32_t _replay_lock(
+  struct g_lock_replay_builder *builder,
+  struct g_lock_trace_event *event
+  )
+{
+  gpointer pos = g_hash_table_lookup(builder->locks, event->id);
+  if(!pos) {
+    g_array_append_val(builder->lock_list, *event);
+    pos = GUINT_TO_POINTER(builder->lock_list->len);
+    g_hash_table_insert(builder->locks, (gpointer)event->id, pos);
+  }
+  return GPOINTER_TO_UINT(pos) - 1;
+}
+
+/**
+ * Position of a call site in the binary trace
+ *
+ * @param builder The trace being saved
+ * @param callsite The call site or NULL
+ * @return The position of the call site or G_LOCK_REPLAY_NO_CALLSITE
+ */
+static uint16_t _replay_callsite(
+  struct g_lock_replay_builder *builder,
+  const struct g_lock_callsite *callsite
+  )
+{
+  gpointer pos;
+  if(!callsite) {
+    return G_LOCK_REPLAY_NO_CALLSITE;
+  }
+  pos = g_hash_table_lookup(builder->callsites, callsite);
+  if(!pos) {
+    if(builder->callsite_list->len >= G_LOCK_REPLAY_NO_CALLSITE) {
+      return G_LOCK_REPLAY_NO_CALLSITE;
+    }
+    g_ptr_array_add(builder->callsite_list, (gpointer)callsite);
+    pos = GUINT_TO_POINTER(builder->callsite_list->len);
+    g_hash_table_insert(builder->callsites, (gpointer)callsite, pos);
+  }
+  return GPOINTER_TO_UINT(pos) - 1;
+}
+
+/**
+ * Add the events of a thread to the binary trace
+ *
+ * Waits are folded into the acquisition they ended with. Releases of
+ * acquisitions made before the window kept in the ring are dropped.
+ * The first event is timed from the start of the whole trace so the
+ * threads keep their relative start times.
+ *
+ * @param builder The trace being saved
+ * @param buffer The buffer of the thread
+ * @param start Time of the oldest event of all the threads
+ */
+static void _replay_add_thread(
+  struct g_lock_replay_builder *builder,
+  struct g_lock_trace_buffer *buffer,
+  int64_t start
+  )
+{
+  struct g_lock_trace_event *events, *event, *wait;
+  struct g_lock_replay_event record;
+  struct g_lock_replay_thread thread;
+  GArray *records, *waits;
+  GHashTable *held;
+  uint64_t count;
+  uint32_t holds;
+  int64_t prev = start, requested;
+  int wx;
+
+  events = _trace_copy_events(buffer, &count);
+  if(!events) {
+    return;
+  }
+  records = g_array_new(FALSE, FALSE, sizeof(struct g_lock_replay_event));
+  waits = g_array_new(FALSE, FALSE, sizeof(struct g_lock_trace_event));
+  held = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  for(uint64_t ix = 0; ix < count; ix++) {
+    event = &events[ix];
+    memset(&record, 0, sizeof(record));
+    record.action = event->action;
+    record.callsite = _replay_callsite(builder, event->callsite);
+    holds = GPOINTER_TO_UINT(g_hash_table_lookup(held, event->id));
+    switch(event->phase) {
+      case G_LOCK_TRACE_WAIT:
+        g_array_append_val(waits, *event);
+        continue;
+      case G_LOCK_TRACE_ACQUIRED:
+        requested = event->time;
+        for(wx = (int)waits->len - 1; wx >= 0; wx--) {
+          wait = &g_array_index(waits, struct g_lock_trace_event, wx);
+          if(wait->id == event->id) {
+            requested = wait->time;
+            g_array_remove_index(waits, wx);
+            break;
+          }
+        }
+        record.op = G_LOCK_REPLAY_ACQUIRE;
+        record.wait_us = _replay_us(event->time - requested);
+        record.delta_us = _replay_us(requested - prev);
+        g_hash_table_insert(held, (gpointer)event->id,
+          GUINT_TO_POINTER(holds + 1));
+        break;
+      case G_LOCK_TRACE_RELEASED:
+        if(!holds) {
+          prev = event->time;
+          continue;
+        }
+        record.op = G_LOCK_REPLAY_RELEASE;
+        record.delta_us = _replay_us(event->time - prev);
+        g_hash_table_insert(held, (gpointer)event->id,
+          GUINT_TO_POINTER(holds - 1));
+        break;
+    }
+    record.lock = _replay_lock(builder, event);
+    g_array_append_val(records, record);
+    prev = event->time;
+  }
+
+  memset(&thread, 0, sizeof(thread));
+  thread.event_count = records->len;
+  memcpy(thread.name, buffer->thread_name, sizeof(thread.name));
+  g_string_append_len(builder->threads, (const char *)&thread,
+    sizeof(thread));
+  g_string_append_len(builder->threads, (const char *)records->data,
+    records->len * sizeof(struct g_lock_replay_event));
+  builder->thread_count++;
+
+  g_hash_table_destroy(held);
+  g_array_free(waits, TRUE);
+  g_array_free(records, TRUE);
+  free(events);
+}
+
+/**
+ * Append a string of a binary trace record
+ *
+ * @param out Where to append
+ * @param str The string
+ * @param len Length of the string, as written in its record
+ */
+static void _replay_append_string(GString *out, const char *str, uint16_t len)
+{
+  g_string_append_len(out, str? str: "", len);
+}
+
+/**
+ * Save the recorded events as a binary trace
+ *
+ * Every acquisition is saved with its lock, action, call site, wait
+ * and the time since the previous event of its thread, which is
+ * what tools/replay needs to run the same workload again with other
+ * lock types. Each event takes 16 bytes.
+ *
+ * @param path Where to write the trace
+ * @return true if the file was written
+ */
+bool g_lock_trace_save(const char *path)
+{
+  struct g_lock_replay_builder builder;
+  struct g_lock_replay_header header;
+  struct g_lock_replay_lock lock;
+  struct g_lock_replay_callsite site;
+  struct g_lock_trace_buffer *buffer;
+  struct g_lock_trace_event *event;
+  const struct g_lock_callsite *callsite;
+  GString *out;
+  GList *tmpl;
+  GError *error = NULL;
+  int64_t start = INT64_MAX;
+  bool ret = true;
+
+  if(!path) {
+    lock_log("No path provided");
+    return false;
+  }
+
+  memset(&builder, 0, sizeof(builder));
+  builder.locks = g_hash_table_new(g_direct_hash, g_direct_equal);
+  builder.lock_list = g_array_new(FALSE, FALSE,
+    sizeof(struct g_lock_trace_event));
+  builder.callsites = g_hash_table_new(g_direct_hash, g_direct_equal);
+  builder.callsite_list = g_ptr_array_new();
+  builder.threads = g_string_new(NULL);
+
+  g_mutex_lock(&_trace.lock);
+  // Oldest event kept by any thread
+  for(tmpl = _trace.buffers; tmpl; tmpl = tmpl->next) {
+    buffer = tmpl->data;
+    g_mutex_lock(&buffer->lock);
+    if(buffer->written) {
+      event = &buffer->events[
+        (buffer->written - MIN(buffer->written, buffer->capacity)) %
+        buffer->capacity];
+      start = MIN(start, event->time);
+    }
+    g_mutex_unlock(&buffer->lock);
+  }
+  for(tmpl = _trace.buffers; tmpl; tmpl = tmpl->next) {
+    _replay_add_thread(&builder, tmpl->data, start);
+  }
+  g_mutex_unlock(&_trace.lock);
+
+  out = g_string_new(NULL);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, G_LOCK_REPLAY_MAGIC, sizeof(header.magic));
+  header.lock_count = builder.lock_list->len;
+  header.callsite_count = builder.callsite_list->len;
+  header.thread_count = builder.thread_count;
+  g_string_append_len(out, (const char *)&header, sizeof(header));
+
+  for(guint ix = 0; ix < builder.lock_list->len; ix++) {
+    event = &g_array_index(builder.lock_list, struct g_lock_trace_event, ix);
+    lock.index = event->index;
+    lock.type = event->type;
+    lock.rw_policy = event->rw_policy;
+    lock.name_len = MIN(strlen(event->name), UINT16_MAX);
+    g_string_append_len(out, (const char *)&lock, sizeof(lock));
+    _replay_append_string(out, event->name, lock.name_len);
+  }
+  for(guint ix = 0; ix < builder.callsite_list->len; ix++) {
+    callsite = g_ptr_array_index(builder.callsite_list, ix);
+    site.line = callsite->line;
+    site.func_len = callsite->func? MIN(strlen(callsite->func), UINT16_MAX): 0;
+    site.file_len = callsite->file? MIN(strlen(callsite->file), UINT16_MAX): 0;
+    g_string_append_len(out, (const char *)&site, sizeof(site));
+    _replay_append_string(out, callsite->func, site.func_len);
+    _replay_append_string(out, callsite->file, site.file_len);
+  }
+  g_string_append_len(out, builder.threads->str, builder.threads->len);
+
+  if(!g_file_set_contents(path, out->str, out->len, &error)) {
+    lock_log("Failed to write trace to %s: %s", path, error->message);
+    g_error_free(error);
+    ret = false;
+  }
+
+  g_string_free(out, TRUE);
+  g_string_free(builder.threads, TRUE);
+  g_ptr_array_free(builder.callsite_list, TRUE);
+  g_hash_table_destroy(builder.callsites);
+  g_array_free(builder.lock_list, TRUE);
+  g_hash_table_destroy(builder.locks);
+  return ret;
+}
@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *async_lock = NULL;
+GLock *rw_lock = NULL;
+
+#define HOLD_TIME 300000 // 300ms
+#define TICK_MS 10
+#define HAMMER_THREADS 4
+#define STARVE_LIMIT 2000000 // 2s
+
+static GMainLoop *loop = NULL;
+static GMainContext *context = NULL;
+static GLockSession *loop_session = NULL;
+static gint holder_ready = 0;
+static int ticks = 0;
+static int failures = 0;
+static gint hammering = 0;
+static int64_t granted_at = 0;
+
+/**
+ * Thread which holds a lock for a while
+ *
+ * @param lock The lock to hold
+ */
+static void _holder_thread(GLock *lock)
+{
+  G_LOCK_SESSION_START();
+  if(lock->type == G_LOCK_RW) {
+    g_lock_start_write(session, lock);
+  } else {
+    g_lock_start(session, lock);
+  }
+  g_atomic_int_set(&holder_ready, 1);
+  usleep(HOLD_TIME);
+  if(lock->type == G_LOCK_RW) {
+    g_lock_end_write(session, lock);
+  } else {
+    g_lock_end(session, lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which takes the lock back as soon as it lets it go
+ *
+ * @param lock The lock to keep busy
+ */
+static void _hammer_thread(GLock *lock)
+{
+  G_LOCK_SESSION_START();
+  while(g_atomic_int_get(&hammering)) {
+    g_lock_start(session, lock);
+    usleep(100);
+    g_lock_end(session, lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Counts main loop iterations while a request is pending
+ */
+static gboolean _tick(gpointer data)
+{
+  ticks++;
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Start a thread holding the lock and wait until it has it
+ *
+ * @param lock The lock the thread should hold
+ * @return The holder thread
+ */
+static GThread *_start_holder(GLock *lock)
+{
+  GThread *holder;
+  g_atomic_int_set(&holder_ready, 0);
+  holder = g_thread_new("holder", (GThreadFunc)_holder_thread, lock);
+  while(!g_atomic_int_get(&holder_ready)) {
+    usleep(1000);
+  }
+  return holder;
+}
+
+/**
+ * Callback for a request which must be granted
+ */
+static void _granted(
+  GLockSession *session,
+  GLock *lock,
+  bool acquired,
+  gpointer user_data
+  )
+{
+  printf("Granted %s acquired %d after %d ticks\n",
+    lock->name, acquired, ticks);
+  if(!acquired || ticks < 5) {
+    // The loop should have kept running while the lock was busy
+    failures++;
+  } else if(lock->type == G_LOCK_RW) {
+    g_lock_end_read(session, lock);
+  } else {
+    g_lock_end(session, lock);
+  }
+  g_main_loop_quit(loop);
+}
+
+/**
+ * Callback for a request racing threads which keep taking the lock
+ */
+static void _not_starved(
+  GLockSession *session,
+  GLock *lock,
+  bool acquired,
+  gpointer user_data
+  )
+{
+  granted_at = g_get_monotonic_time();
+  printf("Granted %s acquired %d while hammered\n", lock->name, acquired);
+  if(!acquired) {
+    failures++;
+  } else {
+    g_lock_end(session, lock);
+  }
+  g_main_loop_quit(loop);
+}
+
+/**
+ * Callback for a request which gets cancelled
+ */
+static void _cancelled(
+  GLockSession *session,
+  GLock *lock,
+  bool acquired,
+  gpointer user_data
+  )
+{
+  printf("Cancelled %s acquired %d\n", lock->name, acquired);
+  if(acquired) {
+    failures++;
+    g_lock_end(session, lock);
+  }
+  g_main_loop_quit(loop);
+}
+
+/**
+ * Cancel the pending request
+ */
+static gboolean _cancel(gpointer data)
+{
+  g_cancellable_cancel(data);
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * Give up on a request which never completes
+ */
+static gboolean _give_up(gpointer data)
+{
+  printf("Request still pending\n");
+  failures++;
+  g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * Run the loop until a request completes
+ */
+static void _run_loop()
+{
+  GSource *tick = g_timeout_source_new(TICK_MS);
+  ticks = 0;
+  g_source_set_callback(tick, _tick, NULL, NULL);
+  g_source_attach(tick, context);
+  g_main_loop_run(loop);
+  g_source_destroy(tick);
+  g_source_unref(tick);
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  GThread *holder;
+  GCancellable *cancellable;
+  async_lock = g_lock_create_mutex("async");
+  rw_lock = g_lock_create_rw_policy("async-rw", G_LOCK_RW_POLICY_PHASE_FAIR);
+
+  context = g_main_context_new();
+  g_main_context_push_thread_default(context);
+  loop = g_main_loop_new(context, FALSE);
+  loop_session = g_lock_session_new();
+
+  // Granted once the holder lets go
+  holder = _start_holder(async_lock);
+  g_lock_start_async(loop_session, async_lock, G_LOCK_ACTION_BASIC,
+    NULL, _granted, NULL);
+  g_lock_show_all();
+  _run_loop();
+  g_thread_join(holder);
+
+  // Read side of a read/write lock
+  holder = _start_holder(rw_lock);
+  g_lock_start_async(loop_session, rw_lock, G_LOCK_ACTION_READ,
+    NULL, _granted, NULL);
+  _run_loop();
+  g_thread_join(holder);
+
+  // Cancelled while the holder still has the lock
+  holder = _start_holder(async_lock);
+  cancellable = g_cancellable_new();
+  g_lock_start_async(loop_session, async_lock, G_LOCK_ACTION_BASIC,
+    cancellable, _cancelled, NULL);
+  GSource *cancel = g_timeout_source_new(50);
+  g_source_set_callback(cancel, _cancel, cancellable, NULL);
+  g_source_attach(cancel, context);
+  g_source_unref(cancel);
+  _run_loop();
+  g_thread_join(holder);
+  g_object_unref(cancellable);
+
+  // Threads taking the lock back right away must not starve a request
+  GThread *hammers[HAMMER_THREADS];
+  GArray *array;
+  int64_t queued_at;
+  uint64_t main_wait_us = 0;
+  g_lock_thread_stats_start();
+  g_atomic_int_set(&hammering, 1);
+  for(int ix = 0; ix < HAMMER_THREADS; ix++) {
+    hammers[ix] = g_thread_new("hammer", (GThreadFunc)_hammer_thread,
+      async_lock);
+  }
+  usleep(10000);
+  queued_at = g_get_monotonic_time();
+  g_lock_start_async(loop_session, async_lock, G_LOCK_ACTION_BASIC,
+    NULL, _not_starved, NULL);
+  GSource *give_up = g_timeout_source_new(STARVE_LIMIT / 1000);
+  g_source_set_callback(give_up, _give_up, NULL, NULL);
+  g_source_attach(give_up, context);
+  _run_loop();
+  g_source_destroy(give_up);
+  g_source_unref(give_up);
+  g_atomic_int_set(&hammering, 0);
+  for(int ix = 0; ix < HAMMER_THREADS; ix++) {
+    g_thread_join(hammers[ix]);
+  }
+  if(granted_at) {
+    printf("Request granted after %" PRId64 "us\n",
+      granted_at - queued_at);
+  }
+
+  // The wait of the request counts for the thread running the context
+  array = g_lock_thread_stats(true);
+  for(guint ix = 0; ix < array->len; ix++) {
+    struct g_lock_thread_stats *stats = &g_array_index(array,
+      struct g_lock_thread_stats, ix);
+    if(strcmp(stats->name, "hammer") != 0) {
+      main_wait_us += stats->counters.wait_us;
+    }
+  }
+  g_array_unref(array);
+  g_lock_thread_stats_stop();
+  if(!main_wait_us) {
+    printf("Wait of the request not accounted\n");
+    failures++;
+  }
+
+  g_lock_show_all();
+  if(async_lock->stats.holding || async_lock->stats.waiting ||
+     async_lock->stats.holders || async_lock->stats.waiters) {
+    printf("Callers left behind on the lock\n");
+    failures++;
+  }
+  if(loop_session->lock_list) {
+    printf("Locks left behind in the session\n");
+    failures++;
+  }
+
+  g_lock_session_free(loop_session);
+  g_main_loop_unref(loop);
+  g_main_context_pop_thread_default(context);
+  g_main_context_unref(context);
+  g_lock_manager_free();
+  return failures? 1: 0;
+}
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *budget_lock = NULL;
+
+#define HOLD_BUDGET 2000 // 2ms
+#define WAIT_BUDGET 2000 // 2ms
+#define LONG_HOLD 10000 // 10ms
+#define ITERATIONS 10
+
+/**
+ * Take the lock and keep it for a while
+ *
+ * @param session The lock session
+ * @param hold_us How long to keep the lock
+ */
+static void _hold(GLockSession *session, uint32_t hold_us)
+{
+  if(g_lock_start(session, budget_lock)) {
+    usleep(hold_us);
+    g_lock_end(session, budget_lock);
+  }
+}
+
+/**
+ * Thread which keeps the lock past its budget
+ */
+static void _slow_thread()
+{
+  G_LOCK_SESSION_START();
+  _hold(session, LONG_HOLD);
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Find the statistics of the call site in _hold()
+ *
+ * @return The statistics or NULL if not found
+ */
+static struct g_lock_callsite_stats *_hold_site()
+{
+  GHashTableIter iter;
+  struct g_lock_callsite_stats *site;
+  g_hash_table_iter_init(&iter, budget_lock->stats.callsites);
+  while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&site)) {
+    if(strcmp(site->callsite->func, "_hold") == 0) {
+      return site;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  struct g_lock_callsite_stats *site;
+  budget_lock = g_lock_create_mutex("budget lock");
+  if(g_lock_set_budget(budget_lock, -1, 0) ||
+     !g_lock_set_budget(budget_lock, HOLD_BUDGET, WAIT_BUDGET)) {
+    printf("Unexpected budget result\n");
+    return 1;
+  }
+
+  GLockSession *session = g_lock_session_new();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    _hold(session, 0);
+  }
+  site = _hold_site();
+  if(!site || site->hold_violations || site->wait_violations ||
+     site->hold_stack || site->wait_stack) {
+    printf("Unexpected violation within budget\n");
+    return 1;
+  }
+
+  // The first long hold only marks the call site
+  _hold(session, LONG_HOLD);
+  if(site->hold_violations != 1 || site->hold_stack) {
+    printf("Unexpected first violation\n");
+    return 1;
+  }
+  // A short hold is sampled but doesn't keep its stack
+  _hold(session, 0);
+  if(site->hold_stack) {
+    printf("Stack kept for a hold within budget\n");
+    return 1;
+  }
+  _hold(session, LONG_HOLD);
+  if(site->hold_violations != 2 || !site->hold_stack ||
+     site->suppressed != 1) {
+    printf("Unexpected second violation\n");
+    return 1;
+  }
+
+  // Wait behind a thread holding the lock for too long
+  GThread *slow = g_thread_new("slow", (GThreadFunc)_slow_thread, NULL);
+  usleep(LONG_HOLD / 4);
+  _hold(session, 0);
+  g_thread_join(slow);
+  if(site->wait_violations != 1 || !site->wait_stack ||
+     site->hold_violations != 3) {
+    printf("Unexpected wait violation\n");
+    return 1;
+  }
+
+  g_lock_show_budget_violations();
+  g_lock_session_free(session);
+  g_lock_manager_free();
+  return 0;
+}
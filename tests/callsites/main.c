@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *hot_lock = NULL;
+
+#define ITERATIONS 20
+#define SLEEP_TIME 10000 // 10ms
+#define POLL_TIME 1000 // 1ms
+
+/**
+ * Thread which holds the lock for a while on each iteration
+ */
+static void _slow_thread()
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(g_lock_start(session, hot_lock)) {
+      usleep(SLEEP_TIME);
+      g_lock_end(session, hot_lock);
+    }
+    usleep(SLEEP_TIME / 10);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which only takes the lock after the others are done
+ */
+static void _quiet_thread()
+{
+  G_LOCK_SESSION_START();
+  if(g_lock_try_start(session, hot_lock)) {
+    g_lock_end(session, hot_lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Find the statistics of a call site by function name
+ *
+ * @param lock The lock to look in
+ * @param func The function name of the call site
+ * @return The statistics or NULL
+ */
+static struct g_lock_callsite_stats *_find_site(GLock *lock, const char *func)
+{
+  GHashTableIter iter;
+  gpointer value;
+  struct g_lock_callsite_stats *site;
+  g_hash_table_iter_init(&iter, lock->stats.callsites);
+  while(g_hash_table_iter_next(&iter, NULL, &value)) {
+    site = value;
+    if(!strcmp(site->callsite->func, func)) {
+      return site;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  struct g_lock_callsite_stats *slow_site, *quiet_site;
+  struct g_lock_queue_stats queue;
+  hot_lock = g_lock_create_mutex("hot");
+  GLockSession *session = g_lock_session_new();
+  // Call sites are only counted while someone reads them
+  g_lock_metrics_collect_start();
+
+  // Both slow threads find the lock busy on their first iteration
+  g_lock_start(session, hot_lock);
+  GThread *slow1 = g_thread_new("slow1", (GThreadFunc)_slow_thread, NULL);
+  GThread *slow2 = g_thread_new("slow2", (GThreadFunc)_slow_thread, NULL);
+  do {
+    usleep(POLL_TIME);
+    g_lock_queue_stats(hot_lock, &queue);
+  } while(queue.waiting < 2);
+  g_lock_end(session, hot_lock);
+  g_lock_session_free(session);
+  g_thread_join(slow1);
+  g_thread_join(slow2);
+  GThread *quiet1 = g_thread_new("quiet1", (GThreadFunc)_quiet_thread, NULL);
+  g_thread_join(quiet1);
+
+  g_lock_show_all();
+  g_lock_show_top_callsites(5);
+
+  slow_site = _find_site(hot_lock, "_slow_thread");
+  quiet_site = _find_site(hot_lock, "_quiet_thread");
+  if(!slow_site || !quiet_site) {
+    printf("Missing call site statistics\n");
+    return 1;
+  }
+  if(slow_site->acquisitions != 2 * ITERATIONS || slow_site->contended < 2 ||
+     slow_site->hold_us < 2 * ITERATIONS * SLEEP_TIME) {
+    printf("Unexpected statistics for the slow call site\n");
+    return 1;
+  }
+  if(quiet_site->acquisitions != 1 || quiet_site->contended ||
+     strcmp(quiet_site->callsite->lock_hint, "hot_lock")) {
+    printf("Unexpected statistics for the quiet call site\n");
+    return 1;
+  }
+  g_lock_metrics_collect_stop();
+  g_lock_manager_free();
+  return 0;
+}
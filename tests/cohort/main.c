@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *cohort_lock = NULL;
+
+#define NODES 2
+#define THREADS 8
+#define ITERATIONS 2000
+
+static gint inside = 0;
+static gint order = 0;
+static gint violations = 0;
+static uint32_t counter = 0;
+
+/**
+ * Thread which keeps taking the lock from its own node
+ *
+ * @param data The node of the thread
+ */
+static void _node_thread(gpointer data)
+{
+  G_LOCK_SESSION_START();
+  g_lock_numa_set_thread_node(GPOINTER_TO_INT(data));
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(g_lock_start(session, cohort_lock)) {
+      if(g_atomic_int_add(&inside, 1) != 0) {
+        g_atomic_int_inc(&violations);
+      }
+      counter++;
+      g_atomic_int_add(&inside, -1);
+      g_lock_end(session, cohort_lock);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which only tries to take the lock
+ *
+ * @param data The node of the thread
+ * @return Non NULL if the lock was taken
+ */
+static gpointer _try_thread(gpointer data)
+{
+  bool taken;
+  GLockSession *session = g_lock_session_new();
+  g_lock_numa_set_thread_node(GPOINTER_TO_INT(data));
+  if((taken = g_lock_try_start(session, cohort_lock))) {
+    g_lock_end(session, cohort_lock);
+  }
+  g_lock_session_free(session);
+  return taken? GINT_TO_POINTER(1): NULL;
+}
+
+/**
+ * Thread which takes the lock once and records when it got it
+ *
+ * @param data The node of the thread
+ * @return How many threads got the lock before, plus one
+ */
+static gpointer _order_thread(gpointer data)
+{
+  gint position = 0;
+  GLockSession *session = g_lock_session_new();
+  g_lock_numa_set_thread_node(GPOINTER_TO_INT(data));
+  if(g_lock_start(session, cohort_lock)) {
+    position = g_atomic_int_add(&order, 1) + 1;
+    g_lock_end(session, cohort_lock);
+  }
+  g_lock_session_free(session);
+  return GINT_TO_POINTER(position);
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  GThread *threads[THREADS];
+  GThread *try_thread, *remote, *local;
+  gpointer taken;
+  GLockSession *session = g_lock_session_new();
+
+  g_lock_numa_set_nodes(NODES);
+  if(g_lock_numa_nodes() != NODES) {
+    printf("Node override ignored\n");
+    return 1;
+  }
+  cohort_lock = g_lock_create_cohort("cohort");
+
+  // A held lock can't be taken from the same or another node
+  g_lock_numa_set_thread_node(0);
+  if(!g_lock_start(session, cohort_lock)) {
+    printf("Failed to take the lock\n");
+    return 1;
+  }
+  for(int node = 0; node < NODES; node++) {
+    try_thread = g_thread_new("try", _try_thread, GINT_TO_POINTER(node));
+    taken = g_thread_join(try_thread);
+    if(taken) {
+      printf("Lock taken from node %d while held\n", node);
+      return 1;
+    }
+  }
+  g_lock_end(session, cohort_lock);
+  try_thread = g_thread_new("try", _try_thread, GINT_TO_POINTER(1));
+  if(!g_thread_join(try_thread)) {
+    printf("Free lock not taken from node 1\n");
+    return 1;
+  }
+
+  // A waiter of the holder's node goes before an older remote waiter
+  g_lock_start(session, cohort_lock);
+  remote = g_thread_new("remote", _order_thread, GINT_TO_POINTER(1));
+  usleep(50000);
+  local = g_thread_new("local", _order_thread, GINT_TO_POINTER(0));
+  usleep(50000);
+  g_lock_end(session, cohort_lock);
+  if(GPOINTER_TO_INT(g_thread_join(local)) != 1 ||
+     GPOINTER_TO_INT(g_thread_join(remote)) != 2) {
+    printf("Lock not handed over within the node\n");
+    return 1;
+  }
+  g_lock_session_free(session);
+
+  for(int ix = 0; ix < THREADS; ix++) {
+    threads[ix] = g_thread_new("node", (GThreadFunc)_node_thread,
+      GINT_TO_POINTER(ix % NODES));
+  }
+  for(int ix = 0; ix < THREADS; ix++) {
+    g_thread_join(threads[ix]);
+  }
+
+  if(violations || counter != THREADS * ITERATIONS) {
+    printf("Mutual exclusion broken %d violations counter %u\n",
+      violations, counter);
+    return 1;
+  }
+  if(cohort_lock->_lock.cohort.node_count != NODES) {
+    printf("Lock split over %u nodes\n",
+      cohort_lock->_lock.cohort.node_count);
+    return 1;
+  }
+  g_lock_show_all();
+
+  g_lock_numa_set_nodes(0);
+  g_lock_manager_free();
+  return 0;
+}
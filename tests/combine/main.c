@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *first_lock = NULL;
+GLock *counter_lock = NULL;
+GLock *rw_lock = NULL;
+
+#define THREADS 8
+#define ITERATIONS 5000
+#define TOTAL (THREADS * ITERATIONS)
+
+uint64_t counter = 0;
+gint in_use = 0;
+gint overlaps = 0;
+gint out_of_order = 0;
+uint8_t seen[TOTAL + 1];
+
+/**
+ * Increment the counter, run with counter_lock held
+ *
+ * @param user_data Unused
+ * @return The new value of the counter
+ */
+static gpointer _increment(gpointer user_data)
+{
+  if(!g_atomic_int_compare_and_exchange(&in_use, 0, 1)) {
+    g_atomic_int_inc(&overlaps);
+  }
+  counter++;
+  g_atomic_int_set(&in_use, 0);
+  return GSIZE_TO_POINTER(counter);
+}
+
+/**
+ * Thread which increments the counter through g_lock_execute
+ */
+static void _increment_thread()
+{
+  gsize value, last = 0;
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    value = GPOINTER_TO_SIZE(
+      g_lock_execute(session, counter_lock, _increment, NULL));
+    if(value <= last || value > TOTAL) {
+      g_atomic_int_inc(&out_of_order);
+    } else {
+      // Each value is handed to a single caller
+      seen[value]++;
+      last = value;
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Return the argument, run with a lock held
+ *
+ * @param user_data The argument
+ * @return The argument
+ */
+static gpointer _identity(gpointer user_data)
+{
+  return user_data;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  int failures = 0;
+  GThread *threads[THREADS];
+  struct g_lock_combine_stats *combine;
+  GHashTableIter iter;
+  struct g_lock_callsite_stats *site;
+  uint64_t acquisitions = 0;
+  first_lock = g_lock_create_mutex("first lock");
+  counter_lock = g_lock_create_mutex("counter lock");
+  rw_lock = g_lock_create_rw("rw lock");
+  GLockSession *session = g_lock_session_new();
+  g_lock_metrics_collect_start();
+
+  for(int ix = 0; ix < THREADS; ix++) {
+    threads[ix] = g_thread_new("combine", (GThreadFunc)_increment_thread,
+      NULL);
+  }
+  for(int ix = 0; ix < THREADS; ix++) {
+    g_thread_join(threads[ix]);
+  }
+  g_lock_show_all();
+
+  if(counter != TOTAL || overlaps || out_of_order) {
+    printf("Unexpected counter: %" PRIu64 " - Overlaps: %d - "
+      "Out of order: %d\n", counter, overlaps, out_of_order);
+    failures++;
+  }
+  for(int ix = 1; ix <= TOTAL; ix++) {
+    if(seen[ix] != 1) {
+      printf("Result %d handed out %u times\n", ix, seen[ix]);
+      failures++;
+      break;
+    }
+  }
+
+  // Each batch is one acquisition of the lock
+  combine = &counter_lock->combine;
+  g_hash_table_iter_init(&iter, counter_lock->stats.callsites);
+  while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&site)) {
+    acquisitions += site->acquisitions;
+  }
+  if(combine->requests != TOTAL || !combine->batches ||
+     combine->batches > TOTAL || combine->max_batch > TOTAL ||
+     acquisitions < combine->batches ||
+     counter_lock->stats.holding || counter_lock->stats.holders) {
+    printf("Unexpected combining statistics\n");
+    failures++;
+  }
+
+  // Read/write locks are taken for writing
+  if(g_lock_execute(session, rw_lock, _identity, rw_lock) != rw_lock ||
+     rw_lock->stats.write_wait.count != 1) {
+    printf("Unexpected result on a read/write lock\n");
+    failures++;
+  }
+
+  // Taking a lock out of order doesn't run the function
+  g_lock_manager_allow_wrong_order(true);
+  g_lock_start(session, counter_lock);
+  if(g_lock_execute(session, first_lock, _identity, first_lock) ||
+     first_lock->combine.requests) {
+    printf("Function run out of order\n");
+    failures++;
+  }
+  g_lock_end(session, counter_lock);
+  if(session->lock_list) {
+    printf("Locks left in the session\n");
+    failures++;
+  }
+
+  g_lock_session_free(session);
+  g_lock_metrics_collect_stop();
+  g_lock_manager_free();
+  return failures? 1: 0;
+}
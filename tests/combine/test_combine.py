@@ -0,0 +1,2 @@
+def test_main(utils):
+  utils.compile_and_run(__file__)
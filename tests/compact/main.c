@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+#define ENTRIES 64
+#define ITERATIONS 1000
+
+/**
+ * Structure owning a compact lock
+ */
+struct cache_entry {
+  GLockCompact lock;
+  uint64_t value;
+};
+
+struct cache_entry entries[ENTRIES];
+
+/**
+ * Thread which updates every entry
+ */
+static void _update_thread()
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    struct cache_entry *entry = &entries[ix % 4];
+    if(g_lock_compact_start(session, &entry->lock)) {
+      entry->value++;
+      g_lock_compact_end(session, &entry->lock);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  uint64_t total = 0;
+  GLock *table_lock = g_lock_create_mutex("table");
+  GLockClass *entry_class = g_lock_class_new("cache-entry",
+    G_LOCK_CLASS_ADDRESS_ORDERED);
+  GLock *stats_lock = g_lock_create_mutex("stats");
+  g_lock_metrics_collect_start();
+
+  if(sizeof(GLockCompact) > 2 * sizeof(gpointer)) {
+    printf("Compact lock takes %zu bytes\n", sizeof(GLockCompact));
+    return 1;
+  }
+  for(int ix = 0; ix < ENTRIES; ix++) {
+    g_lock_compact_init(&entries[ix].lock, entry_class);
+  }
+
+  GThread *update1 = g_thread_new("update1", (GThreadFunc)_update_thread,
+    NULL);
+  GThread *update2 = g_thread_new("update2", (GThreadFunc)_update_thread,
+    NULL);
+  GThread *update3 = g_thread_new("update3", (GThreadFunc)_update_thread,
+    NULL);
+  g_thread_join(update1);
+  g_thread_join(update2);
+  g_thread_join(update3);
+  for(int ix = 0; ix < ENTRIES; ix++) {
+    total += entries[ix].value;
+  }
+  if(total != ITERATIONS * 3) {
+    printf("Entries were not updated\n");
+    return 1;
+  }
+  // Every acquisition is counted, not only the contended ones
+  if(entry_class->stats.acquisitions != ITERATIONS * 3 ||
+     entry_class->metrics.acquisitions != ITERATIONS * 3 ||
+     entry_class->stats.contended != entry_class->metrics.contended) {
+    printf("Unexpected class acquisitions\n");
+    return 1;
+  }
+  // Statistics only exist for locks which were contended or inspected
+  if(entries[ENTRIES - 1].lock.ref != entry_class ||
+     !g_lock_compact_stats(&entries[ENTRIES - 1].lock) ||
+     entries[ENTRIES - 1].lock.ref == entry_class) {
+    printf("Statistics were not created on demand\n");
+    return 1;
+  }
+
+  // Compact locks are ordered through their class
+  GLockSession *session = g_lock_session_new();
+  g_lock_start(session, table_lock);
+  g_lock_compact_start(session, &entries[0].lock);
+  g_lock_compact_start(session, &entries[1].lock);
+  g_lock_start(session, stats_lock);
+  g_lock_end(session, stats_lock);
+  g_lock_compact_end(session, &entries[1].lock);
+  g_lock_compact_end(session, &entries[0].lock);
+  g_lock_end(session, table_lock);
+
+  // The room for held compact locks is kept between acquisitions
+  for(int ix = 0; ix < ENTRIES; ix++) {
+    g_lock_compact_start(session, &entries[ix].lock);
+  }
+  for(int ix = 0; ix < ENTRIES; ix += 2) {
+    g_lock_compact_end(session, &entries[ix].lock);
+  }
+  for(int ix = ENTRIES - 1; ix > 0; ix -= 2) {
+    g_lock_compact_end(session, &entries[ix].lock);
+  }
+  if(session->compact_count || session->compact_size < ENTRIES ||
+     !g_lock_compact_try_start(session, &entries[0].lock)) {
+    printf("Compact locks not released\n");
+    return 1;
+  }
+  g_lock_compact_end(session, &entries[0].lock);
+
+  g_lock_manager_allow_wrong_order(true);
+  g_lock_compact_start(session, &entries[1].lock);
+  if(g_lock_compact_start(session, &entries[0].lock) ||
+     g_lock_compact_try_start(session, &entries[1].lock) ||
+     g_lock_start(session, table_lock)) {
+    printf("Compact lock taken out of order\n");
+    return 1;
+  }
+  g_lock_compact_end(session, &entries[1].lock);
+  g_lock_session_free(session);
+
+  g_lock_show_all();
+  for(int ix = 0; ix < ENTRIES; ix++) {
+    g_lock_compact_clear(&entries[ix].lock);
+  }
+  if(entry_class->instances) {
+    printf("Compact locks left in the class\n");
+    return 1;
+  }
+  g_lock_manager_free();
+  return 0;
+}
@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *queue_lock = NULL;
+GCond queue_cond;
+
+#define ITERATIONS 10
+#define SLEEP_TIME 20000 // 20ms
+
+static int queued = 0;
+static int consumed = 0;
+static gint late_woken = 0;
+
+/**
+ * Thread which waits for items to show up
+ */
+static void _consumer_thread()
+{
+  G_LOCK_SESSION_START();
+  g_lock_start(session, queue_lock);
+  while(consumed < ITERATIONS) {
+    while(!queued) {
+      g_lock_wait(session, queue_lock, &queue_cond);
+    }
+    queued--;
+    consumed++;
+    printf("Consumed %d\n", consumed);
+  }
+  g_lock_end(session, queue_lock);
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which produces items slowly
+ */
+static void _producer_thread()
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    usleep(SLEEP_TIME);
+    if(g_lock_start(session, queue_lock)) {
+      queued++;
+      g_lock_signal(session, queue_lock, &queue_cond);
+      g_lock_end(session, queue_lock);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which waits on the condition for a while
+ */
+static void _timed_thread()
+{
+  G_LOCK_SESSION_START();
+  g_lock_start(session, queue_lock);
+  if(g_lock_wait_until(session, queue_lock, &queue_cond,
+       g_get_monotonic_time() + 4 * SLEEP_TIME)) {
+    g_atomic_int_set(&late_woken, 1);
+  }
+  g_lock_end(session, queue_lock);
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  bool woken;
+  GLock *rw_lock;
+  queue_lock = g_lock_create_mutex("queue");
+  rw_lock = g_lock_create_rw("not-a-mutex");
+  g_cond_init(&queue_cond);
+
+  GThread *consumer = g_thread_new("consumer", (GThreadFunc)_consumer_thread,
+    NULL);
+  GThread *producer = g_thread_new("producer", (GThreadFunc)_producer_thread,
+    NULL);
+
+  // The consumer waits on the condition while keeping its record
+  usleep(SLEEP_TIME / 2);
+  g_lock_show_all();
+
+  g_thread_join(producer);
+  g_thread_join(consumer);
+
+  // Nobody signals so this times out
+  GLockSession *session = g_lock_session_new();
+  g_lock_start(session, queue_lock);
+  woken = g_lock_wait_until(session, queue_lock, &queue_cond,
+    g_get_monotonic_time() + SLEEP_TIME);
+  g_lock_broadcast(session, queue_lock, &queue_cond);
+  g_lock_end(session, queue_lock);
+
+  // Signalling without holding the lock wakes nobody up
+  GThread *timed = g_thread_new("timed", (GThreadFunc)_timed_thread, NULL);
+  usleep(SLEEP_TIME);
+  g_lock_signal(session, queue_lock, &queue_cond);
+  g_lock_broadcast(session, queue_lock, &queue_cond);
+  g_thread_join(timed);
+  if(g_atomic_int_get(&late_woken)) {
+    printf("Woken up by a session not holding the lock\n");
+    return 1;
+  }
+
+  // Only mutex locks can be used with conditions
+  g_lock_start_write(session, rw_lock);
+  if(g_lock_wait(session, rw_lock, &queue_cond)) {
+    printf("Waited on a read/write lock\n");
+    return 1;
+  }
+  g_lock_end_write(session, rw_lock);
+  g_lock_session_free(session);
+
+  g_lock_show_all();
+  if(woken) {
+    printf("Timed wait was woken up\n");
+    return 1;
+  }
+  if(consumed != ITERATIONS || queue_lock->stats.cond_wait.count <
+     ITERATIONS + 1) {
+    printf("Unexpected condition statistics\n");
+    return 1;
+  }
+  if(queue_lock->stats.holders || queue_lock->stats.waiters) {
+    printf("Callers left behind on the lock\n");
+    return 1;
+  }
+  g_cond_clear(&queue_cond);
+  g_lock_manager_free();
+  return 0;
+}
@@ -3,6 +3,29 @@ import pytest
 import subprocess
 import shlex
 
+# Library sources compiled into every test
+LIB_SOURCES = [
+  "g_lock_manager.c",
+  "g_lock_async.c",
+  "g_lock_deadlock.c",
+  "g_lock_compact.c",
+  "g_lock_metrics.c",
+  "g_lock_trace.c",
+  "g_lock_budget.c",
+  "g_lock_cohort.c",
+  "g_lock_shared.c",
+  "g_lock_publish.c",
+  "g_lock_executor.c",
+  "g_lock_epoch.c",
+  "g_lock_queue.c",
+  "g_lock_thread.c",
+  "g_lock_combine.c",
+  "g_lock_dump.c",
+]
+
+# Packages the library depends on
+PACKAGES = "glib-2.0 gio-2.0"
+
 def pkg_config(pkg, libs=False, cflags=False):
   cmds = ["pkg-config"]
   if libs:
@@ -36,9 +59,10 @@ class Utils(object):
     self.do_cmd("rm -f *.gcda *.gcno")
 
     # Compile
-    glib_libs = pkg_config("glib-2.0", libs=True)
-    glib_cflags = pkg_config("glib-2.0", cflags=True)
-    g_lock_manager = "{}/g_lock_manager.c".format(self.root_path)
+    glib_libs = pkg_config(PACKAGES, libs=True)
+    glib_cflags = pkg_config(PACKAGES, cflags=True)
+    g_lock_manager = " ".join(
+      "{}/{}".format(self.root_path, src) for src in LIB_SOURCES)
     self.do_cmd("gcc -g -Wall -std=gnu99 "
       "-fprofile-arcs -ftest-coverage "
       "{cflags} "
@@ -57,8 +81,8 @@ class Utils(object):
     self.do_cmd("rm -f *.gcda *.gcno")
 
     # Compile
-    glib_libs = subprocess.check_output(shlex.split("pkg-config --libs glib-2.0")).strip()
-    glib_cflags = subprocess.check_output(shlex.split("pkg-config --cflags glib-2.0")).strip()
+    glib_libs = pkg_config(PACKAGES, libs=True)
+    glib_cflags = pkg_config(PACKAGES, cflags=True)
     self.do_cmd("gcc -g -Wall -std=gnu99 "
       "-fprofile-arcs -ftest-coverage "
       "{cflags} "
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *queue_lock = NULL;
+GLock *slow_lock = NULL;
+GLock *busy_lock = NULL;
+
+#define WAITERS 3
+#define BUSY_THREADS 6
+#define BUSY_TIME 500000 // 500ms
+#define LONG_HOLD 150000 // 150ms
+#define POLL_TIME 1000 // 1ms
+
+gint busy_stop = 0;
+
+/**
+ * Thread which waits for a lock and keeps it for a while
+ *
+ * @param lock The lock to take
+ */
+static void _wait_thread(GLock *lock)
+{
+  G_LOCK_SESSION_START();
+  if(g_lock_start(session, lock)) {
+    usleep(lock == slow_lock? LONG_HOLD: 0);
+    g_lock_end(session, lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which keeps taking a lock for a moment
+ */
+static void _busy_thread()
+{
+  G_LOCK_SESSION_START();
+  while(!g_atomic_int_get(&busy_stop)) {
+    if(g_lock_start(session, busy_lock)) {
+      g_lock_end(session, busy_lock);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Wait until a number of callers queue on a lock
+ *
+ * @param lock The lock
+ * @param waiting How many callers to wait for
+ * @return true if they queued otherwise false
+ */
+static bool _wait_queued(GLock *lock, int waiting)
+{
+  struct g_lock_queue_stats stats;
+  for(int ix = 0; ix < 5000; ix++) {
+    if(g_lock_queue_stats(lock, &stats) && stats.waiting == waiting) {
+      return true;
+    }
+    usleep(POLL_TIME);
+  }
+  return false;
+}
+
+/**
+ * Check waiters and holders are told apart
+ *
+ * @return The number of failures
+ */
+static int _test_waiters_holders()
+{
+  int failures = 0;
+  struct g_lock_caller *holder, *waiter;
+  struct g_lock_queue_stats stats;
+  GThread *thread;
+  GLockSession *session = g_lock_session_new();
+
+  g_lock_start(session, queue_lock);
+  thread = g_thread_new("waiter", (GThreadFunc)_wait_thread, queue_lock);
+  if(!_wait_queued(queue_lock, 1)) {
+    printf("Waiter never queued\n");
+    failures++;
+  }
+  g_lock_show_all();
+
+  g_mutex_lock(&queue_lock->stats_lock);
+  if(queue_lock->stats.holding != 1 ||
+     g_list_length(queue_lock->stats.holders) != 1 ||
+     g_list_length(queue_lock->stats.waiters) != 1) {
+    printf("Unexpected holders and waiters\n");
+    failures++;
+  } else {
+    holder = queue_lock->stats.holders->data;
+    waiter = queue_lock->stats.waiters->data;
+    if(holder->session != session || !holder->acquired_at ||
+       waiter->session == session || !waiter->wait_started_at ||
+       waiter->acquired_at || !waiter->contended) {
+      printf("Unexpected caller records\n");
+      failures++;
+    }
+  }
+  g_mutex_unlock(&queue_lock->stats_lock);
+
+  g_lock_end(session, queue_lock);
+  g_thread_join(thread);
+  g_lock_session_free(session);
+
+  g_lock_queue_stats(queue_lock, &stats);
+  if(stats.waiting || stats.holding || queue_lock->stats.holders ||
+     queue_lock->stats.waiters || stats.max_waiting != 1 ||
+     stats.avg_waiting <= 0) {
+    printf("Unexpected queue after release: %d %d %d %.2f\n",
+      stats.waiting, stats.holding, stats.max_waiting, stats.avg_waiting);
+    failures++;
+  }
+  return failures;
+}
+
+/**
+ * Check a queue behind long holds is not taken for a convoy
+ *
+ * @return The number of failures
+ */
+static int _test_long_holds()
+{
+  int failures = 0;
+  struct g_lock_queue_stats stats;
+  GThread *threads[WAITERS];
+  GLockSession *session = g_lock_session_new();
+
+  g_lock_start(session, slow_lock);
+  for(int ix = 0; ix < WAITERS; ix++) {
+    threads[ix] = g_thread_new("slow", (GThreadFunc)_wait_thread, slow_lock);
+  }
+  if(!_wait_queued(slow_lock, WAITERS)) {
+    printf("Waiters never queued\n");
+    failures++;
+  }
+  usleep(LONG_HOLD);
+  g_lock_end(session, slow_lock);
+  for(int ix = 0; ix < WAITERS; ix++) {
+    g_thread_join(threads[ix]);
+  }
+  g_lock_session_free(session);
+
+  g_lock_queue_stats(slow_lock, &stats);
+  printf("Long holds: average %.2f - longest %d - convoys %" PRIu64 "\n",
+    stats.avg_waiting, stats.max_waiting, stats.convoys);
+  if(stats.max_waiting != WAITERS || stats.avg_waiting < 1 ||
+     stats.convoys || stats.convoy) {
+    printf("Long holds taken for a convoy\n");
+    failures++;
+  }
+  return failures;
+}
+
+/**
+ * Check a long queue behind short holds is flagged
+ *
+ * @return The number of failures
+ */
+static int _test_convoy()
+{
+  int failures = 0;
+  struct g_lock_queue_stats stats;
+  GThread *threads[BUSY_THREADS];
+
+  for(int ix = 0; ix < BUSY_THREADS; ix++) {
+    threads[ix] = g_thread_new("busy", (GThreadFunc)_busy_thread, NULL);
+  }
+  usleep(BUSY_TIME);
+  g_atomic_int_set(&busy_stop, 1);
+  for(int ix = 0; ix < BUSY_THREADS; ix++) {
+    g_thread_join(threads[ix]);
+  }
+
+  g_lock_queue_stats(busy_lock, &stats);
+  printf("Short holds: average %.2f - longest %d - convoys %" PRIu64 "\n",
+    stats.avg_waiting, stats.max_waiting, stats.convoys);
+  g_lock_show_convoys();
+  if(!stats.convoys || stats.waiting || stats.holding) {
+    printf("Convoy not flagged\n");
+    failures++;
+  }
+  return failures;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  int failures = 0;
+  queue_lock = g_lock_create_mutex("queue lock");
+  slow_lock = g_lock_create_mutex("slow lock");
+  busy_lock = g_lock_create_mutex("busy lock");
+
+  failures += _test_waiters_holders();
+  failures += _test_long_holds();
+  failures += _test_convoy();
+
+  g_lock_manager_free();
+  return failures? 1: 0;
+}
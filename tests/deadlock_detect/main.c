@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *lock1 = NULL;
+GLock *lock2 = NULL;
+GLock *lock3 = NULL;
+
+#define SLEEP_TIME 100000 // 100ms
+
+/**
+ * Take two locks using one session per lock
+ *
+ * Each session on its own respects the lock order, which is why
+ * the manager can't refuse the second lock. Two threads doing this
+ * in opposite order deadlock for real.
+ *
+ * @param first The lock to take first
+ * @param second The lock to take second
+ */
+static void _take_two(GLock *first, GLock *second)
+{
+  GLockSession *outer = g_lock_session_new();
+  GLockSession *inner = g_lock_session_new();
+  g_lock_start(outer, first);
+  usleep(SLEEP_TIME);
+  g_lock_start(inner, second);
+  printf("Should never get here\n");
+}
+
+/**
+ * Thread taking lock1 then lock2
+ */
+static void _thread1()
+{
+  _take_two(lock1, lock2);
+}
+
+/**
+ * Thread taking lock2 then lock1
+ */
+static void _thread2()
+{
+  _take_two(lock2, lock1);
+}
+
+/**
+ * Thread which waits on lock3 while it is briefly held
+ */
+static void _contended_thread()
+{
+  G_LOCK_SESSION_START();
+  g_lock_start(session, lock3);
+  g_lock_end(session, lock3);
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  uint32_t found;
+  GThread *th;
+  lock1 = g_lock_create_mutex("lock1");
+  lock2 = g_lock_create_mutex("lock2");
+  lock3 = g_lock_create_mutex("lock3");
+
+  g_lock_manager_allow_wrong_order(true);
+  g_lock_manager_start_deadlock_detector(100);
+
+  // Plain contention is not a deadlock
+  GLockSession *session = g_lock_session_new();
+  g_lock_start(session, lock3);
+  th = g_thread_new("contended", (GThreadFunc)_contended_thread, NULL);
+  usleep(SLEEP_TIME);
+  found = g_lock_manager_check_deadlocks();
+  g_lock_end(session, lock3);
+  g_lock_session_free(session);
+  g_thread_join(th);
+  if(found) {
+    printf("False deadlock reported\n");
+    return 1;
+  }
+
+  // A real deadlock
+  g_thread_new("th1", (GThreadFunc)_thread1, NULL);
+  g_thread_new("th2", (GThreadFunc)_thread2, NULL);
+  usleep(3 * SLEEP_TIME);
+  g_lock_show_all();
+  found = g_lock_manager_check_deadlocks();
+  printf("Deadlocks found: %u\n", found);
+  g_lock_manager_stop_deadlock_detector();
+  if(found != 1) {
+    return 1;
+  }
+  // The deadlocked threads are never joined
+  exit(0);
+}
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *held_lock = NULL;
+GLock *idle_lock = NULL;
+
+#define POLL_TIME 1000 // 1ms
+
+int fds[2];
+char output[65536];
+
+/**
+ * Thread which waits for the held lock
+ */
+static void _wait_thread()
+{
+  G_LOCK_SESSION_START();
+  if(g_lock_start(session, held_lock)) {
+    g_lock_end(session, held_lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Read what was dumped so far
+ *
+ * @return The text dumped
+ */
+static const char *_read_output()
+{
+  ssize_t len = read(fds[0], output, sizeof(output) - 1);
+  output[len > 0? len: 0] = '\0';
+  printf("%s", output);
+  return output;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  int failures = 0;
+  const char *text;
+  GThread *thread;
+  struct g_lock_queue_stats queue;
+  held_lock = g_lock_create_mutex("held lock");
+  idle_lock = g_lock_create_mutex("idle lock");
+  GLockSession *session = g_lock_session_new();
+
+  if(pipe(fds) != 0) {
+    printf("Failed to create pipe\n");
+    return 1;
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  // A holder and a waiter, counted even without metrics
+  g_lock_start(session, held_lock);
+  thread = g_thread_new("waiter", (GThreadFunc)_wait_thread, NULL);
+  for(int ix = 0; ix < 5000; ix++) {
+    g_lock_queue_stats(held_lock, &queue);
+    if(queue.waiting == 1) {
+      break;
+    }
+    usleep(POLL_TIME);
+  }
+  if(!g_lock_dump(fds[1])) {
+    printf("Dump failed\n");
+    failures++;
+  }
+  text = _read_output();
+  if(!strstr(text, "Metrics not collected") ||
+     !strstr(text, "Lock: held lock - Index: 0 - Holding: 1 - Waiting: 1\n") ||
+     strstr(text, "idle lock")) {
+    printf("Unexpected dump\n");
+    failures++;
+  }
+
+  // A busy stats lock is never touched
+  g_mutex_lock(&held_lock->stats_lock);
+  if(!g_lock_dump(fds[1])) {
+    printf("Dump failed with the stats lock held\n");
+    failures++;
+  }
+  g_mutex_unlock(&held_lock->stats_lock);
+  text = _read_output();
+  if(!strstr(text, "Lock: held lock - Index: 0 - Holding: 1 - Waiting: 1")) {
+    printf("Unexpected dump with the stats lock held\n");
+    failures++;
+  }
+
+  g_lock_metrics_collect_start();
+  g_lock_end(session, held_lock);
+  g_thread_join(thread);
+
+  // From a signal handler
+  if(g_lock_dump_install(SIGUSR1, -1) ||
+     !g_lock_dump_install(SIGUSR1, fds[1]) ||
+     g_lock_dump_install(SIGUSR2, fds[1])) {
+    printf("Unexpected install result\n");
+    failures++;
+  }
+  g_lock_start(session, idle_lock);
+  raise(SIGUSR1);
+  text = _read_output();
+  if(strstr(text, "Metrics not collected") ||
+     !strstr(text, "Lock: held lock - Index: 0 - Holding: 0 - Waiting: 0 - "
+       "Acquisitions: 2 - Contended: 1") ||
+     !strstr(text, "Lock: idle lock - Index: 1 - Holding: 1 - Waiting: 0")) {
+    printf("Unexpected dump from the signal handler\n");
+    failures++;
+  }
+  g_lock_end(session, idle_lock);
+  g_lock_dump_uninstall();
+  signal(SIGUSR1, SIG_IGN);
+  raise(SIGUSR1);
+  if(read(fds[0], output, sizeof(output)) > 0) {
+    printf("Dumped after uninstall\n");
+    failures++;
+  }
+
+  // Writing to a closed file descriptor fails
+  close(fds[0]);
+  signal(SIGPIPE, SIG_IGN);
+  if(g_lock_dump(fds[1])) {
+    printf("Dump to a closed pipe succeeded\n");
+    failures++;
+  }
+  close(fds[1]);
+
+  g_lock_metrics_collect_stop();
+  g_lock_session_free(session);
+  g_lock_manager_free();
+  return failures? 1: 0;
+}
@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+#define ENTRIES 1000
+#define ITERATIONS 100
+
+/**
+ * Structure owning its lock
+ */
+struct cache_entry {
+  GLock lock;
+  uint64_t value;
+};
+
+struct cache_entry entries[ENTRIES];
+
+/**
+ * Thread which updates every entry
+ */
+static void _update_thread()
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    for(int jx = 0; jx < ENTRIES; jx += 100) {
+      if(g_lock_start(session, &entries[jx].lock)) {
+        entries[jx].value++;
+        g_lock_end(session, &entries[jx].lock);
+      }
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  GLock *created[ENTRIES];
+
+  for(int ix = 0; ix < ENTRIES; ix++) {
+    g_lock_init(&entries[ix].lock, "cache-entry", G_LOCK_MUTEX);
+  }
+  // Names are shared between locks
+  if(entries[0].lock.name != entries[ENTRIES - 1].lock.name) {
+    printf("Lock names are not interned\n");
+    return 1;
+  }
+
+  GThread *update1 = g_thread_new("update1", (GThreadFunc)_update_thread,
+    NULL);
+  GThread *update2 = g_thread_new("update2", (GThreadFunc)_update_thread,
+    NULL);
+  g_thread_join(update1);
+  g_thread_join(update2);
+  if(entries[0].value != ITERATIONS * 2) {
+    printf("Entries were not updated\n");
+    return 1;
+  }
+
+  // Freed locks are reused by the next ones created
+  for(int ix = 0; ix < ENTRIES; ix++) {
+    created[ix] = g_lock_create_mutex("pooled");
+  }
+  GLock *reused = created[ENTRIES / 2];
+  g_lock_free(reused);
+  if(g_lock_create_mutex("pooled") != reused) {
+    printf("Freed lock was not reused\n");
+    return 1;
+  }
+
+  // Each kind of lock is only cleaned up the way it was made
+  g_lock_free(&entries[1].lock);
+  g_lock_clear(created[0]);
+  if(g_lock_manager_default()->locks.length != ENTRIES * 2) {
+    printf("Unexpected number of registered locks\n");
+    return 1;
+  }
+
+  for(int ix = 0; ix < ENTRIES / 2; ix++) {
+    g_lock_clear(&entries[ix].lock);
+  }
+  g_lock_manager_free();
+  if(g_lock_manager_default()->locks.length) {
+    printf("Locks left registered\n");
+    return 1;
+  }
+  // The rest are still owned by the entries
+  for(int ix = ENTRIES / 2; ix < ENTRIES; ix++) {
+    g_lock_clear(&entries[ix].lock);
+  }
+  return 0;
+}
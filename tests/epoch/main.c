@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+#include "../../g_lock_manager_private.h"
+
+/**
+ * Define locks
+ */
+#define CHURN_LOCKS 16
+#define READERS 2
+#define DURATION 300000 // 0.3s
+#define SLEEP_TIME 50000 // 50ms
+
+static gint stop = 0;
+static gint reading = 0;
+static gint leave = 0;
+static gint cleared = 0;
+static gint lookups = 0;
+static GLock embedded;
+
+/**
+ * Thread which stays in a reading section until told to leave
+ */
+static void _reader_thread()
+{
+  _g_lock_epoch_enter();
+  g_atomic_int_set(&reading, 1);
+  while(!g_atomic_int_get(&leave)) {
+    usleep(1000);
+  }
+  _g_lock_epoch_exit();
+}
+
+/**
+ * Thread which clears the embedded lock
+ */
+static void _clear_thread()
+{
+  g_lock_clear(&embedded);
+  g_atomic_int_set(&cleared, 1);
+}
+
+/**
+ * Thread which keeps walking the registry
+ */
+static void _walk_thread()
+{
+  char *name, *text;
+  uint32_t index = 0;
+  while(!g_atomic_int_get(&stop)) {
+    name = g_lock_name_by_index(index++ % (CHURN_LOCKS * 4));
+    free(name);
+    text = g_lock_metrics_render();
+    g_free(text);
+    g_atomic_int_inc(&lookups);
+  }
+}
+
+/**
+ * Thread which keeps creating and freeing locks and classes
+ */
+static void _churn_thread()
+{
+  GLock *locks[CHURN_LOCKS];
+  GLockClass *klass;
+  while(!g_atomic_int_get(&stop)) {
+    for(int ix = 0; ix < CHURN_LOCKS; ix++) {
+      locks[ix] = g_lock_create_mutex("churn");
+    }
+    klass = g_lock_class_new("churn-class", G_LOCK_CLASS_FORBIDDEN);
+    for(int ix = 0; ix < CHURN_LOCKS; ix++) {
+      g_lock_free(locks[ix]);
+    }
+    g_lock_class_free(klass);
+  }
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  GThread *reader, *clearer, *walkers[READERS], *churn;
+  GLock *first = g_lock_create_mutex("first");
+  GLock *second = g_lock_create_mutex("second");
+  GLock *created, *reused[3];
+  int found = 0;
+  uint32_t index = first->index;
+  char *name;
+
+  // A lock freed while a reader is inside is not reused
+  reader = g_thread_new("reader", (GThreadFunc)_reader_thread, NULL);
+  while(!g_atomic_int_get(&reading)) {
+    usleep(1000);
+  }
+  g_lock_free(first);
+  name = g_lock_name_by_index(index);
+  if(name) {
+    printf("Freed lock %s is still registered\n", name);
+    return 1;
+  }
+  created = g_lock_create_mutex("created");
+  if(created == first) {
+    printf("Lock was reused while a reader could see it\n");
+    return 1;
+  }
+
+  // Clearing an embedded lock waits for the reader
+  g_lock_init(&embedded, "embedded", G_LOCK_MUTEX);
+  clearer = g_thread_new("clearer", (GThreadFunc)_clear_thread, NULL);
+  usleep(SLEEP_TIME);
+  if(g_atomic_int_get(&cleared)) {
+    printf("Embedded lock was cleared while a reader could see it\n");
+    return 1;
+  }
+  g_atomic_int_set(&leave, 1);
+  g_thread_join(reader);
+  g_thread_join(clearer);
+  if(!g_atomic_int_get(&cleared)) {
+    printf("Embedded lock was not cleared\n");
+    return 1;
+  }
+
+  // Once the reader left the memory is reused
+  g_lock_free(second);
+  g_lock_free(created);
+  for(int ix = 0; ix < 3; ix++) {
+    reused[ix] = g_lock_create_mutex("reused");
+    found |= (reused[ix] == first) | (reused[ix] == second) << 1;
+  }
+  if(found != 3) {
+    printf("Retired locks were not freed\n");
+    return 1;
+  }
+  for(int ix = 0; ix < 3; ix++) {
+    g_lock_free(reused[ix]);
+  }
+
+  // Walk the registry while it keeps changing
+  churn = g_thread_new("churn", (GThreadFunc)_churn_thread, NULL);
+  for(int ix = 0; ix < READERS; ix++) {
+    walkers[ix] = g_thread_new("walk", (GThreadFunc)_walk_thread, NULL);
+  }
+  usleep(DURATION);
+  g_atomic_int_set(&stop, 1);
+  g_thread_join(churn);
+  for(int ix = 0; ix < READERS; ix++) {
+    g_thread_join(walkers[ix]);
+  }
+  if(!g_atomic_int_get(&lookups)) {
+    printf("The registry was never walked\n");
+    return 1;
+  }
+
+  g_lock_manager_free();
+  printf("Registry readers don't block frees\n");
+  return 0;
+}
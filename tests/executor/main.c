@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+#define ACCOUNTS 8
+GLock *account_locks[ACCOUNTS];
+GLock *held_lock = NULL;
+
+#define WORKERS 4
+#define TRANSFERS 2000
+#define BALANCE 1000
+#define SLEEP_TIME 50000 // 50ms
+
+int64_t balances[ACCOUNTS];
+gint in_use[ACCOUNTS];
+gint overlaps = 0;
+gint nested_runs = 0;
+gint held_runs = 0;
+GLockExecutor *executor = NULL;
+
+struct transfer {
+  uint32_t from;
+  uint32_t to;
+};
+
+/**
+ * Move one unit between two accounts, with both their locks held
+ */
+static void _transfer(GLockSession *session, gpointer user_data)
+{
+  struct transfer *transfer = user_data;
+  if(!g_atomic_int_compare_and_exchange(&in_use[transfer->from], 0, 1)) {
+    g_atomic_int_inc(&overlaps);
+  }
+  if(!g_atomic_int_compare_and_exchange(&in_use[transfer->to], 0, 1)) {
+    g_atomic_int_inc(&overlaps);
+  }
+  balances[transfer->from]--;
+  balances[transfer->to]++;
+  g_atomic_int_set(&in_use[transfer->from], 0);
+  g_atomic_int_set(&in_use[transfer->to], 0);
+  free(transfer);
+}
+
+/**
+ * Task submitted by another task
+ */
+static void _nested(GLockSession *session, gpointer user_data)
+{
+  g_atomic_int_inc(&nested_runs);
+}
+
+/**
+ * Task which submits another task for the same lock
+ */
+static void _submitter(GLockSession *session, gpointer user_data)
+{
+  struct g_lock_task_lock locks[] = {
+    { account_locks[0], G_LOCK_ACTION_BASIC },
+  };
+  g_lock_executor_submit(executor, locks, 1, _nested, NULL);
+}
+
+/**
+ * Task needing a lock held by the main thread
+ */
+static void _held(GLockSession *session, gpointer user_data)
+{
+  g_atomic_int_inc(&held_runs);
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  struct g_lock_executor_stats stats;
+  struct g_lock_task_lock locks[2];
+  struct transfer *transfer;
+  GLockSession *session;
+  int64_t total = 0;
+  char name[32];
+
+  for(int ix = 0; ix < ACCOUNTS; ix++) {
+    snprintf(name, sizeof(name), "account%d", ix);
+    account_locks[ix] = g_lock_create_mutex(name);
+    balances[ix] = BALANCE;
+  }
+  held_lock = g_lock_create_rw("held");
+  executor = g_lock_executor_new(WORKERS);
+
+  // Locks are given in any order and taken by index
+  srand(1);
+  for(int ix = 0; ix < TRANSFERS; ix++) {
+    transfer = malloc(sizeof(struct transfer));
+    transfer->from = rand() % ACCOUNTS;
+    transfer->to = (transfer->from + 1 + rand() % (ACCOUNTS - 1)) %
+      ACCOUNTS;
+    locks[0].lock = account_locks[transfer->from];
+    locks[0].action = G_LOCK_ACTION_BASIC;
+    locks[1].lock = account_locks[transfer->to];
+    locks[1].action = G_LOCK_ACTION_BASIC;
+    if(!g_lock_executor_submit(executor, locks, 2, _transfer, transfer)) {
+      printf("Failed to submit a transfer\n");
+      return 1;
+    }
+  }
+  locks[0].lock = account_locks[0];
+  g_lock_executor_submit(executor, locks, 1, _submitter, NULL);
+  g_lock_executor_wait(executor);
+
+  for(int ix = 0; ix < ACCOUNTS; ix++) {
+    total += balances[ix];
+  }
+  if(total != ACCOUNTS * BALANCE || overlaps) {
+    printf("Total %" PRId64 " with %d tasks overlapping\n", total,
+      overlaps);
+    return 1;
+  }
+  if(nested_runs != 1) {
+    printf("The nested task ran %d times\n", nested_runs);
+    return 1;
+  }
+
+  // A task waits for a lock held outside of the executor
+  session = g_lock_session_new();
+  g_lock_start_read(session, held_lock);
+  locks[0].lock = held_lock;
+  locks[0].action = G_LOCK_ACTION_WRITE;
+  g_lock_executor_submit(executor, locks, 1, _held, NULL);
+  usleep(SLEEP_TIME);
+  if(held_runs) {
+    printf("The task ran while its lock was held\n");
+    return 1;
+  }
+  g_lock_end_read(session, held_lock);
+  g_lock_executor_wait(executor);
+  g_lock_session_free(session);
+  if(held_runs != 1) {
+    printf("The task did not run once its lock was released\n");
+    return 1;
+  }
+
+  // Invalid tasks are refused
+  locks[0].lock = account_locks[1];
+  locks[1].lock = account_locks[1];
+  locks[0].action = locks[1].action = G_LOCK_ACTION_BASIC;
+  if(g_lock_executor_submit(executor, locks, 2, _held, NULL) ||
+     g_lock_executor_submit(executor, locks, 1, NULL, NULL)) {
+    printf("An invalid task was accepted\n");
+    return 1;
+  }
+
+  g_lock_executor_stats(executor, &stats);
+  printf("Submitted %" PRIu64 " executed %" PRIu64 " parked %" PRIu64
+    " stolen %" PRIu64 "\n", stats.submitted, stats.executed,
+    stats.parked, stats.stolen);
+  if(stats.submitted != TRANSFERS + 3 || stats.executed != stats.submitted ||
+     stats.refused || !stats.parked) {
+    printf("Unexpected executor counters\n");
+    return 1;
+  }
+  g_lock_executor_free(executor);
+
+  for(int ix = 0; ix < ACCOUNTS; ix++) {
+    g_lock_free(account_locks[ix]);
+  }
+  g_lock_free(held_lock);
+  g_lock_manager_free();
+  printf("Tasks ran with their locks\n");
+  return 0;
+}
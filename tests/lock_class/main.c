@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+#define CONNECTIONS 16
+#define ITERATIONS 100
+
+/**
+ * Structure owning its lock
+ */
+struct connection {
+  GLock lock;
+  uint64_t sent;
+};
+
+struct connection connections[CONNECTIONS];
+
+/**
+ * Thread which moves data between pairs of connections
+ *
+ * Both connections are held at once, taken by increasing address.
+ */
+static void _transfer_thread()
+{
+  struct connection *first, *second;
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    first = &connections[ix % CONNECTIONS];
+    second = &connections[(ix * 7 + 1) % CONNECTIONS];
+    if(first == second) {
+      continue;
+    }
+    if(first > second) {
+      struct connection *tmp = first;
+      first = second;
+      second = tmp;
+    }
+    g_lock_start(session, &first->lock);
+    g_lock_start(session, &second->lock);
+    first->sent++;
+    second->sent++;
+    g_lock_end(session, &second->lock);
+    g_lock_end(session, &first->lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  GLock *server_lock = g_lock_create_mutex("server");
+  GLockClass *conn_class = g_lock_class_new("connection",
+    G_LOCK_CLASS_ADDRESS_ORDERED);
+  GLockClass *node_class = g_lock_class_new("tree-node",
+    G_LOCK_CLASS_SUBCLASS);
+  GLockClass *entry_class = g_lock_class_new("cache-entry",
+    G_LOCK_CLASS_FORBIDDEN);
+  GLock *parent = g_lock_create_instance(node_class, G_LOCK_MUTEX, 0);
+  GLock *child = g_lock_create_instance(node_class, G_LOCK_MUTEX, 1);
+  GLock *entry1 = g_lock_create_instance(entry_class, G_LOCK_MUTEX, 0);
+  GLock *entry2 = g_lock_create_instance(entry_class, G_LOCK_MUTEX, 0);
+
+  for(int ix = 0; ix < CONNECTIONS; ix++) {
+    g_lock_init_instance(&connections[ix].lock, conn_class, G_LOCK_MUTEX, 0);
+  }
+  if(connections[3].lock.index != conn_class->index ||
+     conn_class->instances != CONNECTIONS) {
+    printf("Instances are not part of their class\n");
+    return 1;
+  }
+
+  GThread *transfer1 = g_thread_new("transfer1",
+    (GThreadFunc)_transfer_thread, NULL);
+  GThread *transfer2 = g_thread_new("transfer2",
+    (GThreadFunc)_transfer_thread, NULL);
+  g_thread_join(transfer1);
+  g_thread_join(transfer2);
+
+  GLockSession *session = g_lock_session_new();
+  // The class is ordered after locks created before it
+  g_lock_start(session, server_lock);
+  g_lock_start(session, &connections[0].lock);
+  g_lock_end(session, &connections[0].lock);
+  g_lock_end(session, server_lock);
+
+  g_lock_start(session, parent);
+  g_lock_start(session, child);
+  g_lock_end(session, child);
+  g_lock_end(session, parent);
+
+  // Each rule refuses its own violations
+  g_lock_manager_allow_wrong_order(true);
+  g_lock_start(session, &connections[1].lock);
+  if(g_lock_start(session, &connections[0].lock)) {
+    printf("Connections taken against address order\n");
+    return 1;
+  }
+  g_lock_end(session, &connections[1].lock);
+  g_lock_start(session, child);
+  if(g_lock_start(session, parent)) {
+    printf("Nodes taken against subclass order\n");
+    return 1;
+  }
+  g_lock_end(session, child);
+  g_lock_start(session, entry1);
+  if(g_lock_start(session, entry2)) {
+    printf("Two cache entries taken at once\n");
+    return 1;
+  }
+  g_lock_end(session, entry1);
+  g_lock_session_free(session);
+
+  g_lock_show_all();
+  if(conn_class->stats.acquisitions < ITERATIONS ||
+     node_class->stats.acquisitions != 3) {
+    printf("Unexpected class statistics\n");
+    return 1;
+  }
+
+  // A class can only go once its instances are gone
+  g_lock_free(entry1);
+  g_lock_class_free(entry_class);
+  g_lock_free(entry2);
+  g_lock_class_free(entry_class);
+  g_lock_manager_free();
+  for(int ix = 0; ix < CONNECTIONS; ix++) {
+    g_lock_clear(&connections[ix].lock);
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+#define APP_LOCKS(X) \
+  X(config_lock, G_LOCK_RW, 10) \
+  X(registry_lock, G_LOCK_RECURSIVE, 20) \
+  X(queue_lock, G_LOCK_MUTEX, 30)
+
+G_LOCK_TABLE_DECLARE(app_locks, APP_LOCKS);
+G_LOCK_TABLE_DEFINE(app_locks, APP_LOCKS);
+
+#define LATE_LOCKS(X) \
+  X(overlap_lock, G_LOCK_MUTEX, 25) \
+  X(after_lock, G_LOCK_MUTEX, 40)
+
+G_LOCK_TABLE_DECLARE(late_locks, LATE_LOCKS);
+G_LOCK_TABLE_DEFINE(late_locks, LATE_LOCKS);
+
+G_LOCK_ASSERT_ORDER(config_lock, registry_lock);
+G_LOCK_ASSERT_ORDER(registry_lock, queue_lock);
+G_LOCK_ASSERT_ORDER(queue_lock, after_lock);
+
+#define ITERATIONS 100
+
+/**
+ * Thread which takes the locks in the declared order
+ */
+static void _nested_thread()
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    g_lock_start_read(session, config_lock);
+    g_lock_start(session, registry_lock);
+    g_lock_start(session, queue_lock);
+    g_lock_end(session, queue_lock);
+    g_lock_end(session, registry_lock);
+    g_lock_end_read(session, config_lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  GLockSession *session = g_lock_session_new();
+
+  // Unregistered locks are refused
+  if(g_lock_start(session, queue_lock)) {
+    printf("Took a lock which is not registered\n");
+    return 1;
+  }
+
+  if(!g_lock_table_register(&app_locks) ||
+     g_lock_table_register(&app_locks)) {
+    printf("Unexpected registration result\n");
+    return 1;
+  }
+  GLock *late_lock = g_lock_create_mutex("late");
+  if(queue_lock->index != 30 || late_lock->index != 31) {
+    printf("Unexpected lock indices\n");
+    return 1;
+  }
+
+  // A table overlapping the registered locks is refused untouched
+  if(g_lock_table_register(&late_locks) || late_locks.manager ||
+     overlap_lock->manager || after_lock->manager) {
+    printf("Overlapping table registered\n");
+    return 1;
+  }
+
+  GThread *nested1 = g_thread_new("nested1", (GThreadFunc)_nested_thread,
+    NULL);
+  GThread *nested2 = g_thread_new("nested2", (GThreadFunc)_nested_thread,
+    NULL);
+  g_thread_join(nested1);
+  g_thread_join(nested2);
+
+  // The declared order is enforced at runtime too
+  g_lock_manager_allow_wrong_order(true);
+  g_lock_start(session, queue_lock);
+  if(g_lock_start(session, registry_lock)) {
+    printf("Lock taken out of order\n");
+    return 1;
+  }
+  g_lock_end(session, queue_lock);
+  g_lock_session_free(session);
+
+  g_lock_show_all();
+  g_lock_show_top_callsites(3);
+  char *name = g_lock_name_by_index(20);
+  if(!name || strcmp(name, "registry_lock")) {
+    printf("Wrong lock found by index\n");
+    return 1;
+  }
+  free(name);
+
+  // Static locks stay usable after the manager is cleaned up
+  g_lock_free(config_lock);
+  g_lock_manager_free();
+  if(!g_lock_table_register(&app_locks)) {
+    printf("Table can't be registered again\n");
+    return 1;
+  }
+  _nested_thread();
+  g_lock_manager_free();
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  char *name;
+  GLockManager *plugin = g_lock_manager_new();
+  GLock *core_lock = g_lock_create_mutex("core");
+  GLock *plugin_outer = g_lock_create_in(plugin, "plugin-outer",
+    G_LOCK_MUTEX);
+  GLock *plugin_inner = g_lock_create_in(plugin, "plugin-inner",
+    G_LOCK_MUTEX);
+
+  // Each manager numbers its own locks
+  if(core_lock->index != 0 || plugin_outer->index != 0 ||
+     plugin_inner->index != 1) {
+    printf("Managers share an index space\n");
+    return 1;
+  }
+  name = g_lock_name_by_index_in(plugin, 1);
+  if(!name || strcmp(name, "plugin-inner")) {
+    printf("Wrong lock found by index\n");
+    return 1;
+  }
+  free(name);
+
+  // Order is only checked between locks of the same manager
+  GLockSession *session = g_lock_session_new();
+  g_lock_start(session, plugin_outer);
+  g_lock_start(session, core_lock);
+  g_lock_start(session, plugin_inner);
+  g_lock_end(session, plugin_inner);
+  g_lock_end(session, core_lock);
+  g_lock_end(session, plugin_outer);
+
+  // Settings are per manager, the default one still aborts
+  g_lock_manager_set_debug_in(plugin, true);
+  g_lock_manager_allow_wrong_order_in(plugin, true);
+  g_lock_start(session, plugin_inner);
+  if(g_lock_start(session, plugin_outer)) {
+    printf("Lock taken out of order\n");
+    return 1;
+  }
+  g_lock_end(session, plugin_inner);
+  g_lock_session_free(session);
+
+  g_lock_show_all_in(plugin);
+  g_lock_show_all();
+  if(plugin_outer->stats.holding || core_lock->stats.holding) {
+    printf("Locks left taken\n");
+    return 1;
+  }
+
+  // Each manager reuses its own lock structures
+  g_lock_free(plugin_inner);
+  GLock *core_late = g_lock_create_mutex("core-late");
+  GLock *plugin_late = g_lock_create_in(plugin, "plugin-late", G_LOCK_MUTEX);
+  if(core_late == plugin_inner || plugin_late != plugin_inner ||
+     plugin->retiring || !plugin->slabs || plugin->slabs->next) {
+    printf("Managers share a pool\n");
+    return 1;
+  }
+  g_lock_free(core_late);
+
+  g_lock_manager_destroy(plugin);
+  if(g_lock_manager_default()->locks.head->data != core_lock) {
+    printf("Default manager lost its locks\n");
+    return 1;
+  }
+  g_lock_manager_free();
+  return 0;
+}
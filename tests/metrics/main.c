@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *busy_lock = NULL;
+
+#define ITERATIONS 20
+#define SLEEP_TIME 2000 // 2ms
+
+/**
+ * Thread which keeps the lock busy
+ */
+static void _busy_thread()
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(g_lock_start(session, busy_lock)) {
+      usleep(SLEEP_TIME);
+      g_lock_end(session, busy_lock);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Scrape the exporter listening on a Unix socket
+ *
+ * @param path Path of the socket
+ * @return The allocated response or NULL on error
+ */
+static char *_scrape(const char *path)
+{
+  struct sockaddr_un addr;
+  GString *response = g_string_new(NULL);
+  const char *request = "GET /metrics HTTP/1.0\r\n\r\n";
+  char buffer[1024];
+  ssize_t got;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+     write(fd, request, strlen(request)) < 0) {
+    close(fd);
+    return NULL;
+  }
+  while((got = read(fd, buffer, sizeof(buffer))) > 0) {
+    g_string_append_len(response, buffer, got);
+  }
+  close(fd);
+  return g_string_free(response, FALSE);
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  char *metrics, *response;
+  char *path = g_strdup_printf("%s/g-lock-metrics-%d.sock",
+    g_get_tmp_dir(), getpid());
+  GLockClass *conn_class = g_lock_class_new("connection",
+    G_LOCK_CLASS_FORBIDDEN);
+  GLock *conn = g_lock_create_instance(conn_class, G_LOCK_MUTEX, 0);
+  busy_lock = g_lock_create_mutex("busy \"lock\"");
+  GLockManager *manager = g_lock_manager_new();
+  GLock *other_lock = g_lock_create_in(manager, "other", G_LOCK_MUTEX);
+  GLockSession *session = g_lock_session_new();
+
+  // Nothing is counted until somebody collects the metrics
+  g_lock_start(session, busy_lock);
+  g_lock_end(session, busy_lock);
+  if(busy_lock->metrics.acquisitions || busy_lock->metrics.holders) {
+    printf("Metrics updated without being collected\n");
+    return 1;
+  }
+  g_lock_metrics_collect_start();
+
+  // Collecting is turned on for each manager on its own
+  g_lock_start(session, other_lock);
+  g_lock_end(session, other_lock);
+  if(other_lock->metrics.acquisitions) {
+    printf("Metrics of another manager updated\n");
+    return 1;
+  }
+  g_lock_metrics_collect_start_in(manager);
+
+  GThread *busy1 = g_thread_new("busy1", (GThreadFunc)_busy_thread, NULL);
+  GThread *busy2 = g_thread_new("busy2", (GThreadFunc)_busy_thread, NULL);
+  g_thread_join(busy1);
+  g_thread_join(busy2);
+
+  g_lock_start(session, conn);
+  g_lock_start(session, other_lock);
+
+  metrics = g_lock_metrics_render();
+  printf("%s", metrics);
+  if(!strstr(metrics,
+       "glock_acquisitions_total{lock=\"busy \\\"lock\\\"\","
+       "index=\"1\"} 40\n") ||
+     !strstr(metrics, "glock_holders{class=\"connection\",index=\"0\"} 1\n") ||
+     !strstr(metrics, "glock_hold_seconds_count{lock=\"busy \\\"lock\\\"\","
+       "index=\"1\"} 40\n") ||
+     !g_str_has_suffix(metrics, "# EOF\n")) {
+    printf("Unexpected metrics\n");
+    return 1;
+  }
+  g_free(metrics);
+
+  if(!g_lock_metrics_start_unix(path) || g_lock_metrics_start_unix(path)) {
+    printf("Unexpected exporter start result\n");
+    return 1;
+  }
+  response = _scrape(path);
+  if(!response || !g_str_has_prefix(response, "HTTP/1.0 200 OK\r\n") ||
+     !strstr(response, "application/openmetrics-text") ||
+     !strstr(response, "glock_holders{class=\"connection\",index=\"0\"} 1\n")) {
+    printf("Unexpected scrape response\n");
+    return 1;
+  }
+  g_free(response);
+  g_lock_metrics_stop();
+  if(access(path, F_OK) == 0) {
+    printf("Socket left behind\n");
+    return 1;
+  }
+
+  // Another manager is served on its own
+  if(!g_lock_metrics_start_unix_in(manager, path)) {
+    printf("Exporter of another manager not started\n");
+    return 1;
+  }
+  response = _scrape(path);
+  if(!response ||
+     !strstr(response, "glock_holders{lock=\"other\",index=\"0\"} 1\n") ||
+     strstr(response, "connection")) {
+    printf("Unexpected scrape response of another manager\n");
+    return 1;
+  }
+  g_free(response);
+  g_lock_metrics_stop();
+
+  g_lock_end(session, other_lock);
+  g_lock_end(session, conn);
+  g_lock_metrics_collect_stop_in(manager);
+  g_lock_metrics_collect_stop();
+  if(conn_class->metrics.holders || other_lock->metrics.holders) {
+    printf("Holders left in the metrics\n");
+    return 1;
+  }
+  g_lock_session_free(session);
+  g_lock_manager_destroy(manager);
+  g_free(path);
+  g_lock_manager_free();
+  return 0;
+}
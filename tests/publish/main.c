@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *busy_lock = NULL;
+GLock *idle_lock = NULL;
+GLockClass *klass = NULL;
+GLock *instance = NULL;
+
+#define ITERATIONS 50
+#define SLEEP_TIME 200 // 0.2ms
+#define CAPACITY 4
+
+/**
+ * Thread which takes the busy lock and the instance
+ */
+static void _busy_thread()
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(g_lock_start(session, busy_lock)) {
+      usleep(SLEEP_TIME);
+      g_lock_end(session, busy_lock);
+    }
+    if(g_lock_start(session, instance)) {
+      g_lock_end(session, instance);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Find the record of a lock or class in the file
+ *
+ * @param records The records of the file
+ * @param used Number of records in use
+ * @param name Name of the lock or class
+ * @return The record or NULL
+ */
+static struct g_lock_publish_record *_find(
+  struct g_lock_publish_record *records,
+  uint32_t used,
+  const char *name
+  )
+{
+  for(uint32_t ix = 0; ix < used; ix++) {
+    if(records[ix].state != G_LOCK_PUBLISH_FREE &&
+       strcmp(records[ix].name, name) == 0) {
+      return &records[ix];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Check the record of a lock matches its metrics
+ *
+ * @param record The record in the file
+ * @param metrics The metrics of the lock
+ * @param name Name of the lock
+ * @return 0 if they match otherwise 1
+ */
+static int _check(
+  struct g_lock_publish_record *record,
+  struct g_lock_metrics *metrics,
+  const char *name
+  )
+{
+  if(!record) {
+    printf("%s is not published\n", name);
+    return 1;
+  }
+  if(record->seq & 1 ||
+     record->acquisitions != metrics->acquisitions ||
+     record->contended != metrics->contended ||
+     record->holders != metrics->holders ||
+     record->wait_sum_us != metrics->wait_sum_us ||
+     record->hold_sum_us != metrics->hold_sum_us) {
+    printf("%s published %" PRIu64 " acquisitions %" PRIu64
+      " contended, expected %" PRIu64 " and %" PRIu64 "\n", name,
+      record->acquisitions, record->contended,
+      metrics->acquisitions, metrics->contended);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  struct g_lock_publish_header *header;
+  struct g_lock_publish_record *records, *record;
+  size_t size = sizeof(struct g_lock_publish_header) +
+    CAPACITY * sizeof(struct g_lock_publish_record);
+  GLock *spare1, *spare2, *spare3;
+  GLockSession *session;
+  uint32_t slot;
+  int fd, rc = 0;
+  char *path = g_strdup_printf("%s/g-lock-publish-%d.stats",
+    g_get_tmp_dir(), getpid());
+
+  // Locks created before publishing are published when it starts
+  busy_lock = g_lock_create_mutex("busy");
+  if(!g_lock_publish_start(path, CAPACITY)) {
+    printf("Failed to publish\n");
+    return 1;
+  }
+  if(g_lock_publish_start(path, CAPACITY)) {
+    printf("Published twice\n");
+    return 1;
+  }
+  idle_lock = g_lock_create_mutex("idle");
+  klass = g_lock_class_new("class", G_LOCK_CLASS_FORBIDDEN);
+  instance = g_lock_create_instance(klass, G_LOCK_MUTEX, 0);
+
+  fd = open(path, O_RDONLY);
+  header = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(header == MAP_FAILED) {
+    printf("Failed to map %s\n", path);
+    return 1;
+  }
+  records = (struct g_lock_publish_record *)
+    ((char *)header + header->header_size);
+  if(memcmp(header->magic, G_LOCK_PUBLISH_MAGIC, sizeof(header->magic)) ||
+     header->version != G_LOCK_PUBLISH_VERSION ||
+     header->record_size != sizeof(struct g_lock_publish_record) ||
+     header->capacity != CAPACITY || header->pid != (uint32_t)getpid() ||
+     header->used != 3) {
+    printf("Unexpected header version %u capacity %u used %u\n",
+      header->version, header->capacity, header->used);
+    return 1;
+  }
+  // Instances are only published through their class
+  if(!_find(records, header->used, "class") ||
+     _find(records, header->used, "class")->state != G_LOCK_PUBLISH_CLASS) {
+    printf("The class is not published\n");
+    return 1;
+  }
+
+  GThread *busy1 = g_thread_new("busy1", (GThreadFunc)_busy_thread, NULL);
+  GThread *busy2 = g_thread_new("busy2", (GThreadFunc)_busy_thread, NULL);
+  g_thread_join(busy1);
+  g_thread_join(busy2);
+
+  rc |= _check(_find(records, header->used, "busy"), &busy_lock->metrics,
+    "busy");
+  rc |= _check(_find(records, header->used, "idle"), &idle_lock->metrics,
+    "idle");
+  rc |= _check(_find(records, header->used, "class"), &klass->metrics,
+    "class");
+  if(rc) {
+    return 1;
+  }
+  if(busy_lock->metrics.acquisitions != 2 * ITERATIONS) {
+    printf("Unexpected acquisitions %" PRIu64 "\n",
+      busy_lock->metrics.acquisitions);
+    return 1;
+  }
+
+  // A freed lock gives its record to the next lock
+  record = _find(records, header->used, "idle");
+  slot = record - records;
+  g_lock_free(idle_lock);
+  if(record->state != G_LOCK_PUBLISH_FREE || record->acquisitions) {
+    printf("The record of a freed lock is still in use\n");
+    return 1;
+  }
+  spare1 = g_lock_create_mutex("spare1");
+  record = _find(records, header->used, "spare1");
+  if(!record || record - records != slot) {
+    printf("The free record was not reused\n");
+    return 1;
+  }
+
+  // The file holds 4 records, the last lock is dropped
+  spare2 = g_lock_create_mutex("spare2");
+  spare3 = g_lock_create_mutex("spare3");
+  if(header->used != CAPACITY || header->dropped != 1 ||
+     _find(records, header->used, "spare3")) {
+    printf("Unexpected used %u dropped %u\n", header->used,
+      header->dropped);
+    return 1;
+  }
+
+  // The file stays readable after publishing stops
+  g_lock_publish_stop();
+  session = g_lock_session_new();
+  if(g_lock_start(session, spare2)) {
+    g_lock_end(session, spare2);
+  }
+  g_lock_session_free(session);
+  record = _find(records, header->used, "spare2");
+  if(!record || record->acquisitions) {
+    printf("A lock was published after stopping\n");
+    return 1;
+  }
+
+  munmap(header, size);
+  unlink(path);
+  g_free(path);
+  g_lock_free(spare1);
+  g_lock_free(spare2);
+  g_lock_free(spare3);
+  g_lock_free(instance);
+  g_lock_class_free(klass);
+  g_lock_free(busy_lock);
+  g_lock_manager_free();
+  printf("Live statistics are published\n");
+  return 0;
+}
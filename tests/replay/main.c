@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *outer_lock = NULL;
+GLock *inner_lock = NULL;
+
+#define ITERATIONS 20
+#define SLEEP_TIME 1000 // 1ms
+
+/**
+ * Thread which takes both locks
+ */
+static void _busy_thread()
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(g_lock_start(session, outer_lock)) {
+      if(g_lock_start_read(session, inner_lock)) {
+        usleep(SLEEP_TIME);
+        g_lock_end_read(session, inner_lock);
+      }
+      g_lock_end(session, outer_lock);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  struct g_lock_replay_header header;
+  struct g_lock_replay_lock lock;
+  struct g_lock_replay_thread thread;
+  struct g_lock_replay_event event;
+  uint32_t acquired = 0, released = 0, waited = 0;
+  const char *pos;
+  gchar *contents;
+  gsize length;
+  char *path = g_strdup_printf("%s/g-lock-replay-%d.bin",
+    g_get_tmp_dir(), getpid());
+  outer_lock = g_lock_create_mutex("outer");
+  inner_lock = g_lock_create_rw("inner");
+
+  g_lock_trace_start(0);
+  GThread *busy1 = g_thread_new("busy1", (GThreadFunc)_busy_thread, NULL);
+  GThread *busy2 = g_thread_new("busy2", (GThreadFunc)_busy_thread, NULL);
+  g_thread_join(busy1);
+  g_thread_join(busy2);
+  g_lock_trace_stop();
+
+  if(!g_lock_trace_save(path) ||
+     !g_file_get_contents(path, &contents, &length, NULL)) {
+    printf("Failed to save the trace\n");
+    return 1;
+  }
+  unlink(path);
+
+  pos = contents;
+  memcpy(&header, pos, sizeof(header));
+  pos += sizeof(header);
+  if(memcmp(header.magic, G_LOCK_REPLAY_MAGIC, sizeof(header.magic)) ||
+     header.lock_count != 2 || header.callsite_count != 4 ||
+     header.thread_count != 2) {
+    printf("Unexpected header %u locks %u call sites %u threads\n",
+      header.lock_count, header.callsite_count, header.thread_count);
+    return 1;
+  }
+  for(uint32_t ix = 0; ix < header.lock_count; ix++) {
+    memcpy(&lock, pos, sizeof(lock));
+    pos += sizeof(lock) + lock.name_len;
+    if(lock.index != ix || lock.type != (ix? G_LOCK_RW: G_LOCK_MUTEX)) {
+      printf("Unexpected lock %u\n", ix);
+      return 1;
+    }
+  }
+  // Call sites are variable sized, find the threads from the end
+  pos = contents + length - 2 * (sizeof(thread) +
+    4 * ITERATIONS * sizeof(event));
+  for(uint32_t ix = 0; ix < header.thread_count; ix++) {
+    memcpy(&thread, pos, sizeof(thread));
+    pos += sizeof(thread);
+    if(thread.event_count != 4 * ITERATIONS ||
+       strncmp(thread.name, "busy", 4) != 0) {
+      printf("Unexpected thread %.16s with %u events\n", thread.name,
+        thread.event_count);
+      return 1;
+    }
+    for(uint32_t ex = 0; ex < thread.event_count; ex++) {
+      memcpy(&event, pos, sizeof(event));
+      pos += sizeof(event);
+      if(event.op == G_LOCK_REPLAY_ACQUIRE) {
+        acquired++;
+        waited += event.wait_us > 0;
+      } else {
+        released++;
+        // Only the inner lock is held while sleeping
+        if(event.lock == 1 && event.delta_us < SLEEP_TIME) {
+          printf("Hold shorter than the sleep\n");
+          return 1;
+        }
+      }
+    }
+  }
+  if(acquired != 4 * ITERATIONS || released != 4 * ITERATIONS ||
+     !waited) {
+    printf("Unexpected events %u acquired %u released %u waited\n",
+      acquired, released, waited);
+    return 1;
+  }
+
+  g_free(contents);
+  g_free(path);
+  g_lock_manager_free();
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *rw_lock = NULL;
+
+#define ITERATIONS 200
+#define SLEEP_TIME 200 // 200us
+
+static gint readers_active = 0;
+static gint writers_active = 0;
+static gint violations = 0;
+
+/**
+ * Thread which uses the read portion of the rw lock
+ */
+static void _read_thread()
+{
+  GLockSession *session = g_lock_session_new();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(g_lock_start_read(session, rw_lock)) {
+      g_atomic_int_inc(&readers_active);
+      if(g_atomic_int_get(&writers_active)) {
+        g_atomic_int_inc(&violations);
+      }
+      usleep(SLEEP_TIME);
+      g_atomic_int_add(&readers_active, -1);
+      g_lock_end_read(session, rw_lock);
+    }
+  }
+  g_lock_session_free(session);
+}
+
+/**
+ * Thread which uses the write portion of the rw lock
+ */
+static void _write_thread()
+{
+  GLockSession *session = g_lock_session_new();
+  for(int ix = 0; ix < ITERATIONS / 4; ix++) {
+    if(g_lock_start_write(session, rw_lock)) {
+      g_atomic_int_inc(&writers_active);
+      if(g_atomic_int_get(&readers_active) ||
+         g_atomic_int_get(&writers_active) != 1) {
+        g_atomic_int_inc(&violations);
+      }
+      usleep(SLEEP_TIME);
+      g_atomic_int_add(&writers_active, -1);
+      g_lock_end_write(session, rw_lock);
+    }
+    usleep(SLEEP_TIME);
+  }
+  g_lock_session_free(session);
+}
+
+/**
+ * Run readers and writers against a lock with the given policy
+ *
+ * @param name The lock name
+ * @param policy The read/write policy to test
+ * @return true if the lock behaved
+ */
+static bool _test_policy(const char *name, enum g_lock_rw_policy policy)
+{
+  GThread *threads[6];
+  rw_lock = g_lock_create_rw_policy(name, policy);
+
+  threads[0] = g_thread_new("read1", (GThreadFunc)_read_thread, NULL);
+  threads[1] = g_thread_new("read2", (GThreadFunc)_read_thread, NULL);
+  threads[2] = g_thread_new("read3", (GThreadFunc)_read_thread, NULL);
+  threads[3] = g_thread_new("read4", (GThreadFunc)_read_thread, NULL);
+  threads[4] = g_thread_new("write1", (GThreadFunc)_write_thread, NULL);
+  threads[5] = g_thread_new("write2", (GThreadFunc)_write_thread, NULL);
+  for(int ix = 0; ix < 6; ix++) {
+    g_thread_join(threads[ix]);
+  }
+
+  g_lock_show_all();
+  if(rw_lock->stats.read_wait.count != 4 * ITERATIONS ||
+     rw_lock->stats.write_wait.count != 2 * (ITERATIONS / 4)) {
+    printf("%s: unexpected wait sample counts\n", name);
+    return false;
+  }
+  g_lock_free(rw_lock);
+  return true;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  if(!_test_policy("default", G_LOCK_RW_POLICY_DEFAULT) ||
+     !_test_policy("reader", G_LOCK_RW_POLICY_READER) ||
+     !_test_policy("writer", G_LOCK_RW_POLICY_WRITER) ||
+     !_test_policy("phase-fair", G_LOCK_RW_POLICY_PHASE_FAIR)) {
+    return 1;
+  }
+  if(violations) {
+    printf("Mutual exclusion violated %d times\n", violations);
+    return 1;
+  }
+  g_lock_manager_free();
+  return 0;
+}
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../../g_lock_manager.h"
+
+#define WORKERS 4
+#define ITERATIONS 1000
+
+/**
+ * Memory shared by all the processes
+ */
+struct shared_region {
+  GLockShared lock;
+  uint32_t counter;
+  gint inside;
+  gint violations;
+};
+
+static struct shared_region *region = NULL;
+
+/**
+ * Worker process which keeps taking a local and the shared lock
+ *
+ * @return The exit status of the worker
+ */
+static int _worker()
+{
+  GLock *local_lock = g_lock_create_mutex("local");
+  GLock *shared_lock = g_lock_create_shared(&region->lock);
+  GLockSession *session = g_lock_session_new();
+  if(!local_lock || !shared_lock) {
+    return 1;
+  }
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    g_lock_start(session, local_lock);
+    if(g_lock_start(session, shared_lock)) {
+      if(g_atomic_int_add(&region->inside, 1) != 0) {
+        g_atomic_int_inc(&region->violations);
+      }
+      region->counter++;
+      g_atomic_int_add(&region->inside, -1);
+      g_lock_end(session, shared_lock);
+    }
+    g_lock_end(session, local_lock);
+  }
+  g_lock_session_free(session);
+  return 0;
+}
+
+/**
+ * Fork a process running a function
+ *
+ * @param func What the process runs
+ * @return The pid of the process
+ */
+static pid_t _fork(int (*func)())
+{
+  pid_t pid = fork();
+  if(pid == 0) {
+    _exit(func());
+  }
+  return pid;
+}
+
+/**
+ * Worker process which exits holding the shared lock
+ *
+ * @return The exit status of the worker
+ */
+static int _dying_worker()
+{
+  GLock *shared_lock = g_lock_create_shared(&region->lock);
+  GLockSession *session = g_lock_session_new();
+  if(!g_lock_start(session, shared_lock)) {
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Wait for a process and check it succeeded
+ *
+ * @param pid The process
+ * @return true if the process exited with 0
+ */
+static bool _wait(pid_t pid)
+{
+  int status;
+  if(waitpid(pid, &status, 0) != pid) {
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  pid_t workers[WORKERS];
+  GLock *shared_lock;
+  GLockSession *session;
+
+  region = mmap(NULL, sizeof(struct shared_region), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(region == MAP_FAILED) {
+    printf("Failed to map shared memory\n");
+    return 1;
+  }
+  if(g_lock_create("shared", G_LOCK_SHARED) ||
+     g_lock_create_shared(&region->lock)) {
+    printf("Shared lock created without shared memory\n");
+    return 1;
+  }
+  if(!g_lock_shared_init(&region->lock, "shared")) {
+    printf("Failed to initialize the shared lock\n");
+    return 1;
+  }
+
+  for(int ix = 0; ix < WORKERS; ix++) {
+    workers[ix] = _fork(_worker);
+  }
+  for(int ix = 0; ix < WORKERS; ix++) {
+    if(!_wait(workers[ix])) {
+      printf("Worker %d failed\n", ix);
+      return 1;
+    }
+  }
+  if(region->violations || region->counter != WORKERS * ITERATIONS ||
+     region->lock.stats.acquisitions != WORKERS * ITERATIONS ||
+     region->lock.stats.hold.count != WORKERS * ITERATIONS) {
+    printf("Unexpected state %d violations counter %u acquisitions %"
+      PRIu64 "\n", region->violations, region->counter,
+      region->lock.stats.acquisitions);
+    return 1;
+  }
+
+  // The lock of a process which died holding it is recovered
+  if(!_wait(_fork(_dying_worker)) || !region->lock.holder_pid) {
+    printf("Dying worker did not keep the lock\n");
+    return 1;
+  }
+  shared_lock = g_lock_create_shared(&region->lock);
+  session = g_lock_session_new();
+  if(!g_lock_start(session, shared_lock)) {
+    printf("Failed to recover the lock\n");
+    return 1;
+  }
+  if(region->lock.holder_pid != getpid() ||
+     region->lock.stats.owner_died != 1) {
+    printf("Holder not recorded after recovery\n");
+    return 1;
+  }
+  g_lock_show_all();
+  g_lock_end(session, shared_lock);
+  if(region->lock.holder_pid) {
+    printf("Holder kept after release\n");
+    return 1;
+  }
+  g_lock_session_free(session);
+  g_lock_shared_show(&region->lock);
+
+  g_lock_manager_free();
+  g_lock_shared_clear(&region->lock);
+  munmap(region, sizeof(struct shared_region));
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *shared_lock = NULL;
+
+#define WORKERS 3
+#define SLEEP_TIME 50000 // 50ms
+#define HOLD_TIME 10000 // 10ms
+#define POLL_TIME 1000 // 1ms
+
+/**
+ * Thread which waits for the lock and keeps it for a while
+ */
+static void _worker_thread()
+{
+  G_LOCK_SESSION_START();
+  if(g_lock_start(session, shared_lock)) {
+    usleep(HOLD_TIME);
+    g_lock_end(session, shared_lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Find the entry of a thread name
+ *
+ * @param array The stats returned by g_lock_thread_stats
+ * @param name The thread name
+ * @return The entry or NULL if not found
+ */
+static struct g_lock_thread_stats *_find(GArray *array, const char *name)
+{
+  struct g_lock_thread_stats *stats;
+  for(guint ix = 0; ix < array->len; ix++) {
+    stats = &g_array_index(array, struct g_lock_thread_stats, ix);
+    if(strcmp(stats->name, name) == 0) {
+      return stats;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  int failures = 0;
+  GThread *threads[WORKERS];
+  struct g_lock_queue_stats queue;
+  struct g_lock_thread_stats *workers, *self;
+  GArray *array;
+  shared_lock = g_lock_create_mutex("shared lock");
+  GLockSession *session = g_lock_session_new();
+
+  // Nothing is accounted before starting
+  g_lock_start(session, shared_lock);
+  g_lock_end(session, shared_lock);
+  g_lock_thread_stats_start();
+
+  g_lock_start(session, shared_lock);
+  for(int ix = 0; ix < WORKERS; ix++) {
+    threads[ix] = g_thread_new("worker", (GThreadFunc)_worker_thread, NULL);
+  }
+  for(int ix = 0; ix < 5000; ix++) {
+    g_lock_queue_stats(shared_lock, &queue);
+    if(queue.waiting == WORKERS) {
+      break;
+    }
+    usleep(POLL_TIME);
+  }
+  usleep(SLEEP_TIME);
+  g_lock_end(session, shared_lock);
+  for(int ix = 0; ix < WORKERS; ix++) {
+    g_thread_join(threads[ix]);
+  }
+  g_lock_show_thread_stats(false);
+
+  array = g_lock_thread_stats(true);
+  workers = _find(array, "worker");
+  g_lock_thread_stats_stop();
+  self = _find(array, "main");
+  if(!workers || workers->threads != WORKERS ||
+     workers->counters.acquisitions != WORKERS ||
+     workers->counters.contended != WORKERS ||
+     workers->counters.wait_us < SLEEP_TIME * WORKERS ||
+     workers->counters.hold_us < HOLD_TIME * WORKERS ||
+     workers->alive_us < workers->counters.wait_us ||
+     workers->interval_us < SLEEP_TIME) {
+    printf("Unexpected worker statistics\n");
+    failures++;
+  }
+  if(!self || self->threads != 1 || self->counters.acquisitions != 1 ||
+     self->counters.contended || self->counters.wait_us ||
+     self->counters.hold_us < SLEEP_TIME) {
+    printf("Unexpected main thread statistics\n");
+    failures++;
+  }
+  g_array_unref(array);
+
+  // Nothing is accounted once stopped, exited workers went on reset
+  g_lock_start(session, shared_lock);
+  g_lock_end(session, shared_lock);
+  array = g_lock_thread_stats(false);
+  self = _find(array, "main");
+  if(_find(array, "worker") || !self || self->counters.acquisitions) {
+    printf("Unexpected statistics after reset\n");
+    failures++;
+  }
+  g_array_unref(array);
+
+  g_lock_session_free(session);
+  g_lock_manager_free();
+  return failures? 1: 0;
+}
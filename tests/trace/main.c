@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *busy_lock = NULL;
+GLock *idle_lock = NULL;
+
+#define ITERATIONS 20
+#define SLEEP_TIME 1000 // 1ms
+#define EVENTS_PER_THREAD 16
+
+/**
+ * Thread which keeps the lock busy
+ */
+static void _busy_thread()
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(g_lock_start(session, busy_lock)) {
+      usleep(SLEEP_TIME);
+      g_lock_end(session, busy_lock);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Count the occurrences of a string
+ *
+ * @param haystack Where to look
+ * @param needle What to look for
+ * @return How many times needle was found
+ */
+static uint32_t _count(const char *haystack, const char *needle)
+{
+  uint32_t count = 0;
+  while((haystack = strstr(haystack, needle))) {
+    count++;
+    haystack += strlen(needle);
+  }
+  return count;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  char *trace;
+  char *path = g_strdup_printf("%s/g-lock-trace-%d.json",
+    g_get_tmp_dir(), getpid());
+  busy_lock = g_lock_create_mutex("busy \"lock\"");
+  idle_lock = g_lock_create_mutex("idle lock");
+
+  // Nothing is recorded before the start
+  GLockSession *session = g_lock_session_new();
+  g_lock_start(session, idle_lock);
+  g_lock_end(session, idle_lock);
+
+  if(!g_lock_trace_start(EVENTS_PER_THREAD)) {
+    printf("Failed to start recording\n");
+    return 1;
+  }
+  GThread *busy1 = g_thread_new("busy1", (GThreadFunc)_busy_thread, NULL);
+  GThread *busy2 = g_thread_new("busy2", (GThreadFunc)_busy_thread, NULL);
+  g_thread_join(busy1);
+  g_thread_join(busy2);
+  g_lock_start(session, idle_lock);
+
+  trace = g_lock_trace_export();
+  printf("%s", trace);
+  if(!g_str_has_prefix(trace, "{\"displayTimeUnit\"") ||
+     !g_str_has_suffix(trace, "]}\n") ||
+     !strstr(trace, "\"args\":{\"name\":\"busy1\"}") ||
+     !strstr(trace, "\"args\":{\"name\":\"busy2\"}") ||
+     !strstr(trace, "\"cat\":\"wait\",\"name\":\"wait busy \\\"lock\\\"\"") ||
+     !strstr(trace, "\"cat\":\"hold\",\"name\":\"busy \\\"lock\\\"\"") ||
+     !strstr(trace, "\"func\":\"_busy_thread\"") ||
+     _count(trace, "\"name\":\"idle lock\"") != 1 ||
+     _count(trace, "\"open\":true") != 1) {
+    printf("Unexpected trace\n");
+    return 1;
+  }
+  // Each thread only keeps its latest events
+  if(_count(trace, "\"ph\":\"X\"") > 2 * EVENTS_PER_THREAD + 1) {
+    printf("Recording is not bounded\n");
+    return 1;
+  }
+  g_free(trace);
+
+  g_lock_trace_stop();
+  g_lock_end(session, idle_lock);
+  if(!g_lock_trace_export_file(path)) {
+    printf("Failed to export trace\n");
+    return 1;
+  }
+  unlink(path);
+
+  g_lock_session_free(session);
+  g_free(path);
+  g_lock_manager_free();
+  return 0;
+}
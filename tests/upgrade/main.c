@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Define locks
+ */
+GLock *rw_lock = NULL;
+GLock *phase_lock = NULL;
+
+#define ITERATIONS 200
+#define SLEEP_TIME 200 // 200us
+#define READ_HOLD 20000 // 20ms
+
+static gint readers_active = 0;
+static gint writers_active = 0;
+static gint violations = 0;
+static uint32_t counter = 0;
+
+/**
+ * Thread which holds the read side for a while
+ */
+static void _long_read_thread()
+{
+  G_LOCK_SESSION_START();
+  if(g_lock_start_read(session, rw_lock)) {
+    g_atomic_int_inc(&readers_active);
+    usleep(READ_HOLD);
+    g_atomic_int_add(&readers_active, -1);
+    g_lock_end_read(session, rw_lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which only tries to take the lock
+ *
+ * @param action What to try
+ * @return Non NULL if the lock was taken
+ */
+static gpointer _try_thread(gpointer action)
+{
+  bool taken = false;
+  GLockSession *session = g_lock_session_new();
+  switch(GPOINTER_TO_INT(action)) {
+    case G_LOCK_ACTION_READ:
+      if((taken = g_lock_try_start_read(session, rw_lock))) {
+        g_lock_end_read(session, rw_lock);
+      }
+      break;
+    default:
+      if((taken = g_lock_try_start_upgradable(session, rw_lock))) {
+        g_lock_end_upgradable(session, rw_lock);
+      }
+      break;
+  }
+  g_lock_session_free(session);
+  return GINT_TO_POINTER(taken);
+}
+
+/**
+ * Try to take the lock from another thread
+ *
+ * @param action What to try
+ * @return true if the lock was taken
+ */
+static bool _try_other(enum g_lock_action action)
+{
+  GThread *thread = g_thread_new("try", _try_thread,
+    GINT_TO_POINTER(action));
+  return GPOINTER_TO_INT(g_thread_join(thread));
+}
+
+/**
+ * Thread doing read-modify-write cycles
+ *
+ * @param lock The lock to update under
+ */
+static void _update_thread(GLock *lock)
+{
+  uint32_t seen;
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(!g_lock_start_upgradable(session, lock)) {
+      continue;
+    }
+    seen = counter;
+    usleep(SLEEP_TIME);
+    if(!g_lock_upgrade(session, lock)) {
+      g_atomic_int_inc(&violations);
+      g_lock_end_upgradable(session, lock);
+      continue;
+    }
+    g_atomic_int_inc(&writers_active);
+    if(g_atomic_int_get(&readers_active) || seen != counter) {
+      g_atomic_int_inc(&violations);
+    }
+    counter++;
+    g_atomic_int_add(&writers_active, -1);
+    g_lock_downgrade(session, lock);
+    g_lock_end_read(session, lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which upgrades as soon as it gets the upgradable side
+ *
+ * @param lock The lock to upgrade
+ */
+static void _upgrade_thread(GLock *lock)
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(!g_lock_start_upgradable(session, lock)) {
+      continue;
+    }
+    if(!g_lock_upgrade(session, lock)) {
+      g_atomic_int_inc(&violations);
+      g_lock_end_upgradable(session, lock);
+      continue;
+    }
+    g_atomic_int_inc(&writers_active);
+    if(g_atomic_int_get(&readers_active)) {
+      g_atomic_int_inc(&violations);
+    }
+    counter++;
+    usleep(SLEEP_TIME);
+    g_atomic_int_add(&writers_active, -1);
+    g_lock_end_write(session, lock);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which uses the write portion of the rw lock
+ *
+ * @param lock The lock to write under
+ */
+static void _write_thread(GLock *lock)
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(g_lock_start_write(session, lock)) {
+      g_atomic_int_inc(&writers_active);
+      if(g_atomic_int_get(&readers_active)) {
+        g_atomic_int_inc(&violations);
+      }
+      counter++;
+      usleep(SLEEP_TIME);
+      g_atomic_int_add(&writers_active, -1);
+      g_lock_end_write(session, lock);
+    }
+    // Let the upgraders in between the writes
+    usleep(SLEEP_TIME);
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Thread which uses the read portion of the rw lock
+ *
+ * @param lock The lock to read under
+ */
+static void _read_thread(GLock *lock)
+{
+  G_LOCK_SESSION_START();
+  for(int ix = 0; ix < ITERATIONS; ix++) {
+    if(g_lock_start_read(session, lock)) {
+      g_atomic_int_inc(&readers_active);
+      if(g_atomic_int_get(&writers_active)) {
+        g_atomic_int_inc(&violations);
+      }
+      usleep(SLEEP_TIME);
+      g_atomic_int_add(&readers_active, -1);
+      g_lock_end_read(session, lock);
+    }
+  }
+  G_LOCK_SESSION_END();
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  GThread *threads[8];
+  GLock *default_lock = g_lock_create_rw("default rw");
+  rw_lock = g_lock_create_rw_policy("upgradable rw",
+    G_LOCK_RW_POLICY_WRITER);
+  phase_lock = g_lock_create_rw_policy("phase-fair rw",
+    G_LOCK_RW_POLICY_PHASE_FAIR);
+  GLockSession *session = g_lock_session_new();
+
+  // GRWLock can't upgrade
+  if(g_lock_start_upgradable(session, default_lock)) {
+    printf("Default read/write lock taken upgradable\n");
+    return 1;
+  }
+
+  // Upgradable readers coexist with readers but not with each other
+  GThread *reader = g_thread_new("reader",
+    (GThreadFunc)_long_read_thread, NULL);
+  while(!g_atomic_int_get(&readers_active)) {
+    usleep(SLEEP_TIME);
+  }
+  if(!g_lock_try_start_upgradable(session, rw_lock) ||
+     _try_other(G_LOCK_ACTION_UPGRADABLE) ||
+     !_try_other(G_LOCK_ACTION_READ)) {
+    printf("Unexpected upgradable sharing\n");
+    return 1;
+  }
+  // The upgrade waits for the reader to leave
+  if(!g_lock_upgrade(session, rw_lock) ||
+     g_atomic_int_get(&readers_active) ||
+     rw_lock->stats.upgrade_wait.count != 1 ||
+     _try_other(G_LOCK_ACTION_READ) ||
+     g_lock_upgrade(session, rw_lock)) {
+    printf("Unexpected upgrade\n");
+    return 1;
+  }
+  g_thread_join(reader);
+  if(!g_lock_downgrade(session, rw_lock) ||
+     !_try_other(G_LOCK_ACTION_READ) ||
+     !_try_other(G_LOCK_ACTION_UPGRADABLE) ||
+     rw_lock->stats.holding != 1 ||
+     g_list_length(rw_lock->stats.holders) != 1) {
+    printf("Unexpected downgrade\n");
+    return 1;
+  }
+  g_lock_end_read(session, rw_lock);
+
+  threads[0] = g_thread_new("update1", (GThreadFunc)_update_thread,
+    rw_lock);
+  threads[1] = g_thread_new("update2", (GThreadFunc)_update_thread,
+    rw_lock);
+  threads[2] = g_thread_new("read1", (GThreadFunc)_read_thread, rw_lock);
+  threads[3] = g_thread_new("read2", (GThreadFunc)_read_thread, rw_lock);
+  for(int ix = 0; ix < 4; ix++) {
+    g_thread_join(threads[ix]);
+  }
+  if(violations || counter != 2 * ITERATIONS) {
+    printf("Violations: %d, counter: %u\n", violations, counter);
+    return 1;
+  }
+
+  // Readers let in by a writer phase must not meet an upgraded holder
+  counter = 0;
+  threads[0] = g_thread_new("upgrade1", (GThreadFunc)_upgrade_thread,
+    phase_lock);
+  threads[1] = g_thread_new("upgrade2", (GThreadFunc)_upgrade_thread,
+    phase_lock);
+  threads[2] = g_thread_new("write", (GThreadFunc)_write_thread,
+    phase_lock);
+  for(int ix = 3; ix < 8; ix++) {
+    threads[ix] = g_thread_new("read", (GThreadFunc)_read_thread,
+      phase_lock);
+  }
+  for(int ix = 0; ix < 8; ix++) {
+    g_thread_join(threads[ix]);
+  }
+  if(violations || counter != 3 * ITERATIONS) {
+    printf("Phase-fair violations: %d, counter: %u\n", violations, counter);
+    return 1;
+  }
+
+  g_lock_show_all();
+  g_lock_session_free(session);
+  g_lock_manager_free();
+  return 0;
+}
@@ -0,0 +1,555 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Inspect the live statistics file of a process
+ *
+ * "glockctl top" maps the file written by g_lock_publish_start()
+ * read-only and shows the locks which were contended the most since
+ * the previous refresh. Records are copied under their sequence lock
+ * without writing anything, so watching a process does not change
+ * how it runs.
+ */
+
+#define TOP_READ_RETRIES 100
+#define TOP_DEFAULT_ROWS 20
+#define TOP_DEFAULT_DELAY_MS 1000
+
+enum top_sort {
+  TOP_SORT_CONTENDED = 0,
+  TOP_SORT_WAIT,
+  TOP_SORT_HOLD,
+  TOP_SORT_ACQUISITIONS,
+  TOP_SORT_HOLDERS,
+};
+
+/**
+ * A record as copied at one refresh
+ */
+struct top_entry {
+  uint32_t slot; /*<< Position of the record in the file */
+  struct g_lock_publish_record record;
+  uint64_t acquisitions; /*<< Since the previous refresh */
+  uint64_t contended; /*<< Since the previous refresh */
+  uint64_t wait_us; /*<< Since the previous refresh */
+  uint64_t hold_us; /*<< Since the previous refresh */
+  uint64_t wait_buckets[G_LOCK_METRICS_BUCKETS]; /*<< Since the previous */
+};
+
+static struct {
+  const struct g_lock_publish_header *header;
+  const struct g_lock_publish_record *records;
+  size_t size;
+  enum top_sort sort;
+  uint32_t rows;
+  int delay_ms;
+  bool once;
+  GArray *previous; /*<< struct top_entry of the previous refresh */
+  struct termios saved_termios;
+  bool raw; /*<< The terminal was put in raw mode */
+} _top;
+
+static volatile sig_atomic_t _top_stop = 0;
+
+/**
+ * Map the statistics file read-only and check its header
+ *
+ * @param path Path of the file
+ * @return true if the file can be read
+ */
+static bool _top_map(const char *path)
+{
+  const struct g_lock_publish_header *header;
+  struct stat st;
+  void *map;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  if(fstat(fd, &st) < 0 ||
+     (size_t)st.st_size < sizeof(struct g_lock_publish_header)) {
+    fprintf(stderr, "%s is not a lock statistics file\n", path);
+    close(fd);
+    return false;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  header = map;
+  if(memcmp(header->magic, G_LOCK_PUBLISH_MAGIC, sizeof(header->magic))) {
+    fprintf(stderr, "%s is not a lock statistics file\n", path);
+    munmap(map, st.st_size);
+    return false;
+  }
+  if(header->version != G_LOCK_PUBLISH_VERSION ||
+     header->record_size != sizeof(struct g_lock_publish_record) ||
+     header->buckets != G_LOCK_METRICS_BUCKETS ||
+     header->header_size + (size_t)header->capacity *
+       header->record_size > (size_t)st.st_size) {
+    fprintf(stderr, "%s has an unsupported layout (version %u)\n", path,
+      header->version);
+    munmap(map, st.st_size);
+    return false;
+  }
+  _top.header = header;
+  _top.records = (const struct g_lock_publish_record *)
+    ((const char *)map + header->header_size);
+  _top.size = st.st_size;
+  return true;
+}
+
+/**
+ * Copy a record under its sequence lock
+ *
+ * @param src The record in the file
+ * @param dst Where to copy it
+ * @return false if the record kept changing while being copied
+ */
+static bool _top_read_record(
+  const struct g_lock_publish_record *src,
+  struct g_lock_publish_record *dst
+  )
+{
+  uint32_t seq;
+  for(int retry = 0; retry < TOP_READ_RETRIES; retry++) {
+    seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+    if(seq & 1) {
+      continue;
+    }
+    memcpy(dst, src, sizeof(struct g_lock_publish_record));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == seq) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Find the entry of the previous refresh for the same lock
+ *
+ * A record reused by another lock is not a match.
+ *
+ * @param entry The entry just read
+ * @return The previous entry or NULL
+ */
+static struct top_entry *_top_previous(struct top_entry *entry)
+{
+  struct top_entry *prev;
+  if(!_top.previous) {
+    return NULL;
+  }
+  for(guint ix = 0; ix < _top.previous->len; ix++) {
+    prev = &g_array_index(_top.previous, struct top_entry, ix);
+    if(prev->slot == entry->slot &&
+       prev->record.state == entry->record.state &&
+       prev->record.index == entry->record.index &&
+       strcmp(prev->record.name, entry->record.name) == 0) {
+      return prev;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Copy every record in use and compute what changed since last time
+ *
+ * @return The entries, struct top_entry
+ */
+static GArray *_top_snapshot()
+{
+  GArray *entries = g_array_new(FALSE, TRUE, sizeof(struct top_entry));
+  uint32_t used = __atomic_load_n(&_top.header->used, __ATOMIC_ACQUIRE);
+  struct top_entry entry, *prev;
+
+  used = MIN(used, _top.header->capacity);
+  for(uint32_t ix = 0; ix < used; ix++) {
+    memset(&entry, 0, sizeof(entry));
+    entry.slot = ix;
+    if(!_top_read_record(&_top.records[ix], &entry.record) ||
+       entry.record.state == G_LOCK_PUBLISH_FREE) {
+      continue;
+    }
+    entry.record.name[G_LOCK_PUBLISH_NAME_MAX - 1] = '\0';
+    prev = _top_previous(&entry);
+    entry.acquisitions = entry.record.acquisitions -
+      (prev? prev->record.acquisitions: 0);
+    entry.contended = entry.record.contended -
+      (prev? prev->record.contended: 0);
+    entry.wait_us = entry.record.wait_sum_us -
+      (prev? prev->record.wait_sum_us: 0);
+    entry.hold_us = entry.record.hold_sum_us -
+      (prev? prev->record.hold_sum_us: 0);
+    for(int bx = 0; bx < G_LOCK_METRICS_BUCKETS; bx++) {
+      entry.wait_buckets[bx] = entry.record.wait_buckets[bx] -
+        (prev? prev->record.wait_buckets[bx]: 0);
+    }
+    g_array_append_val(entries, entry);
+  }
+  return entries;
+}
+
+/**
+ * Value an entry is sorted by
+ *
+ * @param entry The entry
+ * @return The value, larger first
+ */
+static uint64_t _top_key(const struct top_entry *entry)
+{
+  switch(_top.sort) {
+    case TOP_SORT_CONTENDED:
+      return entry->contended;
+    case TOP_SORT_WAIT:
+      return entry->wait_us;
+    case TOP_SORT_HOLD:
+      return entry->hold_us;
+    case TOP_SORT_ACQUISITIONS:
+      return entry->acquisitions;
+    case TOP_SORT_HOLDERS:
+      return entry->record.holders > 0? entry->record.holders: 0;
+  }
+  return 0;
+}
+
+/**
+ * Order entries by the selected key, largest first
+ *
+ * @param a The first struct top_entry
+ * @param b The second struct top_entry
+ * @return Negative if a goes first
+ */
+static gint _top_compare(gconstpointer a, gconstpointer b)
+{
+  uint64_t ka = _top_key(a), kb = _top_key(b);
+  if(ka != kb) {
+    return ka > kb? -1: 1;
+  }
+  return strcmp(((const struct top_entry *)a)->record.name,
+    ((const struct top_entry *)b)->record.name);
+}
+
+/**
+ * Upper bound of the bucket holding the 99th percentile
+ *
+ * @param buckets The bucket counts
+ * @param count Number of samples
+ * @return The bound in microseconds, UINT64_MAX for the last bucket
+ */
+static uint64_t _top_p99(const uint64_t *buckets, uint64_t count)
+{
+  uint64_t seen = 0;
+  for(int ix = 0; ix < G_LOCK_METRICS_BUCKETS; ix++) {
+    seen += buckets[ix];
+    if(seen * 100 >= count * 99) {
+      return _top.header->bucket_bounds[ix];
+    }
+  }
+  return UINT64_MAX;
+}
+
+/**
+ * Format a duration in microseconds for a narrow column
+ *
+ * @param buf Where to format
+ * @param size Size of buf
+ * @param us The duration, UINT64_MAX for unbounded
+ * @return buf
+ */
+static const char *_top_duration(char *buf, size_t size, uint64_t us)
+{
+  if(us == UINT64_MAX) {
+    snprintf(buf, size, ">1s");
+  } else if(us >= 1000000) {
+    snprintf(buf, size, "%.1fs", us / 1e6);
+  } else if(us >= 1000) {
+    snprintf(buf, size, "%.1fms", us / 1e3);
+  } else {
+    snprintf(buf, size, "%" PRIu64 "us", us);
+  }
+  return buf;
+}
+
+/**
+ * Print one refresh
+ *
+ * @param entries The entries of this refresh
+ * @param elapsed_us Time since the previous refresh
+ */
+static void _top_print(GArray *entries, int64_t elapsed_us)
+{
+  static const char *sort_names[] = {
+    "contended", "wait", "hold", "acquisitions", "holders"
+  };
+  struct top_entry *entry;
+  char avg_wait[16], p99_wait[16], avg_hold[16];
+  double seconds = elapsed_us > 0? elapsed_us / 1e6: 1;
+  bool alive = kill(_top.header->pid, 0) == 0 || errno == EPERM;
+
+  if(!_top.once && isatty(STDOUT_FILENO)) {
+    printf("\033[H\033[2J");
+  }
+  printf("pid %u%s - %u locks, %u dropped - sorted by %s\n",
+    _top.header->pid, alive? "": " (exited)",
+    entries->len, _top.header->dropped, sort_names[_top.sort]);
+  if(!_top.once) {
+    printf("keys: c contended, w wait, h hold, a acquisitions, "
+      "o holders, q quit\n");
+  }
+  printf("%-24s %10s %10s %6s %9s %9s %9s %7s\n", "lock", "acq/s",
+    "cont/s", "cont%", "avg wait", "p99 wait", "avg hold", "holders");
+
+  g_array_sort(entries, _top_compare);
+  for(guint ix = 0; ix < entries->len && ix < _top.rows; ix++) {
+    entry = &g_array_index(entries, struct top_entry, ix);
+    printf("%-23.23s%s %10.0f %10.0f %5.1f%% %9s %9s %9s %7" PRId64 "\n",
+      entry->record.name,
+      entry->record.state == G_LOCK_PUBLISH_CLASS? "*": " ",
+      entry->acquisitions / seconds,
+      entry->contended / seconds,
+      entry->acquisitions? 100.0 * entry->contended / entry->acquisitions:
+        0.0,
+      _top_duration(avg_wait, sizeof(avg_wait), entry->acquisitions?
+        entry->wait_us / entry->acquisitions: 0),
+      entry->acquisitions? _top_duration(p99_wait, sizeof(p99_wait),
+        _top_p99(entry->wait_buckets, entry->acquisitions)): "-",
+      _top_duration(avg_hold, sizeof(avg_hold), entry->acquisitions?
+        entry->hold_us / entry->acquisitions: 0),
+      entry->record.holders);
+  }
+  fflush(stdout);
+}
+
+/**
+ * Put the terminal back the way it was
+ */
+static void _top_restore_terminal()
+{
+  if(_top.raw) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &_top.saved_termios);
+    _top.raw = false;
+  }
+}
+
+/**
+ * Read single key presses from the terminal without echo
+ */
+static void _top_raw_terminal()
+{
+  struct termios raw;
+  if(!isatty(STDIN_FILENO) ||
+     tcgetattr(STDIN_FILENO, &_top.saved_termios) < 0) {
+    return;
+  }
+  raw = _top.saved_termios;
+  raw.c_lflag &= ~(ICANON | ECHO);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if(tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0) {
+    _top.raw = true;
+  }
+}
+
+/**
+ * Wait for the next refresh while handling key presses
+ *
+ * @return false when asked to quit
+ */
+static bool _top_wait()
+{
+  struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+  char key;
+  int rc = poll(&pfd, _top.raw? 1: 0, _top.delay_ms);
+  if(_top_stop) {
+    return false;
+  }
+  if(rc <= 0 || read(STDIN_FILENO, &key, 1) != 1) {
+    return true;
+  }
+  switch(key) {
+    case 'q':
+      return false;
+    case 'c':
+      _top.sort = TOP_SORT_CONTENDED;
+      break;
+    case 'w':
+      _top.sort = TOP_SORT_WAIT;
+      break;
+    case 'h':
+      _top.sort = TOP_SORT_HOLD;
+      break;
+    case 'a':
+      _top.sort = TOP_SORT_ACQUISITIONS;
+      break;
+    case 'o':
+      _top.sort = TOP_SORT_HOLDERS;
+      break;
+  }
+  return true;
+}
+
+/**
+ * Stop refreshing on SIGINT or SIGTERM
+ *
+ * @param signum The signal
+ */
+static void _top_signal(int signum)
+{
+  _top_stop = 1;
+}
+
+/**
+ * Parse a sort key given on the command line
+ *
+ * @param str The key
+ * @return false if the key is unknown
+ */
+static bool _top_parse_sort(const char *str)
+{
+  static const struct {
+    const char *name;
+    enum top_sort sort;
+  } keys[] = {
+    { "contended", TOP_SORT_CONTENDED },
+    { "wait", TOP_SORT_WAIT },
+    { "hold", TOP_SORT_HOLD },
+    { "acquisitions", TOP_SORT_ACQUISITIONS },
+    { "holders", TOP_SORT_HOLDERS },
+  };
+  for(size_t ix = 0; ix < G_N_ELEMENTS(keys); ix++) {
+    if(strcmp(str, keys[ix].name) == 0) {
+      _top.sort = keys[ix].sort;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Print the usage of the tool
+ *
+ * @param name Name the tool was run as
+ */
+static void _usage(const char *name)
+{
+  fprintf(stderr,
+    "Usage: %s top [-1] [-d SECONDS] [-n ROWS] [-s KEY] FILE\n"
+    "  -1             print the totals since publishing started and exit\n"
+    "  -d SECONDS     time between refreshes, 1 by default\n"
+    "  -n ROWS        number of locks shown, 20 by default\n"
+    "  -s KEY         sort by contended, wait, hold, acquisitions or\n"
+    "                 holders, contended by default\n"
+    "Classes are marked with a *.\n",
+    name);
+}
+
+/**
+ * Show the most contended locks of a statistics file
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The arguments after "top"
+ * @param name Name the tool was run as
+ * @return On success 0 is returned, otherwise 1.
+ */
+static int _top_main(int argc, char **argv, const char *name)
+{
+  GArray *entries;
+  int64_t now, last;
+  int opt;
+
+  _top.rows = TOP_DEFAULT_ROWS;
+  _top.delay_ms = TOP_DEFAULT_DELAY_MS;
+  while((opt = getopt(argc, argv, "1d:n:s:")) != -1) {
+    switch(opt) {
+      case '1':
+        _top.once = true;
+        break;
+      case 'd':
+        _top.delay_ms = strtod(optarg, NULL) * 1000;
+        break;
+      case 'n':
+        _top.rows = strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        if(!_top_parse_sort(optarg)) {
+          _usage(name);
+          return 1;
+        }
+        break;
+      default:
+        _usage(name);
+        return 1;
+    }
+  }
+  if(optind != argc - 1 || _top.delay_ms <= 0 || !_top.rows) {
+    _usage(name);
+    return 1;
+  }
+  if(!_top_map(argv[optind])) {
+    return 1;
+  }
+
+  // The first refresh shows the totals since publishing started
+  last = g_get_real_time();
+  entries = _top_snapshot();
+  _top_print(entries, last - _top.header->started_at);
+  if(_top.once) {
+    g_array_free(entries, TRUE);
+    return 0;
+  }
+
+  signal(SIGINT, _top_signal);
+  signal(SIGTERM, _top_signal);
+  _top_raw_terminal();
+  for(;;) {
+    if(_top.previous) {
+      g_array_free(_top.previous, TRUE);
+    }
+    _top.previous = entries;
+    if(!_top_wait()) {
+      break;
+    }
+    now = g_get_real_time();
+    entries = _top_snapshot();
+    _top_print(entries, now - last);
+    last = now;
+  }
+  _top_restore_terminal();
+  g_array_free(_top.previous, TRUE);
+  return 0;
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  if(argc < 2 || strcmp(argv[1], "top") != 0) {
+    _usage(argv[0]);
+    return 1;
+  }
+  return _top_main(argc - 1, argv + 1, argv[0]);
+}
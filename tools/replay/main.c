@@ -0,0 +1,639 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../g_lock_manager.h"
+
+/**
+ * Replay a binary lock trace
+ *
+ * Runs the acquisitions saved by g_lock_trace_save() again, one
+ * thread per recorded thread, against real locks of the manager.
+ * The time between events is spent spinning so holds keep their
+ * length, and any lock can be given another type to see what the
+ * change would do to the same workload.
+ *
+ * Each replayed thread uses a session per lock. The recorded program
+ * already passed the order checks, and instances of a class don't
+ * keep their class when replayed.
+ */
+
+#define REPLAY_START_DELAY_US 10000
+#define REPLAY_SLEEP_SLACK_US 100
+
+struct replay_lock {
+  uint32_t index; /*<< Index when recorded */
+  enum g_lock_type type;
+  enum g_lock_rw_policy policy;
+  char *name;
+  bool substituted; /*<< Type given on the command line */
+  bool reentered; /*<< Taken again while held when recorded */
+  GLock *lock;
+  uint64_t acquisitions;
+  uint64_t recorded_wait_us;
+  GArray *waits; /*<< uint32_t replayed waits in microseconds */
+};
+
+struct replay_thread {
+  char name[17];
+  struct g_lock_replay_event *events;
+  uint32_t event_count;
+  uint64_t recorded_us; /*<< Time the thread ran when recorded */
+  GThread *thread;
+  GArray *waits; /*<< struct replay_wait */
+};
+
+struct replay_wait {
+  uint32_t lock;
+  uint32_t wait_us;
+};
+
+struct replay_held {
+  uint32_t lock;
+  enum g_lock_action action;
+};
+
+static struct {
+  struct replay_lock *locks;
+  uint32_t lock_count;
+  struct replay_thread *threads;
+  uint32_t thread_count;
+  uint32_t repeat;
+  int64_t start_at; /*<< Monotonic time all threads start */
+} _replay;
+
+/**
+ * Read the next record of the trace
+ *
+ * @param pos Current position, moved past the record
+ * @param end End of the trace
+ * @param out Where to copy the record
+ * @param len Size of the record
+ * @return false if the trace is truncated
+ */
+static bool _read(const char **pos, const char *end, void *out, size_t len)
+{
+  if((size_t)(end - *pos) < len) {
+    return false;
+  }
+  memcpy(out, *pos, len);
+  *pos += len;
+  return true;
+}
+
+/**
+ * Read a string following a record of the trace
+ *
+ * @param pos Current position, moved past the string
+ * @param end End of the trace
+ * @param len Length of the string
+ * @return The allocated string or NULL if the trace is truncated
+ */
+static char *_read_string(const char **pos, const char *end, uint16_t len)
+{
+  char *str;
+  if(end - *pos < len) {
+    return NULL;
+  }
+  str = g_strndup(*pos, len);
+  *pos += len;
+  return str;
+}
+
+/**
+ * Load a binary trace
+ *
+ * @param path The trace to load
+ * @return true if the trace was loaded
+ */
+static bool _load(const char *path)
+{
+  struct g_lock_replay_header header;
+  struct g_lock_replay_lock lock;
+  struct g_lock_replay_callsite site;
+  struct g_lock_replay_thread thread;
+  struct replay_thread *replay;
+  struct g_lock_replay_event *event;
+  GHashTable *held;
+  gchar *contents;
+  gsize length;
+  const char *pos, *end;
+  uint32_t holds;
+  bool ret = false;
+
+  if(!g_file_get_contents(path, &contents, &length, NULL)) {
+    fprintf(stderr, "Failed to read %s\n", path);
+    return false;
+  }
+  pos = contents;
+  end = contents + length;
+
+  if(!_read(&pos, end, &header, sizeof(header)) ||
+     memcmp(header.magic, G_LOCK_REPLAY_MAGIC, sizeof(header.magic))) {
+    fprintf(stderr, "%s is not a lock trace\n", path);
+    goto done;
+  }
+
+  _replay.lock_count = header.lock_count;
+  _replay.locks = calloc(header.lock_count + 1, sizeof(struct replay_lock));
+  for(uint32_t ix = 0; ix < header.lock_count; ix++) {
+    if(!_read(&pos, end, &lock, sizeof(lock)) ||
+       !(_replay.locks[ix].name = _read_string(&pos, end, lock.name_len))) {
+      goto truncated;
+    }
+    _replay.locks[ix].index = lock.index;
+    _replay.locks[ix].type = lock.type;
+    _replay.locks[ix].policy = lock.rw_policy;
+    // Other processes are not replayed, a shared lock is a plain mutex
+    if(lock.type == G_LOCK_SHARED) {
+      _replay.locks[ix].type = G_LOCK_MUTEX;
+    }
+    _replay.locks[ix].waits = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  }
+
+  // Call sites are only needed to read past them
+  for(uint32_t ix = 0; ix < header.callsite_count; ix++) {
+    if(!_read(&pos, end, &site, sizeof(site)) ||
+       end - pos < site.func_len + site.file_len) {
+      goto truncated;
+    }
+    pos += site.func_len + site.file_len;
+  }
+
+  _replay.thread_count = header.thread_count;
+  _replay.threads = calloc(header.thread_count + 1,
+    sizeof(struct replay_thread));
+  for(uint32_t ix = 0; ix < header.thread_count; ix++) {
+    replay = &_replay.threads[ix];
+    if(!_read(&pos, end, &thread, sizeof(thread))) {
+      goto truncated;
+    }
+    memcpy(replay->name, thread.name, sizeof(thread.name));
+    replay->event_count = thread.event_count;
+    replay->events = calloc(thread.event_count + 1,
+      sizeof(struct g_lock_replay_event));
+    if(!_read(&pos, end, replay->events,
+         (size_t)thread.event_count * sizeof(struct g_lock_replay_event))) {
+      goto truncated;
+    }
+
+    held = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for(uint32_t ex = 0; ex < replay->event_count; ex++) {
+      event = &replay->events[ex];
+      if(event->lock >= _replay.lock_count) {
+        g_hash_table_destroy(held);
+        goto truncated;
+      }
+      replay->recorded_us += event->delta_us + event->wait_us;
+      holds = GPOINTER_TO_UINT(g_hash_table_lookup(held,
+        GUINT_TO_POINTER(event->lock)));
+      if(event->op == G_LOCK_REPLAY_ACQUIRE) {
+        if(holds) {
+          _replay.locks[event->lock].reentered = true;
+        }
+        _replay.locks[event->lock].acquisitions++;
+        _replay.locks[event->lock].recorded_wait_us += event->wait_us;
+        holds++;
+      } else if(holds) {
+        holds--;
+      }
+      g_hash_table_insert(held, GUINT_TO_POINTER(event->lock),
+        GUINT_TO_POINTER(holds));
+    }
+    g_hash_table_destroy(held);
+  }
+  ret = true;
+  goto done;
+
+truncated:
+  fprintf(stderr, "%s is truncated\n", path);
+done:
+  g_free(contents);
+  return ret;
+}
+
+static const struct {
+  const char *name;
+  enum g_lock_type type;
+  enum g_lock_rw_policy policy;
+} _replay_types[] = {
+  { "mutex", G_LOCK_MUTEX, G_LOCK_RW_POLICY_DEFAULT },
+  { "recursive", G_LOCK_RECURSIVE, G_LOCK_RW_POLICY_DEFAULT },
+  { "rw", G_LOCK_RW, G_LOCK_RW_POLICY_DEFAULT },
+  { "rw-reader", G_LOCK_RW, G_LOCK_RW_POLICY_READER },
+  { "rw-writer", G_LOCK_RW, G_LOCK_RW_POLICY_WRITER },
+  { "rw-phase-fair", G_LOCK_RW, G_LOCK_RW_POLICY_PHASE_FAIR },
+  { "cohort", G_LOCK_COHORT, G_LOCK_RW_POLICY_DEFAULT },
+};
+
+/**
+ * Parse a lock type given on the command line
+ *
+ * @param str The type
+ * @param type Where to store the type
+ * @param policy Where to store the read/write policy
+ * @return false if the type is unknown
+ */
+static bool _parse_type(
+  const char *str,
+  enum g_lock_type *type,
+  enum g_lock_rw_policy *policy
+  )
+{
+  for(size_t ix = 0; ix < G_N_ELEMENTS(_replay_types); ix++) {
+    if(strcmp(str, _replay_types[ix].name) == 0) {
+      *type = _replay_types[ix].type;
+      *policy = _replay_types[ix].policy;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Name a lock type the way it is given on the command line
+ *
+ * @param type The lock type
+ * @param policy The read/write policy
+ * @return The name of the type
+ */
+static const char *_type_name(
+  enum g_lock_type type,
+  enum g_lock_rw_policy policy
+  )
+{
+  for(size_t ix = 0; ix < G_N_ELEMENTS(_replay_types); ix++) {
+    if(_replay_types[ix].type == type &&
+       _replay_types[ix].policy == policy) {
+      return _replay_types[ix].name;
+    }
+  }
+  return "unknown";
+}
+
+/**
+ * Apply a NAME=TYPE or INDEX=TYPE substitution
+ *
+ * @param arg The substitution
+ * @return false if it is invalid or matches no lock
+ */
+static bool _substitute(const char *arg)
+{
+  enum g_lock_type type;
+  enum g_lock_rw_policy policy;
+  struct replay_lock *lock;
+  char *key, *eq, *endp;
+  unsigned long index;
+  bool by_index, found = false;
+
+  key = g_strdup(arg);
+  eq = strrchr(key, '=');
+  if(!eq || !_parse_type(eq + 1, &type, &policy)) {
+    fprintf(stderr, "Invalid substitution %s\n", arg);
+    g_free(key);
+    return false;
+  }
+  *eq = '\0';
+  index = strtoul(key, &endp, 10);
+  by_index = *key && !*endp;
+
+  for(uint32_t ix = 0; ix < _replay.lock_count; ix++) {
+    lock = &_replay.locks[ix];
+    if(by_index? lock->index != index: strcmp(lock->name, key) != 0) {
+      continue;
+    }
+    if(lock->reentered && type != G_LOCK_RECURSIVE) {
+      fprintf(stderr, "Lock %s is taken recursively, it must stay "
+        "recursive\n", lock->name);
+      g_free(key);
+      return false;
+    }
+    lock->type = type;
+    lock->policy = policy;
+    lock->substituted = true;
+    found = true;
+  }
+  if(!found) {
+    fprintf(stderr, "No lock matches %s\n", arg);
+  }
+  g_free(key);
+  return found;
+}
+
+/**
+ * Order the locks the way they were created
+ */
+static gint _compare_index(gconstpointer a, gconstpointer b)
+{
+  const struct replay_lock *la = *(struct replay_lock * const *)a;
+  const struct replay_lock *lb = *(struct replay_lock * const *)b;
+  return la->index < lb->index? -1: la->index > lb->index;
+}
+
+/**
+ * Create the locks in their recorded order
+ */
+static void _create_locks()
+{
+  struct replay_lock *lock;
+  GPtrArray *order = g_ptr_array_new();
+  for(uint32_t ix = 0; ix < _replay.lock_count; ix++) {
+    g_ptr_array_add(order, &_replay.locks[ix]);
+  }
+  g_ptr_array_sort(order, _compare_index);
+  for(guint ix = 0; ix < order->len; ix++) {
+    lock = g_ptr_array_index(order, ix);
+    if(lock->type == G_LOCK_RW && lock->policy != G_LOCK_RW_POLICY_DEFAULT) {
+      lock->lock = g_lock_create_rw_policy(lock->name, lock->policy);
+    } else {
+      lock->lock = g_lock_create(lock->name, lock->type);
+    }
+  }
+  g_ptr_array_free(order, TRUE);
+}
+
+/**
+ * The action to replay a recorded acquisition with
+ *
+ * @param lock The replayed lock
+ * @param action The recorded action
+ * @return The action valid for the type of the replayed lock
+ */
+static enum g_lock_action _replay_action(
+  struct replay_lock *lock,
+  enum g_lock_action action
+  )
+{
+  if(lock->type != G_LOCK_RW) {
+    return G_LOCK_ACTION_BASIC;
+  }
+  if(action == G_LOCK_ACTION_READ) {
+    return G_LOCK_ACTION_READ;
+  }
+  if(action == G_LOCK_ACTION_UPGRADABLE &&
+     lock->policy != G_LOCK_RW_POLICY_DEFAULT) {
+    return G_LOCK_ACTION_UPGRADABLE;
+  }
+  return G_LOCK_ACTION_WRITE;
+}
+
+/**
+ * Spend the time between two events
+ *
+ * Long gaps sleep, the end of every gap spins so that short holds
+ * keep their length.
+ *
+ * @param us The time to spend
+ */
+static void _replay_delay(uint32_t us)
+{
+  int64_t end = g_get_monotonic_time() + us;
+  if(us > 2 * REPLAY_SLEEP_SLACK_US) {
+    g_usleep(us - REPLAY_SLEEP_SLACK_US);
+  }
+  while(g_get_monotonic_time() < end);
+}
+
+/**
+ * Release everything a replayed thread still holds
+ *
+ * @param sessions Session of each lock
+ * @param held The locks held, most recent last
+ */
+static void _release_all(GLockSession **sessions, GArray *held)
+{
+  struct replay_held *entry;
+  while(held->len) {
+    entry = &g_array_index(held, struct replay_held, held->len - 1);
+    _g_lock_end(sessions[entry->lock], _replay.locks[entry->lock].lock,
+      entry->action, G_LOCK_CALLSITE(lock));
+    g_array_remove_index(held, held->len - 1);
+  }
+}
+
+/**
+ * Replay the events of one recorded thread
+ *
+ * @param data The struct replay_thread
+ */
+static gpointer _replay_thread(gpointer data)
+{
+  struct replay_thread *replay = data;
+  struct g_lock_replay_event *event;
+  struct replay_lock *lock;
+  struct replay_held entry;
+  struct replay_wait wait;
+  GLockSession **sessions;
+  GArray *held;
+  int64_t asked;
+  int hx;
+
+  sessions = calloc(_replay.lock_count + 1, sizeof(GLockSession *));
+  held = g_array_new(FALSE, FALSE, sizeof(struct replay_held));
+  while(g_get_monotonic_time() < _replay.start_at);
+
+  for(uint32_t rep = 0; rep < _replay.repeat; rep++) {
+    for(uint32_t ix = 0; ix < replay->event_count; ix++) {
+      event = &replay->events[ix];
+      lock = &_replay.locks[event->lock];
+      _replay_delay(event->delta_us);
+      if(event->op == G_LOCK_REPLAY_ACQUIRE) {
+        if(!sessions[event->lock]) {
+          sessions[event->lock] = g_lock_session_new();
+        }
+        entry.lock = event->lock;
+        entry.action = _replay_action(lock, event->action);
+        asked = g_get_monotonic_time();
+        if(!_g_lock_start(sessions[event->lock], lock->lock, entry.action,
+             G_LOCK_CALLSITE(lock))) {
+          continue;
+        }
+        wait.lock = event->lock;
+        wait.wait_us = g_get_monotonic_time() - asked;
+        g_array_append_val(replay->waits, wait);
+        g_array_append_val(held, entry);
+        continue;
+      }
+      // Releases follow the recorded order, not the held order
+      for(hx = (int)held->len - 1; hx >= 0; hx--) {
+        if(g_array_index(held, struct replay_held, hx).lock == event->lock) {
+          entry = g_array_index(held, struct replay_held, hx);
+          _g_lock_end(sessions[entry.lock], lock->lock, entry.action,
+            G_LOCK_CALLSITE(lock));
+          g_array_remove_index(held, hx);
+          break;
+        }
+      }
+    }
+    _release_all(sessions, held);
+  }
+
+  for(uint32_t ix = 0; ix < _replay.lock_count; ix++) {
+    if(sessions[ix]) {
+      g_lock_session_free(sessions[ix]);
+    }
+  }
+  free(sessions);
+  g_array_free(held, TRUE);
+  return NULL;
+}
+
+/**
+ * Compare two waits for sorting
+ */
+static gint _compare_wait(gconstpointer a, gconstpointer b)
+{
+  uint32_t wa = *(const uint32_t *)a, wb = *(const uint32_t *)b;
+  return wa < wb? -1: wa > wb;
+}
+
+/**
+ * Print the recorded and replayed numbers
+ *
+ * @param elapsed_us How long the replay took
+ */
+static void _report(int64_t elapsed_us)
+{
+  struct replay_lock *lock;
+  struct replay_wait *wait;
+  uint64_t acquisitions = 0, replayed = 0, recorded_us = 0, sum;
+  uint32_t p50, p99;
+
+  for(uint32_t tx = 0; tx < _replay.thread_count; tx++) {
+    recorded_us = MAX(recorded_us, _replay.threads[tx].recorded_us);
+    for(guint wx = 0; wx < _replay.threads[tx].waits->len; wx++) {
+      wait = &g_array_index(_replay.threads[tx].waits,
+        struct replay_wait, wx);
+      g_array_append_val(_replay.locks[wait->lock].waits, wait->wait_us);
+    }
+  }
+  recorded_us *= _replay.repeat;
+
+  printf("%-24s %-14s %10s %12s %12s %10s %10s\n", "lock", "type",
+    "acquired", "rec avg us", "avg us", "p50 us", "p99 us");
+  for(uint32_t ix = 0; ix < _replay.lock_count; ix++) {
+    lock = &_replay.locks[ix];
+    acquisitions += lock->acquisitions * _replay.repeat;
+    replayed += lock->waits->len;
+    g_array_sort(lock->waits, _compare_wait);
+    sum = 0;
+    for(guint wx = 0; wx < lock->waits->len; wx++) {
+      sum += g_array_index(lock->waits, uint32_t, wx);
+    }
+    p50 = p99 = 0;
+    if(lock->waits->len) {
+      p50 = g_array_index(lock->waits, uint32_t, lock->waits->len / 2);
+      p99 = g_array_index(lock->waits, uint32_t,
+        (uint64_t)lock->waits->len * 99 / 100);
+    }
+    printf("%-24.24s %-13s%s %10" PRIu64 " %12.1f %12.1f %10u %10u\n",
+      lock->name,
+      _type_name(lock->type, lock->policy),
+      lock->substituted? "*": " ",
+      (uint64_t)lock->waits->len,
+      lock->acquisitions?
+        (double)lock->recorded_wait_us / lock->acquisitions: 0.0,
+      lock->waits->len? (double)sum / lock->waits->len: 0.0,
+      p50, p99);
+  }
+  printf("recorded: %" PRIu64 " acquisitions in %.3f s, %.0f/s\n",
+    acquisitions, recorded_us / 1e6,
+    recorded_us? acquisitions * 1e6 / recorded_us: 0.0);
+  printf("replayed: %" PRIu64 " acquisitions in %.3f s, %.0f/s\n",
+    replayed, elapsed_us / 1e6,
+    elapsed_us? replayed * 1e6 / elapsed_us: 0.0);
+}
+
+/**
+ * Print how to use the tool
+ *
+ * @param name Name of the program
+ */
+static void _usage(const char *name)
+{
+  fprintf(stderr,
+    "Usage: %s [-l] [-r REPEAT] [-t LOCK=TYPE]... TRACE\n"
+    "  -l             list the locks of the trace and exit\n"
+    "  -r REPEAT      replay the trace REPEAT times\n"
+    "  -t LOCK=TYPE   replay the locks with that name or index as TYPE:\n"
+    "                 mutex, recursive, rw, rw-reader, rw-writer,\n"
+    "                 rw-phase-fair or cohort\n",
+    name);
+}
+
+/**
+ * Main function that will be called at the time of execution
+ *
+ * @param argc How many arguments were passed in
+ * @param argv The command line arguments
+ * @return On success 0 is returned, otherwise 1.
+ */
+int main(int argc, char **argv)
+{
+  GPtrArray *substitutions = g_ptr_array_new();
+  bool list = false;
+  int opt;
+
+  _replay.repeat = 1;
+  while((opt = getopt(argc, argv, "lr:t:")) != -1) {
+    switch(opt) {
+      case 'l':
+        list = true;
+        break;
+      case 'r':
+        _replay.repeat = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        g_ptr_array_add(substitutions, optarg);
+        break;
+      default:
+        _usage(argv[0]);
+        return 1;
+    }
+  }
+  if(optind != argc - 1 || !_replay.repeat) {
+    _usage(argv[0]);
+    return 1;
+  }
+  if(!_load(argv[optind])) {
+    return 1;
+  }
+
+  if(list) {
+    for(uint32_t ix = 0; ix < _replay.lock_count; ix++) {
+      printf("%u %s %s %" PRIu64 " acquisitions%s\n",
+        _replay.locks[ix].index,
+        _replay.locks[ix].name,
+        _type_name(_replay.locks[ix].type, _replay.locks[ix].policy),
+        _replay.locks[ix].acquisitions,
+        _replay.locks[ix].reentered? " (recursive)": "");
+    }
+    return 0;
+  }
+  for(guint ix = 0; ix < substitutions->len; ix++) {
+    if(!_substitute(g_ptr_array_index(substitutions, ix))) {
+      return 1;
+    }
+  }
+  g_ptr_array_free(substitutions, TRUE);
+
+  _create_locks();
+  _replay.start_at = g_get_monotonic_time() + REPLAY_START_DELAY_US;
+  for(uint32_t ix = 0; ix < _replay.thread_count; ix++) {
+    _replay.threads[ix].waits = g_array_new(FALSE, FALSE,
+      sizeof(struct replay_wait));
+    _replay.threads[ix].thread = g_thread_new(_replay.threads[ix].name,
+      _replay_thread, &_replay.threads[ix]);
+  }
+  for(uint32_t ix = 0; ix < _replay.thread_count; ix++) {
+    g_thread_join(_replay.threads[ix].thread);
+  }
+  _report(g_get_monotonic_time() - _replay.start_at);
+
+  g_lock_manager_free();
+  return 0;
+}